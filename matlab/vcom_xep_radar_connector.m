@@ -21,6 +21,8 @@ classdef vcom_xep_radar_connector < handle
     properties(Hidden)
         usb_conn;
         x4DownConverter = 0;
+        frameFormat = 0;
+        captureBuffer = [];
  
         % System options
         dirpath = fileparts(which('xep_radar_connector'));
@@ -102,6 +104,9 @@ classdef vcom_xep_radar_connector < handle
             if (strcmp(registerName, 'ddc_en') || strcmp(registerName, 'DownConvert'))
                 obj.x4DownConverter = value;
             end
+            if strcmp(registerName, 'frame_format')
+                obj.frameFormat = value;
+            end
             
             cmd = uint8(['VarSetValue_ByName(' registerName ',' num2str(value) ')']);
             write(obj.usb_conn, cmd, 'uint8'); % Send command
@@ -116,6 +121,23 @@ classdef vcom_xep_radar_connector < handle
             status = obj.TryUpdateChip('DownConvert', value);
             obj.x4DownConverter = value;
         end
+
+        %% Select the encoding frames are sent in
+        function status = SetFrameFormat(obj, format)
+            % SetFrameFormat Selects how frames are encoded on the USB link.
+            % Frames are decoded back to values on reception, so the frame
+            % functions return the same data with less precision.
+            %   0  float32 (default)
+            %   1  raw X4 counters, raw frames only
+            %   2  int16 with a per frame scale
+            %   3  IEEE half floats
+            %   4  block floating point, int16 with an exponent per 16 bins
+            %
+            % Example:
+            %   radar.SetFrameFormat(2);
+            %   frame = radar.GetFrameRawDouble;
+            status = obj.TryUpdateChip('frame_format', format);
+        end
         
         %% Get a register value from the BBB
         function register = Item(obj, registerName)
@@ -161,6 +183,56 @@ classdef vcom_xep_radar_connector < handle
             list = char(obj.getData());
             list = strsplit(list, ',');
         end
+
+        %% Get the value of every variable on the radar at once
+        function vars = GetAllVariables(obj)
+            % GetAllVariables Read the whole radar configuration in one
+            % request, as a struct with a field per variable
+            %
+            % Example:
+            %   vars = radar.GetAllVariables;
+            %   iterations = vars.Iterations;
+
+            write(obj.usb_conn, 'GetAllVariables()', 'uint8');
+            pairs = strsplit(char(obj.getData()), ',');
+
+            vars = struct();
+            for i = 1:numel(pairs)
+                pair = strsplit(pairs{i}, '=');
+                vars.(pair{1}) = str2double(pair{2});
+            end
+        end
+
+        %% Set several variables at once
+        function status = SetVariables(obj, vars)
+            % SetVariables Set the variables named by the fields of a struct
+            % in one request. Either all of them change or, when one fails,
+            % none of them does
+            %
+            % Example:
+            %   radar.SetVariables(struct('Iterations', 16, 'DownConvert', 1));
+
+            names = fieldnames(vars);
+            pairs = cell(1, numel(names));
+            for i = 1:numel(names)
+                pairs{i} = [names{i} '=' num2str(vars.(names{i}), 8)];
+            end
+
+            cmd = uint8(['SetVariables(' strjoin(pairs, ',') ')']);
+            write(obj.usb_conn, cmd, 'uint8');
+            status = obj.getData();
+
+            for i = 1:numel(names)
+                if any(strcmp(names{i}, {'ddc_en', 'DownConvert'}))
+                    obj.x4DownConverter = vars.(names{i});
+                elseif strcmp(names{i}, 'frame_format')
+                    obj.frameFormat = vars.(names{i});
+                end
+            end
+
+            % Update the number of samplers in case it changed
+            obj.updateNumberOfSamplers();
+        end
         
         %% Get a list of the variables on the radar
         function register = RegisterRead(obj, address, length)
@@ -180,6 +252,39 @@ classdef vcom_xep_radar_connector < handle
             a = obj.getData();
             register = str2num(char(a));
         end
+
+        %% Send several commands at once and collect their replies
+        function replies = SendCommands(obj, cmds)
+            % SendCommands Send a cell array of text commands in one write
+            % without waiting for each reply. The replies come back in the
+            % order of the commands. A failed command does not stop the
+            % ones after it, its reply holds the error message.
+            %
+            % Example:
+            %   replies = radar.SendCommands({'VarGetValue_ByName(dac_min)', ...
+            %                                 'VarGetValue_ByName(dac_max)'});
+
+            write(obj.usb_conn, uint8([cmds{:}]), 'uint8');
+
+            replies = cell(size(cmds));
+            if obj.DEV_v2_packet_type == 1
+                for i = 1:numel(cmds)
+                    try
+                        replies{i} = char(obj.getData());
+                    catch e
+                        replies{i} = e.message;
+                    end
+                end
+            else
+                % Without packet lengths each reply ends at its ACK
+                a = [];
+                while numel(strfind(char(a), '<ACK>')) < numel(cmds)
+                    a = [a, read(obj.usb_conn, 1, 'uint8')]; %#ok
+                end
+                parts = strsplit(char(a), '<ACK>');
+                replies(:) = parts(1:numel(cmds));
+            end
+        end
         
         %% Get the actual sampler resolution
         function resolution = SamplerResolution(obj)
@@ -208,6 +313,211 @@ classdef vcom_xep_radar_connector < handle
             obj.getData();
             obj.updateNumberOfSamplers();
         end
+
+        %% Start pushing frames from the radar
+        function status = StartStreaming(obj, fps, mode)
+            % StartStreaming Starts continuous frame acquisition on the
+            % radar timer. Frames are pushed without further requests until
+            % StopStreaming is called; read them with ReadStreamFrame.
+            % mode is 0 for raw frames (default), 1 for normalized frames.
+            % Other commands are rejected while streaming.
+            %
+            % Example:
+            %   radar.StartStreaming(20, 1);
+            %   for i = 1:100
+            %       [frame, header] = radar.ReadStreamFrame();
+            %   end
+            %   radar.StopStreaming();
+
+            if nargin < 3
+                mode = 0;
+            end
+
+            cmd = uint8(['StartStreaming(' num2str(fps) ',' num2str(mode) ')']);
+            write(obj.usb_conn, cmd, 'uint8'); % Send command
+            status = obj.getData();            % Wait for ACK
+        end
+
+        %% Read the next streamed frame
+        function [frame, header] = ReadStreamFrame(obj)
+            % ReadStreamFrame Reads the next frame pushed after
+            % StartStreaming. header holds the packet sequence number, the
+            % X4 frame counter, the timestamp in ms and the number of frames
+            % dropped since streaming started. Gaps in the sequence number
+            % are not possible, gaps in the frame counter mean dropped
+            % frames.
+
+            [frame, header] = obj.readStreamPacket();
+            if isempty(header)
+                error('Expected a stream frame');
+            end
+
+            frame = double(frame);
+            if obj.x4DownConverter == 1
+                frame = frame(1:2:end) + 1i * frame(2:2:end);
+            end
+        end
+
+        %% Stop pushing frames
+        function StopStreaming(obj)
+            % StopStreaming Stops streaming and discards the frames that
+            % were sent ahead of the reply.
+            write(obj.usb_conn, 'StopStreaming()', 'uint8'); % Send command
+            header = 1;
+            while ~isempty(header)
+                [~, header] = obj.readStreamPacket();
+            end
+        end
+
+        %% Stream range-Doppler maps computed on the radar
+        function status = StartDoppler(obj, fps, frames, cells)
+            % StartDoppler Starts streaming range-Doppler maps computed on
+            % the radar from down converted frames. Each map covers the last
+            % frames frames (16 to 128, a power of two) and a new one is sent
+            % every frames/2 frames. With cells > 0 only the strongest cells
+            % of each map are sent. Read them with ReadDoppler, stop with
+            % StopStreaming. Doppler index k is (k - frames/2) * fps / frames
+            % Hz.
+            %
+            % Example:
+            %   radar.TryUpdateChip('DownConvert', 1);
+            %   radar.StartDoppler(100, 64);
+            %   [map, header] = radar.ReadDoppler();
+            %   imagesc(map);
+            %   radar.StopStreaming();
+
+            if nargin < 4
+                cells = 0;
+            end
+
+            cmd = uint8(['StartDoppler(' num2str(fps) ',' num2str(frames) ',' num2str(cells) ')']);
+            write(obj.usb_conn, cmd, 'uint8'); % Send command
+            status = obj.getData();            % Wait for ACK
+        end
+
+        %% Read the next range-Doppler map
+        function [map, header] = ReadDoppler(obj)
+            % ReadDoppler Reads the next packet pushed after StartDoppler.
+            % map holds one column per range bin and one row per Doppler
+            % index, zero Doppler at row frames/2 + 1. When cells were
+            % requested, map is a struct of the bin, Doppler index and
+            % magnitude of each cell instead, strongest first.
+
+            [map, header] = obj.readStreamPacket();
+            if isempty(header) || ~isfield(header, 'frames')
+                error('Expected a Doppler packet');
+            end
+        end
+
+        %% Capture a burst of frames into the radar memory
+        function status = CaptureFrames(obj, frames, fps, mode)
+            % CaptureFrames Captures frames on the radar timer into the
+            % radar's own memory, at rates the USB link could not sustain.
+            % frames is the number of frames, 0 to capture until
+            % StopCapture. mode is 0 for raw frames (default), 1 for
+            % normalized frames. Poll CaptureStatus until the capture has
+            % finished, then read the frames with ReadCapture. Other
+            % commands are rejected while capturing.
+            %
+            % Example:
+            %   radar.CaptureFrames(1000, 500);
+            %   while radar.CaptureStatus().running
+            %       pause(0.1);
+            %   end
+            %   [frames, info] = radar.ReadCapture();
+
+            if nargin < 4
+                mode = 0;
+            end
+
+            cmd = uint8(['CaptureFrames(' num2str(frames) ',' num2str(fps) ',' num2str(mode) ')']);
+            write(obj.usb_conn, cmd, 'uint8'); % Send command
+            status = obj.getData();            % Wait for ACK
+        end
+
+        %% Progress of the capture
+        function status = CaptureStatus(obj)
+            % CaptureStatus Returns whether the capture is running, the
+            % number of frames captured, the index of the oldest frame kept,
+            % the number of frames the radar memory holds and the frames
+            % dropped or failed during the capture.
+            write(obj.usb_conn, 'CaptureStatus()', 'uint8'); % Send command
+            v = str2double(strsplit(char(obj.getData()), ','));
+            status = struct('running', v(1) == 1, 'captured', v(2), ...
+                'first', v(3), 'capacity', v(4), 'dropped', v(5), 'errors', v(6));
+        end
+
+        %% End a capture early
+        function StopCapture(obj)
+            % StopCapture Stops the capture, keeping the frames captured so
+            % far.
+            write(obj.usb_conn, 'StopCapture()', 'uint8'); % Send command
+            obj.getData();                                 % Wait for ACK
+        end
+
+        %% Read captured frames
+        function [frames, info] = ReadCapture(obj, first, count)
+            % ReadCapture Reads count frames of the last capture, starting at
+            % capture index first, in one transfer. Without arguments all
+            % frames are read. frames holds one frame per column. info holds
+            % the capture index, X4 frame counter and timestamp in ms of each
+            % frame and the frames dropped during the capture.
+
+            if nargin < 2
+                first = 0;
+            end
+            if nargin < 3
+                count = 0;
+            end
+
+            cmd = uint8(['ReadCapture(' num2str(first) ',' num2str(count) ')']);
+            write(obj.usb_conn, cmd, 'uint8'); % Send command
+
+            if obj.DEV_v2_packet_type == 1
+                packetlength = read(obj.usb_conn, 1, 'int32');
+                a = uint8(read(obj.usb_conn, packetlength, 'uint8'));
+                if ~strcmp(char(a(1:5)), '<CAP>')
+                    obj.parseErrReturn(a);
+                end
+                obj.captureBuffer = a(6:end);
+            else
+                tag = read(obj.usb_conn, 5, 'uint8');
+                if ~strcmp(char(tag), '<CAP>')
+                    a = [tag, obj.getData(), uint8('<ACK>')];
+                    obj.parseErrReturn(a);
+                end
+            end
+
+            h = typecast(uint8(obj.readCaptureBytes(20)), 'uint32');
+            n = double(h(2));
+            format = h(4);
+
+            frames = [];
+            info = struct('index', zeros(1, n), 'frameCounter', zeros(1, n), ...
+                'timestamp', zeros(1, n), 'dropped', double(h(5)));
+
+            for k = 1:n
+                r = double(typecast(uint8(obj.readCaptureBytes(16)), 'uint32'));
+                info.index(k) = r(1);
+                info.frameCounter(k) = r(2);
+                info.timestamp(k) = r(3);
+
+                data = obj.readCaptureBytes(r(4));
+                if format ~= 0
+                    frame = obj.decodeFrame(data(1:16), data(17:end));
+                else
+                    frame = typecast(uint8(data), 'single');
+                end
+
+                frames(:, k) = double(frame(:)); %#ok
+            end
+
+            obj.readCaptureBytes(5); % <ACK>
+
+            if obj.x4DownConverter == 1
+                frames = frames(1:2:end, :) + 1i * frames(2:2:end, :);
+            end
+        end
     end
         
     methods(Hidden)
@@ -235,8 +545,14 @@ classdef vcom_xep_radar_connector < handle
                 frame = read(obj.usb_conn, packetlength, 'uint8');
                 obj.parseErrReturn(frame);
                 frame = frame(1:end-5);
+                if obj.frameFormat ~= 0
+                    frame = obj.decodeFrame(frame(1:16), frame(17:end));
+                    return
+                end
                 frame = typecast(uint8(frame), 'single');
                 return
+            elseif obj.frameFormat ~= 0
+                frame = obj.readEncodedFrame();
             else                
                 frame = [];
                 i = 1;
@@ -296,8 +612,14 @@ classdef vcom_xep_radar_connector < handle
                 frame = read(obj.usb_conn, packetlength, 'uint8');
                 obj.parseErrReturn(frame);
                 frame=frame(1:end-5);
+                if obj.frameFormat ~= 0
+                    frame = obj.decodeFrame(frame(1:16), frame(17:end));
+                    return
+                end
                 frame = typecast(uint8(frame), 'single');
                 return
+            elseif obj.frameFormat ~= 0
+                frame = obj.readEncodedFrame();
             else                
                 frame = [];
                 i = 1;
@@ -382,6 +704,179 @@ classdef vcom_xep_radar_connector < handle
             end
         end
         
+        %% Read a stream frame, or the reply that ends the stream
+        function [frame, header] = readStreamPacket(obj)
+            % Returns the frame and header of a "<STR>" packet, or an empty
+            % header once a regular reply has been read
+            frame = [];
+            header = [];
+
+            if obj.DEV_v2_packet_type == 1
+                packetlength = read(obj.usb_conn, 1, 'int32');
+                a = read(obj.usb_conn, packetlength, 'uint8');
+                if (packetlength > 37) && strcmp(char(a(1:5)), '<DOP>')
+                    [frame, header] = obj.parseDopplerPacket(uint8(a(6:end-5)));
+                    return
+                elseif (packetlength > 25) && strcmp(char(a(1:5)), '<STR>')
+                    h = typecast(uint8(a(6:25)), 'uint32');
+                    if obj.frameFormat ~= 0
+                        frame = obj.decodeFrame(a(26:41), a(42:end-5));
+                    else
+                        frame = typecast(uint8(a(26:end-5)), 'single');
+                    end
+                else
+                    obj.parseErrReturn(a);
+                    return
+                end
+            else
+                tag = read(obj.usb_conn, 5, 'uint8');
+                if strcmp(char(tag), '<ACK>')
+                    return
+                elseif strcmp(char(tag), '<DOP>')
+                    [frame, header] = obj.parseDopplerPacket(obj.readDopplerBytes());
+                    return
+                elseif ~strcmp(char(tag), '<STR>')
+                    a = [tag, obj.getData(), uint8('<ACK>')];
+                    obj.parseErrReturn(a);
+                    return
+                end
+                h = read(obj.usb_conn, 5, 'uint32');
+                if obj.frameFormat ~= 0
+                    d = read(obj.usb_conn, 16, 'uint8');
+                    n = double(typecast(uint8(d(9:12)), 'uint32'));
+                    frame = obj.decodeFrame(d, read(obj.usb_conn, n, 'uint8'));
+                else
+                    frame = read(obj.usb_conn, h(5), 'single');
+                end
+                read(obj.usb_conn, 5, 'uint8'); % <ACK>
+            end
+
+            header = struct('sequence', h(1), 'frameCounter', h(2), ...
+                'timestamp', h(3), 'dropped', h(4));
+        end
+
+        %% Read the rest of a Doppler packet sent without packet length
+        function a = readDopplerBytes(obj)
+            a = uint8(read(obj.usb_conn, 32, 'uint8'));
+            h = double(typecast(a, 'uint32'));
+            if h(7) > 0
+                a = [a, uint8(read(obj.usb_conn, 8 * h(7), 'uint8'))];
+            elseif h(8) ~= 0
+                for b = 1:h(5)
+                    d = uint8(read(obj.usb_conn, 16, 'uint8'));
+                    n = double(typecast(d(9:12), 'uint32'));
+                    a = [a, d, uint8(read(obj.usb_conn, n, 'uint8'))]; %#ok
+                end
+            else
+                a = [a, uint8(read(obj.usb_conn, 4 * h(5) * h(6), 'uint8'))];
+            end
+            read(obj.usb_conn, 5, 'uint8'); % <ACK>
+        end
+
+        %% Decode a Doppler packet, header and map or cells
+        function [map, header] = parseDopplerPacket(obj, a)
+            h = double(typecast(a(1:32), 'uint32'));
+            header = struct('sequence', h(1), 'frameCounter', h(2), ...
+                'timestamp', h(3), 'dropped', h(4), 'bins', h(5), ...
+                'frames', h(6), 'cells', h(7));
+            data = a(33:end);
+
+            if h(7) > 0
+                c = reshape(data(1:8*h(7)), 8, h(7));
+                map = struct( ...
+                    'bin', double(typecast(reshape(c(1:2, :), 1, []), 'uint16')), ...
+                    'doppler', double(typecast(reshape(c(3:4, :), 1, []), 'int16')), ...
+                    'magnitude', double(typecast(reshape(c(5:8, :), 1, []), 'single')));
+                return
+            end
+
+            map = zeros(h(6), h(5));
+            pos = 1;
+            for b = 1:h(5)
+                if h(8) ~= 0
+                    d = data(pos:pos+15);
+                    n = double(typecast(d(9:12), 'uint32'));
+                    map(:, b) = obj.decodeFrame(d, data(pos+16:pos+15+n));
+                    pos = pos + 16 + n;
+                else
+                    map(:, b) = typecast(data(pos:pos+4*h(6)-1), 'single');
+                    pos = pos + 4 * h(6);
+                end
+            end
+        end
+
+        %% Read an encoded frame sent without packet length
+        function frame = readEncodedFrame(obj)
+            % Reads the descriptor first as the frame size depends on it
+            d = read(obj.usb_conn, 5, 'uint8');
+            if strcmp(char(d), '<ERR>')
+                a = [d, obj.getData(), uint8('<ACK>')];
+                obj.parseErrReturn(a);
+            end
+            d = [d, read(obj.usb_conn, 11, 'uint8')];
+            n = double(typecast(uint8(d(9:12)), 'uint32'));
+            frame = obj.decodeFrame(d, read(obj.usb_conn, n, 'uint8'));
+            read(obj.usb_conn, 5, 'uint8'); % <ACK>
+        end
+
+        %% Read the next bytes of a ReadCapture reply
+        function bytes = readCaptureBytes(obj, n)
+            % The reply is read at once when it is preceded by its length
+            if obj.DEV_v2_packet_type == 1
+                bytes = obj.captureBuffer(1:n);
+                obj.captureBuffer = obj.captureBuffer(n+1:end);
+            else
+                bytes = uint8(read(obj.usb_conn, n, 'uint8'));
+            end
+        end
+
+        %% Decode a frame from its descriptor
+        function frame = decodeFrame(obj, d, data)
+            % d is the 16 byte frame descriptor (format, value size, block
+            % size, count, length, scale) and data the encoded frame
+            d = uint8(d);
+            data = uint8(data(:)');
+            format = d(1);
+            valueSize = double(d(2));
+            blockSize = double(typecast(d(3:4), 'uint16'));
+            count = double(typecast(d(5:8), 'uint32'));
+            scale = double(typecast(d(13:16), 'single'));
+
+            switch format
+                case 1 % Little endian counters, signed when wider than 4 bytes
+                    b = double(reshape(data(1:count*valueSize), valueSize, count));
+                    frame = (256 .^ (0:valueSize-1)) * b;
+                    if valueSize > 4
+                        full = 2 ^ (8*valueSize);
+                        frame(frame >= full/2) = frame(frame >= full/2) - full;
+                    end
+                    % The float frames carry Q negated
+                    if obj.x4DownConverter == 1
+                        frame(2:2:end) = -frame(2:2:end);
+                    end
+                case 2 % int16 * scale
+                    frame = double(typecast(data(1:2*count), 'int16')) * scale;
+                case 3 % IEEE half
+                    h = double(typecast(data(1:2*count), 'uint16'));
+                    e = bitand(bitshift(h, -10), 31);
+                    m = bitand(h, 1023);
+                    frame = (1 + m/1024) .* 2 .^ (e - 15);
+                    frame(e == 0) = m(e == 0) * 2^-24;
+                    frame(e == 31 & m == 0) = Inf;
+                    frame(e == 31 & m ~= 0) = NaN;
+                    frame(h >= 32768) = -frame(h >= 32768);
+                case 4 % Block floating point
+                    m = double(typecast(data(1:2*count), 'int16'));
+                    blocks = ceil(count / blockSize);
+                    e = double(typecast(data(2*count+1:2*count+blocks), 'int8'));
+                    frame = m .* 2 .^ e(floor((0:count-1) / blockSize) + 1);
+                otherwise % float32
+                    frame = double(typecast(data(1:4*count), 'single'));
+            end
+
+            frame = single(frame);
+        end
+
         %% Update "Number of Samplers" interval var
         function [] = updateNumberOfSamplers(obj)
             obj.numSamplers = obj.Item('SamplersPerFrame');
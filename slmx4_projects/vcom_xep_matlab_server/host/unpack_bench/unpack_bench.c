@@ -0,0 +1,336 @@
+/**
+@file unpack_bench.c
+
+Host benchmark for the X4 frame unpack and normalization code
+
+Builds x4driver.c and x4_post_norm.c for the host against stub callbacks, feeds
+synthetic frames for every counter width, DDC, I/Q layout and frame area offset
+combination through the driver and reports ns/bin, throughput and whether the
+output is bit exact against a plain reference implementation.
+
+See README.md for build and usage.
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "x4driver.h"
+#include "x4driver_unpack.h"
+#include "x4_post_norm.h"
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define XEP_LOCK_OK 1
+
+#define DEFAULT_BINS       1024
+#define DEFAULT_ITERATIONS 2000
+#define MAX_BINS           4096
+#define MAX_OFFSET         8
+
+// Large enough for MAX_BINS 6 byte counters plus the frame area offset
+#define RAW_SIZE ((MAX_BINS + MAX_OFFSET) * 6 + 8)
+
+#define MODE_NORMALIZED 0
+#define MODE_RAW        1
+#define MODE_POST_NORM  2
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+typedef struct {
+	uint8_t bytes_per_counter;
+	uint8_t ddc;
+	uint8_t iq_separate;
+	uint8_t offset;
+
+} BenchConfig_t;
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static X4Driver_t *create_driver();
+static void configure_driver(X4Driver_t *x4, const BenchConfig_t *cfg);
+static void fill_frame(uint8_t *raw, const BenchConfig_t *cfg, uint32_t bins, uint32_t seed);
+static void reference_unpack(const uint8_t *raw, const BenchConfig_t *cfg, uint32_t bins, int mode, float *out);
+static void reference_post_norm(float *x, const BenchConfig_t *cfg, uint32_t bins);
+static int run_case(X4Driver_t *x4, const BenchConfig_t *cfg, uint32_t bins, uint32_t iterations, int mode);
+static double now_ns();
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Normalization constants in the range a real X4 configuration produces
+static const float bench_nfactor = 1.0f / (1024.0f * 64.0f * 16.0f);
+static const float bench_filter_factor = 1.0f / 316.0f;
+static const float bench_offset = 1023.5f;
+
+static uint8_t raw_frame[RAW_SIZE];
+static float out_frame[MAX_BINS];
+static float ref_frame[MAX_BINS];
+
+static const char *mode_names[] = {"normalized", "raw", "post_norm"};
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Stub Callbacks
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static uint32_t stub_take(void *lock, uint32_t timeout) { (void)lock; (void)timeout; return XEP_LOCK_OK; }
+static void stub_give(void *lock) { (void)lock; }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Main
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int main(int argc, char **argv)
+{
+	uint32_t bins = (argc > 1) ? (uint32_t)atoi(argv[1]) : DEFAULT_BINS;
+	uint32_t iterations = (argc > 2) ? (uint32_t)atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+	if (bins == 0 || bins > MAX_BINS || (bins & 1) || iterations == 0) {
+		fprintf(stderr, "usage: %s [bins (even, <= %d)] [iterations]\n", argv[0], MAX_BINS);
+		return 2;
+	}
+
+	X4Driver_t *x4 = create_driver();
+	if (x4 == NULL) {
+		fprintf(stderr, "x4driver_create failed\n");
+		return 2;
+	}
+
+	printf("kernels=%d bins=%u iterations=%u\n", X4DRIVER_UNPACK_KERNELS, bins, iterations);
+	printf("%-4s %-4s %-3s %-6s %-10s %10s %12s %s\n", "bpc", "ddc", "iq", "offset", "mode", "ns/bin", "Mbins/s", "exact");
+
+	static const uint8_t offsets[] = {0, 1, 7};
+	int failures = 0;
+
+	for (int ddc = 0; ddc < 2; ddc++) {
+		for (uint8_t bpc = 3; bpc <= 6; bpc++) {
+			if (ddc == 0 && bpc > 4) continue; // baseband counters are 3 or 4 bytes
+			if (ddc == 1 && bpc < 4) continue; // down converted counters are 4 to 6 bytes
+
+			for (int iq = 0; iq < 2; iq++) {
+				if (ddc == 0 && iq == 1) continue; // layout only applies to I/Q data
+
+				for (size_t o = 0; o < sizeof(offsets); o++) {
+					if (ddc == 1 && offsets[o] != 0) continue; // DDC frames are not offset
+
+					BenchConfig_t cfg = {bpc, (uint8_t)ddc, (uint8_t)iq, offsets[o]};
+					configure_driver(x4, &cfg);
+
+					for (int mode = MODE_NORMALIZED; mode <= MODE_POST_NORM; mode++)
+						failures += run_case(x4, &cfg, bins, iterations, mode);
+				}
+			}
+		}
+	}
+
+	free(x4);
+
+	if (failures) {
+		printf("%d case(s) not bit exact\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static X4Driver_t *create_driver()
+{
+	X4DriverCallbacks_t callbacks;
+	memset(&callbacks, 0, sizeof(callbacks));
+
+	X4DriverLock_t lock = {0};
+	lock.lock = stub_take;
+	lock.unlock = stub_give;
+
+	X4DriverTimer_t timer = {0};
+
+	X4Driver_t *x4 = NULL;
+	void *mem = malloc(x4driver_get_instance_size());
+	if (mem == NULL)
+		return NULL;
+
+	if (x4driver_create(&x4, mem, &callbacks, &lock, &timer, &timer, NULL)) {
+		free(mem);
+		return NULL;
+	}
+
+	return x4;
+}
+
+
+/**
+Function sets the driver fields the unpack code depends on (normally set while
+configuring the X4)
+*/
+static void configure_driver(X4Driver_t *x4, const BenchConfig_t *cfg)
+{
+	x4->bytes_per_counter = cfg->bytes_per_counter;
+	x4->downconversion_enabled = cfg->ddc;
+	x4->iq_separate = cfg->iq_separate;
+	x4->frame_area_start_bin_offset = cfg->offset;
+	x4->normalization_nfactor = bench_nfactor;
+	x4->filter_normalization_factor = bench_filter_factor;
+	x4->normalization_offset = bench_offset;
+}
+
+
+/**
+Function generates a frame of counters over the full range of the counter width.
+Every 16th frame is all zero to exercise the zero frame detection
+*/
+static void fill_frame(uint8_t *raw, const BenchConfig_t *cfg, uint32_t bins, uint32_t seed)
+{
+	uint32_t state = seed * 2654435761u + 1;
+	uint32_t bytes = (bins + cfg->offset) * cfg->bytes_per_counter;
+
+	if ((seed & 15) == 15) {
+		memset(raw, 0, RAW_SIZE);
+		return;
+	}
+
+	for (uint32_t i = 0; i < bytes; i++) {
+		state = state * 1664525u + 1013904223u;
+		raw[i] = (uint8_t)(state >> 24);
+	}
+}
+
+
+/**
+Function reads one little endian counter into a 64 bit value
+*/
+static uint64_t load_counter(const uint8_t *p, uint8_t bytes)
+{
+	uint64_t v = 0;
+	for (uint8_t i = 0; i < bytes; i++)
+		v |= (uint64_t)p[i] << (8 * i);
+	return v;
+}
+
+
+/**
+Function is a plain per bin implementation of the driver unpack semantics
+*/
+static void reference_unpack(const uint8_t *raw, const BenchConfig_t *cfg, uint32_t bins, int mode, float *out)
+{
+	uint8_t bpc = cfg->bytes_per_counter;
+
+	if (!cfg->ddc) {
+		raw += cfg->offset * bpc;
+		for (uint32_t i = 0; i < bins; i++) {
+			uint32_t v = (uint32_t)load_counter(&raw[i * bpc], bpc);
+			out[i] = (mode == MODE_NORMALIZED) ? v * bench_nfactor - bench_offset : (float)v;
+		}
+		return;
+	}
+
+	float nfactor = bench_nfactor * bench_filter_factor;
+	uint32_t shift = 64 - 8 * bpc;
+
+	for (uint32_t i = 0; i < bins; i++) {
+		int64_t v = (int64_t)(load_counter(&raw[i * bpc], bpc) << shift) >> shift;
+		float f = (float)v;
+		if (mode == MODE_NORMALIZED)
+			f = f * nfactor;
+		if (i % 2 == 1)
+			f = -f;
+
+		uint32_t index = i;
+		if (cfg->iq_separate)
+			index = (i % 2 == 0) ? i / 2 : bins / 2 + i / 2;
+		out[index] = f;
+	}
+}
+
+
+/**
+Function applies the x4_post_norm formulas to a raw frame
+*/
+static void reference_post_norm(float *x, const BenchConfig_t *cfg, uint32_t bins)
+{
+	for (uint32_t i = 0; i < bins; i++) {
+		if (cfg->ddc)
+			x[i] = x[i] * (bench_filter_factor * bench_nfactor) * ((i % 2 == 1) ? -1.0 : 1.0);
+		else
+			x[i] = x[i] / bench_nfactor + bench_offset;
+	}
+}
+
+
+/**
+Function times one configuration and mode and checks it against the reference
+
+@return 1 if the output was not bit exact, 0 otherwise
+*/
+static int run_case(X4Driver_t *x4, const BenchConfig_t *cfg, uint32_t bins, uint32_t iterations, int mode)
+{
+	// x4_post_norm conjugates by index so it only applies to interleaved I/Q
+	if (mode == MODE_POST_NORM && cfg->iq_separate)
+		return 0;
+
+	uint32_t mismatches = 0;
+	double elapsed = 0;
+
+	for (uint32_t it = 0; it < iterations; it++) {
+		fill_frame(raw_frame, cfg, bins, it);
+
+		double start = now_ns();
+		int status;
+		if (mode == MODE_NORMALIZED) {
+			status = x4driver_unpack_frame_normalized(x4, raw_frame, RAW_SIZE, out_frame, bins);
+		} else {
+			status = x4driver_unpack_frame_raw(x4, raw_frame, RAW_SIZE, out_frame, bins);
+			if (mode == MODE_POST_NORM) {
+				if (cfg->ddc)
+					x4_norm_data_ddc(out_frame, bins, bench_filter_factor, bench_nfactor);
+				else
+					x4_norm_data(out_frame, bins, bench_offset, bench_nfactor);
+			}
+		}
+		elapsed += now_ns() - start;
+
+		if (status) {
+			mismatches = bins;
+			break;
+		}
+
+		// Only the first frames are checked so the check does not dominate the run
+		if (it < 64) {
+			reference_unpack(raw_frame, cfg, bins, (mode == MODE_NORMALIZED) ? MODE_NORMALIZED : MODE_RAW, ref_frame);
+			if (mode == MODE_POST_NORM)
+				reference_post_norm(ref_frame, cfg, bins);
+			for (uint32_t i = 0; i < bins; i++)
+				mismatches += (memcmp(&out_frame[i], &ref_frame[i], sizeof(float)) != 0);
+		}
+	}
+
+	double ns_per_bin = elapsed / ((double)iterations * bins);
+	printf("%-4u %-4u %-3u %-6u %-10s %10.3f %12.1f %s\n",
+		cfg->bytes_per_counter, cfg->ddc, cfg->iq_separate, cfg->offset, mode_names[mode],
+		ns_per_bin, 1000.0 / ns_per_bin, mismatches ? "NO" : "yes");
+
+	return mismatches ? 1 : 0;
+}
+
+
+static double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
@@ -0,0 +1,457 @@
+/**
+@file vcom_bench.c
+
+Benchmark of the VCOM XEP MATLAB server through the client library
+
+Measures the round trip of binary and text requests one at a time, the rate
+of pipelined requests, and streams frames to report the sustained frame rate
+and the latency percentiles of their delivery. Runs against a board, or against
+the pseudo terminal stand-in of vcom_sim.c when no port is given.
+
+See README.md for build and usage.
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vcom_client.h"
+#include "vcom_sim.h"
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define DEFAULT_REQUESTS 1000
+#define DEFAULT_WINDOW   16
+#define DEFAULT_FPS      500.0f
+#define DEFAULT_SECONDS  5
+#define DEFAULT_SIM_BINS 188
+
+#define REPLY_TIMEOUT_MS 1000
+#define FRAME_TIMEOUT_MS 1000
+
+/**
+@struct Samples_t
+Latencies of a measurement in ns
+*/
+typedef struct {
+	uint64_t *values;
+	uint32_t count;
+	uint32_t size;
+
+} Samples_t;
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static int bench_requests(VcomClient_t *client, uint32_t requests);
+static int bench_text(VcomClient_t *client, uint32_t requests);
+static int bench_pipelined(VcomClient_t *client, uint32_t requests, uint32_t window);
+static int bench_frames(VcomClient_t *client, uint32_t requests);
+static int bench_stream(VcomClient_t *client, float fps, int mode, uint32_t seconds, bool decode);
+static bool samples_init(Samples_t *samples, uint32_t size);
+static void samples_add(Samples_t *samples, uint64_t value);
+static void samples_print(const char *name, Samples_t *samples);
+static int compare_u64(const void *a, const void *b);
+static void usage();
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Main
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int main(int argc, char **argv)
+{
+	const char *port = NULL;
+	uint32_t requests = DEFAULT_REQUESTS;
+	uint32_t window = DEFAULT_WINDOW;
+	float fps = DEFAULT_FPS;
+	uint32_t seconds = DEFAULT_SECONDS;
+	uint32_t bins = DEFAULT_SIM_BINS;
+	int mode = 1;
+	int format = -1;
+	bool decode = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:n:w:f:t:m:F:b:dh")) != -1) {
+		switch (opt) {
+		case 'p': port = optarg; break;
+		case 'n': requests = strtoul(optarg, NULL, 0); break;
+		case 'w': window = strtoul(optarg, NULL, 0); break;
+		case 'f': fps = strtof(optarg, NULL); break;
+		case 't': seconds = strtoul(optarg, NULL, 0); break;
+		case 'm': mode = atoi(optarg); break;
+		case 'F': format = atoi(optarg); break;
+		case 'b': bins = strtoul(optarg, NULL, 0); break;
+		case 'd': decode = true; break;
+		default: usage(); return 2;
+		}
+	}
+
+	if (requests == 0 || window == 0) {
+		usage();
+		return 2;
+	}
+
+	VcomSim_t *sim = NULL;
+	char sim_path[64];
+	if (port == NULL) {
+		if (vcom_sim_start(&sim, bins, sim_path, sizeof(sim_path)) != VCOM_SIM_SUCCESS) {
+			fprintf(stderr, "Failed to start the stand-in\n");
+			return 1;
+		}
+		port = sim_path;
+		printf("Stand-in on %s, %u bins\n", port, (unsigned)bins);
+	}
+
+	VcomClient_t *client;
+	int status = vcom_client_open(&client, port, NULL);
+	if (status) {
+		fprintf(stderr, "Failed to open %s, error %d\n", port, status);
+		vcom_sim_stop(sim);
+		return 1;
+	}
+
+	// The radar may be open already from an earlier session
+	vcom_client_command(client, "NVA_CreateHandle()", NULL, REPLY_TIMEOUT_MS);
+	vcom_client_command(client, "OpenRadar()", NULL, REPLY_TIMEOUT_MS);
+
+	if (format >= 0) {
+		char cmd[64];
+		snprintf(cmd, sizeof(cmd), "VarSetValue_ByName(frame_format,%d)", format);
+		if (vcom_client_command(client, cmd, NULL, REPLY_TIMEOUT_MS)) {
+			fprintf(stderr, "Failed to set frame format %d\n", format);
+			vcom_client_close(client);
+			vcom_sim_stop(sim);
+			return 1;
+		}
+	}
+
+	int failures = 0;
+	failures += bench_requests(client, requests);
+	failures += bench_text(client, requests);
+	failures += bench_pipelined(client, requests, window);
+	failures += bench_frames(client, requests);
+	failures += bench_stream(client, fps, mode, seconds, decode);
+
+	vcom_client_close(client);
+	vcom_sim_stop(sim);
+
+	return failures ? 1 : 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function measures binary pings sent one at a time
+*/
+static int bench_requests(VcomClient_t *client, uint32_t requests)
+{
+	Samples_t samples;
+	if (!samples_init(&samples, requests))
+		return 1;
+
+	for (uint32_t i = 0; i < requests; i++) {
+		MatBinRequest_t request;
+		MatBinResponse_t response;
+		memset(&request, 0, sizeof(request));
+		request.opcode = MAT_OP_PING;
+		request.request_id = i;
+		request.value.i = (int32_t)i;
+
+		uint64_t start = vcom_client_time_ns();
+		int status = vcom_client_request(client, &request, &response, NULL, REPLY_TIMEOUT_MS);
+		if (status || response.value.i != (int32_t)i) {
+			fprintf(stderr, "Ping %u failed, error %d\n", (unsigned)i, status);
+			free(samples.values);
+			return 1;
+		}
+		samples_add(&samples, vcom_client_time_ns() - start);
+	}
+
+	samples_print("ping", &samples);
+	free(samples.values);
+
+	return 0;
+}
+
+
+/**
+Function measures a text command sent one at a time
+*/
+static int bench_text(VcomClient_t *client, uint32_t requests)
+{
+	Samples_t samples;
+	if (!samples_init(&samples, requests))
+		return 1;
+
+	for (uint32_t i = 0; i < requests; i++) {
+		uint64_t start = vcom_client_time_ns();
+		int status = vcom_client_command(client, "VarGetValue_ByName(pps)", NULL, REPLY_TIMEOUT_MS);
+		if (status) {
+			fprintf(stderr, "VarGetValue_ByName(pps) failed, error %d\n", status);
+			free(samples.values);
+			return 1;
+		}
+		samples_add(&samples, vcom_client_time_ns() - start);
+	}
+
+	samples_print("text", &samples);
+	free(samples.values);
+
+	return 0;
+}
+
+
+/**
+Function keeps up to window pings in flight and checks that the responses come
+back in order
+*/
+static int bench_pipelined(VcomClient_t *client, uint32_t requests, uint32_t window)
+{
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint64_t start = vcom_client_time_ns();
+
+	while (received < requests) {
+		while (sent < requests && sent - received < window) {
+			MatBinRequest_t request;
+			memset(&request, 0, sizeof(request));
+			request.magic = MAT_BIN_MAGIC;
+			request.opcode = MAT_OP_PING;
+			request.request_id = sent++;
+			if (vcom_client_send(client, &request, sizeof(request)))
+				return 1;
+		}
+
+		VcomReply_t reply;
+		if (vcom_client_get_reply(client, &reply, REPLY_TIMEOUT_MS)) {
+			fprintf(stderr, "Pipelined ping %u lost\n", (unsigned)received);
+			return 1;
+		}
+
+		MatBinResponse_t response;
+		bool ok = reply.length >= sizeof(response);
+		if (ok) {
+			memcpy(&response, reply.data, sizeof(response));
+			ok = response.request_id == received;
+		}
+		vcom_client_free_reply(&reply);
+
+		if (!ok) {
+			fprintf(stderr, "Pipelined ping %u out of order\n", (unsigned)received);
+			return 1;
+		}
+		received++;
+	}
+
+	double seconds = (vcom_client_time_ns() - start) / 1e9;
+	printf("%-10s %8u requests  window %u  %.0f requests/s\n", "pipelined", (unsigned)requests, (unsigned)window, requests / seconds);
+
+	return 0;
+}
+
+
+/**
+Function measures single frames fetched with binary requests
+*/
+static int bench_frames(VcomClient_t *client, uint32_t requests)
+{
+	Samples_t samples;
+	if (!samples_init(&samples, requests))
+		return 1;
+
+	uint32_t bytes = 0;
+	for (uint32_t i = 0; i < requests; i++) {
+		MatBinRequest_t request;
+		MatBinResponse_t response;
+		VcomReply_t payload;
+		memset(&request, 0, sizeof(request));
+		request.opcode = MAT_OP_GET_FRAME_RAW;
+		request.request_id = i;
+
+		uint64_t start = vcom_client_time_ns();
+		int status = vcom_client_request(client, &request, &response, &payload, REPLY_TIMEOUT_MS);
+		if (status || response.status != MAT_STATUS_OK) {
+			fprintf(stderr, "Frame %u failed, error %d, status %d\n", (unsigned)i, status, status ? 0 : response.status);
+			if (status == 0)
+				vcom_client_free_reply(&payload);
+			free(samples.values);
+			return 1;
+		}
+		samples_add(&samples, vcom_client_time_ns() - start);
+		bytes = response.length;
+		vcom_client_free_reply(&payload);
+	}
+
+	samples_print("frame", &samples);
+	printf("%-10s %8u bytes per frame\n", "", (unsigned)bytes);
+	free(samples.values);
+
+	return 0;
+}
+
+
+/**
+Function streams for the given time. The delivery latency is the host receive
+time less the device timestamp, relative to its minimum over the run, as the
+two clocks are not related
+*/
+static int bench_stream(VcomClient_t *client, float fps, int mode, uint32_t seconds, bool decode)
+{
+	uint32_t expected = (uint32_t)(fps * seconds) + 16;
+	Samples_t interval, handoff, delivery;
+	if (!samples_init(&interval, expected) || !samples_init(&handoff, expected) || !samples_init(&delivery, expected))
+		return 1;
+
+	float *values = malloc(FRAME_ENCODE_MAX_VALUES * 2 * sizeof(float));
+	if (values == NULL)
+		return 1;
+
+	vcom_client_reset_stats(client);
+
+	int status = vcom_client_start_streaming(client, fps, mode);
+	if (status) {
+		fprintf(stderr, "StartStreaming failed, error %d\n", status);
+		return 1;
+	}
+
+	uint64_t end = vcom_client_time_ns() + (uint64_t)seconds * 1000000000u;
+	uint64_t first_ns = 0, last_ns = 0, previous_ns = 0;
+	int64_t min_offset = INT64_MAX;
+	uint32_t frames = 0, decode_errors = 0, device_dropped = 0;
+
+	while (vcom_client_time_ns() < end) {
+		VcomFrameView_t frame;
+		status = vcom_client_acquire_frame(client, &frame, FRAME_TIMEOUT_MS);
+		if (status)
+			break;
+
+		uint64_t now = vcom_client_time_ns();
+		samples_add(&handoff, now - frame.receive_ns);
+
+		if (frames == 0)
+			first_ns = frame.receive_ns;
+		else
+			samples_add(&interval, frame.receive_ns - previous_ns);
+		previous_ns = frame.receive_ns;
+		last_ns = frame.receive_ns;
+
+		int64_t offset = (int64_t)(frame.receive_ns / 1000) - (int64_t)frame.header.timestamp * 1000;
+		samples_add(&delivery, (uint64_t)offset);
+		if (offset < min_offset)
+			min_offset = offset;
+
+		if (decode && vcom_client_decode_frame(&frame, values, FRAME_ENCODE_MAX_VALUES * 2))
+			decode_errors++;
+
+		device_dropped = frame.header.dropped;
+		frames++;
+		vcom_client_release_frame(client);
+	}
+
+	vcom_client_stop_streaming(client);
+
+	// Frames sent before the stop
+	VcomFrameView_t frame;
+	while (vcom_client_acquire_frame(client, &frame, 0) == VCOM_CLIENT_SUCCESS)
+		vcom_client_release_frame(client);
+
+	VcomClientStats_t stats;
+	vcom_client_get_stats(client, &stats);
+
+	for (uint32_t i = 0; i < delivery.count; i++)
+		delivery.values[i] = (delivery.values[i] - min_offset) * 1000;
+
+	double elapsed = (last_ns - first_ns) / 1e9;
+	printf("%-10s %8u frames  requested %.1f fps  sustained %.1f fps  %.2f MB/s\n", "stream", (unsigned)frames, fps,
+	       (frames > 1 && elapsed > 0) ? (frames - 1) / elapsed : 0.0, stats.bytes / 1e6 / seconds);
+	samples_print("interval", &interval);
+	samples_print("handoff", &handoff);
+	samples_print("delivery", &delivery);
+	printf("%-10s device dropped %u  ring dropped %u  sequence gaps %u  bad %u  resync bytes %u  reads %llu\n", "",
+	       (unsigned)device_dropped, (unsigned)stats.ring_dropped, (unsigned)stats.sequence_gaps,
+	       (unsigned)stats.bad_frames, (unsigned)stats.resyncs, (unsigned long long)stats.reads);
+
+	free(values);
+	free(interval.values);
+	free(handoff.values);
+	free(delivery.values);
+
+	if (frames == 0 || stats.bad_frames || decode_errors) {
+		fprintf(stderr, "Stream failed, %u frames, %u bad, %u not decoded\n", (unsigned)frames, (unsigned)stats.bad_frames, (unsigned)decode_errors);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+static bool samples_init(Samples_t *samples, uint32_t size)
+{
+	samples->values = malloc((size_t)size * sizeof(uint64_t));
+	samples->count = 0;
+	samples->size = size;
+
+	return samples->values != NULL;
+}
+
+
+static void samples_add(Samples_t *samples, uint64_t value)
+{
+	if (samples->count < samples->size)
+		samples->values[samples->count++] = value;
+}
+
+
+/**
+Function prints the percentiles in us
+*/
+static void samples_print(const char *name, Samples_t *samples)
+{
+	if (samples->count == 0) {
+		printf("%-10s no samples\n", name);
+		return;
+	}
+
+	qsort(samples->values, samples->count, sizeof(uint64_t), compare_u64);
+
+	uint32_t n = samples->count;
+	printf("%-10s %8u samples  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f us\n", name, (unsigned)n,
+	       samples->values[n / 2] / 1e3, samples->values[(uint64_t)n * 90 / 100] / 1e3,
+	       samples->values[(uint64_t)n * 99 / 100] / 1e3, samples->values[n - 1] / 1e3);
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+static void usage()
+{
+	fprintf(stderr,
+	        "usage: vcom_bench [-p port] [-n requests] [-w window] [-f fps] [-t seconds] [-m mode] [-F format] [-b bins] [-d]\n"
+	        "  -p  Port of the board, the pseudo terminal stand-in if not given\n"
+	        "  -n  Requests per measurement (%d)\n"
+	        "  -w  Pipelined requests in flight (%d)\n"
+	        "  -f  Stream frame rate (%.0f)\n"
+	        "  -t  Stream time in s (%d)\n"
+	        "  -m  Stream mode, 0 raw, 1 normalized (1)\n"
+	        "  -F  frame_format to set, FRAME_FORMAT_* (unchanged)\n"
+	        "  -b  Bins of the stand-in (%d)\n"
+	        "  -d  Decode every streamed frame\n",
+	        DEFAULT_REQUESTS, DEFAULT_WINDOW, DEFAULT_FPS, DEFAULT_SECONDS, DEFAULT_SIM_BINS);
+}
@@ -0,0 +1,775 @@
+/**
+@file vcom_client.c
+
+See header
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#define _GNU_SOURCE
+
+#include "vcom_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define TAG_LENGTH 5
+
+// Bytes asked for per read()
+#define READ_SIZE (64 * 1024)
+
+// Time the reader waits for data before checking for a stop request
+#define READER_POLL_MS 50
+
+// Time open() waits for the server to answer
+#define OPEN_TIMEOUT_MS 2000
+
+// Commands sent by open(). Each is rejected harmlessly when there is nothing to
+// stop; the reply to SendPacketLengths(1) is the first one surely framed
+#define OPEN_COMMANDS "StopStreaming()StopCapture()SendPacketLengths(1)"
+
+/**
+@struct ReplyNode_t
+Queued reply
+*/
+typedef struct ReplyNode {
+	struct ReplyNode *next;
+	VcomReply_t reply;
+
+} ReplyNode_t;
+
+struct VcomClient {
+	int fd;
+	pthread_t reader;
+	bool reader_started;
+	atomic_bool stop;
+	atomic_bool closed; // Reader has stopped
+
+	pthread_mutex_t write_lock;
+
+	// Frame ring, head is written by the reader and tail by the consumer
+	uint8_t *slot_data;
+	VcomFrameView_t *slot_views;
+	uint32_t slot_size;
+	uint32_t slot_mask;
+	atomic_uint head;
+	atomic_uint tail;
+	sem_t frames_ready;
+	bool frame_held;
+
+	// Replies, oldest first
+	pthread_mutex_t reply_lock;
+	pthread_cond_t reply_ready;
+	ReplyNode_t *reply_first;
+	ReplyNode_t *reply_last;
+
+	// Reader state
+	uint8_t *rx;
+	uint32_t rx_size;
+	uint32_t rx_count;
+	bool synced;
+	bool have_sequence;
+	uint32_t last_sequence;
+
+	pthread_mutex_t stats_lock;
+	VcomClientStats_t stats;
+};
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static int configure_port(int fd);
+static int handshake(VcomClient_t *client);
+static void *reader_task(void *arg);
+static uint32_t parse_messages(VcomClient_t *client, VcomClientStats_t *delta);
+static void dispatch_frame(VcomClient_t *client, const uint8_t *body, uint32_t length, uint64_t now, VcomClientStats_t *delta);
+static void dispatch_reply(VcomClient_t *client, const uint8_t *body, uint32_t length, uint64_t now);
+static bool parse_descriptor(const uint8_t *payload, uint32_t length, uint32_t bins, FrameDescriptor_t *descriptor);
+static void add_stats(VcomClient_t *client, const VcomClientStats_t *delta);
+static void free_replies(VcomClient_t *client);
+static void deadline(struct timespec *ts, clockid_t clock, uint32_t timeout_ms);
+static uint32_t read_u32(const uint8_t *p);
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int vcom_client_open(VcomClient_t **client, const char *path, const VcomClientConfig_t *config)
+{
+	if (client == NULL || path == NULL) return VCOM_CLIENT_ERR_ARG;
+
+	uint32_t slot_size = (config && config->slot_size) ? config->slot_size : VCOM_CLIENT_DEFAULT_SLOT_SIZE;
+	uint32_t slots = (config && config->slots) ? config->slots : VCOM_CLIENT_DEFAULT_SLOTS;
+	if (slots & (slots - 1)) return VCOM_CLIENT_ERR_ARG;
+
+	VcomClient_t *c = calloc(1, sizeof(VcomClient_t));
+	if (c == NULL) return VCOM_CLIENT_ERR_MEMORY;
+
+	c->slot_size = slot_size;
+	c->slot_mask = slots - 1;
+	c->slot_data = malloc((size_t)slots * slot_size);
+	c->slot_views = calloc(slots, sizeof(VcomFrameView_t));
+	c->rx_size = 2 * READ_SIZE;
+	c->rx = malloc(c->rx_size);
+	if (c->slot_data == NULL || c->slot_views == NULL || c->rx == NULL) {
+		free(c->slot_data);
+		free(c->slot_views);
+		free(c->rx);
+		free(c);
+		return VCOM_CLIENT_ERR_MEMORY;
+	}
+
+	pthread_mutex_init(&c->write_lock, NULL);
+	pthread_mutex_init(&c->reply_lock, NULL);
+	pthread_mutex_init(&c->stats_lock, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&c->reply_ready, &attr);
+	pthread_condattr_destroy(&attr);
+	sem_init(&c->frames_ready, 0, 0);
+
+	c->fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (c->fd < 0 || configure_port(c->fd)) {
+		vcom_client_close(c);
+		return VCOM_CLIENT_ERR_OPEN;
+	}
+
+	if (pthread_create(&c->reader, NULL, reader_task, c)) {
+		vcom_client_close(c);
+		return VCOM_CLIENT_ERR_MEMORY;
+	}
+	c->reader_started = true;
+
+	int status = handshake(c);
+	if (status) {
+		vcom_client_close(c);
+		return status;
+	}
+
+	*client = c;
+
+	return VCOM_CLIENT_SUCCESS;
+}
+
+
+void vcom_client_close(VcomClient_t *client)
+{
+	if (client == NULL)
+		return;
+
+	if (client->reader_started) {
+		atomic_store(&client->stop, true);
+		pthread_join(client->reader, NULL);
+	}
+
+	if (client->fd >= 0)
+		close(client->fd);
+
+	free_replies(client);
+	sem_destroy(&client->frames_ready);
+	pthread_cond_destroy(&client->reply_ready);
+	pthread_mutex_destroy(&client->stats_lock);
+	pthread_mutex_destroy(&client->reply_lock);
+	pthread_mutex_destroy(&client->write_lock);
+	free(client->slot_data);
+	free(client->slot_views);
+	free(client->rx);
+	free(client);
+}
+
+
+int vcom_client_send(VcomClient_t *client, const void *data, size_t n)
+{
+	if (client == NULL || (data == NULL && n > 0)) return VCOM_CLIENT_ERR_ARG;
+	if (atomic_load(&client->closed)) return VCOM_CLIENT_ERR_CLOSED;
+
+	const uint8_t *p = data;
+	int status = VCOM_CLIENT_SUCCESS;
+
+	pthread_mutex_lock(&client->write_lock);
+	while (n > 0) {
+		ssize_t written = write(client->fd, p, n);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			status = VCOM_CLIENT_ERR_IO;
+			break;
+		}
+		p += written;
+		n -= written;
+	}
+	pthread_mutex_unlock(&client->write_lock);
+
+	return status;
+}
+
+
+int vcom_client_get_reply(VcomClient_t *client, VcomReply_t *reply, uint32_t timeout_ms)
+{
+	if (client == NULL || reply == NULL) return VCOM_CLIENT_ERR_ARG;
+
+	struct timespec ts;
+	deadline(&ts, CLOCK_MONOTONIC, timeout_ms);
+
+	int status = VCOM_CLIENT_SUCCESS;
+
+	pthread_mutex_lock(&client->reply_lock);
+	while (client->reply_first == NULL) {
+		if (atomic_load(&client->closed)) {
+			status = VCOM_CLIENT_ERR_CLOSED;
+			break;
+		}
+		if (pthread_cond_timedwait(&client->reply_ready, &client->reply_lock, &ts) == ETIMEDOUT) {
+			status = VCOM_CLIENT_ERR_TIMEOUT;
+			break;
+		}
+	}
+
+	ReplyNode_t *node = NULL;
+	if (status == VCOM_CLIENT_SUCCESS) {
+		node = client->reply_first;
+		client->reply_first = node->next;
+		if (client->reply_first == NULL)
+			client->reply_last = NULL;
+	}
+	pthread_mutex_unlock(&client->reply_lock);
+
+	if (node == NULL)
+		return status;
+
+	*reply = node->reply;
+	free(node);
+
+	return VCOM_CLIENT_SUCCESS;
+}
+
+
+void vcom_client_free_reply(VcomReply_t *reply)
+{
+	if (reply == NULL)
+		return;
+
+	free(reply->data);
+	reply->data = NULL;
+	reply->length = 0;
+}
+
+
+int vcom_client_command(VcomClient_t *client, const char *cmd, VcomReply_t *reply, uint32_t timeout_ms)
+{
+	if (client == NULL || cmd == NULL) return VCOM_CLIENT_ERR_ARG;
+
+	int status = vcom_client_send(client, cmd, strlen(cmd));
+	if (status)
+		return status;
+
+	// A warning goes out ahead of the reply of the same command
+	VcomReply_t r;
+	do {
+		status = vcom_client_get_reply(client, &r, timeout_ms);
+		if (status)
+			return status;
+
+		if (r.type == VCOM_REPLY_WARNING)
+			vcom_client_free_reply(&r);
+	} while (r.type == VCOM_REPLY_WARNING);
+
+	status = (r.type == VCOM_REPLY_ERROR) ? VCOM_CLIENT_ERR_DEVICE : VCOM_CLIENT_SUCCESS;
+
+	if (reply != NULL)
+		*reply = r;
+	else
+		vcom_client_free_reply(&r);
+
+	return status;
+}
+
+
+int vcom_client_request(VcomClient_t *client, MatBinRequest_t *request, MatBinResponse_t *response, VcomReply_t *payload, uint32_t timeout_ms)
+{
+	if (client == NULL || request == NULL || response == NULL) return VCOM_CLIENT_ERR_ARG;
+
+	request->magic = MAT_BIN_MAGIC;
+
+	int status = vcom_client_send(client, request, sizeof(MatBinRequest_t));
+	if (status)
+		return status;
+
+	VcomReply_t r;
+	status = vcom_client_get_reply(client, &r, timeout_ms);
+	if (status)
+		return status;
+
+	if (r.type != VCOM_REPLY_DATA || r.length < sizeof(MatBinResponse_t)) {
+		vcom_client_free_reply(&r);
+		return VCOM_CLIENT_ERR_PROTOCOL;
+	}
+
+	memcpy(response, r.data, sizeof(MatBinResponse_t));
+	if (response->magic != MAT_BIN_MAGIC || response->request_id != request->request_id) {
+		vcom_client_free_reply(&r);
+		return VCOM_CLIENT_ERR_PROTOCOL;
+	}
+
+	if (payload != NULL)
+		*payload = r;
+	else
+		vcom_client_free_reply(&r);
+
+	return VCOM_CLIENT_SUCCESS;
+}
+
+
+int vcom_client_start_streaming(VcomClient_t *client, float fps, int mode)
+{
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "StartStreaming(%g,%d)", fps, mode);
+
+	return vcom_client_command(client, cmd, NULL, 1000);
+}
+
+
+int vcom_client_stop_streaming(VcomClient_t *client)
+{
+	return vcom_client_command(client, "StopStreaming()", NULL, 5000);
+}
+
+
+int vcom_client_acquire_frame(VcomClient_t *client, VcomFrameView_t *frame, uint32_t timeout_ms)
+{
+	if (client == NULL || frame == NULL || client->frame_held) return VCOM_CLIENT_ERR_ARG;
+
+	struct timespec ts;
+	deadline(&ts, CLOCK_REALTIME, timeout_ms);
+
+	while (sem_timedwait(&client->frames_ready, &ts) != 0) {
+		if (errno == EINTR)
+			continue;
+		return atomic_load(&client->closed) ? VCOM_CLIENT_ERR_CLOSED : VCOM_CLIENT_ERR_TIMEOUT;
+	}
+
+	unsigned tail = atomic_load_explicit(&client->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&client->head, memory_order_acquire);
+
+	// The reader posts once more when it stops
+	if (head == tail)
+		return VCOM_CLIENT_ERR_CLOSED;
+
+	*frame = client->slot_views[tail & client->slot_mask];
+	client->frame_held = true;
+
+	return VCOM_CLIENT_SUCCESS;
+}
+
+
+void vcom_client_release_frame(VcomClient_t *client)
+{
+	if (client == NULL || !client->frame_held)
+		return;
+
+	client->frame_held = false;
+	atomic_fetch_add_explicit(&client->tail, 1, memory_order_release);
+}
+
+
+int vcom_client_decode_frame(const VcomFrameView_t *frame, float *values, uint32_t max_count)
+{
+	if (frame == NULL || values == NULL) return VCOM_CLIENT_ERR_ARG;
+
+	if (frame_decode(&frame->descriptor, frame->data, values, max_count) != FRAME_ENCODE_SUCCESS)
+		return VCOM_CLIENT_ERR_PROTOCOL;
+
+	return VCOM_CLIENT_SUCCESS;
+}
+
+
+void vcom_client_get_stats(VcomClient_t *client, VcomClientStats_t *stats)
+{
+	pthread_mutex_lock(&client->stats_lock);
+	*stats = client->stats;
+	pthread_mutex_unlock(&client->stats_lock);
+}
+
+
+void vcom_client_reset_stats(VcomClient_t *client)
+{
+	pthread_mutex_lock(&client->stats_lock);
+	memset(&client->stats, 0, sizeof(client->stats));
+	pthread_mutex_unlock(&client->stats_lock);
+}
+
+
+uint64_t vcom_client_time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function puts the port in raw mode and drops anything queued on it
+*/
+static int configure_port(int fd)
+{
+	struct termios tio;
+	if (tcgetattr(fd, &tio))
+		return 1;
+
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &tio))
+		return 1;
+
+	tcflush(fd, TCIOFLUSH);
+
+	return 0;
+}
+
+
+/**
+Function brings the server into a known state. The reader skips everything up
+to the reply to SendPacketLengths(1); the replies queued after it are dropped
+up to the answer to a ping
+*/
+static int handshake(VcomClient_t *client)
+{
+	int status = vcom_client_send(client, OPEN_COMMANDS, strlen(OPEN_COMMANDS));
+	if (status)
+		return status;
+
+	MatBinRequest_t ping;
+	memset(&ping, 0, sizeof(ping));
+	ping.magic = MAT_BIN_MAGIC;
+	ping.opcode = MAT_OP_PING;
+	ping.request_id = (uint32_t)vcom_client_time_ns();
+
+	status = vcom_client_send(client, &ping, sizeof(ping));
+	if (status)
+		return status;
+
+	uint64_t end = vcom_client_time_ns() + OPEN_TIMEOUT_MS * 1000000ull;
+
+	for (;;) {
+		uint64_t now = vcom_client_time_ns();
+		if (now >= end)
+			return VCOM_CLIENT_ERR_OPEN;
+
+		VcomReply_t reply;
+		status = vcom_client_get_reply(client, &reply, (uint32_t)((end - now) / 1000000) + 1);
+		if (status == VCOM_CLIENT_ERR_TIMEOUT)
+			return VCOM_CLIENT_ERR_OPEN;
+		if (status)
+			return status;
+
+		MatBinResponse_t response;
+		bool found = false;
+		if (reply.length >= sizeof(response)) {
+			memcpy(&response, reply.data, sizeof(response));
+			found = response.magic == MAT_BIN_MAGIC && response.opcode == MAT_OP_PING && response.request_id == ping.request_id;
+		}
+		vcom_client_free_reply(&reply);
+
+		if (found)
+			return VCOM_CLIENT_SUCCESS;
+	}
+}
+
+
+/**
+Thread reading the port in large blocks and handing out the complete messages
+*/
+static void *reader_task(void *arg)
+{
+	VcomClient_t *client = arg;
+
+	while (!atomic_load(&client->stop)) {
+		struct pollfd pfd = {.fd = client->fd, .events = POLLIN};
+		int ready = poll(&pfd, 1, READER_POLL_MS);
+		if (ready < 0 && errno != EINTR)
+			break;
+		if (ready <= 0)
+			continue;
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
+
+		// A message longer than the buffer grows it
+		if (client->rx_size - client->rx_count < READ_SIZE) {
+			uint8_t *rx = realloc(client->rx, (size_t)client->rx_size * 2);
+			if (rx == NULL)
+				break;
+			client->rx = rx;
+			client->rx_size *= 2;
+		}
+
+		ssize_t n = read(client->fd, client->rx + client->rx_count, client->rx_size - client->rx_count);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
+			break;
+
+		VcomClientStats_t delta;
+		memset(&delta, 0, sizeof(delta));
+		delta.bytes = n;
+		delta.reads = 1;
+
+		client->rx_count += n;
+		uint32_t used = parse_messages(client, &delta);
+		if (used > 0) {
+			memmove(client->rx, client->rx + used, client->rx_count - used);
+			client->rx_count -= used;
+		}
+
+		add_stats(client, &delta);
+	}
+
+	// Wake anyone waiting for a frame or a reply
+	atomic_store(&client->closed, true);
+	sem_post(&client->frames_ready);
+	pthread_mutex_lock(&client->reply_lock);
+	pthread_cond_broadcast(&client->reply_ready);
+	pthread_mutex_unlock(&client->reply_lock);
+
+	return NULL;
+}
+
+
+/**
+Function hands out every complete message in the read buffer
+
+@return Bytes of the buffer used up
+*/
+static uint32_t parse_messages(VcomClient_t *client, VcomClientStats_t *delta)
+{
+	static const uint8_t sync[4 + TAG_LENGTH] = {TAG_LENGTH, 0, 0, 0, '<', 'A', 'C', 'K', '>'};
+
+	const uint8_t *rx = client->rx;
+	uint32_t count = client->rx_count;
+	uint32_t pos = 0;
+	uint64_t now = vcom_client_time_ns();
+
+	while (pos < count) {
+		// Out of step, skip to the end of the next empty reply
+		if (!client->synced) {
+			uint8_t *found = memmem(rx + pos, count - pos, sync, sizeof(sync));
+			if (found == NULL) {
+				uint32_t keep = (count - pos < sizeof(sync)) ? count - pos : sizeof(sync) - 1;
+				delta->resyncs += count - pos - keep;
+				return count - keep;
+			}
+
+			uint32_t skip = (uint32_t)(found - (rx + pos));
+			delta->resyncs += skip;
+			pos += skip + sizeof(sync);
+			client->synced = true;
+			continue;
+		}
+
+		if (count - pos < 4)
+			break;
+
+		uint32_t length = read_u32(rx + pos);
+		if (length < TAG_LENGTH || length > VCOM_CLIENT_MAX_REPLY) {
+			client->synced = false;
+			continue;
+		}
+
+		if (count - pos - 4 < length)
+			break;
+
+		const uint8_t *body = rx + pos + 4;
+		if (memcmp(body + length - TAG_LENGTH, "<ACK>", TAG_LENGTH) != 0) {
+			client->synced = false;
+			continue;
+		}
+
+		if (length >= TAG_LENGTH + sizeof(VcomStreamHeader_t) + TAG_LENGTH && memcmp(body, "<STR>", TAG_LENGTH) == 0) {
+			dispatch_frame(client, body, length, now, delta);
+		}
+		else {
+			dispatch_reply(client, body, length, now);
+			delta->replies++;
+		}
+
+		pos += 4 + length;
+	}
+
+	return pos;
+}
+
+
+/**
+Function copies a stream packet into the next free slot. A full ring drops the
+packet, the reader never waits for the consumer
+*/
+static void dispatch_frame(VcomClient_t *client, const uint8_t *body, uint32_t length, uint64_t now, VcomClientStats_t *delta)
+{
+	VcomFrameView_t view;
+	memcpy(&view.header, body + TAG_LENGTH, sizeof(VcomStreamHeader_t));
+	view.receive_ns = now;
+
+	const uint8_t *payload = body + TAG_LENGTH + sizeof(VcomStreamHeader_t);
+	uint32_t payload_length = length - TAG_LENGTH - sizeof(VcomStreamHeader_t) - TAG_LENGTH;
+
+	delta->frames++;
+
+	// Sequence numbers restart with every StartStreaming()
+	if (client->have_sequence && view.header.sequence > client->last_sequence + 1)
+		delta->sequence_gaps += view.header.sequence - client->last_sequence - 1;
+	client->last_sequence = view.header.sequence;
+	client->have_sequence = true;
+
+	if (!parse_descriptor(payload, payload_length, view.header.bins, &view.descriptor) || view.descriptor.length > client->slot_size) {
+		delta->bad_frames++;
+		return;
+	}
+
+	unsigned head = atomic_load_explicit(&client->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&client->tail, memory_order_acquire);
+	if (head - tail > client->slot_mask) {
+		delta->ring_dropped++;
+		return;
+	}
+
+	uint32_t slot = head & client->slot_mask;
+	uint8_t *data = client->slot_data + (size_t)slot * client->slot_size;
+	memcpy(data, payload + payload_length - view.descriptor.length, view.descriptor.length);
+	view.data = data;
+	client->slot_views[slot] = view;
+
+	atomic_store_explicit(&client->head, head + 1, memory_order_release);
+	sem_post(&client->frames_ready);
+}
+
+
+static void dispatch_reply(VcomClient_t *client, const uint8_t *body, uint32_t length, uint64_t now)
+{
+	ReplyNode_t *node = malloc(sizeof(ReplyNode_t));
+	if (node == NULL)
+		return;
+
+	uint32_t skip = 0;
+	node->reply.type = VCOM_REPLY_DATA;
+	if (length >= 2 * TAG_LENGTH && memcmp(body, "<ERR>", TAG_LENGTH) == 0) {
+		node->reply.type = VCOM_REPLY_ERROR;
+		skip = TAG_LENGTH;
+	}
+	else if (length >= 2 * TAG_LENGTH && memcmp(body, "<WRN>", TAG_LENGTH) == 0) {
+		node->reply.type = VCOM_REPLY_WARNING;
+		skip = TAG_LENGTH;
+	}
+
+	node->reply.length = length - TAG_LENGTH - skip;
+	node->reply.receive_ns = now;
+	node->reply.data = malloc(node->reply.length + 1);
+	if (node->reply.data == NULL) {
+		free(node);
+		return;
+	}
+
+	memcpy(node->reply.data, body + skip, node->reply.length);
+	node->reply.data[node->reply.length] = '\0';
+	node->next = NULL;
+
+	pthread_mutex_lock(&client->reply_lock);
+	if (client->reply_last != NULL)
+		client->reply_last->next = node;
+	else
+		client->reply_first = node;
+	client->reply_last = node;
+	pthread_cond_signal(&client->reply_ready);
+	pthread_mutex_unlock(&client->reply_lock);
+}
+
+
+/**
+Function works out the encoding of a stream frame. Only frames not sent as
+floats carry a FrameDescriptor_t, the one of a float frame is filled in
+*/
+static bool parse_descriptor(const uint8_t *payload, uint32_t length, uint32_t bins, FrameDescriptor_t *descriptor)
+{
+	if (length >= sizeof(FrameDescriptor_t)) {
+		memcpy(descriptor, payload, sizeof(FrameDescriptor_t));
+		if (descriptor->format != FRAME_FORMAT_FLOAT32 && descriptor->format < FRAME_FORMAT_COUNT && descriptor->length == length - sizeof(FrameDescriptor_t))
+			return true;
+	}
+
+	if (length != bins * sizeof(float))
+		return false;
+
+	descriptor->format = FRAME_FORMAT_FLOAT32;
+	descriptor->value_size = sizeof(float);
+	descriptor->block_size = 0;
+	descriptor->count = bins;
+	descriptor->length = length;
+	descriptor->scale = 1.0f;
+
+	return true;
+}
+
+
+static void add_stats(VcomClient_t *client, const VcomClientStats_t *delta)
+{
+	pthread_mutex_lock(&client->stats_lock);
+	client->stats.bytes += delta->bytes;
+	client->stats.reads += delta->reads;
+	client->stats.frames += delta->frames;
+	client->stats.ring_dropped += delta->ring_dropped;
+	client->stats.sequence_gaps += delta->sequence_gaps;
+	client->stats.bad_frames += delta->bad_frames;
+	client->stats.replies += delta->replies;
+	client->stats.resyncs += delta->resyncs;
+	pthread_mutex_unlock(&client->stats_lock);
+}
+
+
+static void free_replies(VcomClient_t *client)
+{
+	while (client->reply_first != NULL) {
+		ReplyNode_t *node = client->reply_first;
+		client->reply_first = node->next;
+		free(node->reply.data);
+		free(node);
+	}
+	client->reply_last = NULL;
+}
+
+
+static void deadline(struct timespec *ts, clockid_t clock, uint32_t timeout_ms)
+{
+	clock_gettime(clock, ts);
+	ts->tv_sec += timeout_ms / 1000;
+	ts->tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+
+static uint32_t read_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
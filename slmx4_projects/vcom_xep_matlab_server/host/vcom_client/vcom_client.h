@@ -0,0 +1,295 @@
+/**
+@file vcom_client.h
+
+Host (Linux) client of the VCOM XEP MATLAB server
+
+Opens the CDC port of the board, switches the server to length prefixed replies
+and runs a reader thread that splits the byte stream into messages:
+
+- Stream packets ("<STR>") go into a ring of frame slots. The ring has one
+  producer (the reader thread) and one consumer and is lock free; a waiting
+  consumer is woken through a semaphore. Frames are handed out as views into
+  their slot and stay valid until released, so they are never copied after
+  the reader has taken them off the port.
+- Every other message is a reply, queued in the order it arrived.
+
+Replies come back in the order of the commands, so commands can be pipelined
+with vcom_client_send() and collected with vcom_client_get_reply(). Requests
+and stream frames can be mixed: StopStreaming() is answered after the last
+frame of the stream.
+
+Example:
+@code
+VcomClient_t *client;
+vcom_client_open(&client, "/dev/ttyACM0", NULL);
+vcom_client_command(client, "OpenRadar()", NULL, 1000);
+vcom_client_start_streaming(client, 100.0f, 1);
+
+VcomFrameView_t frame;
+while (vcom_client_acquire_frame(client, &frame, 1000) == VCOM_CLIENT_SUCCESS) {
+  // frame.data holds frame.descriptor.length bytes, see frame_decode()
+  vcom_client_release_frame(client);
+}
+
+vcom_client_stop_streaming(client);
+vcom_client_close(client);
+@endcode
+
+@note
+One thread acquires frames and one thread sends commands and collects
+replies, which may be the same thread.
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef VCOM_CLIENT_h
+#define VCOM_CLIENT_h
+
+#include "frame_encode.h"
+#include "mat_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+// Bytes per frame slot, the largest transmit slot of the server
+#define VCOM_CLIENT_DEFAULT_SLOT_SIZE 8192
+
+// Frame slots, a power of two
+#define VCOM_CLIENT_DEFAULT_SLOTS 256
+
+// Longest reply accepted, a ReadCapture() of the whole SDRAM ring
+#define VCOM_CLIENT_MAX_REPLY (64 * 1024 * 1024)
+
+#define VCOM_CLIENT_SUCCESS      0
+#define VCOM_CLIENT_ERR_ARG      1
+#define VCOM_CLIENT_ERR_OPEN     2
+#define VCOM_CLIENT_ERR_IO       3
+#define VCOM_CLIENT_ERR_TIMEOUT  4
+#define VCOM_CLIENT_ERR_DEVICE   5 // Server replied with an error
+#define VCOM_CLIENT_ERR_PROTOCOL 6
+#define VCOM_CLIENT_ERR_MEMORY   7
+#define VCOM_CLIENT_ERR_CLOSED   8 // Port closed or reader stopped
+
+// Reply types
+#define VCOM_REPLY_DATA    0
+#define VCOM_REPLY_ERROR   1 // "<ERR>" reply, data holds the message
+#define VCOM_REPLY_WARNING 2 // "<WRN>" reply, data holds the message
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+typedef struct VcomClient VcomClient_t;
+
+/**
+@struct VcomClientConfig_t
+Client settings, zero for the defaults
+*/
+typedef struct {
+	uint32_t slot_size; // Bytes per frame slot
+	uint32_t slots;     // Frame slots, a power of two
+
+} VcomClientConfig_t;
+
+/**
+@struct VcomStreamHeader_t
+Header of every stream packet, as sent by the server
+*/
+typedef struct {
+	uint32_t sequence;      // Packet number since StartStreaming(), starts at 0
+	uint32_t frame_counter; // X4 frame counter
+	uint32_t timestamp;     // Time the frame was read in ms, device clock
+	uint32_t dropped;       // Frames the server dropped since StartStreaming()
+	uint32_t bins;          // Number of values in the frame
+
+} VcomStreamHeader_t;
+
+/**
+@struct VcomFrameView_t
+Stream frame in its ring slot, valid until vcom_client_release_frame()
+*/
+typedef struct {
+	VcomStreamHeader_t header;
+	FrameDescriptor_t descriptor; // Describes data, also for FRAME_FORMAT_FLOAT32
+	const uint8_t *data;          // Encoded frame
+	uint64_t receive_ns;          // Host CLOCK_MONOTONIC time the packet was complete
+
+} VcomFrameView_t;
+
+/**
+@struct VcomReply_t
+Reply to a command, without the length and "<ACK>". Owns its data
+*/
+typedef struct {
+	int type;         // VCOM_REPLY_*
+	uint8_t *data;    // Reply bytes plus a terminating NUL
+	uint32_t length;  // Bytes of reply
+	uint64_t receive_ns;
+
+} VcomReply_t;
+
+/**
+@struct VcomClientStats_t
+Reader counters, cleared by vcom_client_reset_stats()
+*/
+typedef struct {
+	uint64_t bytes;         // Bytes read from the port
+	uint64_t reads;         // read() calls that returned data
+	uint32_t frames;        // Stream packets received
+	uint32_t ring_dropped;  // Frames dropped because the ring was full
+	uint32_t sequence_gaps; // Frames missing between received sequence numbers
+	uint32_t bad_frames;    // Stream packets that did not fit a slot or parse
+	uint32_t replies;       // Replies received
+	uint32_t resyncs;       // Bytes skipped to find the next message
+
+} VcomClientStats_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function opens the port, stops a stream or capture left running and switches
+the server to length prefixed replies
+
+@param [out] **client  Client handle
+@param [in]   *path    Port, e.g. "/dev/ttyACM0"
+@param [in]   *config  Settings, NULL for the defaults
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_open(VcomClient_t **client, const char *path, const VcomClientConfig_t *config);
+
+/**
+Function stops the reader thread and closes the port. Releases every frame and
+reply not yet taken
+*/
+void vcom_client_close(VcomClient_t *client);
+
+/**
+Function writes bytes to the server without waiting for a reply
+
+@param [in] *data  Commands, text or MatBinRequest_t, back to back
+@param [in]  n     Number of bytes
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_send(VcomClient_t *client, const void *data, size_t n);
+
+/**
+Function takes the oldest reply. A warning is a reply of its own, followed by
+the reply of the command that caused it
+
+@param [out] *reply       Reply, free with vcom_client_free_reply()
+@param [in]   timeout_ms  Time to wait for it
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_get_reply(VcomClient_t *client, VcomReply_t *reply, uint32_t timeout_ms);
+
+/**
+Function frees the data of a reply
+*/
+void vcom_client_free_reply(VcomReply_t *reply);
+
+/**
+Function sends a text command and waits for its reply, skipping a warning
+ahead of it
+
+@param [in]  *cmd         Command, e.g. "VarGetValue_ByName(pps)"
+@param [out] *reply       Reply, NULL to discard it
+@param [in]   timeout_ms  Time to wait for the reply
+
+@return VCOM_CLIENT_SUCCESS on success, VCOM_CLIENT_ERR_DEVICE for an "<ERR>"
+reply (also returned in reply), error code on failure
+*/
+int vcom_client_command(VcomClient_t *client, const char *cmd, VcomReply_t *reply, uint32_t timeout_ms);
+
+/**
+Function sends a binary request and waits for its response
+
+@param [in]  *request     Request, magic is filled in
+@param [out] *response    Response header
+@param [out] *payload     Whole reply, response header included, NULL to
+                          discard it
+@param [in]   timeout_ms  Time to wait for the response
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure. A request the
+server rejects succeeds with the reason in response->status
+*/
+int vcom_client_request(VcomClient_t *client, MatBinRequest_t *request, MatBinResponse_t *response, VcomReply_t *payload, uint32_t timeout_ms);
+
+/**
+Function starts streaming
+
+@param [in] fps   Frame rate
+@param [in] mode  0 for raw frames, 1 for normalized frames
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_start_streaming(VcomClient_t *client, float fps, int mode);
+
+/**
+Function stops streaming. Frames sent before the stop stay in the ring
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_stop_streaming(VcomClient_t *client);
+
+/**
+Function gets the oldest stream frame without copying it
+
+@param [out] *frame       View of the frame
+@param [in]   timeout_ms  Time to wait for a frame
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_acquire_frame(VcomClient_t *client, VcomFrameView_t *frame, uint32_t timeout_ms);
+
+/**
+Function hands the slot of the frame from vcom_client_acquire_frame() back to
+the reader
+*/
+void vcom_client_release_frame(VcomClient_t *client);
+
+/**
+Function decodes a frame view to floats
+
+@param [in]  *frame      Frame from vcom_client_acquire_frame()
+@param [out] *values     Decoded frame, frame->descriptor.count floats
+@param [in]   max_count  Size of values
+
+@return VCOM_CLIENT_SUCCESS on success, error code on failure
+*/
+int vcom_client_decode_frame(const VcomFrameView_t *frame, float *values, uint32_t max_count);
+
+/**
+Function gets the reader counters
+
+@param [out] *stats  Copy of the counters
+*/
+void vcom_client_get_stats(VcomClient_t *client, VcomClientStats_t *stats);
+
+/**
+Function clears the reader counters
+*/
+void vcom_client_reset_stats(VcomClient_t *client);
+
+/**
+Function gets the CLOCK_MONOTONIC time the client stamps messages with
+
+@return Time in ns
+*/
+uint64_t vcom_client_time_ns();
+
+#ifdef __cplusplus
+}
+#endif
+#endif // VCOM_CLIENT_h
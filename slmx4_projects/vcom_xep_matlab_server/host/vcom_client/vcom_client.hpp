@@ -0,0 +1,178 @@
+/**
+@file vcom_client.hpp
+
+C++ wrapper of the VCOM XEP MATLAB server client
+
+Owns the client handle and turns error codes into exceptions. Frames are held
+by a Frame, which releases its slot when it goes out of scope.
+
+Example:
+@code
+slmx4::VcomClient radar("/dev/ttyACM0");
+radar.command("OpenRadar()");
+radar.startStreaming(100.0f, 1);
+
+for (int i = 0; i < 100; i++) {
+  slmx4::VcomClient::Frame frame = radar.acquireFrame(1000);
+  std::vector<float> values = frame.decode();
+}
+
+radar.stopStreaming();
+@endcode
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef VCOM_CLIENT_hpp
+#define VCOM_CLIENT_hpp
+
+#include "vcom_client.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace slmx4 {
+
+/**
+Error returned by the client library
+*/
+class VcomError : public std::runtime_error {
+public:
+	VcomError(const std::string &what, int code) : std::runtime_error(what), code_(code) {}
+
+	int code() const { return code_; }
+
+private:
+	int code_;
+};
+
+
+class VcomClient {
+public:
+	/**
+	Stream frame in its ring slot, released on destruction
+	*/
+	class Frame {
+	public:
+		Frame(Frame &&other) noexcept : client_(other.client_), view_(other.view_) { other.client_ = nullptr; }
+		Frame(const Frame &) = delete;
+		Frame &operator=(const Frame &) = delete;
+		Frame &operator=(Frame &&) = delete;
+		~Frame() { release(); }
+
+		const VcomFrameView_t &view() const { return view_; }
+		const VcomStreamHeader_t &header() const { return view_.header; }
+		const uint8_t *data() const { return view_.data; }
+		uint32_t length() const { return view_.descriptor.length; }
+
+		std::vector<float> decode() const
+		{
+			std::vector<float> values(view_.descriptor.count);
+			check(vcom_client_decode_frame(&view_, values.data(), (uint32_t)values.size()), "decode_frame");
+			return values;
+		}
+
+		void release()
+		{
+			if (client_ != nullptr)
+				vcom_client_release_frame(client_);
+			client_ = nullptr;
+		}
+
+	private:
+		friend class VcomClient;
+		Frame(VcomClient_t *client, const VcomFrameView_t &view) : client_(client), view_(view) {}
+
+		VcomClient_t *client_;
+		VcomFrameView_t view_;
+	};
+
+	explicit VcomClient(const std::string &port, const VcomClientConfig_t *config = nullptr)
+	{
+		check(vcom_client_open(&client_, port.c_str(), config), "open " + port);
+	}
+
+	VcomClient(const VcomClient &) = delete;
+	VcomClient &operator=(const VcomClient &) = delete;
+	~VcomClient() { vcom_client_close(client_); }
+
+	VcomClient_t *handle() { return client_; }
+
+	/**
+	Sends a text command and returns its reply. An "<ERR>" reply throws with
+	the message of the server
+	*/
+	std::string command(const std::string &cmd, uint32_t timeout_ms = 1000)
+	{
+		VcomReply_t reply;
+		int status = vcom_client_command(client_, cmd.c_str(), &reply, timeout_ms);
+		if (status == VCOM_CLIENT_ERR_DEVICE) {
+			std::string message((const char *)reply.data, reply.length);
+			vcom_client_free_reply(&reply);
+			throw VcomError(message, status);
+		}
+		check(status, cmd);
+
+		std::string text((const char *)reply.data, reply.length);
+		vcom_client_free_reply(&reply);
+		return text;
+	}
+
+	/**
+	Sends commands back to back and returns their replies in order
+	*/
+	std::vector<std::string> pipeline(const std::vector<std::string> &cmds, uint32_t timeout_ms = 1000)
+	{
+		std::string all;
+		for (const std::string &cmd : cmds)
+			all += cmd;
+		check(vcom_client_send(client_, all.data(), all.size()), "send");
+
+		std::vector<std::string> replies;
+		while (replies.size() < cmds.size()) {
+			VcomReply_t reply;
+			check(vcom_client_get_reply(client_, &reply, timeout_ms), "get_reply");
+			if (reply.type != VCOM_REPLY_WARNING)
+				replies.emplace_back((const char *)reply.data, reply.length);
+			vcom_client_free_reply(&reply);
+		}
+		return replies;
+	}
+
+	MatBinResponse_t request(MatBinRequest_t request, uint32_t timeout_ms = 1000)
+	{
+		MatBinResponse_t response;
+		check(vcom_client_request(client_, &request, &response, nullptr, timeout_ms), "request");
+		return response;
+	}
+
+	void startStreaming(float fps, int mode) { check(vcom_client_start_streaming(client_, fps, mode), "StartStreaming"); }
+	void stopStreaming() { check(vcom_client_stop_streaming(client_), "StopStreaming"); }
+
+	Frame acquireFrame(uint32_t timeout_ms)
+	{
+		VcomFrameView_t view;
+		check(vcom_client_acquire_frame(client_, &view, timeout_ms), "acquire_frame");
+		return Frame(client_, view);
+	}
+
+	VcomClientStats_t stats()
+	{
+		VcomClientStats_t stats;
+		vcom_client_get_stats(client_, &stats);
+		return stats;
+	}
+
+private:
+	static void check(int status, const std::string &what)
+	{
+		if (status != VCOM_CLIENT_SUCCESS)
+			throw VcomError(what + " failed, error " + std::to_string(status), status);
+	}
+
+	VcomClient_t *client_ = nullptr;
+};
+
+} // namespace slmx4
+
+#endif // VCOM_CLIENT_hpp
@@ -0,0 +1,583 @@
+/**
+@file vcom_sim.c
+
+See header
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#define _GNU_SOURCE
+
+#include "vcom_sim.h"
+
+#include "frame_encode.h"
+#include "mat_protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+// Same limits as the server
+#define MAT_CMD_MAX_LENGTH 384
+#define MAX_BINS FRAME_ENCODE_MAX_VALUES
+
+#define CMD_BUFFER_SIZE 4096
+
+// Time the serving thread waits for a command when not streaming
+#define POLL_MS 50
+
+#define STREAM_MODE_RAW        0
+#define STREAM_MODE_NORMALIZED 1
+
+// Synthetic frame: a target on a noise floor
+#define TARGET_BIN_FRACTION 0.3f
+#define TARGET_AMPLITUDE    1000.0f
+#define NOISE_AMPLITUDE     20.0f
+#define NORMALIZED_SCALE    (1.0f / 8192.0f)
+
+/**
+@struct SimVar_t
+Variable of the stand-in, a subset of the server registry
+*/
+typedef struct {
+	const char *name;
+	const char *alias;
+	uint16_t id;   // MatVarId_t
+	bool writable;
+	int32_t value;
+
+} SimVar_t;
+
+struct VcomSim {
+	int master;
+	int slave; // Kept open so the master never sees a hangup
+	pthread_t thread;
+	atomic_bool stop;
+
+	uint32_t bins;
+	bool packet_lengths;
+	bool open;
+
+	bool streaming;
+	int stream_mode;
+	uint64_t stream_period_ns;
+	uint64_t next_frame_ns;
+	uint32_t stream_sequence;
+	uint32_t stream_dropped;
+	uint32_t frame_counter;
+	uint64_t start_ns;
+	uint32_t noise_state;
+
+	uint8_t cmd[CMD_BUFFER_SIZE];
+	uint32_t cmd_count;
+
+	SimVar_t vars[8];
+	float frame[2 * MAX_BINS];
+	uint8_t tx[64];
+};
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static void *sim_task(void *arg);
+static void handle_commands(VcomSim_t *sim);
+static void handle_text(VcomSim_t *sim, char *cmd);
+static void handle_binary(VcomSim_t *sim, const MatBinRequest_t *request);
+static void send_stream_frame(VcomSim_t *sim);
+static uint32_t frame_bins(VcomSim_t *sim);
+static void render_frame(VcomSim_t *sim, bool normalized, FrameDescriptor_t *descriptor);
+static SimVar_t *find_var(VcomSim_t *sim, const char *name, int id);
+static void write_message(VcomSim_t *sim, const char *tag, const void *prefix, uint32_t prefix_len, const void *data, uint32_t data_len);
+static void write_all(VcomSim_t *sim, const uint8_t *data, size_t n);
+static uint64_t now_ns();
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int vcom_sim_start(VcomSim_t **sim, uint32_t bins, char *path, size_t path_size)
+{
+	if (sim == NULL || path == NULL || bins == 0 || bins > MAX_BINS) return VCOM_SIM_ERR_ARG;
+
+	VcomSim_t *s = calloc(1, sizeof(VcomSim_t));
+	if (s == NULL) return VCOM_SIM_ERR_ARG;
+
+	s->bins = bins;
+	s->noise_state = 12345;
+	s->start_ns = now_ns();
+
+	const SimVar_t vars[] = {
+		{"DACMin",           "dac_min",     MAT_VAR_DAC_MIN,            true,  949},
+		{"DACMax",           "dac_max",     MAT_VAR_DAC_MAX,            true,  1100},
+		{"DACStep",          "dac_step",    MAT_VAR_DAC_STEP,           true,  1},
+		{"PPS",              "pps",         MAT_VAR_PPS,                true,  32},
+		{"Iterations",       "iterations",  MAT_VAR_ITERATIONS,         true,  16},
+		{"SamplersPerFrame", "num_samples", MAT_VAR_SAMPLERS_PER_FRAME, false, (int32_t)bins},
+		{"DownConvert",      "ddc_en",      MAT_VAR_DDC_EN,             true,  0},
+		{"frame_format",     NULL,          MAT_VAR_FRAME_FORMAT,       true,  FRAME_FORMAT_FLOAT32},
+	};
+	memcpy(s->vars, vars, sizeof(vars));
+
+	s->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (s->master < 0 || grantpt(s->master) || unlockpt(s->master) || ptsname_r(s->master, path, path_size)) {
+		if (s->master >= 0)
+			close(s->master);
+		free(s);
+		return VCOM_SIM_ERR_PTY;
+	}
+
+	// Raw from the start, the client may write before it has set up the port
+	s->slave = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	struct termios tio;
+	if (s->slave >= 0 && tcgetattr(s->slave, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(s->slave, TCSANOW, &tio);
+	}
+
+	// Writes give up on a stop request instead of blocking for a client that
+	// is gone
+	fcntl(s->master, F_SETFL, fcntl(s->master, F_GETFL) | O_NONBLOCK);
+
+	if (pthread_create(&s->thread, NULL, sim_task, s)) {
+		close(s->slave);
+		close(s->master);
+		free(s);
+		return VCOM_SIM_ERR_TASK;
+	}
+
+	*sim = s;
+
+	return VCOM_SIM_SUCCESS;
+}
+
+
+void vcom_sim_stop(VcomSim_t *sim)
+{
+	if (sim == NULL)
+		return;
+
+	atomic_store(&sim->stop, true);
+	pthread_join(sim->thread, NULL);
+
+	close(sim->slave);
+	close(sim->master);
+	free(sim);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Thread serving commands and, while streaming, sending a frame every period
+like the server's command task does
+*/
+static void *sim_task(void *arg)
+{
+	VcomSim_t *sim = arg;
+
+	while (!atomic_load(&sim->stop)) {
+		uint64_t timeout = POLL_MS * 1000000ull;
+		if (sim->streaming) {
+			uint64_t now = now_ns();
+			uint64_t wait = (sim->next_frame_ns > now) ? sim->next_frame_ns - now : 0;
+			if (wait < timeout)
+				timeout = wait;
+		}
+
+		struct pollfd pfd = {.fd = sim->master, .events = POLLIN};
+		struct timespec ts = {.tv_sec = timeout / 1000000000u, .tv_nsec = timeout % 1000000000u};
+		int ready = ppoll(&pfd, 1, &ts, NULL);
+		if (ready < 0 && errno != EINTR)
+			break;
+
+		if (ready > 0 && (pfd.revents & POLLIN)) {
+			ssize_t n = read(sim->master, sim->cmd + sim->cmd_count, CMD_BUFFER_SIZE - sim->cmd_count);
+			if (n > 0) {
+				sim->cmd_count += n;
+				handle_commands(sim);
+			}
+		}
+
+		if (sim->streaming) {
+			uint64_t now = now_ns();
+			if (now >= sim->next_frame_ns) {
+				send_stream_frame(sim);
+
+				// Frames the X4 made while the client was not keeping up
+				sim->next_frame_ns += sim->stream_period_ns;
+				while (sim->next_frame_ns + sim->stream_period_ns <= now) {
+					sim->next_frame_ns += sim->stream_period_ns;
+					sim->stream_dropped++;
+					sim->frame_counter++;
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+Function frames the received bytes into commands the way handle_client_rx()
+does
+*/
+static void handle_commands(VcomSim_t *sim)
+{
+	uint32_t pos = 0;
+
+	while (pos < sim->cmd_count) {
+		uint8_t c = sim->cmd[pos];
+		if (c == '\r' || c == '\n' || c == '\0') {
+			pos++;
+			continue;
+		}
+
+		uint32_t count = sim->cmd_count - pos;
+
+		if (c == MAT_BIN_MAGIC) {
+			if (count < sizeof(MatBinRequest_t))
+				break;
+
+			MatBinRequest_t request;
+			memcpy(&request, sim->cmd + pos, sizeof(request));
+			handle_binary(sim, &request);
+			pos += sizeof(MatBinRequest_t);
+			continue;
+		}
+
+		uint8_t *end = memchr(sim->cmd + pos, ')', count < MAT_CMD_MAX_LENGTH ? count : MAT_CMD_MAX_LENGTH);
+		if (end == NULL) {
+			if (count < MAT_CMD_MAX_LENGTH)
+				break;
+
+			write_message(sim, "<ERR>", "ERROR: Command too long", 23, NULL, 0);
+			pos += MAT_CMD_MAX_LENGTH;
+			continue;
+		}
+
+		char text[MAT_CMD_MAX_LENGTH + 1];
+		uint32_t length = (uint32_t)(end - (sim->cmd + pos)) + 1;
+		memcpy(text, sim->cmd + pos, length);
+		text[length] = '\0';
+		handle_text(sim, text);
+		pos += length;
+	}
+
+	memmove(sim->cmd, sim->cmd + pos, sim->cmd_count - pos);
+	sim->cmd_count -= pos;
+}
+
+
+static void handle_text(VcomSim_t *sim, char *cmd)
+{
+	char *args = strchr(cmd, '(');
+	*strchr(cmd, ')') = '\0';
+	if (args != NULL)
+		*args++ = '\0';
+	else
+		args = "";
+
+	char *arg1 = strtok(args, ",");
+	char *arg2 = strtok(NULL, ",");
+	if (arg1 == NULL)
+		arg1 = "";
+	if (arg2 == NULL)
+		arg2 = "";
+
+	if (sim->streaming && strcmp(cmd, "StopStreaming") != 0 && strcmp(cmd, "Close") != 0) {
+		write_message(sim, "<ERR>", "ERROR: Streaming active", 23, NULL, 0);
+		return;
+	}
+
+	char buf[80];
+	bool needs_open = strcmp(cmd, "VarGetValue_ByName") == 0 || strcmp(cmd, "VarSetValue_ByName") == 0 ||
+	                  strcmp(cmd, "GetFrameRaw") == 0 || strcmp(cmd, "GetFrameNormalized") == 0 || strcmp(cmd, "StartStreaming") == 0;
+
+	if (needs_open && !sim->open) {
+		write_message(sim, "<ERR>", "ERROR: Radar is closed", 22, NULL, 0);
+	}
+	else if (strcmp(cmd, "SendPacketLengths") == 0) {
+		sim->packet_lengths = atoi(arg1) != 0;
+		write_message(sim, NULL, NULL, 0, NULL, 0);
+	}
+	else if (strcmp(cmd, "ConnectorVersion") == 0) {
+		write_message(sim, NULL, "1.0.0", 5, NULL, 0);
+	}
+	else if (strcmp(cmd, "NVA_CreateHandle") == 0 || strcmp(cmd, "OpenRadar") == 0) {
+		sim->open = true;
+		write_message(sim, NULL, NULL, 0, NULL, 0);
+	}
+	else if (strcmp(cmd, "Close") == 0) {
+		sim->open = false;
+		sim->streaming = false;
+		write_message(sim, NULL, NULL, 0, NULL, 0);
+	}
+	else if (strcmp(cmd, "VarGetValue_ByName") == 0) {
+		SimVar_t *var = find_var(sim, arg1, -1);
+		if (var == NULL) {
+			write_message(sim, "<ERR>", "Unknown Variable Name", 21, NULL, 0);
+			return;
+		}
+		int n = snprintf(buf, sizeof(buf), "%d", (int)var->value);
+		write_message(sim, NULL, buf, n, NULL, 0);
+	}
+	else if (strcmp(cmd, "VarSetValue_ByName") == 0) {
+		SimVar_t *var = find_var(sim, arg1, -1);
+		if (var == NULL || !var->writable) {
+			write_message(sim, "<ERR>", "Unknown/Invalid Variable Name", 29, NULL, 0);
+			return;
+		}
+		var->value = atoi(arg2);
+		write_message(sim, NULL, NULL, 0, NULL, 0);
+	}
+	else if (strcmp(cmd, "GetFrameRaw") == 0 || strcmp(cmd, "GetFrameNormalized") == 0) {
+		FrameDescriptor_t descriptor;
+		render_frame(sim, strcmp(cmd, "GetFrameNormalized") == 0, &descriptor);
+		if (descriptor.format == FRAME_FORMAT_FLOAT32)
+			write_message(sim, NULL, NULL, 0, sim->frame, descriptor.length);
+		else
+			write_message(sim, NULL, &descriptor, sizeof(descriptor), sim->frame, descriptor.length);
+	}
+	else if (strcmp(cmd, "StartStreaming") == 0) {
+		float fps = atof(arg1);
+		int mode = atoi(arg2);
+		if (fps < 1.0f || (mode != STREAM_MODE_RAW && mode != STREAM_MODE_NORMALIZED)) {
+			write_message(sim, "<ERR>", "ERROR: Invalid stream mode", 26, NULL, 0);
+			return;
+		}
+		sim->streaming = true;
+		sim->stream_mode = mode;
+		sim->stream_period_ns = (uint64_t)(1e9 / fps);
+		sim->next_frame_ns = now_ns() + sim->stream_period_ns;
+		sim->stream_sequence = 0;
+		sim->stream_dropped = 0;
+		write_message(sim, NULL, NULL, 0, NULL, 0);
+	}
+	else if (strcmp(cmd, "StopStreaming") == 0) {
+		if (!sim->streaming) {
+			write_message(sim, "<ERR>", "ERROR: Not streaming", 20, NULL, 0);
+			return;
+		}
+		sim->streaming = false;
+		write_message(sim, NULL, NULL, 0, NULL, 0);
+	}
+	else if (strcmp(cmd, "StopCapture") == 0) {
+		write_message(sim, "<ERR>", "ERROR: Not capturing", 20, NULL, 0);
+	}
+	else {
+		write_message(sim, "<ERR>", "Invalid and/or Unimplemented Command", 36, NULL, 0);
+	}
+}
+
+
+static void handle_binary(VcomSim_t *sim, const MatBinRequest_t *request)
+{
+	MatBinResponse_t response;
+	memset(&response, 0, sizeof(response));
+	response.magic = MAT_BIN_MAGIC;
+	response.opcode = request->opcode;
+	response.var_id = request->var_id;
+	response.request_id = request->request_id;
+
+	if (request->opcode >= MAT_OP_COUNT) {
+		response.status = MAT_STATUS_ERR_OPCODE;
+	}
+	else if (sim->streaming) {
+		response.status = MAT_STATUS_ERR_STREAMING;
+	}
+	else if (!sim->open && request->opcode != MAT_OP_PING) {
+		response.status = MAT_STATUS_ERR_CLOSED;
+	}
+	else if (request->opcode == MAT_OP_PING) {
+		response.type = request->type;
+		response.value = request->value;
+	}
+	else if (request->opcode == MAT_OP_VAR_GET || request->opcode == MAT_OP_VAR_SET) {
+		SimVar_t *var = find_var(sim, NULL, request->var_id);
+		response.type = MAT_VALUE_INT;
+		if (var == NULL)
+			response.status = MAT_STATUS_ERR_VARIABLE;
+		else if (request->opcode == MAT_OP_VAR_SET && !var->writable)
+			response.status = MAT_STATUS_ERR_READ_ONLY;
+		else if (request->opcode == MAT_OP_VAR_SET)
+			var->value = (request->type == MAT_VALUE_FLOAT) ? (int32_t)request->value.f : request->value.i;
+
+		if (var != NULL)
+			response.value.i = var->value;
+	}
+	else {
+		FrameDescriptor_t descriptor;
+		render_frame(sim, request->opcode == MAT_OP_GET_FRAME_NORMALIZED, &descriptor);
+
+		uint8_t prefix[sizeof(MatBinResponse_t) + sizeof(FrameDescriptor_t)];
+		uint32_t prefix_len = sizeof(MatBinResponse_t);
+
+		response.type = MAT_VALUE_INT;
+		response.value.i = descriptor.format;
+		response.length = descriptor.length;
+		if (descriptor.format != FRAME_FORMAT_FLOAT32) {
+			response.flags |= MAT_BIN_FLAG_DESCRIPTOR;
+			response.length += sizeof(FrameDescriptor_t);
+			memcpy(prefix + prefix_len, &descriptor, sizeof(descriptor));
+			prefix_len += sizeof(FrameDescriptor_t);
+		}
+		memcpy(prefix, &response, sizeof(response));
+
+		write_message(sim, NULL, prefix, prefix_len, sim->frame, descriptor.length);
+		return;
+	}
+
+	write_message(sim, NULL, &response, sizeof(response), NULL, 0);
+}
+
+
+static void send_stream_frame(VcomSim_t *sim)
+{
+	FrameDescriptor_t descriptor;
+	render_frame(sim, sim->stream_mode == STREAM_MODE_NORMALIZED, &descriptor);
+
+	uint32_t header[5];
+	header[0] = sim->stream_sequence++;
+	header[1] = sim->frame_counter;
+	header[2] = (uint32_t)((now_ns() - sim->start_ns) / 1000000);
+	header[3] = sim->stream_dropped;
+	header[4] = frame_bins(sim);
+
+	uint8_t prefix[sizeof(header) + sizeof(FrameDescriptor_t)];
+	uint32_t prefix_len = sizeof(header);
+	memcpy(prefix, header, sizeof(header));
+	if (descriptor.format != FRAME_FORMAT_FLOAT32) {
+		memcpy(prefix + prefix_len, &descriptor, sizeof(descriptor));
+		prefix_len += sizeof(FrameDescriptor_t);
+	}
+
+	write_message(sim, "<STR>", prefix, prefix_len, sim->frame, descriptor.length);
+}
+
+
+/**
+Function gets the values per frame, I and Q each count when down converting
+*/
+static uint32_t frame_bins(VcomSim_t *sim)
+{
+	return find_var(sim, NULL, MAT_VAR_DDC_EN)->value ? 2 * sim->bins : sim->bins;
+}
+
+
+/**
+Function renders the next frame into sim->frame, encoded in frame_format
+*/
+static void render_frame(VcomSim_t *sim, bool normalized, FrameDescriptor_t *descriptor)
+{
+	uint32_t bins = frame_bins(sim);
+	if (bins > MAX_BINS)
+		bins = MAX_BINS;
+
+	float scale = normalized ? NORMALIZED_SCALE : 1.0f;
+	float target = TARGET_BIN_FRACTION * bins;
+
+	for (uint32_t i = 0; i < bins; i++) {
+		sim->noise_state = sim->noise_state * 1664525u + 1013904223u;
+		float noise = ((float)(sim->noise_state >> 8) / (1 << 24) - 0.5f) * 2.0f * NOISE_AMPLITUDE;
+		float d = (i - target) / 2.0f;
+		sim->frame[i] = (TARGET_AMPLITUDE * expf(-d * d) * cosf(0.8f * i) + noise) * scale;
+	}
+
+	sim->frame_counter++;
+
+	uint8_t format = (uint8_t)find_var(sim, NULL, MAT_VAR_FRAME_FORMAT)->value;
+	if (format == FRAME_FORMAT_COUNTERS || frame_encode(format, sim->frame, bins, descriptor) != FRAME_ENCODE_SUCCESS)
+		frame_encode(FRAME_FORMAT_FLOAT32, sim->frame, bins, descriptor);
+}
+
+
+/**
+Function finds a variable by name or by ID
+*/
+static SimVar_t *find_var(VcomSim_t *sim, const char *name, int id)
+{
+	for (size_t i = 0; i < sizeof(sim->vars) / sizeof(sim->vars[0]); i++) {
+		SimVar_t *var = &sim->vars[i];
+		if (name == NULL && var->id == id)
+			return var;
+		if (name != NULL && (strcmp(var->name, name) == 0 || (var->alias != NULL && strcmp(var->alias, name) == 0)))
+			return var;
+	}
+
+	return NULL;
+}
+
+
+/**
+Function sends a reply the way the server frames it: the length when enabled,
+the tag, the prefix, the data and "<ACK>"
+*/
+static void write_message(VcomSim_t *sim, const char *tag, const void *prefix, uint32_t prefix_len, const void *data, uint32_t data_len)
+{
+	uint32_t tag_len = tag ? 5 : 0;
+	uint32_t length = tag_len + prefix_len + data_len + 5;
+	uint32_t offset = 0;
+
+	if (sim->packet_lengths) {
+		memcpy(sim->tx, &length, 4);
+		offset = 4;
+	}
+
+	if (tag_len > 0)
+		memcpy(sim->tx + offset, tag, tag_len);
+	offset += tag_len;
+	if (prefix_len > 0)
+		memcpy(sim->tx + offset, prefix, prefix_len);
+	offset += prefix_len;
+
+	// Write the header first so frames are not copied
+	write_all(sim, sim->tx, offset);
+	write_all(sim, data, data_len);
+	write_all(sim, (const uint8_t *)"<ACK>", 5);
+}
+
+
+static void write_all(VcomSim_t *sim, const uint8_t *data, size_t n)
+{
+	while (n > 0 && !atomic_load(&sim->stop)) {
+		ssize_t written = write(sim->master, data, n);
+		if (written < 0) {
+			if (errno == EAGAIN) {
+				struct pollfd pfd = {.fd = sim->master, .events = POLLOUT};
+				poll(&pfd, 1, POLL_MS);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		data += written;
+		n -= written;
+	}
+}
+
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
@@ -0,0 +1,75 @@
+/**
+@file vcom_sim.h
+
+Stand-in for the VCOM XEP MATLAB server on a pseudo terminal
+
+Answers the commands of mat_handler.c that a client needs to connect, read
+variables and frames and stream, with the same framing and reply formats, so
+the client library can be run and measured without a board. Frames are
+synthetic: a point target on a noise floor.
+
+Example:
+@code
+VcomSim_t *sim;
+char path[64];
+vcom_sim_start(&sim, 188, path, sizeof(path));
+
+VcomClient_t *client;
+vcom_client_open(&client, path, NULL);
+...
+vcom_client_close(client);
+vcom_sim_stop(sim);
+@endcode
+
+@note
+The stand-in runs in a thread of its own. It models the protocol, not the
+timing of USB: a pseudo terminal moves data much faster than the board.
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef VCOM_SIM_h
+#define VCOM_SIM_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define VCOM_SIM_SUCCESS  0
+#define VCOM_SIM_ERR_ARG  1
+#define VCOM_SIM_ERR_PTY  2
+#define VCOM_SIM_ERR_TASK 3
+
+typedef struct VcomSim VcomSim_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function creates the pseudo terminal and starts serving it
+
+@param [out] **sim        Stand-in handle
+@param [in]    bins       Values per frame, as the server counts them
+@param [out]  *path       Path of the terminal to open as the port
+@param [in]    path_size  Size of path
+
+@return VCOM_SIM_SUCCESS on success, error code on failure
+*/
+int vcom_sim_start(VcomSim_t **sim, uint32_t bins, char *path, size_t path_size);
+
+/**
+Function stops serving and closes the pseudo terminal
+*/
+void vcom_sim_stop(VcomSim_t *sim);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // VCOM_SIM_h
@@ -0,0 +1,909 @@
+/**
+@file x4sim.c
+
+See header
+
+@note
+The model covers what x4driver.c relies on, not the full X4. Status registers
+report the state the driver waits for once the matching control register or
+software action has been written (oscillator, PLLs, LDOs), the 8051 answers the
+mailbox instantly once booted from SRAM, and reads longer than one byte return
+wlength dummy bytes ahead of the data like the board's spi_write_read callback.
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "x4sim.h"
+
+#include <math.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define SPI_WRITE_FLAG 0x80
+
+// ADDR_SPI_SPI_MB_FIFO_STATUS_R bits
+#define MB_FROM_CPU_VALID (1 << 1)
+#define MB_TO_CPU_EMPTY   (1 << 2)
+
+// ADDR_SPI_SPI_MEM_FIFO_STATUS_R bits
+#define MEM_FIFO_NOT_EMPTY 0x04
+
+// ADDR_SPI_MEM_MODE_RW values
+#define MEM_MODE_NORMAL      0
+#define MEM_MODE_PROGRAMMING 1
+#define MEM_MODE_READBACK    2
+
+#define BOOT_FROM_SRAM 0
+
+// ADDR_PIF_LDO_STATUS_2_R power good bits and the LDO control disable bit
+#define AVDD_TX_POWER_GOOD (1 << 0)
+#define AVDD_RX_POWER_GOOD (1 << 1)
+#define DVDD_TX_POWER_GOOD (1 << 2)
+#define DVDD_RX_POWER_GOOD (1 << 3)
+#define LDO_DISABLE        (1 << 6)
+
+// 8051 firmware software actions
+#define SW_ACTION_START_TIMER        0
+#define SW_ACTION_STOP_TIMER         1
+#define SW_ACTION_ENABLE_TRIGGER_PIN 5
+#define SW_ACTION_READ_FRAME_COUNTER 9
+#define SW_ACTION_ENABLE_TX_PLL      15
+#define SW_ACTION_ENABLE_RX_PLL      16
+
+// 8051 firmware software registers
+#define SW_REGISTER_FPS_LSB        0
+#define SW_REGISTER_FPS_MSB        1
+#define SW_REGISTER_USE_PERIOD     6
+#define SW_REGISTER_PERIOD_0       7
+
+// Sampler and sweep controller
+#define SAMPLE_RATE_HZ   23.328e9
+#define SPEED_OF_LIGHT   2.99792458e8
+#define METERS_PER_BIN   (1.5e8 / SAMPLE_RATE_HZ)
+#define BINS_PER_MFRAME  96
+#define DDC_DECIMATION   8
+#define DDC_DISCARDED    4
+#define SWEEP_CLOCK_HZ   243e6
+
+// Pulse envelope standard deviation in range, about 1.4 GHz bandwidth
+#define PULSE_SIGMA_M 0.04
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static void power_on(X4Sim_t *sim);
+static void run_until(X4Sim_t *sim, uint64_t t_ns);
+static uint64_t next_event_ns(X4Sim_t *sim);
+static void charge_transfer(X4Sim_t *sim, uint32_t bytes);
+
+static void spi_register_write(X4Sim_t *sim, uint8_t address, uint8_t value);
+static uint8_t spi_register_read(X4Sim_t *sim, uint8_t address);
+
+static bool cpu_running(X4Sim_t *sim);
+static void mailbox_push(X4Sim_t *sim, uint8_t value);
+static void mailbox_execute(X4Sim_t *sim, uint8_t address, uint8_t command, uint8_t value, bool write);
+static void mailbox_respond(X4Sim_t *sim, uint8_t value);
+static void pif_write(X4Sim_t *sim, uint8_t address, uint8_t value);
+static uint8_t pif_read(X4Sim_t *sim, uint8_t address);
+static void sw_action(X4Sim_t *sim, uint8_t action);
+
+static void start_sweep(X4Sim_t *sim);
+static void finish_sweep(X4Sim_t *sim);
+static uint64_t sweep_duration_ns(X4Sim_t *sim);
+static void render_frame(X4Sim_t *sim, double t_s);
+static void fetch_radar_data(X4Sim_t *sim);
+static double gaussian(X4Sim_t *sim);
+
+static uint32_t cb_pin_set_enable(void *user_reference, uint8_t value);
+static uint32_t cb_spi_write(void *user_reference, uint8_t *data, uint32_t length);
+static uint32_t cb_spi_read(void *user_reference, uint8_t *data, uint32_t length);
+static uint32_t cb_spi_write_read(void *user_reference, uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength);
+static uint32_t cb_spi_wait(void *user_reference, uint32_t timeout_ms);
+static void cb_wait_us(uint32_t us);
+static void cb_notify_data_ready(void *user_reference);
+static uint32_t cb_trigger_sweep(void *user_reference);
+static void cb_enable_data_ready_isr(void *user_reference, uint32_t enable);
+static uint32_t cb_wait_data_ready(void *user_reference, uint32_t timeout_ms);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Simulator advanced by wait_us(), which has no user reference
+static X4Sim_t *active_sim = NULL;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void x4sim_init(X4Sim_t *sim)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->spi_clock_hz = X4SIM_DEFAULT_SPI_CLOCK_HZ;
+	sim->transfer_overhead_ns = X4SIM_DEFAULT_TRANSFER_OVERHEAD_NS;
+	sim->noise_state = 1;
+}
+
+
+void x4sim_get_callbacks(X4Sim_t *sim, X4DriverCallbacks_t *callbacks)
+{
+	memset(callbacks, 0, sizeof(*callbacks));
+	callbacks->pin_set_enable = cb_pin_set_enable;
+	callbacks->spi_write = cb_spi_write;
+	callbacks->spi_read = cb_spi_read;
+	callbacks->spi_write_read = cb_spi_write_read;
+	callbacks->wait_us = cb_wait_us;
+	callbacks->notify_data_ready = cb_notify_data_ready;
+	callbacks->trigger_sweep = cb_trigger_sweep;
+	callbacks->enable_data_ready_isr = cb_enable_data_ready_isr;
+	callbacks->wait_data_ready = cb_wait_data_ready;
+
+	// The transfer completes immediately, the split only exercises the driver path
+	callbacks->spi_write_read_async = cb_spi_write_read;
+	callbacks->spi_wait = cb_spi_wait;
+
+	active_sim = sim;
+}
+
+
+int x4sim_add_target(X4Sim_t *sim, float range_m, float amplitude, float velocity_mps)
+{
+	if (sim->target_count >= X4SIM_MAX_TARGETS)
+		return X4SIM_ERR_FULL;
+
+	X4SimTarget_t *target = &sim->targets[sim->target_count++];
+	target->range_m = range_m;
+	target->amplitude = amplitude;
+	target->velocity_mps = velocity_mps;
+
+	return X4SIM_SUCCESS;
+}
+
+
+void x4sim_clear_targets(X4Sim_t *sim)
+{
+	sim->target_count = 0;
+}
+
+
+void x4sim_set_noise(X4Sim_t *sim, float rms, uint32_t seed)
+{
+	sim->noise_rms = rms;
+	sim->noise_state = ((uint64_t)seed << 1) | 1;
+}
+
+
+void x4sim_advance_us(X4Sim_t *sim, uint32_t us)
+{
+	run_until(sim, sim->now_ns + (uint64_t)us * 1000);
+}
+
+
+uint64_t x4sim_get_time_us(X4Sim_t *sim)
+{
+	return sim->now_ns / 1000;
+}
+
+
+void x4sim_reset_spi_stats(X4Sim_t *sim)
+{
+	memset(&sim->stats, 0, sizeof(sim->stats));
+}
+
+
+void x4sim_get_spi_stats(X4Sim_t *sim, X4SimSpiStats_t *stats)
+{
+	*stats = sim->stats;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function resets the chip to its power on state. SRAM content is lost
+*/
+static void power_on(X4Sim_t *sim)
+{
+	memset(sim->spi, 0, sizeof(sim->spi));
+	memset(sim->pif, 0, sizeof(sim->pif));
+	memset(sim->xif, 0, sizeof(sim->xif));
+	memset(sim->sw, 0, sizeof(sim->sw));
+	memset(sim->sram, 0, sizeof(sim->sram));
+	memset(sim->ram, 0, sizeof(sim->ram));
+
+	sim->enabled = true;
+	sim->spi[ADDR_SPI_FORCE_ONE_R] = 0xff;
+	sim->spi[ADDR_SPI_BOOT_FROM_OTP_SPI_RWE] = 1;
+
+	sim->pif[ADDR_PIF_DVDD_TX_CTRL_RW] = LDO_DISABLE;
+	sim->pif[ADDR_PIF_DVDD_RX_CTRL_RW] = LDO_DISABLE;
+	sim->pif[ADDR_PIF_AVDD_TX_CTRL_RW] = LDO_DISABLE;
+	sim->pif[ADDR_PIF_AVDD_RX_CTRL_RW] = LDO_DISABLE;
+	sim->pif[ADDR_PIF_RX_COUNTER_NUM_BYTES_RW] = 3;
+	sim->pif[ADDR_PIF_TX_PLL_CTRL_1_RW] = TX_CENTER_FREQUENCY_EU_7_290GHz << 4;
+	sim->pif[ADDR_PIF_RX_MFRAMES_COARSE_RW] = X4SIM_FRAME_BINS / BINS_PER_MFRAME;
+	sim->pif[ADDR_PIF_TRX_CLOCKS_PER_PULSE_RW] = 16;
+
+	sim->sram_loaded = 0;
+	sim->mem_address = 0;
+	sim->to_cpu_count = 0;
+	sim->from_cpu_head = 0;
+	sim->from_cpu_count = 0;
+	sim->osc_lock = false;
+	sim->common_pll_lock = false;
+	sim->tx_pll_lock = false;
+	sim->rx_pll_lock = false;
+	sim->coeff_i1_count = 0;
+	sim->sweep_active = false;
+	sim->frame_done = false;
+	sim->frame_counter = 0;
+	sim->trigger_pin_enabled = false;
+	sim->timer_running = false;
+	sim->data_ready = false;
+	sim->radar_fifo_head = 0;
+	sim->radar_fifo_count = 0;
+}
+
+
+/**
+Function runs timer triggers and sweep completions up to t_ns in time order
+*/
+static void run_until(X4Sim_t *sim, uint64_t t_ns)
+{
+	for (;;) {
+		uint64_t next = next_event_ns(sim);
+		if (next > t_ns)
+			break;
+
+		if (next > sim->now_ns)
+			sim->now_ns = next;
+
+		if (sim->sweep_active && sim->sweep_end_ns == next) {
+			finish_sweep(sim);
+		} else {
+			sim->timer_next_ns += sim->timer_period_ns;
+			start_sweep(sim);
+		}
+	}
+
+	if (t_ns > sim->now_ns)
+		sim->now_ns = t_ns;
+}
+
+
+/**
+Function gets the time of the next sweep completion or timer trigger
+*/
+static uint64_t next_event_ns(X4Sim_t *sim)
+{
+	uint64_t next = UINT64_MAX;
+	if (sim->sweep_active)
+		next = sim->sweep_end_ns;
+	if (sim->enabled && sim->timer_running && sim->timer_next_ns < next)
+		next = sim->timer_next_ns;
+	return next;
+}
+
+
+/**
+Function advances the clock by the bus time of one transfer
+*/
+static void charge_transfer(X4Sim_t *sim, uint32_t bytes)
+{
+	uint64_t ns = sim->transfer_overhead_ns;
+	if (sim->spi_clock_hz)
+		ns += (uint64_t)bytes * 8 * 1000000000ULL / sim->spi_clock_hz;
+
+	sim->stats.transactions++;
+	sim->stats.bus_time_ns += ns;
+	run_until(sim, sim->now_ns + ns);
+}
+
+
+/**
+Function handles one byte written to an SPI register
+*/
+static void spi_register_write(X4Sim_t *sim, uint8_t address, uint8_t value)
+{
+	if (!sim->enabled)
+		return;
+
+	switch (address) {
+	case ADDR_SPI_TO_CPU_WRITE_DATA_WE:
+		mailbox_push(sim, value);
+		break;
+	case ADDR_SPI_SPI_MB_CLEAR_STATUS_WE:
+		sim->to_cpu_count = 0;
+		sim->from_cpu_count = 0;
+		break;
+	case ADDR_SPI_SPI_RADAR_DATA_CLEAR_STATUS_WE:
+		sim->radar_fifo_count = 0;
+		break;
+	case ADDR_SPI_TO_MEM_WRITE_DATA_WE:
+		if (sim->spi[ADDR_SPI_MEM_MODE_RW] == MEM_MODE_PROGRAMMING && sim->mem_address < X4SIM_SRAM_SIZE) {
+			sim->sram[sim->mem_address++] = value;
+			if (sim->mem_address > sim->sram_loaded)
+				sim->sram_loaded = sim->mem_address;
+		}
+		break;
+	case ADDR_SPI_MEM_MODE_RW:
+		sim->spi[address] = value;
+		if (value != MEM_MODE_NORMAL)
+			sim->mem_address = ((uint32_t)sim->spi[ADDR_SPI_MEM_FIRST_ADDR_MSB_RW] << 8) | sim->spi[ADDR_SPI_MEM_FIRST_ADDR_LSB_RW];
+		break;
+	default:
+		sim->spi[address] = value;
+		break;
+	}
+}
+
+
+/**
+Function handles one byte read from an SPI register
+*/
+static uint8_t spi_register_read(X4Sim_t *sim, uint8_t address)
+{
+	if (!sim->enabled)
+		return 0;
+
+	uint8_t value;
+	switch (address) {
+	case ADDR_SPI_RADAR_DATA_SPI_RE:
+		if (sim->radar_fifo_count == 0)
+			return 0;
+		sim->radar_fifo_count--;
+		return sim->radar_fifo[sim->radar_fifo_head++];
+	case ADDR_SPI_RADAR_DATA_SPI_STATUS_R:
+		return sim->radar_fifo_count ? 1 : 0;
+	case ADDR_SPI_SPI_MB_FIFO_STATUS_R:
+		value = 0;
+		if (sim->to_cpu_count == 0)
+			value |= MB_TO_CPU_EMPTY;
+		if (sim->from_cpu_count)
+			value |= MB_FROM_CPU_VALID;
+		return value;
+	case ADDR_SPI_FROM_CPU_READ_DATA_RE:
+		if (sim->from_cpu_count == 0)
+			return 0;
+		value = sim->from_cpu[sim->from_cpu_head];
+		sim->from_cpu_head = (sim->from_cpu_head + 1) % X4SIM_MAILBOX_SIZE;
+		sim->from_cpu_count--;
+		return value;
+	case ADDR_SPI_SPI_MEM_FIFO_STATUS_R:
+		return (sim->spi[ADDR_SPI_MEM_MODE_RW] == MEM_MODE_READBACK) ? MEM_FIFO_NOT_EMPTY : 0;
+	case ADDR_SPI_FROM_MEM_READ_DATA_RE:
+		if (sim->spi[ADDR_SPI_MEM_MODE_RW] != MEM_MODE_READBACK || sim->mem_address >= X4SIM_SRAM_SIZE)
+			return 0;
+		return sim->sram[sim->mem_address++];
+	default:
+		return sim->spi[address];
+	}
+}
+
+
+/**
+Function checks if the 8051 runs the uploaded firmware
+*/
+static bool cpu_running(X4Sim_t *sim)
+{
+	return sim->enabled && sim->sram_loaded > 0 &&
+		sim->spi[ADDR_SPI_BOOT_FROM_OTP_SPI_RWE] == BOOT_FROM_SRAM &&
+		sim->spi[ADDR_SPI_MEM_MODE_RW] == MEM_MODE_NORMAL;
+}
+
+
+/**
+Function adds a byte to the TO_CPU FIFO and lets the 8051 execute complete
+commands: address and command for reads, address | 0x80, command and value
+for writes
+*/
+static void mailbox_push(X4Sim_t *sim, uint8_t value)
+{
+	if (sim->to_cpu_count >= sizeof(sim->to_cpu))
+		return;
+	sim->to_cpu[sim->to_cpu_count++] = value;
+
+	if (!cpu_running(sim))
+		return;
+
+	bool write = (sim->to_cpu[0] & SPI_WRITE_FLAG) != 0;
+	if (sim->to_cpu_count < (write ? 3u : 2u))
+		return;
+
+	sim->to_cpu_count = 0;
+	sim->stats.mailbox_commands++;
+	mailbox_execute(sim, sim->to_cpu[0] & 0x7f, sim->to_cpu[1], sim->to_cpu[2], write);
+}
+
+
+/**
+Function executes one mailbox command on the 8051
+*/
+static void mailbox_execute(X4Sim_t *sim, uint8_t address, uint8_t command, uint8_t value, bool write)
+{
+	switch (command) {
+	case PIF_COMMAND:
+		if (write)
+			pif_write(sim, address, value);
+		else
+			mailbox_respond(sim, pif_read(sim, address));
+		break;
+	case XIF_COMMAND:
+		if (write)
+			sim->xif[address] = value;
+		else
+			mailbox_respond(sim, sim->xif[address]);
+		break;
+	case X4_SW_REGISTER_COMMAND:
+		if (write)
+			sim->sw[address] = value;
+		else
+			mailbox_respond(sim, sim->sw[address]);
+		break;
+	case X4_SW_ACTION_COMMAND:
+		if (write)
+			sw_action(sim, address);
+		break;
+	default:
+		break;
+	}
+}
+
+
+/**
+Function pushes a byte to the FROM_CPU FIFO
+*/
+static void mailbox_respond(X4Sim_t *sim, uint8_t value)
+{
+	if (sim->from_cpu_count >= X4SIM_MAILBOX_SIZE)
+		return;
+	sim->from_cpu[(sim->from_cpu_head + sim->from_cpu_count) % X4SIM_MAILBOX_SIZE] = value;
+	sim->from_cpu_count++;
+}
+
+
+/**
+Function handles a PIF register write, including the action registers
+*/
+static void pif_write(X4Sim_t *sim, uint8_t address, uint8_t value)
+{
+	switch (address) {
+	case ADDR_PIF_TRX_START_W:
+		start_sweep(sim);
+		break;
+	case ADDR_PIF_RX_RESET_COUNTERS_W:
+		sim->frame_done = false;
+		break;
+	case ADDR_PIF_FETCH_RADAR_DATA_SPI_W:
+		fetch_radar_data(sim);
+		break;
+	case ADDR_PIF_RX_DOWNCONVERSION_COEFF_I1_WE:
+		// 6 bit two's complement, most significant coefficient first
+		sim->coeff_i1[sim->coeff_i1_count % 32] = (int8_t)(uint8_t)(value << 2) >> 2;
+		sim->coeff_i1_count++;
+		break;
+	case ADDR_PIF_OSC_CTRL_RW:
+		sim->pif[address] = value;
+		sim->osc_lock = (value & 0x02) != 0;
+		break;
+	case ADDR_PIF_COMMON_PLL_CTRL_1_RW:
+		sim->pif[address] = value;
+		sim->common_pll_lock = value != 0;
+		break;
+	default:
+		sim->pif[address] = value;
+		break;
+	}
+}
+
+
+/**
+Function handles a PIF register read, including the status registers
+*/
+static uint8_t pif_read(X4Sim_t *sim, uint8_t address)
+{
+	uint8_t value = 0;
+
+	switch (address) {
+	case ADDR_PIF_TRX_CTRL_DONE_R:
+	case ADDR_PIF_TRX_BACKEND_DONE_R:
+		return sim->frame_done ? 1 : 0;
+	case ADDR_PIF_RADAR_READOUT_IDLE_R:
+		return 1;
+	case ADDR_PIF_COMMON_PLL_STATUS_R:
+		return (sim->osc_lock ? (1 << 6) : 0) | (sim->common_pll_lock ? (1 << 7) : 0);
+	case ADDR_PIF_TX_PLL_STATUS_R:
+		return sim->tx_pll_lock ? (1 << 7) : 0;
+	case ADDR_PIF_RX_PLL_STATUS_R:
+		return sim->rx_pll_lock ? (1 << 7) : 0;
+	case ADDR_PIF_LDO_STATUS_1_R:
+		return 0;
+	case ADDR_PIF_LDO_STATUS_2_R:
+		if (!(sim->pif[ADDR_PIF_AVDD_TX_CTRL_RW] & LDO_DISABLE)) value |= AVDD_TX_POWER_GOOD;
+		if (!(sim->pif[ADDR_PIF_AVDD_RX_CTRL_RW] & LDO_DISABLE)) value |= AVDD_RX_POWER_GOOD;
+		if (!(sim->pif[ADDR_PIF_DVDD_TX_CTRL_RW] & LDO_DISABLE)) value |= DVDD_TX_POWER_GOOD;
+		if (!(sim->pif[ADDR_PIF_DVDD_RX_CTRL_RW] & LDO_DISABLE)) value |= DVDD_RX_POWER_GOOD;
+		return value;
+	default:
+		return sim->pif[address];
+	}
+}
+
+
+/**
+Function runs an 8051 firmware software action
+*/
+static void sw_action(X4Sim_t *sim, uint8_t action)
+{
+	uint32_t period_ticks = 0;
+	uint32_t fps = 0;
+
+	switch (action) {
+	case SW_ACTION_START_TIMER:
+		if (sim->sw[SW_REGISTER_USE_PERIOD]) {
+			// Period in 1/10000 s
+			for (int i = 3; i >= 0; i--)
+				period_ticks = (period_ticks << 8) | sim->sw[SW_REGISTER_PERIOD_0 + i];
+			sim->timer_period_ns = (uint64_t)period_ticks * 100000;
+		} else {
+			fps = ((uint32_t)sim->sw[SW_REGISTER_FPS_MSB] << 8) | sim->sw[SW_REGISTER_FPS_LSB];
+			sim->timer_period_ns = fps ? 1000000000ULL / fps : 0;
+		}
+		sim->timer_running = sim->timer_period_ns != 0;
+		sim->timer_next_ns = sim->now_ns + sim->timer_period_ns;
+		break;
+	case SW_ACTION_STOP_TIMER:
+		sim->timer_running = false;
+		break;
+	case SW_ACTION_ENABLE_TRIGGER_PIN:
+		sim->trigger_pin_enabled = true;
+		break;
+	case SW_ACTION_READ_FRAME_COUNTER:
+		for (int i = 0; i < 4; i++)
+			mailbox_respond(sim, (uint8_t)(sim->frame_counter >> (8 * i)));
+		break;
+	case SW_ACTION_ENABLE_TX_PLL:
+		sim->tx_pll_lock = true;
+		break;
+	case SW_ACTION_ENABLE_RX_PLL:
+		sim->rx_pll_lock = true;
+		break;
+	default:
+		break;
+	}
+}
+
+
+/**
+Function starts a sweep. A trigger during a sweep is lost, as on the X4
+*/
+static void start_sweep(X4Sim_t *sim)
+{
+	if (sim->sweep_active) {
+		sim->overruns++;
+		return;
+	}
+
+	sim->sweep_active = true;
+	sim->sweep_end_ns = sim->now_ns + sweep_duration_ns(sim);
+	sim->frame_done = false;
+}
+
+
+/**
+Function completes the sweep: renders the frame and raises data ready
+*/
+static void finish_sweep(X4Sim_t *sim)
+{
+	sim->sweep_active = false;
+	render_frame(sim, sim->sweep_end_ns * 1e-9);
+	sim->frame_done = true;
+	sim->frame_counter++;
+	sim->sweeps++;
+	if (sim->data_ready_isr)
+		sim->data_ready = true;
+}
+
+
+/**
+Function calculates the sweep time from the sweep controller registers
+*/
+static uint64_t sweep_duration_ns(X4Sim_t *sim)
+{
+	uint8_t *pif = sim->pif;
+	uint32_t iterations = pif[ADDR_PIF_TRX_ITERATIONS_RW];
+	uint32_t pps = ((uint32_t)pif[ADDR_PIF_TRX_PULSES_PER_STEP_MSB_RW] << 8) | pif[ADDR_PIF_TRX_PULSES_PER_STEP_LSB_RW];
+	uint32_t dac_min = ((uint32_t)pif[ADDR_PIF_TRX_DAC_MIN_H_RW] << 3) | (pif[ADDR_PIF_TRX_DAC_MIN_L_RW] & 0x07);
+	uint32_t dac_max = ((uint32_t)pif[ADDR_PIF_TRX_DAC_MAX_H_RW] << 3) | (pif[ADDR_PIF_TRX_DAC_MAX_L_RW] & 0x07);
+	uint32_t dac_step = pif[ADDR_PIF_TRX_DAC_STEP_RW] & 0x03;
+	uint32_t clocks_per_pulse = pif[ADDR_PIF_TRX_CLOCKS_PER_PULSE_RW] ? pif[ADDR_PIF_TRX_CLOCKS_PER_PULSE_RW] : 16;
+
+	uint32_t dac_steps = (dac_max > dac_min) ? ((dac_max - dac_min) >> dac_step) + 1 : 1;
+	double pulses = (double)iterations * pps * dac_steps;
+
+	return (uint64_t)(pulses * clocks_per_pulse * 1e9 / SWEEP_CLOCK_HZ);
+}
+
+
+/**
+Function fills the frame RAM with counters for the targets at time t_s.
+Counters are scaled so the driver's normalization returns the target amplitude
+*/
+static void render_frame(X4Sim_t *sim, double t_s)
+{
+	uint8_t *pif = sim->pif;
+	uint32_t iterations = pif[ADDR_PIF_TRX_ITERATIONS_RW];
+	uint32_t pps = ((uint32_t)pif[ADDR_PIF_TRX_PULSES_PER_STEP_MSB_RW] << 8) | pif[ADDR_PIF_TRX_PULSES_PER_STEP_LSB_RW];
+	uint32_t dac_min = ((uint32_t)pif[ADDR_PIF_TRX_DAC_MIN_H_RW] << 3) | (pif[ADDR_PIF_TRX_DAC_MIN_L_RW] & 0x07);
+	uint32_t dac_max = ((uint32_t)pif[ADDR_PIF_TRX_DAC_MAX_H_RW] << 3) | (pif[ADDR_PIF_TRX_DAC_MAX_L_RW] & 0x07);
+	uint32_t dac_step = pif[ADDR_PIF_TRX_DAC_STEP_RW] & 0x03;
+	uint32_t bytes_per_counter = pif[ADDR_PIF_RX_COUNTER_NUM_BYTES_RW];
+	bool ddc = (pif[ADDR_PIF_SMPL_MODE_RW] & 0x01) != 0;
+
+	if (bytes_per_counter == 0 || bytes_per_counter > 6)
+		bytes_per_counter = 6;
+
+	// Same constants as _update_normalization_constants() in x4driver.c
+	double nfactor = (iterations * pps != 0) ? (double)(1 << dac_step) / (iterations * pps) / 1024.0 : 1.0;
+	double noffset = (dac_max - dac_min + 1) / 2048.0;
+
+	double fc = (((pif[ADDR_PIF_TX_PLL_CTRL_1_RW] >> 4) & 0x07) == TX_CENTER_FREQUENCY_KCC_8_748GHz) ? 8.748e9 : 7.29e9;
+	double k = 4.0 * M_PI * fc / SPEED_OF_LIGHT;
+	double frame_start_m = ((int)pif[ADDR_PIF_RX_WAIT_RW] - (int)pif[ADDR_PIF_TX_WAIT_RW]) * BINS_PER_MFRAME * METERS_PER_BIN;
+
+	uint32_t bins = pif[ADDR_PIF_RX_MFRAMES_COARSE_RW] * BINS_PER_MFRAME;
+	if (bins > X4SIM_FRAME_BINS)
+		bins = X4SIM_FRAME_BINS;
+
+	memset(sim->ram, 0, sizeof(sim->ram));
+
+	if (!ddc) {
+		int64_t max_counter = (int64_t)((1ULL << (8 * bytes_per_counter)) - 1);
+		for (uint32_t b = 0; b < bins; b++) {
+			double r = frame_start_m + b * METERS_PER_BIN;
+			double x = 0;
+			for (uint32_t i = 0; i < sim->target_count; i++) {
+				X4SimTarget_t *target = &sim->targets[i];
+				double d = r - (target->range_m + target->velocity_mps * t_s);
+				x += target->amplitude * exp(-0.5 * (d / PULSE_SIGMA_M) * (d / PULSE_SIGMA_M)) * cos(k * d);
+			}
+			x += sim->noise_rms * gaussian(sim);
+
+			int64_t counter = llround((x + noffset) / nfactor);
+			if (counter < 0) counter = 0;
+			if (counter > max_counter) counter = max_counter;
+			sim->ram[b] = counter;
+		}
+		return;
+	}
+
+	// Driver normalizes down converted counters by nfactor / sum(|coeff_i1|)
+	double coeff_sum = 0;
+	uint32_t coeff_count = (sim->coeff_i1_count < 32) ? sim->coeff_i1_count : 32;
+	for (uint32_t i = 0; i < coeff_count; i++)
+		coeff_sum += fabs((double)sim->coeff_i1[i]);
+	if (coeff_sum == 0)
+		coeff_sum = 1;
+	double scale = coeff_sum / nfactor;
+
+	int64_t max_counter = (int64_t)((1ULL << (8 * bytes_per_counter - 1)) - 1);
+	for (uint32_t line = 0; line < bins / DDC_DECIMATION; line++) {
+		double r = frame_start_m + ((double)line - DDC_DISCARDED) * DDC_DECIMATION * METERS_PER_BIN;
+		double i_val = 0, q_val = 0;
+		for (uint32_t i = 0; i < sim->target_count; i++) {
+			X4SimTarget_t *target = &sim->targets[i];
+			double d = r - (target->range_m + target->velocity_mps * t_s);
+			double env = target->amplitude * exp(-0.5 * (d / PULSE_SIGMA_M) * (d / PULSE_SIGMA_M));
+			i_val += env * cos(k * d);
+			q_val += env * sin(k * d);
+		}
+		i_val += sim->noise_rms * gaussian(sim);
+		q_val += sim->noise_rms * gaussian(sim);
+
+		// The driver negates Q when unpacking
+		int64_t counters[2] = {llround(i_val * scale), llround(-q_val * scale)};
+		for (int n = 0; n < 2; n++) {
+			if (counters[n] > max_counter) counters[n] = max_counter;
+			if (counters[n] < -max_counter) counters[n] = -max_counter;
+			sim->ram[2 * line + n] = counters[n];
+		}
+	}
+}
+
+
+/**
+Function copies the RAM lines selected by the RX_RAM registers to the radar
+data FIFO, little endian with RX_COUNTER_NUM_BYTES bytes per counter. A
+baseband RAM line holds 4 bins, a down converted line one I/Q pair
+*/
+static void fetch_radar_data(X4Sim_t *sim)
+{
+	uint8_t *pif = sim->pif;
+	uint32_t bytes_per_counter = pif[ADDR_PIF_RX_COUNTER_NUM_BYTES_RW];
+	bool ddc = (pif[ADDR_PIF_SMPL_MODE_RW] & 0x01) != 0;
+	uint32_t first = ((uint32_t)pif[ADDR_PIF_RX_RAM_LINE_FIRST_MSB_RW] << 1) | ((pif[ADDR_PIF_RX_RAM_LSBS_RW] >> 1) & 0x01);
+	uint32_t last = ((uint32_t)pif[ADDR_PIF_RX_RAM_LINE_LAST_MSB_RW] << 1) | (pif[ADDR_PIF_RX_RAM_LSBS_RW] & 0x01);
+	uint32_t per_line = ddc ? 2 : 4;
+
+	if (bytes_per_counter == 0 || bytes_per_counter > 6)
+		bytes_per_counter = 6;
+
+	sim->radar_fifo_head = 0;
+	sim->radar_fifo_count = 0;
+
+	for (uint32_t line = first; line <= last; line++) {
+		for (uint32_t n = 0; n < per_line; n++) {
+			uint32_t index = line * per_line + n;
+			uint64_t counter = (index < 2 * X4SIM_FRAME_BINS) ? (uint64_t)sim->ram[index] : 0;
+			if (sim->radar_fifo_count + bytes_per_counter > X4SIM_RADAR_FIFO_SIZE)
+				return;
+			for (uint32_t b = 0; b < bytes_per_counter; b++)
+				sim->radar_fifo[sim->radar_fifo_count++] = (uint8_t)(counter >> (8 * b));
+		}
+	}
+}
+
+
+/**
+Function draws a standard normal sample (xorshift64* and Box-Muller)
+*/
+static double gaussian(X4Sim_t *sim)
+{
+	double u[2];
+	for (int i = 0; i < 2; i++) {
+		uint64_t x = sim->noise_state;
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		sim->noise_state = x;
+		u[i] = ((x * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+	}
+	if (u[0] < 1e-300)
+		u[0] = 1e-300;
+	return sqrt(-2.0 * log(u[0])) * cos(2.0 * M_PI * u[1]);
+}
+
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+// X4DriverCallbacks_t Callback Functions
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+
+static uint32_t cb_pin_set_enable(void *user_reference, uint8_t value)
+{
+	X4Sim_t *sim = user_reference;
+
+	if (value == 0) {
+		sim->enabled = false;
+		sim->sweep_active = false;
+		sim->timer_running = false;
+		sim->data_ready = false;
+	} else if (!sim->enabled)
+		power_on(sim);
+
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static uint32_t cb_spi_write(void *user_reference, uint8_t *data, uint32_t length)
+{
+	X4Sim_t *sim = user_reference;
+
+	sim->stats.writes++;
+	sim->stats.bytes_out += length;
+
+	// Address byte with the write flag, then data bytes to that register
+	if (length > 1 && (data[0] & SPI_WRITE_FLAG)) {
+		for (uint32_t i = 1; i < length; i++)
+			spi_register_write(sim, data[0] & 0x7f, data[i]);
+	}
+
+	charge_transfer(sim, length);
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static uint32_t cb_spi_read(void *user_reference, uint8_t *data, uint32_t length)
+{
+	X4Sim_t *sim = user_reference;
+
+	sim->stats.reads++;
+	sim->stats.bytes_in += length;
+	memset(data, 0, length);
+
+	charge_transfer(sim, length);
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static uint32_t cb_spi_write_read(void *user_reference, uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength)
+{
+	X4Sim_t *sim = user_reference;
+	uint8_t address = wdata[0] & 0x7f;
+
+	sim->stats.reads++;
+	sim->stats.bytes_out += wlength;
+	sim->stats.bytes_in += rlength;
+
+	if (rlength == 1) {
+		rdata[0] = spi_register_read(sim, address);
+	} else {
+		// Bytes clocked in during the command phase come first, as on the board
+		memset(rdata, 0, wlength);
+		for (uint32_t i = 0; i < rlength; i++)
+			rdata[wlength + i] = spi_register_read(sim, address);
+	}
+
+	charge_transfer(sim, wlength + rlength);
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static uint32_t cb_spi_wait(void *user_reference, uint32_t timeout_ms)
+{
+	(void)user_reference;
+	(void)timeout_ms;
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static void cb_wait_us(uint32_t us)
+{
+	if (active_sim != NULL)
+		x4sim_advance_us(active_sim, us);
+}
+
+
+static void cb_notify_data_ready(void *user_reference)
+{
+	(void)user_reference;
+}
+
+
+static uint32_t cb_trigger_sweep(void *user_reference)
+{
+	X4Sim_t *sim = user_reference;
+
+	if (sim->enabled && sim->trigger_pin_enabled)
+		start_sweep(sim);
+
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static void cb_enable_data_ready_isr(void *user_reference, uint32_t enable)
+{
+	X4Sim_t *sim = user_reference;
+
+	sim->data_ready_isr = enable != 0;
+	if (!enable)
+		sim->data_ready = false;
+}
+
+
+/**
+Function waits for data ready like the board callback: returns 1 and clears
+the signal if a frame completed, otherwise lets virtual time pass up to the
+timeout
+*/
+static uint32_t cb_wait_data_ready(void *user_reference, uint32_t timeout_ms)
+{
+	X4Sim_t *sim = user_reference;
+	uint64_t deadline = sim->now_ns + (uint64_t)timeout_ms * 1000000;
+
+	while (!sim->data_ready) {
+		uint64_t next = next_event_ns(sim);
+		if (next > deadline)
+			break;
+		run_until(sim, next);
+	}
+	if (!sim->data_ready)
+		run_until(sim, deadline);
+
+	uint32_t ready = sim->data_ready;
+	sim->data_ready = false;
+	return ready;
+}
@@ -0,0 +1,268 @@
+/**
+@file x4sim.h
+
+Simulated X4 radar for running the firmware's x4driver on a host
+
+The simulator implements X4DriverCallbacks_t on top of a software model of the
+X4: the SPI register map, the 8051 mailbox FIFOs (PIF, XIF and software
+registers and actions), the 8051 SRAM programming interface, the sweep
+controller and timer, and the radar data FIFO. Each sweep renders a frame of
+counters from a list of point targets plus white noise, scaled the same way the
+driver normalizes them.
+
+Every SPI transfer is counted and charged bus time at the configured SPI clock,
+so the cost of a driver call can be measured by resetting the counters before
+the call and reading them after it.
+
+Example:
+@code
+static X4Sim_t sim;
+x4sim_init(&sim);
+x4sim_add_target(&sim, 1.5f, 0.2f, 0.0f);
+
+X4DriverCallbacks_t callbacks;
+x4sim_get_callbacks(&sim, &callbacks);
+x4driver_create(&x4, mem, &callbacks, &lock, &timer, &timer, &sim);
+x4driver_init(x4);
+
+x4sim_reset_spi_stats(&sim);
+x4driver_set_frame_area(x4, 0.5f, 5.0f);
+x4sim_get_spi_stats(&sim, &stats);
+@endcode
+
+@note
+The simulator has a virtual clock. It advances with SPI bus time, wait_us()
+and wait_data_ready() and never sleeps, so frames are produced as fast as the
+host can run the driver.
+
+@note
+wait_us() has no user reference, it advances the simulator that last handed out
+its callbacks. Only one simulator can be used at a time.
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef X4SIM_h
+#define X4SIM_h
+
+#include "x4driver.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define X4SIM_MAX_TARGETS 8
+
+// 8051 program memory
+#define X4SIM_SRAM_SIZE 8192
+
+// Full frame before the RAM line window is applied
+#define X4SIM_FRAME_BINS 1536
+
+// Largest radar data FIFO content, full frame of 6 byte counters
+#define X4SIM_RADAR_FIFO_SIZE (X4SIM_FRAME_BINS * 6)
+
+#define X4SIM_MAILBOX_SIZE 64
+
+// SPI clock and per transfer chip select delays of the SLMX4 board
+#define X4SIM_DEFAULT_SPI_CLOCK_HZ 20000000
+#define X4SIM_DEFAULT_TRANSFER_OVERHEAD_NS 150
+
+#define X4SIM_SUCCESS  0
+#define X4SIM_ERR_FULL 1
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct X4SimTarget_t
+Point target seen by the simulated radar
+*/
+typedef struct {
+	float range_m;      // Distance at time zero, in driver frame area coordinates
+	float amplitude;    // Peak amplitude in normalized units
+	float velocity_mps; // Radial velocity, positive moves away from the radar
+
+} X4SimTarget_t;
+
+/**
+@struct X4SimSpiStats_t
+SPI bus counters, see x4sim_reset_spi_stats()
+*/
+typedef struct {
+	uint32_t transactions;     // Chip select cycles
+	uint32_t writes;           // spi_write() calls
+	uint32_t reads;            // spi_write_read() and spi_read() calls
+	uint32_t bytes_out;        // Bytes written by the host, including address bytes
+	uint32_t bytes_in;         // Bytes read by the host
+	uint32_t mailbox_commands; // Complete commands received by the 8051
+	uint64_t bus_time_ns;      // Time the transfers take at spi_clock_hz
+
+} X4SimSpiStats_t;
+
+/**
+@struct X4Sim_t
+State of one simulated X4. Configuration fields may be changed at any time,
+everything else is private to x4sim.c
+*/
+typedef struct {
+	// Configuration
+	uint32_t spi_clock_hz;
+	uint32_t transfer_overhead_ns;
+	float noise_rms;
+	X4SimTarget_t targets[X4SIM_MAX_TARGETS];
+	uint32_t target_count;
+
+	// Virtual clock
+	uint64_t now_ns;
+
+	// Power and register files
+	bool enabled;
+	uint8_t spi[128];
+	uint8_t pif[128];
+	uint8_t xif[128];
+	uint8_t sw[128];
+
+	// 8051 SRAM programming interface
+	uint8_t sram[X4SIM_SRAM_SIZE];
+	uint32_t sram_loaded;
+	uint32_t mem_address;
+
+	// Mailbox FIFOs
+	uint8_t to_cpu[4];
+	uint32_t to_cpu_count;
+	uint8_t from_cpu[X4SIM_MAILBOX_SIZE];
+	uint32_t from_cpu_head;
+	uint32_t from_cpu_count;
+
+	// Clocks and supplies
+	bool osc_lock;
+	bool common_pll_lock;
+	bool tx_pll_lock;
+	bool rx_pll_lock;
+
+	// Down conversion filter, I1 coefficients as written
+	int8_t coeff_i1[32];
+	uint32_t coeff_i1_count;
+
+	// Sweep controller
+	bool sweep_active;
+	uint64_t sweep_end_ns;
+	bool frame_done;
+	uint32_t frame_counter;
+	bool trigger_pin_enabled;
+	bool timer_running;
+	uint64_t timer_period_ns;
+	uint64_t timer_next_ns;
+	uint32_t sweeps;
+	uint32_t overruns;
+
+	// Data ready pin
+	bool data_ready_isr;
+	bool data_ready;
+
+	// Frame RAM and radar data FIFO
+	int64_t ram[2 * X4SIM_FRAME_BINS];
+	uint8_t radar_fifo[X4SIM_RADAR_FIFO_SIZE];
+	uint32_t radar_fifo_head;
+	uint32_t radar_fifo_count;
+
+	uint64_t noise_state;
+	X4SimSpiStats_t stats;
+
+} X4Sim_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function sets the simulator to a powered off X4 with no targets and no noise
+
+@param [out] *sim  Simulator
+*/
+void x4sim_init(X4Sim_t *sim);
+
+/**
+Function fills driver callbacks backed by the simulator
+
+@note
+Pass sim as the user reference to x4driver_create(). The lock and timers are
+not part of the callbacks and must be provided by the caller
+
+@param [in]  *sim        Simulator
+@param [out] *callbacks  Callbacks for x4driver_create()
+*/
+void x4sim_get_callbacks(X4Sim_t *sim, X4DriverCallbacks_t *callbacks);
+
+/**
+Function adds a point target
+
+@param [in] *sim           Simulator
+@param [in]  range_m       Distance at time zero
+@param [in]  amplitude     Peak amplitude in normalized units
+@param [in]  velocity_mps  Radial velocity
+
+@return X4SIM_SUCCESS on success, X4SIM_ERR_FULL if X4SIM_MAX_TARGETS are set
+*/
+int x4sim_add_target(X4Sim_t *sim, float range_m, float amplitude, float velocity_mps);
+
+/**
+Function removes all targets
+
+@param [in] *sim  Simulator
+*/
+void x4sim_clear_targets(X4Sim_t *sim);
+
+/**
+Function sets the white noise added to every counter
+
+@param [in] *sim   Simulator
+@param [in]  rms   Noise level in normalized units, 0 for noise free frames
+@param [in]  seed  Noise generator seed
+*/
+void x4sim_set_noise(X4Sim_t *sim, float rms, uint32_t seed);
+
+/**
+Function advances the virtual clock, running the X4 timer and sweeps
+
+@param [in] *sim  Simulator
+@param [in]  us   Time to advance
+*/
+void x4sim_advance_us(X4Sim_t *sim, uint32_t us);
+
+/**
+Function gets the virtual clock
+
+@param [in] *sim  Simulator
+
+@return Time since x4sim_init() in microseconds
+*/
+uint64_t x4sim_get_time_us(X4Sim_t *sim);
+
+/**
+Function clears the SPI bus counters
+
+@param [in] *sim  Simulator
+*/
+void x4sim_reset_spi_stats(X4Sim_t *sim);
+
+/**
+Function gets the SPI bus counters since the last x4sim_reset_spi_stats()
+
+@param [in]  *sim    Simulator
+@param [out] *stats  Copy of the counters
+*/
+void x4sim_get_spi_stats(X4Sim_t *sim, X4SimSpiStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4SIM_h
@@ -0,0 +1,298 @@
+/**
+@file x4sim_demo.c
+
+Runs the firmware's x4driver.c and x4_post_norm.c against the simulated X4
+
+Initializes the driver, configures it the way the MATLAB server does, reads
+baseband and down converted frames with the same call sequence as mat_handler.c
+and streams frames on the X4 timer. Prints the SPI cost of every driver call and
+checks that the targets show up at the expected range.
+
+See README.md for build and usage.
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "x4driver.h"
+#include "x4_post_norm.h"
+#include "x4sim.h"
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define XEP_LOCK_OK 1
+
+// Same as X4_FRAME_BUFFER_SIZE on the board plus the command byte slot
+#define FRAME_BUFFER_SIZE (1535 * 4 + X4DRIVER_SPI_RDATA_OFFSET)
+
+#define METERS_PER_BIN (1.5e8 / 23.328e9)
+
+#define FRAME_READY_TIMEOUT_MS 100
+#define FRAME_FETCH_TIMEOUT_MS 10
+#define STREAM_FPS             20
+#define STREAM_FRAMES          10
+
+// Accepted distance between a target and the detected peak
+#define RANGE_TOLERANCE_M 0.05
+
+/**
+Runs a driver call and prints its SPI cost
+*/
+#define PROFILE(name, call)                                        \
+	do {                                                           \
+		x4sim_reset_spi_stats(&sim);                               \
+		int profile_status = (call);                               \
+		print_stats(name, profile_status);                         \
+		if (profile_status) failures++;                            \
+	} while (0)
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static X4Driver_t *create_driver();
+static int fetch_frame(X4Driver_t *x4);
+static void print_stats(const char *name, int status);
+static int check_peak(const char *name, const float *frame, uint32_t bins, bool iq, float start_m, float bin_m, float expected_m);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+static X4Sim_t sim;
+
+static uint8_t spi_buffer[FRAME_BUFFER_SIZE];
+static uint8_t raw_frame[FRAME_BUFFER_SIZE];
+static float frame[2 * 1536];
+static float post_frame[2 * 1536];
+
+static int failures = 0;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Stub Callbacks
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static uint32_t stub_take(void *lock, uint32_t timeout) { (void)lock; (void)timeout; return XEP_LOCK_OK; }
+static void stub_give(void *lock) { (void)lock; }
+static void *stub_owner(void) { return &sim; } // The demo is the only task
+static uint32_t stub_timer_configure(void *timer, uint32_t frequency) { (void)timer; (void)frequency; return 0; }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Main
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int main()
+{
+	x4sim_init(&sim);
+	x4sim_add_target(&sim, 1.2f, 0.05f, 0.0f);
+	x4sim_add_target(&sim, 3.0f, 0.02f, 0.5f);
+	x4sim_set_noise(&sim, 0.0005f, 1);
+
+	X4Driver_t *x4 = create_driver();
+	if (x4 == NULL) {
+		fprintf(stderr, "x4driver_create failed\n");
+		return 2;
+	}
+
+	printf("%-34s %6s %8s %8s %8s %8s %10s\n", "call", "status", "xfers", "out", "in", "mailbox", "bus_us");
+
+	// Bring up and configure as the MATLAB server does
+	PROFILE("x4driver_init", x4driver_init(x4));
+	PROFILE("x4driver_set_iterations", x4driver_set_iterations(x4, 16));
+	PROFILE("x4driver_set_pulses_per_step", x4driver_set_pulses_per_step(x4, 26));
+	PROFILE("x4driver_set_dac_min", x4driver_set_dac_min(x4, 949));
+	PROFILE("x4driver_set_dac_max", x4driver_set_dac_max(x4, 1100));
+	PROFILE("x4driver_set_frame_area", x4driver_set_frame_area(x4, 0.5f, 4.0f));
+
+	uint8_t value;
+	PROFILE("x4driver_get_pif_register (shadow)", x4driver_get_pif_register(x4, ADDR_PIF_RX_WAIT_RW, &value));
+	PROFILE("x4driver_get_pif_register", x4driver_get_pif_register(x4, ADDR_PIF_TRX_CTRL_DONE_R, &value));
+
+	// Single frame, step by step
+	uint32_t frame_counter = 0;
+	PROFILE("x4driver_start_sweep", x4driver_start_sweep(x4));
+	PROFILE("x4driver_wait_frame_ready", x4driver_wait_frame_ready(x4, FRAME_READY_TIMEOUT_MS));
+	PROFILE("x4driver_read_frame_bytes", x4driver_read_frame_bytes(x4, &frame_counter, raw_frame, sizeof(raw_frame)));
+	PROFILE("x4driver_read_frame_bytes (no fc)", x4driver_read_frame_bytes(x4, NULL, raw_frame, sizeof(raw_frame)));
+
+	// Baseband frame as mat_handler.c reads it, normalized in the driver and
+	// raw plus x4_post_norm.c
+	uint32_t bins = 0;
+	x4driver_get_frame_bin_count(x4, &bins);
+	PROFILE("fetch frame (baseband)", fetch_frame(x4));
+
+	const uint8_t *raw = raw_frame + X4DRIVER_SPI_RDATA_OFFSET;
+	x4driver_unpack_frame_normalized(x4, (uint8_t *)raw, x4->frame_read_size, frame, bins);
+	x4driver_unpack_frame_raw(x4, (uint8_t *)raw, x4->frame_read_size, post_frame, bins);
+
+	bool ddc_en;
+	float nregion, nfactor, noffset;
+	PROFILE("x4_calc_norm_factors", x4_calc_norm_factors(x4, &ddc_en, &nregion, &nfactor, &noffset));
+	x4_norm_data(post_frame, bins, noffset, nfactor);
+
+	// x4_post_norm.c scales to DAC units around a different offset, compare the
+	// peak after removing the mean
+	float mean = 0;
+	for (uint32_t i = 0; i < bins; i++)
+		mean += post_frame[i] / bins;
+	for (uint32_t i = 0; i < bins; i++)
+		post_frame[i] -= mean;
+
+	printf("\nbaseband: %u bins from %.3f m\n", bins, x4->frame_area_start);
+	failures += check_peak("baseband", frame, bins, false, x4->frame_area_start, METERS_PER_BIN, 1.2f);
+	failures += check_peak("x4_post_norm", post_frame, bins, false, x4->frame_area_start, METERS_PER_BIN, 1.2f);
+
+	// Down converted frame
+	printf("\n");
+	PROFILE("x4driver_set_downconversion", x4driver_set_downconversion(x4, 1));
+	x4driver_get_frame_bin_count(x4, &bins);
+	PROFILE("fetch frame (ddc)", fetch_frame(x4));
+	x4driver_unpack_frame_normalized(x4, (uint8_t *)raw, x4->frame_read_size, frame, 2 * bins);
+
+	printf("\nddc: %u I/Q bins from %.3f m\n", bins, x4->frame_area_start);
+	failures += check_peak("ddc", frame, bins, true, x4->frame_area_start, 8 * METERS_PER_BIN, 1.2f);
+
+	// Streaming on the X4 timer with the data ready interrupt
+	printf("\n");
+	PROFILE("x4driver_set_frame_ready_strategy", x4driver_set_frame_ready_strategy(x4, FRAME_IS_READY_INTERRUPT));
+	PROFILE("x4driver_set_sweep_trigger_control", x4driver_set_sweep_trigger_control(x4, SWEEP_TRIGGER_X4));
+	PROFILE("x4driver_set_fps", x4driver_set_fps(x4, STREAM_FPS));
+
+	uint32_t first_counter = 0;
+	uint64_t first_us = 0;
+	for (int i = 0; i < STREAM_FRAMES; i++) {
+		int status = x4driver_wait_frame_ready(x4, FRAME_READY_TIMEOUT_MS);
+		status |= x4driver_read_frame_bytes(x4, &frame_counter, raw_frame, sizeof(raw_frame));
+		if (status) {
+			printf("stream: frame %d failed (%d)\n", i, status);
+			failures++;
+			break;
+		}
+		if (i == 0) {
+			first_counter = frame_counter;
+			first_us = x4sim_get_time_us(&sim);
+		} else if (frame_counter != first_counter + i) {
+			printf("stream: frame counter %u, expected %u\n", frame_counter, first_counter + i);
+			failures++;
+		}
+	}
+
+	double period_ms = (x4sim_get_time_us(&sim) - first_us) / 1000.0 / (STREAM_FRAMES - 1);
+	printf("\nstream: %d frames, %.2f ms period (%d fps requested), %u overruns\n",
+		STREAM_FRAMES, period_ms, STREAM_FPS, sim.overruns);
+	if (fabs(period_ms - 1000.0 / STREAM_FPS) > 1.0)
+		failures++;
+
+	x4driver_set_fps(x4, 0);
+	free(x4);
+
+	if (failures) {
+		printf("\n%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static X4Driver_t *create_driver()
+{
+	X4DriverCallbacks_t callbacks;
+	x4sim_get_callbacks(&sim, &callbacks);
+
+	X4DriverLock_t lock = {0};
+	lock.lock = stub_take;
+	lock.unlock = stub_give;
+	lock.owner = stub_owner;
+
+	X4DriverTimer_t timer = {0};
+	timer.configure = stub_timer_configure;
+
+	X4Driver_t *x4 = NULL;
+	void *mem = malloc(x4driver_get_instance_size());
+	if (mem == NULL)
+		return NULL;
+
+	if (x4driver_create(&x4, mem, &callbacks, &lock, &timer, &timer, &sim)) {
+		free(mem);
+		return NULL;
+	}
+
+	x4->spi_buffer = spi_buffer;
+	x4->spi_buffer_size = sizeof(spi_buffer);
+
+	return x4;
+}
+
+
+/**
+Function reads one frame with the call sequence of sweep_frame() and
+read_frame_bytes() in mat_handler.c: the sweep is waited for without a
+session, and the session only covers the read
+*/
+static int fetch_frame(X4Driver_t *x4)
+{
+	// Register as the data ready waiter and drop any stale signal
+	if (x4->frame_is_ready_strategy == FRAME_IS_READY_INTERRUPT)
+		x4->callbacks.wait_data_ready(x4->user_reference, 0);
+
+	int status = x4driver_start_sweep(x4);
+	status |= x4driver_wait_frame_ready(x4, FRAME_READY_TIMEOUT_MS);
+	if (status)
+		return status;
+
+	status = x4driver_session_begin(x4);
+	if (status)
+		return status;
+
+	status = x4driver_read_frame_bytes_start(x4, NULL, raw_frame, sizeof(raw_frame));
+	if (status == 0)
+		status = x4driver_read_frame_bytes_finish(x4, FRAME_FETCH_TIMEOUT_MS);
+
+	x4driver_session_end(x4);
+	return status;
+}
+
+
+static void print_stats(const char *name, int status)
+{
+	X4SimSpiStats_t stats;
+	x4sim_get_spi_stats(&sim, &stats);
+	printf("%-34s %6d %8u %8u %8u %8u %10.1f\n", name, status, stats.transactions, stats.bytes_out,
+		stats.bytes_in, stats.mailbox_commands, stats.bus_time_ns / 1000.0);
+}
+
+
+/**
+Function finds the strongest bin (magnitude for I/Q frames) and checks it is
+at the expected range
+*/
+static int check_peak(const char *name, const float *frame, uint32_t bins, bool iq, float start_m, float bin_m, float expected_m)
+{
+	uint32_t peak = 0;
+	float peak_value = 0;
+	for (uint32_t i = 0; i < bins; i++) {
+		float v = iq ? hypotf(frame[2 * i], frame[2 * i + 1]) : fabsf(frame[i]);
+		if (v > peak_value) {
+			peak_value = v;
+			peak = i;
+		}
+	}
+
+	float range = start_m + peak * bin_m;
+	bool ok = fabsf(range - expected_m) <= RANGE_TOLERANCE_M + bin_m;
+	printf("%s: peak %.4f at %.3f m, target at %.3f m: %s\n", name, peak_value, range, expected_m, ok ? "ok" : "FAIL");
+
+	return ok ? 0 : 1;
+}
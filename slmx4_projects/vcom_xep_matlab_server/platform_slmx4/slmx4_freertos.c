@@ -10,6 +10,7 @@ Justin Hadella
 */
 #include <slmx4_freertos.h>
 #include <stdbool.h>
+#include <string.h>
 
 // Hardware includes
 #include "board.h"
@@ -20,6 +21,8 @@ Justin Hadella
 #include "fsl_debug_console.h"
 #include "fsl_lpspi.h"
 #include "fsl_lpspi_freertos.h"
+#include "fsl_edma.h"
+#include "fsl_dmamux.h"
 #include "fsl_lpi2c.h"
 #include "fsl_lpi2c_freertos.h"
 #include "fsl_iomuxc.h"
@@ -30,13 +33,15 @@ Justin Hadella
 // FreeRTOS includes
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "task.h"
+#include "timers.h"
+
+#include <cr_section_macros.h>
 
 // -----------------------------------------------------------------------------
 // Definitions
 // -----------------------------------------------------------------------------
 
-#define FRAME_BUFFER_SIZE (1535 * 4)
-
 // ?? Move/Refactor the rest of these defines into the board.h
 
 #define CPU_FREQ (BOARD_BOOTCLOCKRUN_CORE_CLOCK / 1000000)
@@ -62,25 +67,38 @@ Justin Hadella
 static int init_rgb_led_pwm();
 
 static uint32_t x4driver_local_spi_write_read_one(void *user_reference, uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength);
+static uint32_t x4_spi_transfer(Hal_t *hal, lpspi_transfer_t *xfer);
+static int init_x4_spi_dma(Hal_t *hal);
+static void x4_spi_dma_callback(edma_handle_t *handle, void *user_data, bool transfer_done, uint32_t tcds);
+static void x4_spi_dma_stop(Hal_t *hal);
+static void x4_sweep_timer_callback(TimerHandle_t timer);
+static void x4_action_timer_callback(TimerHandle_t timer);
 
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 // Globals
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
+// Only the pin configs are set here, the rest is filled in by the init code
 Hal_t g_hal = {
-	{kGPIO_DigitalOutput, 0, kGPIO_NoIntmode},      // Red LED
-	{kGPIO_DigitalOutput, 0, kGPIO_NoIntmode},      // Green LED
-	{0},
-	{0},
-	{kGPIO_DigitalOutput, 0, kGPIO_NoIntmode},      // X4_EN
-	{kGPIO_DigitalInput, 0, kGPIO_IntRisingEdge},   // X4_GPIO1
-	{kGPIO_DigitalInput, 0, kGPIO_NoIntmode},       // X4_GPIO2
-	{0},
-	{0}
+	.gpio_led_red   = {kGPIO_DigitalOutput, 0, kGPIO_NoIntmode},
+	.gpio_led_green = {kGPIO_DigitalOutput, 0, kGPIO_NoIntmode},
+	.x4_en          = {kGPIO_DigitalOutput, 0, kGPIO_NoIntmode},
+	.x4_gpio1       = {kGPIO_DigitalInput, 0, kGPIO_IntRisingEdge},
+	.x4_gpio2       = {kGPIO_DigitalInput, 0, kGPIO_NoIntmode},
 };
 
 // Buffer used to store radar signal data
-uint8_t g_spi_buffer[FRAME_BUFFER_SIZE];
+uint8_t g_spi_buffer[X4_FRAME_BUFFER_SIZE];
+
+// Frame buffers for DMA readout. DTCM is not cached so no cache maintenance
+// is needed around the transfers
+__BSS(SRAM_DTC) static uint8_t x4_frame_buffers[X4_FRAME_BUFFER_COUNT][X4_FRAME_BUFFER_SIZE];
+
+// Filler clocked out on MOSI while reading the frame (kept in RAM for the DMA)
+static uint8_t x4_spi_dma_dummy = 0;
+
+// Set while a DMA frame readout owns the X4 SPI bus
+static bool x4_spi_dma_active = false;
 
 // Stores the platform init results
 Platform_Status_t platform_status = {0};
@@ -88,6 +106,15 @@ Platform_Status_t platform_status = {0};
 // Flag to enable/disable LED
 uint8_t led_enable[2] = {true, true}; // Red & Green LEDs are enabled by default
 
+// Transfers up to this length use the polled SPI path
+static uint32_t spi_polled_max_length = X4_SPI_POLLED_MAX_LENGTH;
+
+// X4 SPI transfer statistics
+static Platform_SpiStats_t spi_stats = {0};
+
+// Task blocked waiting for the X4 data ready interrupt (NULL if none)
+static volatile TaskHandle_t x4_data_ready_task = NULL;
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Platform Functions
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -106,6 +133,12 @@ PLATFORM_STATUS_e platform__init()
 	CLOCK_EnableClock(kCLOCK_Trace);
 	//end edit for SWO
 
+	// Enable DWT cycle counter used for profiling
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
 	BOARD_InitBootPeripherals(); // peripherals
 
 	// Init FSL debug console
@@ -115,7 +148,7 @@ PLATFORM_STATUS_e platform__init()
 
 	NVIC_SetPriority(BOARD_X4_SPI_IRQ, 3);
 	NVIC_SetPriority(BOARD_I2C2_MASTER_IRQN, 4);
-	//NVIC_SetPriority(BOARD_X4_GPIO1_IRQ, 3);
+	NVIC_SetPriority(BOARD_X4_GPIO1_IRQ, 3); // uses FreeRTOS FromISR API
 
 	// Init LEDs
 	GPIO_PinInit(BOARD_INIT_LED_RED_GPIO, BOARD_INIT_LED_RED_PIN, &g_hal.gpio_led_red);
@@ -150,6 +183,12 @@ PLATFORM_STATUS_e platform__init()
 		platform_status.spi_fail = 1;
 	}
 
+	// Frame readout via eDMA (register accesses keep using the CPU paths)
+	if (init_x4_spi_dma(&g_hal) != 0) {
+		plat_stat |= PLATFORM_X4_SPI_OPEN_ERR;
+		platform_status.spi_fail = 1;
+	}
+
 	//
 	// Init I2C configuration
 	//
@@ -198,6 +237,91 @@ int32_t platform__get_timer_ticks()
 	return xTaskGetTickCount();
 }
 
+
+uint32_t platform__get_cycle_count()
+{
+	return DWT->CYCCNT;
+}
+
+
+uint32_t platform__get_run_time_us()
+{
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+
+	TickType_t ticks = xTaskGetTickCountFromISR();
+	uint32_t val = SysTick->VAL;
+
+	// The SysTick counter reloaded but its interrupt has not counted the tick
+	// yet, read the counter again as it may have reloaded after the first read
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+		ticks++;
+		val = SysTick->VAL;
+	}
+
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+
+	uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+	return ticks * (1000000U / configTICK_RATE_HZ) + (SysTick->LOAD - val) / cycles_per_us;
+}
+
+
+void platform__set_spi_polled_max_length(uint32_t length)
+{
+	spi_polled_max_length = length;
+}
+
+
+uint32_t platform__get_spi_polled_max_length()
+{
+	return spi_polled_max_length;
+}
+
+
+void platform__get_spi_stats(Platform_SpiStats_t *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = spi_stats;
+	taskEXIT_CRITICAL();
+}
+
+
+void platform__reset_spi_stats()
+{
+	taskENTER_CRITICAL();
+	memset(&spi_stats, 0, sizeof(spi_stats));
+	taskEXIT_CRITICAL();
+}
+
+
+uint8_t *platform__get_x4_frame_buffer(uint32_t index)
+{
+	if (index >= X4_FRAME_BUFFER_COUNT)
+		return NULL;
+
+	return x4_frame_buffers[index];
+}
+
+
+void platform__x4_data_ready_isr()
+{
+	BaseType_t higher_priority_task_woken = pdFALSE;
+	TaskHandle_t task = x4_data_ready_task;
+
+	if (task != NULL) {
+		xTaskNotifyFromISR(task, X4_DATA_READY_NOTIFY_BIT, eSetBits, &higher_priority_task_woken);
+		portYIELD_FROM_ISR(higher_priority_task_woken);
+	}
+}
+
+
+void platform__x4_data_ready_abort()
+{
+	TaskHandle_t task = x4_data_ready_task;
+
+	if (task != NULL)
+		xTaskNotify(task, X4_DATA_READY_NOTIFY_BIT, eSetBits);
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // LED Functions
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -360,14 +484,19 @@ int x4adapter_open(X4Driver_t **x4driver)
 	lock.object = (void*)xSemaphoreCreateRecursiveMutex();
 	lock.lock = x4driver_callback_take_sem;
 	lock.unlock = x4driver_callback_give_sem;
+	lock.owner = x4driver_callback_lock_owner;
 
-	// Setup timers
+	// Setup timers. The driver instance is attached as timer ID once created
 	X4DriverTimer_t timer_sweep;
-	timer_sweep.configure = NULL;
-	timer_sweep.object = NULL;
+	timer_sweep.configure = x4driver_callback_timer_configure;
+	timer_sweep.configured_frequency = 0;
+	timer_sweep.object = (void*)xTimerCreate("x4_sweep", 1, pdTRUE, NULL, x4_sweep_timer_callback);
 	X4DriverTimer_t timer_action;
-	timer_action.configure = NULL;
-	timer_action.object = NULL;
+	timer_action.configure = x4driver_callback_timer_configure;
+	timer_action.configured_frequency = 0;
+	timer_action.object = (void*)xTimerCreate("x4_action", 1, pdTRUE, NULL, x4_action_timer_callback);
+	if (timer_sweep.object == NULL || timer_action.object == NULL)
+		return PLATFORM_X4_DRIVER_OPEN_ERR;
 
 	// Setup X4Driver callbacks
 	X4DriverCallbacks_t x4driver_callbacks;
@@ -379,13 +508,18 @@ int x4adapter_open(X4Driver_t **x4driver)
 	x4driver_callbacks.notify_data_ready = x4driver_notify_data_ready;
 	x4driver_callbacks.trigger_sweep = x4driver_trigger_sweep_pin;
 	x4driver_callbacks.enable_data_ready_isr = x4driver_enable_ISR;
+	x4driver_callbacks.wait_data_ready = x4driver_callback_wait_data_ready;
+	x4driver_callbacks.spi_write_read_async = x4driver_callback_spi_write_read_async;
+	x4driver_callbacks.spi_wait = x4driver_callback_spi_wait;
 
 	// Allocate memory and create x4driver handle
 	void* x4driver_instance_memory = malloc(x4driver_get_instance_size());
 	x4driver_create(x4driver, x4driver_instance_memory, &x4driver_callbacks, &lock, &timer_sweep, &timer_action, (void*)&g_hal);
+	vTimerSetTimerID((TimerHandle_t)timer_sweep.object, (void*)*x4driver);
+	vTimerSetTimerID((TimerHandle_t)timer_action.object, (void*)*x4driver);
 
 	// Allocate memory for frame buffer
-	(*x4driver)->spi_buffer_size = FRAME_BUFFER_SIZE;
+	(*x4driver)->spi_buffer_size = X4_FRAME_BUFFER_SIZE;
 	(*x4driver)->spi_buffer = g_spi_buffer; // using fixed array...
 
 	return 0;
@@ -397,6 +531,8 @@ void x4adapter_close(X4Driver_t *x4driver)
 	// Free up allocated memory
 	free (x4driver->user_reference);
 	vSemaphoreDelete(x4driver->lock.object);
+	xTimerDelete((TimerHandle_t)x4driver->sweep_timer.object, portMAX_DELAY);
+	xTimerDelete((TimerHandle_t)x4driver->action_timer.object, portMAX_DELAY);
 	free (x4driver);
 }
 
@@ -430,8 +566,7 @@ uint32_t x4driver_callback_spi_write(void *user_reference, uint8_t *data, uint32
 		.configFlags = X4_SPI_MASTER_PCS_FOR_TRANSFER | kLPSPI_MasterPcsContinuous | kLPSPI_MasterByteSwap
 	};
 
-	int status = LPSPI_RTOS_Transfer(&hal->spi_x4_handle, &xfer);
-	return (status == kStatus_Success) ? 0 : -1;
+	return x4_spi_transfer(hal, &xfer);
 }
 
 
@@ -448,8 +583,7 @@ uint32_t x4driver_callback_spi_read(void *user_reference, uint8_t *data, uint32_
 		.configFlags = X4_SPI_MASTER_PCS_FOR_TRANSFER | kLPSPI_MasterPcsContinuous | kLPSPI_MasterByteSwap
 	};
 
-	int status = LPSPI_RTOS_Transfer(&hal->spi_x4_handle, &xfer);
-	return (status == kStatus_Success) ? 0 : -1;
+	return x4_spi_transfer(hal, &xfer);
 }
 
 
@@ -475,8 +609,7 @@ uint32_t x4driver_callback_spi_write_read(void *user_reference, uint8_t *wdata,
 			.configFlags = X4_SPI_MASTER_PCS_FOR_TRANSFER | kLPSPI_MasterPcsContinuous | kLPSPI_MasterByteSwap
 		};
 
-		int status = LPSPI_RTOS_Transfer(&hal->spi_x4_handle, &xfer);
-		return (status == kStatus_Success) ? 0 : -1;
+		return x4_spi_transfer(hal, &xfer);
 	}
 }
 
@@ -494,12 +627,130 @@ static uint32_t x4driver_local_spi_write_read_one(void *user_reference, uint8_t
 		.configFlags = X4_SPI_MASTER_PCS_FOR_TRANSFER | kLPSPI_MasterPcsContinuous | kLPSPI_MasterByteSwap
 	};
 
-	int status = LPSPI_RTOS_Transfer(&hal->spi_x4_handle, &xfer);
+	uint32_t status = x4_spi_transfer(hal, &xfer);
 	*rdata = rd_tmp[1];
+	return status;
+}
+
+
+static uint32_t x4_spi_transfer(Hal_t *hal, lpspi_transfer_t *xfer)
+{
+	status_t status;
+	uint32_t start = DWT->CYCCNT;
+
+	if (xfer->dataSize <= spi_polled_max_length) {
+		// Register accesses are only a few bytes, so the interrupt and semaphore
+		// wake-up of the RTOS driver cost far more than the transfer itself.
+		// Poll the LPSPI FIFOs in the calling task instead. The RTOS handle mutex
+		// is still taken so we never overlap a frame transfer in progress
+		if (xSemaphoreTake(hal->spi_x4_handle.mutex, portMAX_DELAY) != pdTRUE)
+			return -1;
+		status = LPSPI_MasterTransferBlocking(hal->spi_x4_handle.base, xfer);
+
+		// Updated before the mutex is given, the stream task and the USB task
+		// both transfer
+		uint32_t cycles = DWT->CYCCNT - start;
+		spi_stats.polled_transfers++;
+		spi_stats.polled_cycles += cycles;
+		if (cycles > spi_stats.polled_max_cycles)
+			spi_stats.polled_max_cycles = cycles;
+
+		xSemaphoreGive(hal->spi_x4_handle.mutex);
+	}
+	else {
+		status = LPSPI_RTOS_Transfer(&hal->spi_x4_handle, xfer);
+
+		// The RTOS driver has given its mutex by now
+		uint32_t cycles = DWT->CYCCNT - start;
+		taskENTER_CRITICAL();
+		spi_stats.rtos_transfers++;
+		spi_stats.rtos_cycles += cycles;
+		if (cycles > spi_stats.rtos_max_cycles)
+			spi_stats.rtos_max_cycles = cycles;
+		taskEXIT_CRITICAL();
+	}
+
 	return (status == kStatus_Success) ? 0 : -1;
 }
 
 
+uint32_t x4driver_callback_spi_write_read_async(void *user_reference, uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength)
+{
+	Hal_t *hal = user_reference;
+	LPSPI_Type *base = hal->spi_x4_handle.base;
+	edma_transfer_config_t config;
+
+	// The command bytes are pushed by the CPU ahead of the DMA stream. The TCR
+	// command word written below takes one FIFO entry
+	if (hal->spi_x4_dma_done == NULL || wlength >= LPSPI_GetTxFifoSize(base) || rlength == 0)
+		return x4driver_callback_spi_write_read(user_reference, wdata, wlength, rdata, rlength);
+
+	// Held until x4driver_callback_spi_wait() so no other transfer can start
+	if (xSemaphoreTake(hal->spi_x4_handle.mutex, portMAX_DELAY) != pdTRUE)
+		return -1;
+
+	xSemaphoreTake(hal->spi_x4_dma_done, 0);
+
+	LPSPI_Enable(base, false);
+	LPSPI_DisableDMA(base, kLPSPI_RxDmaEnable | kLPSPI_TxDmaEnable);
+	LPSPI_FlushFifo(base, true, true);
+	LPSPI_ClearStatusFlags(base, kLPSPI_AllStatusFlag);
+	LPSPI_SetFifoWatermarks(base, 0, 0);
+	LPSPI_Enable(base, true);
+
+	// Same framing as the CPU paths: 8 bit frames, PCS held for the whole read
+	base->TCR = (base->TCR & ~(LPSPI_TCR_CONT_MASK | LPSPI_TCR_CONTC_MASK | LPSPI_TCR_RXMSK_MASK |
+		LPSPI_TCR_TXMSK_MASK | LPSPI_TCR_PCS_MASK)) | LPSPI_TCR_CONT(1) | LPSPI_TCR_PCS(X4_SPI);
+
+	// Everything clocked in lands in rdata, including the command byte slots,
+	// which matches x4driver_callback_spi_write_read()
+	EDMA_PrepareTransfer(&config, (void *)LPSPI_GetRxRegisterAddress(base), 1, rdata, 1, 1, wlength + rlength,
+		kEDMA_PeripheralToMemory);
+	EDMA_SubmitTransfer(&hal->spi_x4_rx_dma, &config);
+
+	EDMA_PrepareTransfer(&config, (void *)&x4_spi_dma_dummy, 1, (void *)LPSPI_GetTxRegisterAddress(base), 1, 1, rlength,
+		kEDMA_MemoryToPeripheral);
+	config.srcOffset = 0;
+	EDMA_SubmitTransfer(&hal->spi_x4_tx_dma, &config);
+
+	EDMA_StartTransfer(&hal->spi_x4_rx_dma);
+	EDMA_StartTransfer(&hal->spi_x4_tx_dma);
+
+	for (uint32_t i = 0; i < wlength; i++)
+		LPSPI_WriteData(base, wdata[i]);
+
+	LPSPI_EnableDMA(base, kLPSPI_RxDmaEnable | kLPSPI_TxDmaEnable);
+
+	x4_spi_dma_active = true;
+	spi_stats.dma_transfers++;
+
+	return 0;
+}
+
+
+uint32_t x4driver_callback_spi_wait(void *user_reference, uint32_t timeout_ms)
+{
+	Hal_t *hal = user_reference;
+	uint32_t status = 0;
+
+	// Nothing to wait for if the transfer fell back to a blocking path
+	if (!x4_spi_dma_active)
+		return 0;
+
+	if (xSemaphoreTake(hal->spi_x4_dma_done, pdMS_TO_TICKS(timeout_ms) + 1) != pdTRUE) {
+		EDMA_AbortTransfer(&hal->spi_x4_rx_dma);
+		EDMA_AbortTransfer(&hal->spi_x4_tx_dma);
+		status = -1;
+	}
+
+	x4_spi_dma_stop(hal);
+	x4_spi_dma_active = false;
+	xSemaphoreGive(hal->spi_x4_handle.mutex);
+
+	return status;
+}
+
+
 void x4driver_callback_wait_us(uint32_t us)
 {
 	platform__delay_us(us);
@@ -531,6 +782,160 @@ void x4driver_enable_ISR(void *user_reference, uint32_t enable)
 	}
 }
 
+
+uint32_t x4driver_callback_wait_data_ready(void *user_reference, uint32_t timeout_ms)
+{
+	uint32_t bits = 0;
+	uint32_t other_bits = 0;
+	uint32_t ready = 0;
+	TickType_t ticks = (timeout_ms == 0) ? 0 : pdMS_TO_TICKS(timeout_ms);
+	TickType_t start = xTaskGetTickCount();
+
+	// The ISR notifies the last task that waited. Waiters register with a
+	// timeout of 0 before the sweep starts, so an early edge is not missed
+	x4_data_ready_task = xTaskGetCurrentTaskHandle();
+
+	// Round up so a short timeout still spans at least one tick
+	if (timeout_ms && ticks == 0)
+		ticks = 1;
+
+	for (;;) {
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		TickType_t remaining = (elapsed < ticks) ? (ticks - elapsed) : 0;
+
+		if (xTaskNotifyWait(0, X4_DATA_READY_NOTIFY_BIT, &bits, remaining) == pdFALSE)
+			break;
+
+		// Keep notifications meant for others
+		other_bits |= bits & ~X4_DATA_READY_NOTIFY_BIT;
+
+		if (bits & X4_DATA_READY_NOTIFY_BIT) {
+			ready = 1;
+			break;
+		}
+
+		if (remaining == 0)
+			break;
+	}
+
+	if (other_bits)
+		xTaskNotify(xTaskGetCurrentTaskHandle(), other_bits, eSetBits);
+
+	return ready;
+}
+
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+// X4DriverTimer_t Callback Functions
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+
+uint32_t x4driver_callback_timer_configure(void *timer, uint32_t frequency_hz)
+{
+	X4DriverTimer_t *x4_timer = timer;
+	TimerHandle_t handle = (TimerHandle_t)x4_timer->object;
+
+	if (handle == NULL)
+		return XEP_ERROR_X4DRIVER_NOT_SUPPORTED;
+
+	// Zero frequency stops the timer
+	if (frequency_hz == 0) {
+		xTimerStop(handle, 0);
+		x4_timer->configured_frequency = 0;
+		return XEP_ERROR_X4DRIVER_OK;
+	}
+
+	// Software timers run on the RTOS tick, so the period is rounded to ticks
+	TickType_t period = configTICK_RATE_HZ / frequency_hz;
+	if (period == 0)
+		period = 1;
+
+	// Also starts the timer if it was stopped
+	if (xTimerChangePeriod(handle, period, 0) != pdPASS)
+		return XEP_ERROR_X4DRIVER_BUSY;
+
+	x4_timer->configured_frequency = (float32_t)configTICK_RATE_HZ / period;
+	return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+static void x4_sweep_timer_callback(TimerHandle_t timer)
+{
+	X4Driver_t *x4driver = (X4Driver_t*)pvTimerGetTimerID(timer);
+
+	if (x4driver != NULL)
+		x4driver_start_sweep(x4driver);
+}
+
+
+static void x4_action_timer_callback(TimerHandle_t timer)
+{
+	X4Driver_t *x4driver = (X4Driver_t*)pvTimerGetTimerID(timer);
+
+	if (x4driver != NULL)
+		x4driver_on_action_event(x4driver);
+}
+
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+// X4 SPI eDMA Functions
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+
+static int init_x4_spi_dma(Hal_t *hal)
+{
+	edma_config_t edma_config;
+
+	hal->spi_x4_dma_done = xSemaphoreCreateBinary();
+	if (hal->spi_x4_dma_done == NULL)
+		return -1;
+
+	DMAMUX_Init(DMAMUX);
+	DMAMUX_SetSource(DMAMUX, X4_SPI_DMA_RX_CHANNEL, kDmaRequestMuxLPSPI4Rx);
+	DMAMUX_EnableChannel(DMAMUX, X4_SPI_DMA_RX_CHANNEL);
+	DMAMUX_SetSource(DMAMUX, X4_SPI_DMA_TX_CHANNEL, kDmaRequestMuxLPSPI4Tx);
+	DMAMUX_EnableChannel(DMAMUX, X4_SPI_DMA_TX_CHANNEL);
+
+	EDMA_GetDefaultConfig(&edma_config);
+	EDMA_Init(DMA0, &edma_config);
+
+	EDMA_CreateHandle(&hal->spi_x4_rx_dma, DMA0, X4_SPI_DMA_RX_CHANNEL);
+	EDMA_CreateHandle(&hal->spi_x4_tx_dma, DMA0, X4_SPI_DMA_TX_CHANNEL);
+
+	// Only the RX channel completes the transfer (last byte clocked in)
+	EDMA_SetCallback(&hal->spi_x4_rx_dma, x4_spi_dma_callback, hal);
+
+	// The completion callback uses FreeRTOS FromISR API
+	NVIC_SetPriority((IRQn_Type)(DMA0_DMA16_IRQn + X4_SPI_DMA_RX_CHANNEL), 3);
+	NVIC_SetPriority((IRQn_Type)(DMA0_DMA16_IRQn + X4_SPI_DMA_TX_CHANNEL), 3);
+
+	return 0;
+}
+
+
+static void x4_spi_dma_callback(edma_handle_t *handle, void *user_data, bool transfer_done, uint32_t tcds)
+{
+	Hal_t *hal = user_data;
+	BaseType_t higher_priority_task_woken = pdFALSE;
+
+	if (transfer_done) {
+		xSemaphoreGiveFromISR(hal->spi_x4_dma_done, &higher_priority_task_woken);
+		portYIELD_FROM_ISR(higher_priority_task_woken);
+	}
+}
+
+
+static void x4_spi_dma_stop(Hal_t *hal)
+{
+	LPSPI_Type *base = hal->spi_x4_handle.base;
+
+	LPSPI_DisableDMA(base, kLPSPI_RxDmaEnable | kLPSPI_TxDmaEnable);
+
+	// Clear CONT to release PCS, as the CPU paths do at the end of a transfer
+	base->TCR = (base->TCR & ~(LPSPI_TCR_CONTC_MASK | LPSPI_TCR_CONT_MASK));
+	while (LPSPI_GetStatusFlags(base) & kLPSPI_ModuleBusyFlag) {
+	}
+
+	LPSPI_FlushFifo(base, true, true);
+	LPSPI_ClearStatusFlags(base, kLPSPI_AllStatusFlag);
+}
+
 // ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
 // X4DriverLock_t Callback Functions
 // ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
@@ -545,3 +950,9 @@ void x4driver_callback_give_sem(void *sem)
 {
 	xSemaphoreGiveRecursive((SemaphoreHandle_t)sem);
 }
+
+
+void* x4driver_callback_lock_owner(void)
+{
+	return (void*)xTaskGetCurrentTaskHandle();
+}
@@ -25,6 +25,7 @@ Justin Hadella
 // Hardware includes
 #include "board.h"
 #include "fsl_lpspi_freertos.h"
+#include "fsl_edma.h"
 #include "fsl_lpi2c_freertos.h"
 #include "fsl_common.h"
 #include "fsl_gpio.h"
@@ -51,6 +52,9 @@ typedef struct Hal_t
 
 	lpspi_master_config_t spi_x4;
 	lpspi_rtos_handle_t spi_x4_handle;
+	edma_handle_t spi_x4_rx_dma;
+	edma_handle_t spi_x4_tx_dma;
+	SemaphoreHandle_t spi_x4_dma_done;
 
 	gpio_pin_config_t x4_en;
 	gpio_pin_config_t x4_gpio1;
@@ -65,6 +69,45 @@ typedef struct Hal_t
 // Platform Definitions
 // -----------------------------------------------------------------------------
 
+/**
+Default max length (in bytes) of an X4 SPI transfer done with the polled LPSPI
+path. Longer transfers (radar frame reads) use the interrupt driven RTOS path.
+Can be changed at runtime with platform__set_spi_polled_max_length()
+*/
+#ifndef X4_SPI_POLLED_MAX_LENGTH
+#define X4_SPI_POLLED_MAX_LENGTH 16
+#endif
+
+/**
+Number and size of the DMA capable X4 frame buffers, see
+platform__get_x4_frame_buffer(). Polled frames are unpacked before the next
+one is read, so one buffer is enough. Streaming reads into its own ring, see
+x4_stream.h
+*/
+#ifndef X4_FRAME_BUFFER_COUNT
+#define X4_FRAME_BUFFER_COUNT 1
+#endif
+#define X4_FRAME_BUFFER_SIZE (1535 * 4)
+
+/**
+eDMA channels used for X4 SPI frame readout
+*/
+#ifndef X4_SPI_DMA_RX_CHANNEL
+#define X4_SPI_DMA_RX_CHANNEL 0
+#endif
+#ifndef X4_SPI_DMA_TX_CHANNEL
+#define X4_SPI_DMA_TX_CHANNEL 1
+#endif
+
+/**
+Task notification bit used to signal the X4 data ready interrupt to the task
+waiting in x4driver_callback_wait_data_ready(). Other notification bits are
+left for the application.
+*/
+#ifndef X4_DATA_READY_NOTIFY_BIT
+#define X4_DATA_READY_NOTIFY_BIT (1UL << 31)
+#endif
+
 /**
 @enum PLATFORM_USER_LED_e
 */
@@ -115,6 +158,22 @@ typedef struct {
 
 } Platform_Status_t;
 
+/**
+@struct Platform_SpiStats_t
+This struct holds X4 SPI transfer counts and CPU cycles spent in them (DWT
+cycle counter, includes time blocked waiting for the transfer to complete)
+ */
+typedef struct {
+	uint32_t polled_transfers;
+	uint32_t polled_cycles;
+	uint32_t polled_max_cycles;
+	uint32_t rtos_transfers;
+	uint32_t rtos_cycles;
+	uint32_t rtos_max_cycles;
+	uint32_t dma_transfers;
+
+} Platform_SpiStats_t;
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Platform Functions
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -147,6 +206,76 @@ Function used to get local timer value specific to the hardware platform
 */
 int32_t platform__get_timer_ticks();
 
+/**
+Function used to get the CPU cycle counter (DWT CYCCNT)
+
+@return current cycle count, wraps at 2^32
+*/
+uint32_t platform__get_cycle_count();
+
+/**
+Function used to get the time since the scheduler started in microseconds, the
+FreeRTOS run time stats counter. It is built from the tick count and the
+SysTick counter, so it keeps counting however long no task switch reads it
+
+@note
+Callable from tasks and interrupts
+
+@return time in us, wraps at 2^32 (about 71 minutes)
+*/
+uint32_t platform__get_run_time_us();
+
+/**
+Function sets the max length of an X4 SPI transfer done with the polled path
+
+@param [in] length  Max transfer length in bytes, 0 disables the polled path
+*/
+void platform__set_spi_polled_max_length(uint32_t length);
+
+/**
+Function gets the max length of an X4 SPI transfer done with the polled path
+
+@return Max transfer length in bytes, 0 if the polled path is disabled
+*/
+uint32_t platform__get_spi_polled_max_length();
+
+/**
+Function gets the X4 SPI transfer statistics
+
+@param [out] *stats  Copy of the statistics
+*/
+void platform__get_spi_stats(Platform_SpiStats_t *stats);
+
+/**
+Function clears the X4 SPI transfer statistics
+*/
+void platform__reset_spi_stats();
+
+/**
+Function gets one of the DMA capable X4 frame buffers
+
+@param [in] index  Buffer index, 0 to X4_FRAME_BUFFER_COUNT - 1
+
+@return Pointer to X4_FRAME_BUFFER_SIZE bytes, NULL if index is out of range
+*/
+uint8_t *platform__get_x4_frame_buffer(uint32_t index);
+
+/**
+Function signals the X4 data ready interrupt to the task waiting for a frame
+
+@note
+Must be called from the X4 GPIO1 interrupt handler
+*/
+void platform__x4_data_ready_isr();
+
+/**
+Function wakes the task waiting for X4 data ready as if a frame was ready
+
+@note
+Used to stop a streaming task promptly. Must be called from task context
+*/
+void platform__x4_data_ready_abort();
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // LED Functions
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -278,6 +407,18 @@ void x4driver_callback_wait_us(uint32_t us);
 void x4driver_notify_data_ready(void *user_reference);
 uint32_t x4driver_trigger_sweep_pin(void *user_reference);
 void x4driver_enable_ISR(void *user_reference, uint32_t enable);
+uint32_t x4driver_callback_wait_data_ready(void *user_reference, uint32_t timeout_ms);
+uint32_t x4driver_callback_spi_write_read_async(void *user_reference, uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength);
+uint32_t x4driver_callback_spi_wait(void *user_reference, uint32_t timeout_ms);
+
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+// X4DriverTimer_t Callback Functions
+//
+// Note: These functions are not called directly by user code; they are called
+// indirectly by using the x4driver itself!
+// ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
+
+uint32_t x4driver_callback_timer_configure(void *timer, uint32_t frequency_hz);
 
 // ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
 // X4DriverLock_t Callback Functions
@@ -288,6 +429,7 @@ void x4driver_enable_ISR(void *user_reference, uint32_t enable);
 
 uint32_t x4driver_callback_take_sem(void *sem,uint32_t timeout);
 void x4driver_callback_give_sem(void *sem);
+void* x4driver_callback_lock_owner(void);
 
 #ifdef __cplusplus
 }
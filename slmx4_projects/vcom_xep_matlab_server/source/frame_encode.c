@@ -0,0 +1,331 @@
+/**
+@file frame_encode.c
+
+See header
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "frame_encode.h"
+
+#include <math.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define INT16_FULL_SCALE 32767
+
+// Mantissa bits below the sign in FRAME_FORMAT_BFP16
+#define BFP_MANTISSA_BITS 15
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static uint32_t encode_int16(float *data, uint32_t count, float *scale);
+static uint32_t encode_float16(float *data, uint32_t count);
+static uint32_t encode_bfp16(float *data, uint32_t count);
+static int16_t quantize(float x);
+static uint16_t float_to_half(float x);
+static float half_to_float(uint16_t h);
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int frame_encode(uint8_t format, float *data, uint32_t count, FrameDescriptor_t *descriptor)
+{
+	if (count > FRAME_ENCODE_MAX_VALUES) return FRAME_ENCODE_ERR_LENGTH;
+
+	descriptor->format = format;
+	descriptor->block_size = 0;
+	descriptor->count = count;
+	descriptor->scale = 1.0f;
+
+	switch (format) {
+	case FRAME_FORMAT_FLOAT32:
+		descriptor->value_size = sizeof(float);
+		descriptor->length = count * sizeof(float);
+		break;
+	case FRAME_FORMAT_INT16:
+		descriptor->value_size = sizeof(int16_t);
+		descriptor->length = encode_int16(data, count, &descriptor->scale);
+		break;
+	case FRAME_FORMAT_FLOAT16:
+		descriptor->value_size = sizeof(uint16_t);
+		descriptor->length = encode_float16(data, count);
+		break;
+	case FRAME_FORMAT_BFP16:
+		descriptor->value_size = sizeof(int16_t);
+		descriptor->block_size = FRAME_ENCODE_BFP_BLOCK;
+		descriptor->length = encode_bfp16(data, count);
+		break;
+	default:
+		return FRAME_ENCODE_ERR_FORMAT;
+	}
+
+	return FRAME_ENCODE_SUCCESS;
+}
+
+
+void frame_describe_counters(FrameDescriptor_t *descriptor, uint32_t count, uint8_t bytes_per_counter)
+{
+	descriptor->format = FRAME_FORMAT_COUNTERS;
+	descriptor->value_size = bytes_per_counter;
+	descriptor->block_size = 0;
+	descriptor->count = count;
+	descriptor->length = count * bytes_per_counter;
+	descriptor->scale = 1.0f;
+}
+
+
+uint32_t frame_encoded_length(uint8_t format, uint32_t count, uint8_t bytes_per_counter)
+{
+	switch (format) {
+	case FRAME_FORMAT_COUNTERS:
+		return count * bytes_per_counter;
+	case FRAME_FORMAT_INT16:
+	case FRAME_FORMAT_FLOAT16:
+		return count * sizeof(int16_t);
+	case FRAME_FORMAT_BFP16:
+		return count * sizeof(int16_t) + (count + FRAME_ENCODE_BFP_BLOCK - 1) / FRAME_ENCODE_BFP_BLOCK;
+	default:
+		return count * sizeof(float);
+	}
+}
+
+
+int frame_decode(const FrameDescriptor_t *descriptor, const uint8_t *data, float *values, uint32_t max_count)
+{
+	uint32_t count = descriptor->count;
+	if (count > max_count) return FRAME_ENCODE_ERR_LENGTH;
+
+	switch (descriptor->format) {
+	case FRAME_FORMAT_FLOAT32:
+		memcpy(values, data, count * sizeof(float));
+		break;
+	case FRAME_FORMAT_COUNTERS: {
+		uint32_t size = descriptor->value_size;
+		if (size == 0 || size > 8) return FRAME_ENCODE_ERR_FORMAT;
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint64_t counter = 0;
+			for (uint32_t b = 0; b < size; b++)
+				counter |= (uint64_t)data[i * size + b] << (8 * b);
+
+			// Baseband counters are unsigned, down converted ones signed
+			if (size <= 4) {
+				values[i] = (float)counter;
+			} else {
+				uint32_t shift = 64 - 8 * size;
+				values[i] = (float)((int64_t)(counter << shift) >> shift);
+			}
+		}
+		break;
+	}
+	case FRAME_FORMAT_INT16:
+		for (uint32_t i = 0; i < count; i++) {
+			int16_t q;
+			memcpy(&q, data + 2 * i, sizeof(q));
+			values[i] = q * descriptor->scale;
+		}
+		break;
+	case FRAME_FORMAT_FLOAT16:
+		for (uint32_t i = 0; i < count; i++) {
+			uint16_t h;
+			memcpy(&h, data + 2 * i, sizeof(h));
+			values[i] = half_to_float(h);
+		}
+		break;
+	case FRAME_FORMAT_BFP16: {
+		uint32_t block = descriptor->block_size;
+		if (block == 0) return FRAME_ENCODE_ERR_FORMAT;
+
+		const int8_t *exponents = (const int8_t *)(data + 2 * count);
+		for (uint32_t i = 0; i < count; i++) {
+			int16_t m;
+			memcpy(&m, data + 2 * i, sizeof(m));
+			values[i] = ldexpf((float)m, exponents[i / block]);
+		}
+		break;
+	}
+	default:
+		return FRAME_ENCODE_ERR_FORMAT;
+	}
+
+	return FRAME_ENCODE_SUCCESS;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function scales the frame to full scale int16. Every output value is written
+at or below the position of the float it came from, so the frame can be
+encoded in place
+*/
+static uint32_t encode_int16(float *data, uint32_t count, float *scale)
+{
+	float peak = 0.0f;
+	for (uint32_t i = 0; i < count; i++) {
+		float a = fabsf(data[i]);
+		if (a > peak)
+			peak = a;
+	}
+
+	*scale = (peak > 0.0f) ? peak / INT16_FULL_SCALE : 1.0f;
+	float inv_scale = 1.0f / *scale;
+
+	int16_t *out = (int16_t *)data;
+	for (uint32_t i = 0; i < count; i++)
+		out[i] = quantize(data[i] * inv_scale);
+
+	return count * sizeof(int16_t);
+}
+
+
+static uint32_t encode_float16(float *data, uint32_t count)
+{
+	uint16_t *out = (uint16_t *)data;
+	for (uint32_t i = 0; i < count; i++)
+		out[i] = float_to_half(data[i]);
+
+	return count * sizeof(uint16_t);
+}
+
+
+/**
+Function encodes blocks of FRAME_ENCODE_BFP_BLOCK values with a shared
+exponent. The exponents are collected and appended once every mantissa is
+written, as they would overwrite floats not yet read
+*/
+static uint32_t encode_bfp16(float *data, uint32_t count)
+{
+	int8_t exponents[(FRAME_ENCODE_MAX_VALUES + FRAME_ENCODE_BFP_BLOCK - 1) / FRAME_ENCODE_BFP_BLOCK];
+	uint32_t blocks = 0;
+	int16_t *out = (int16_t *)data;
+
+	for (uint32_t start = 0; start < count; start += FRAME_ENCODE_BFP_BLOCK) {
+		uint32_t end = start + FRAME_ENCODE_BFP_BLOCK;
+		if (end > count)
+			end = count;
+
+		float peak = 0.0f;
+		for (uint32_t i = start; i < end; i++) {
+			float a = fabsf(data[i]);
+			if (a > peak)
+				peak = a;
+		}
+
+		// Smallest exponent that keeps the block peak within the mantissa
+		int e = -128;
+		if (peak > 0.0f) {
+			int peak_exponent;
+			frexpf(peak, &peak_exponent);
+			e = peak_exponent - BFP_MANTISSA_BITS;
+			if (e < -128)
+				e = -128;
+			if (e > 127)
+				e = 127;
+		}
+
+		for (uint32_t i = start; i < end; i++)
+			out[i] = quantize(ldexpf(data[i], -e));
+
+		exponents[blocks++] = (int8_t)e;
+	}
+
+	memcpy((uint8_t *)data + count * sizeof(int16_t), exponents, blocks);
+
+	return count * sizeof(int16_t) + blocks;
+}
+
+
+/**
+Function rounds to the nearest int16, saturating at full scale
+*/
+static int16_t quantize(float x)
+{
+	float r = roundf(x);
+	if (r > INT16_FULL_SCALE)
+		return INT16_FULL_SCALE;
+	if (r < -INT16_FULL_SCALE)
+		return -INT16_FULL_SCALE;
+	return (int16_t)r;
+}
+
+
+/**
+Function converts to IEEE 754 half precision, rounding to nearest even.
+Values out of range become infinity, tiny values become subnormals or zero
+*/
+static uint16_t float_to_half(float x)
+{
+	uint32_t f;
+	memcpy(&f, &x, sizeof(f));
+
+	uint16_t sign = (f >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((f >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = f & 0x007fffff;
+
+	// NaN and infinity
+	if (((f >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+	if (exponent >= 31)
+		return sign | 0x7c00;
+
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return sign;
+
+		// Subnormal, shift the mantissa with its implicit bit into place
+		mantissa |= 0x00800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return sign | half;
+	}
+
+	uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++; // May carry into the exponent, up to infinity
+
+	return sign | half;
+}
+
+
+static float half_to_float(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	float x;
+
+	if (exponent == 0) {
+		x = ldexpf((float)mantissa, -24);
+		return sign ? -x : x;
+	}
+
+	uint32_t f;
+	if (exponent == 31)
+		f = sign | 0x7f800000 | (mantissa << 13);
+	else
+		f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+	memcpy(&x, &f, sizeof(x));
+	return x;
+}
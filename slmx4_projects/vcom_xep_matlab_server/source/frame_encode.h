@@ -0,0 +1,131 @@
+/**
+@file frame_encode.h
+
+Wire encodings for radar frames sent to a client
+
+A frame in any format other than FRAME_FORMAT_FLOAT32 is preceded on the wire
+by a FrameDescriptor_t that tells the client how to decode the data following
+it. All multi byte values are little endian.
+
+- FRAME_FORMAT_FLOAT32   count floats
+- FRAME_FORMAT_COUNTERS  count X4 counters of value_size bytes, as read from
+                         the radar. Counters of up to 4 bytes are unsigned
+                         baseband samples, wider ones are signed down
+                         converted I/Q (interleaved, Q not negated)
+- FRAME_FORMAT_INT16     count int16, value = q * scale
+- FRAME_FORMAT_FLOAT16   count IEEE 754 half floats
+- FRAME_FORMAT_BFP16     count int16 mantissas, then one int8 exponent per
+                         block_size values, value = m * 2^e
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef FRAME_ENCODE_h
+#define FRAME_ENCODE_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define FRAME_FORMAT_FLOAT32  0
+#define FRAME_FORMAT_COUNTERS 1
+#define FRAME_FORMAT_INT16    2
+#define FRAME_FORMAT_FLOAT16  3
+#define FRAME_FORMAT_BFP16    4
+#define FRAME_FORMAT_COUNT    5
+
+// Values sharing one exponent in FRAME_FORMAT_BFP16
+#define FRAME_ENCODE_BFP_BLOCK 16
+
+// Largest frame frame_encode() accepts
+#define FRAME_ENCODE_MAX_VALUES 1536
+
+#define FRAME_ENCODE_SUCCESS    0
+#define FRAME_ENCODE_ERR_FORMAT 1
+#define FRAME_ENCODE_ERR_LENGTH 2
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct FrameDescriptor_t
+Describes the encoded frame that follows it on the wire
+*/
+typedef struct {
+	uint8_t format;      // FRAME_FORMAT_*
+	uint8_t value_size;  // Bytes per value (mantissa for FRAME_FORMAT_BFP16)
+	uint16_t block_size; // Values per exponent for FRAME_FORMAT_BFP16, else 0
+	uint32_t count;      // Number of values
+	uint32_t length;     // Bytes of encoded data following the descriptor
+	float scale;         // Value of one step for FRAME_FORMAT_INT16, else 1
+
+} FrameDescriptor_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function encodes a float frame in place
+
+@note
+The encoded data starts at data and is never longer than the float frame.
+FRAME_FORMAT_COUNTERS does not come from floats, see frame_describe_counters()
+
+@param [in]      format      FRAME_FORMAT_FLOAT32, _INT16, _FLOAT16 or _BFP16
+@param [in,out] *data        Frame, overwritten with the encoded data
+@param [in]      count       Number of floats in the frame
+@param [out]    *descriptor  Descriptor of the encoded data
+
+@return FRAME_ENCODE_SUCCESS on success, error code on failure
+*/
+int frame_encode(uint8_t format, float *data, uint32_t count, FrameDescriptor_t *descriptor);
+
+/**
+Function fills the descriptor of a frame of raw X4 counters
+
+@param [out] *descriptor         Descriptor of the counters
+@param [in]   count              Number of counters
+@param [in]   bytes_per_counter  Size of one counter
+*/
+void frame_describe_counters(FrameDescriptor_t *descriptor, uint32_t count, uint8_t bytes_per_counter);
+
+/**
+Function gets the size of an encoded frame without encoding it
+
+@param [in] format             FRAME_FORMAT_*
+@param [in] count              Number of values
+@param [in] bytes_per_counter  Size of one counter for FRAME_FORMAT_COUNTERS
+
+@return Bytes of encoded data, excluding the descriptor
+*/
+uint32_t frame_encoded_length(uint8_t format, uint32_t count, uint8_t bytes_per_counter);
+
+/**
+Function decodes an encoded frame to floats
+
+@param [in]  *descriptor  Descriptor received with the frame
+@param [in]  *data        Encoded data
+@param [out] *values      Decoded frame, descriptor->count floats
+@param [in]   max_count   Size of values
+
+@return FRAME_ENCODE_SUCCESS on success, error code on failure
+*/
+int frame_decode(const FrameDescriptor_t *descriptor, const uint8_t *data, float *values, uint32_t max_count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // FRAME_ENCODE_h
@@ -31,6 +31,15 @@ Compiler Independent
 
 // Local include
 #include "x4_post_norm.h"
+#include "x4_stream.h"
+#include "x4_capture.h"
+#include "x4_clutter.h"
+#include "x4_doppler.h"
+#include "x4_integrate.h"
+#include "usb_tx_queue.h"
+#include "usb_rx_queue.h"
+#include "frame_encode.h"
+#include "mat_protocol.h"
 
 #include <cr_section_macros.h>
 
@@ -51,6 +60,110 @@ Compiler Independent
 // The X4 PLL is locked to 243 MHz
 #define X4_FIXED_PLL (243e6)
 
+// StartStreaming() modes, same data as GetFrameRaw() and GetFrameNormalized()
+#define STREAM_MODE_RAW        0
+#define STREAM_MODE_NORMALIZED 1
+
+// Stream of range-Doppler maps, see StartDoppler_x4()
+#define STREAM_MODE_DOPPLER    2
+
+// Most tasks CpuStats() reports
+#define CPU_STATS_MAX_TASKS 12
+
+// Time a Doppler map waits for each transmit slot after its first
+#define DOPPLER_SLOT_TIMEOUT_MS 1000
+
+// Most frame bytes usb_frame_submit() fits in one packet, after the headroom
+// and before "<ACK>"
+#define USB_FRAME_MAX_LENGTH (USB_TX_QUEUE_SLOT_SIZE - USB_TX_QUEUE_HEADROOM - 5)
+
+// Size of each field parse_user_command() splits a command into
+#define MAT_ARG_MAX_LENGTH 100
+
+// Longest reply of GetAllVariables() and ListVariables(1)
+#define MAT_VARS_REPLY_LENGTH 1024
+
+// Time ReadCapture() waits for each transmit slot. The message is already
+// under way, so it waits longer than a single reply would
+#define CAPTURE_SLOT_TIMEOUT_MS 1000
+
+/**
+@struct StreamHeader_t
+Header following the "<STR>" tag of every streamed frame. The frame follows as
+bins floats, or as a FrameDescriptor_t and the encoded frame when frame_format
+is not FRAME_FORMAT_FLOAT32, then "<ACK>"
+*/
+typedef struct {
+	uint32_t sequence;      // Packet number since StartStreaming(), starts at 0
+	uint32_t frame_counter; // X4 frame counter
+	uint32_t timestamp;     // Time the frame was read in ms
+	uint32_t dropped;       // Frames dropped since StartStreaming()
+	uint32_t bins;          // Number of values in the frame
+
+} StreamHeader_t;
+
+/**
+@struct DopplerHeader_t
+Header following the "<DOP>" tag of every range-Doppler packet. With cells 0
+the map follows as bins rows of frames magnitudes, each row encoded like a
+stream frame. Otherwise cells X4DopplerCell_t follow, strongest first. Then
+"<ACK>"
+*/
+typedef struct {
+	uint32_t sequence;      // Packet number since StartDoppler(), starts at 0
+	uint32_t frame_counter; // X4 frame counter of the newest frame in the map
+	uint32_t timestamp;     // Time the newest frame was read in ms
+	uint32_t dropped;       // Frames dropped since StartDoppler()
+	uint32_t bins;          // Range bins
+	uint32_t frames;        // Frames in the map, its Doppler cells per range bin
+	uint32_t cells;         // Cells that follow, 0 when the map follows
+	uint32_t format;        // frame_format of the map rows, FRAME_FORMAT_*
+
+} DopplerHeader_t;
+
+/**
+@struct CaptureHeader_t
+Header following the "<CAP>" tag of ReadCapture(). count frames follow, each
+as a CaptureRecord_t and the frame encoded like a stream frame, then "<ACK>"
+*/
+typedef struct {
+	uint32_t first;   // Capture index of the first frame
+	uint32_t count;   // Number of frames
+	uint32_t bins;    // Number of values in each frame
+	uint32_t format;  // frame_format of the frames, FRAME_FORMAT_*
+	uint32_t dropped; // Frames dropped during the capture
+
+} CaptureHeader_t;
+
+/**
+@struct CaptureRecord_t
+Metadata in front of every frame of ReadCapture()
+*/
+typedef struct {
+	uint32_t index;         // Capture index
+	uint32_t frame_counter; // X4 frame counter
+	uint32_t timestamp;     // Time the frame was read in ms
+	uint32_t length;        // Bytes of frame following, descriptor included
+
+} CaptureRecord_t;
+
+/**
+@struct MatVar_t
+Variable registry entry
+*/
+typedef struct {
+	const char *name;              // Name in the text interface
+	const char *alias;             // Other accepted name, NULL if none
+	uint8_t type;                  // MAT_VALUE_INT or MAT_VALUE_FLOAT
+	const char *units;             // SI units of the value, "" for counts and settings
+	int (*get)(MatValue_t *value); // Returns an X4 driver error code
+	int (*set)(MatValue_t value);  // NULL for read only variables
+
+} MatVar_t;
+
+// Answers a binary request, see mat_protocol.h
+typedef void (*MatBinHandler_t)(const MatBinRequest_t *request, MatBinResponse_t *response);
+
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 // External Variables
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
@@ -78,11 +191,38 @@ static bool isOpen = false;
 // Flag indicates whether DDC is enabled
 static bool ddc_en = false;
 
-// Storage for USB data to transmit
-static uint8_t usb_tx_buf[4 * 1536 + 5];
+// Transmit queue slot being filled by usb_write_buf(), sent by usb_write()
+static uint8_t *usb_tx_slot = NULL;
+
+// What happens to streamed frames when every transmit slot is in use
+static UsbTxDropPolicy_t tx_drop_policy = USB_TX_DROP_NEWEST;
+
+// Wire encoding of frames, FRAME_FORMAT_FLOAT32 sends them without descriptor
+static uint8_t frame_format = FRAME_FORMAT_FLOAT32;
+
+// Warning left by a variable setter, e.g. for a discouraged setting
+static char var_warning[100];
+
+// Frame streaming state, see StartStreaming_x4()
+static int stream_mode = STREAM_MODE_RAW;
+static int stream_bins = 0;
+static uint32_t stream_sequence = 0;
 
-// Stores the radar signal data
-static float x[1536]; // DDC_EN == 1
+// Range-Doppler stream state, see StartDoppler_x4()
+static uint32_t doppler_frames = 0;
+static uint32_t doppler_cells = 0;
+
+// Settings the capture was taken with, see CaptureFrames_x4(). The frames are
+// unpacked with the settings of the radar when they are read
+static int capture_mode = STREAM_MODE_RAW;
+static int capture_bins = 0;
+static uint32_t capture_read_size = 0;
+static bool capture_ddc_en = false;
+
+// Run time counters at the previous CpuStats(), see CpuStats_x4()
+static TaskHandle_t cpu_stats_tasks[CPU_STATS_MAX_TASKS];
+static uint32_t cpu_stats_counters[CPU_STATS_MAX_TASKS];
+static uint32_t cpu_stats_total = 0;
 
 // -----------------------------------------------------------------------------
 // Function Prototypes
@@ -91,7 +231,8 @@ static float x[1536]; // DDC_EN == 1
 static bool memory_allocation_ok();
 static void free_memory();
 
-static void parse_user_command(char* buf, int n, char* cmd, char* arg1, char* arg2, char* arg3);
+static int next_command(uint8_t *cmd);
+static void parse_user_command(char* buf, int n, char* cmd, char* arg1, char* arg2, char* arg3, char* params);
 
 static int InitHandle_x4();
 static int OpenRadar_x4();
@@ -99,18 +240,101 @@ static int CloseRadar_x4();
 
 static int VarGetValue_ByName_x4(char* var_name);
 static int VarSetValue_ByName_x4(char* var_name, char* var_value);
+static int GetAllVariables_x4();
+static int SetVariables_x4(char* params);
 
 static int GetFrameRaw_x4();
 static int GetFrameNormalized_x4();
 
-static int ListVariables_x4();
+static int ListVariables_x4(int details);
 static int RegisterRead_x4(int address);
 static int ResetAllVars_x4();
 
 static int GetRegisterProperties_x4(char *name);
-
+static int SpiBenchmark_x4(int iterations);
+static int LockBenchmark_x4(int iterations);
+static int CpuStats_x4();
+
+static int StartStreaming_x4(float fps, int mode);
+static int StopStreaming_x4();
+static int StartDoppler_x4(float fps, int frames, int cells);
+static bool stream_doppler_frame(const X4StreamFrame_t *frame);
+static int write_doppler_map(const DopplerHeader_t *header);
+static int write_doppler_cells(const DopplerHeader_t *header);
+
+static int CaptureFrames_x4(int frames, float fps, int mode);
+static int CaptureStatus_x4();
+static int StopCapture_x4();
+static int ReadCapture_x4(int first, int count);
+static int write_capture_frame(uint32_t index, uint32_t length);
+
+static int sweep_frame(X4Driver_t* x4driver);
+static int read_frame_bytes(X4Driver_t* x4driver, uint8_t *raw);
 static int get_frame_normalized(X4Driver_t* x4driver, float *frame, int n);
 static int get_frame_raw(X4Driver_t* x4driver, float *frame, int n);
+static int get_frame_counters(X4Driver_t* x4driver, uint8_t *counters, FrameDescriptor_t *descriptor);
+static int get_frame_encoded(bool normalized, FrameDescriptor_t *descriptor);
+static bool counters_integrable(uint32_t count);
+
+static const MatVar_t *find_variable(const char *name);
+static int format_variable(const MatVar_t *var, const MatValue_t *value, char *buf, size_t size);
+static int parse_variable(const MatVar_t *var, const char *text, MatValue_t *value);
+static void update_frame_state();
+static int var_get_dac_min(MatValue_t *value);
+static int var_set_dac_min(MatValue_t value);
+static int var_get_dac_max(MatValue_t *value);
+static int var_set_dac_max(MatValue_t value);
+static int var_get_dac_step(MatValue_t *value);
+static int var_set_dac_step(MatValue_t value);
+static int var_get_pps(MatValue_t *value);
+static int var_set_pps(MatValue_t value);
+static int var_get_iterations(MatValue_t *value);
+static int var_set_iterations(MatValue_t value);
+static int var_get_prf(MatValue_t *value);
+static int var_get_prf_div(MatValue_t *value);
+static int var_set_prf_div(MatValue_t value);
+static int var_get_fs(MatValue_t *value);
+static int var_get_samplers_per_frame(MatValue_t *value);
+static int var_get_frame_length(MatValue_t *value);
+static int var_set_frame_length(MatValue_t value);
+static int var_get_rx_wait(MatValue_t *value);
+static int var_set_rx_wait(MatValue_t value);
+static int var_get_tx_region(MatValue_t *value);
+static int var_set_tx_region(MatValue_t value);
+static int var_get_tx_power(MatValue_t *value);
+static int var_set_tx_power(MatValue_t value);
+static int var_get_ddc_en(MatValue_t *value);
+static int var_set_ddc_en(MatValue_t value);
+static int var_get_frame_offset(MatValue_t *value);
+static int var_set_frame_offset(MatValue_t value);
+static int var_get_frame_start(MatValue_t *value);
+static int var_set_frame_start(MatValue_t value);
+static int var_get_frame_end(MatValue_t *value);
+static int var_set_frame_end(MatValue_t value);
+static int var_get_sweep_time(MatValue_t *value);
+static int var_get_unambiguous_range(MatValue_t *value);
+static int var_get_res(MatValue_t *value);
+static int var_get_fs_rf(MatValue_t *value);
+static int var_get_tx_drop_policy(MatValue_t *value);
+static int var_set_tx_drop_policy(MatValue_t value);
+static int var_get_frame_format(MatValue_t *value);
+static int var_set_frame_format(MatValue_t value);
+static int var_get_clutter_mode(MatValue_t *value);
+static int var_set_clutter_mode(MatValue_t value);
+static int var_get_clutter_alpha(MatValue_t *value);
+static int var_set_clutter_alpha(MatValue_t value);
+static int var_get_clutter_capture(MatValue_t *value);
+static int var_set_clutter_capture(MatValue_t value);
+static int var_get_integrate_frames(MatValue_t *value);
+static int var_set_integrate_frames(MatValue_t value);
+
+static void handle_binary_request(const uint8_t *buf, int n);
+static void bin_ping(const MatBinRequest_t *request, MatBinResponse_t *response);
+static void bin_var_get(const MatBinRequest_t *request, MatBinResponse_t *response);
+static void bin_var_set(const MatBinRequest_t *request, MatBinResponse_t *response);
+static void bin_get_frame_raw(const MatBinRequest_t *request, MatBinResponse_t *response);
+static void bin_get_frame_normalized(const MatBinRequest_t *request, MatBinResponse_t *response);
+static void bin_get_frame(bool normalized, MatBinResponse_t *response);
 
 static int connector_version();
 static int write_warning(const char* warning);
@@ -121,12 +345,62 @@ static int write_ack();
 static int write_error(const char* error);
 static int write_binary(const void* data, int data_len);
 static int write_data(const char* data);
+static int write_binary_frame(const FrameDescriptor_t *descriptor);
+static int write_stream_frame(const StreamHeader_t *header, const FrameDescriptor_t *descriptor);
+static int write_bin_response(const MatBinResponse_t *response);
+static int write_bin_frame(MatBinResponse_t *response, const FrameDescriptor_t *descriptor);
 static int set_io_pin_dir(int bank, int pin, int direction);
 static int write_io_pin(int bank, int pin, int val);
 static int read_io_pin(int bank, int pin, int* val);
 
 static void usb_write_buf(uint8_t *buf, uint32_t buf_len, uint32_t *offset);
-static int  usb_write(size_t n);
+static int  usb_write(size_t n, bool droppable);
+static float *usb_frame_acquire(uint32_t timeout_ms);
+static int  usb_frame_submit(const void *prefix, uint32_t prefix_len, uint32_t data_len, bool droppable, bool packet);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Variable Registry
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Variables by MatVarId_t, shared by the text and binary interfaces
+static const MatVar_t mat_vars[MAT_VAR_COUNT] = {
+	[MAT_VAR_DAC_MIN]            = {"DACMin",            "dac_min",     MAT_VALUE_INT,   "",    var_get_dac_min,            var_set_dac_min},
+	[MAT_VAR_DAC_MAX]            = {"DACMax",            "dac_max",     MAT_VALUE_INT,   "",    var_get_dac_max,            var_set_dac_max},
+	[MAT_VAR_DAC_STEP]           = {"DACStep",           "dac_step",    MAT_VALUE_INT,   "",    var_get_dac_step,           var_set_dac_step},
+	[MAT_VAR_PPS]                = {"PPS",               "pps",         MAT_VALUE_INT,   "",    var_get_pps,                var_set_pps},
+	[MAT_VAR_ITERATIONS]         = {"Iterations",        "iterations",  MAT_VALUE_INT,   "",    var_get_iterations,         var_set_iterations},
+	[MAT_VAR_PRF]                = {"PRF",               "prf",         MAT_VALUE_FLOAT, "Hz",  var_get_prf,                NULL},
+	[MAT_VAR_PRF_DIV]            = {"prf_div",           NULL,          MAT_VALUE_INT,   "",    var_get_prf_div,            var_set_prf_div},
+	[MAT_VAR_FS]                 = {"SamplingRate",      "fs",          MAT_VALUE_FLOAT, "Hz",  var_get_fs,                 NULL},
+	[MAT_VAR_SAMPLERS_PER_FRAME] = {"SamplersPerFrame",  "num_samples", MAT_VALUE_INT,   "",    var_get_samplers_per_frame, NULL},
+	[MAT_VAR_FRAME_LENGTH]       = {"frame_length",      NULL,          MAT_VALUE_INT,   "",    var_get_frame_length,       var_set_frame_length},
+	[MAT_VAR_RX_WAIT]            = {"RxWait",            "rx_wait",     MAT_VALUE_INT,   "",    var_get_rx_wait,            var_set_rx_wait},
+	[MAT_VAR_TX_REGION]          = {"TxRegion",          "tx_region",   MAT_VALUE_INT,   "",    var_get_tx_region,          var_set_tx_region},
+	[MAT_VAR_TX_POWER]           = {"tx_power",          NULL,          MAT_VALUE_INT,   "",    var_get_tx_power,           var_set_tx_power},
+	[MAT_VAR_DDC_EN]             = {"DownConvert",       "ddc_en",      MAT_VALUE_INT,   "",    var_get_ddc_en,             var_set_ddc_en},
+	[MAT_VAR_FRAME_OFFSET]       = {"frame_offset",      NULL,          MAT_VALUE_FLOAT, "m",   var_get_frame_offset,       var_set_frame_offset},
+	[MAT_VAR_FRAME_START]        = {"frame_start",       NULL,          MAT_VALUE_FLOAT, "m",   var_get_frame_start,        var_set_frame_start},
+	[MAT_VAR_FRAME_END]          = {"frame_end",         NULL,          MAT_VALUE_FLOAT, "m",   var_get_frame_end,          var_set_frame_end},
+	[MAT_VAR_SWEEP_TIME]         = {"sweep_time",        NULL,          MAT_VALUE_FLOAT, "s",   var_get_sweep_time,         NULL},
+	[MAT_VAR_UNAMBIGUOUS_RANGE]  = {"unambiguous_range", "ur",          MAT_VALUE_FLOAT, "m",   var_get_unambiguous_range,  NULL},
+	[MAT_VAR_RES]                = {"res",               NULL,          MAT_VALUE_FLOAT, "m",   var_get_res,                NULL},
+	[MAT_VAR_FS_RF]              = {"fs_rf",             NULL,          MAT_VALUE_FLOAT, "Hz",  var_get_fs_rf,              NULL},
+	[MAT_VAR_TX_DROP_POLICY]     = {"tx_drop_policy",    NULL,          MAT_VALUE_INT,   "",    var_get_tx_drop_policy,     var_set_tx_drop_policy},
+	[MAT_VAR_FRAME_FORMAT]       = {"frame_format",      NULL,          MAT_VALUE_INT,   "",    var_get_frame_format,       var_set_frame_format},
+	[MAT_VAR_CLUTTER_MODE]       = {"clutter_mode",      NULL,          MAT_VALUE_INT,   "",    var_get_clutter_mode,       var_set_clutter_mode},
+	[MAT_VAR_CLUTTER_ALPHA]      = {"clutter_alpha",     NULL,          MAT_VALUE_FLOAT, "",    var_get_clutter_alpha,      var_set_clutter_alpha},
+	[MAT_VAR_CLUTTER_CAPTURE]    = {"clutter_capture",   NULL,          MAT_VALUE_INT,   "",    var_get_clutter_capture,    var_set_clutter_capture},
+	[MAT_VAR_INTEGRATE_FRAMES]   = {"integrate_frames",  NULL,          MAT_VALUE_INT,   "",    var_get_integrate_frames,   var_set_integrate_frames},
+};
+
+// Binary request handlers by MatOpcode_t
+static const MatBinHandler_t bin_handlers[MAT_OP_COUNT] = {
+	[MAT_OP_PING]                 = bin_ping,
+	[MAT_OP_VAR_GET]              = bin_var_get,
+	[MAT_OP_VAR_SET]              = bin_var_set,
+	[MAT_OP_GET_FRAME_RAW]        = bin_get_frame_raw,
+	[MAT_OP_GET_FRAME_NORMALIZED] = bin_get_frame_normalized,
+};
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Public Functions
@@ -149,22 +423,63 @@ void handle_client_init()
 }
 
 
+void handle_client_rx()
+{
+	uint8_t cmd[MAT_CMD_MAX_LENGTH];
+
+	for (;;)
+	{
+		int n = next_command(cmd);
+		if (n == 0)
+			break;
+
+		if (n > 0)
+			handle_client_request(cmd, n);
+	}
+}
+
+
 void handle_client_request(uint8_t *buf, int n)
 {
 	// Define some vars to use in parsing....
 	int ind = 0;
 
-	char cmd[100];     // Parsed command string
-	char arg1[100];    // First argument of the command
-	char arg2[100];    // Second argument of the command
-	char arg3[100];    // Third argument of the command
+	char cmd[MAT_ARG_MAX_LENGTH];     // Parsed command string
+	char arg1[MAT_ARG_MAX_LENGTH];    // First argument of the command
+	char arg2[MAT_ARG_MAX_LENGTH];    // Second argument of the command
+	char arg3[MAT_ARG_MAX_LENGTH];    // Third argument of the command
+	char params[MAT_CMD_MAX_LENGTH];  // All of the arguments, not split
 
 	int dummy;
 
-	parse_user_command(buf, n, cmd, arg1, arg2, arg3);
+	// Binary requests skip the text parser
+	if (n > 0 && buf[0] == MAT_BIN_MAGIC)
+	{
+		handle_binary_request(buf, n);
+		memset(buf, 0, n);
+		return;
+	}
+
+	parse_user_command(buf, n, cmd, arg1, arg2, arg3, params);
 //	printf("~~ cmd = <%s>\n", buf);
 	memset(buf, 0, n);
 
+	// A capture owns the radar until it finishes, the stream until it is
+	// stopped. CpuStats() is meant to be used meanwhile
+	if (x4_capture_is_running())
+	{
+		if (strcmp("CaptureStatus", cmd) != 0 && strcmp("StopCapture", cmd) != 0 && strcmp("Close", cmd) != 0 && strcmp("CpuStats", cmd) != 0)
+		{
+			write_error("ERROR: Capture active");
+			return;
+		}
+	}
+	else if (x4_stream_is_running() && strcmp("StopStreaming", cmd) != 0 && strcmp("Close", cmd) != 0 && strcmp("CpuStats", cmd) != 0)
+	{
+		write_error("ERROR: Streaming active");
+		return;
+	}
+
 	// Handle the user's command
 	if (strcmp("VarGetValue_ByName", cmd) == 0)
 		VarGetValue_ByName_x4(arg1);
@@ -178,8 +493,12 @@ void handle_client_request(uint8_t *buf, int n)
 		GetFrameNormalized_x4();
 	else if (strcmp("VarSetValue_ByName", cmd) == 0)
 		VarSetValue_ByName_x4(arg1, arg2);
+	else if (strcmp("GetAllVariables", cmd) == 0)
+		GetAllVariables_x4();
+	else if (strcmp("SetVariables", cmd) == 0)
+		SetVariables_x4(params);
 	else if (strcmp("ListVariables", cmd) == 0)
-		ListVariables_x4();
+		ListVariables_x4(atoi(arg1));
 	else if (strcmp("RegisterRead", cmd) == 0)
 		RegisterRead_x4(atoi(arg1));
 	else if (strcmp("VarsResetAllToDefault", cmd) == 0)
@@ -200,10 +519,120 @@ void handle_client_request(uint8_t *buf, int n)
 		read_io_pin(atoi(arg1), atoi(arg2), &dummy);//?? need a return -- this won't compile!
 	else if (strcmp("GetRegisterProperties", cmd) == 0)
 		GetRegisterProperties_x4(arg1);
+	else if (strcmp("SpiBenchmark", cmd) == 0)
+		SpiBenchmark_x4(atoi(arg1));
+	else if (strcmp("LockBenchmark", cmd) == 0)
+		LockBenchmark_x4(atoi(arg1));
+	else if (strcmp("CpuStats", cmd) == 0)
+		CpuStats_x4();
+	else if (strcmp("StartStreaming", cmd) == 0)
+		StartStreaming_x4(atof(arg1), atoi(arg2));
+	else if (strcmp("StopStreaming", cmd) == 0)
+		StopStreaming_x4();
+	else if (strcmp("StartDoppler", cmd) == 0)
+		StartDoppler_x4(atof(arg1), atoi(arg2), atoi(arg3));
+	else if (strcmp("CaptureFrames", cmd) == 0)
+		CaptureFrames_x4(atoi(arg1), atof(arg2), atoi(arg3));
+	else if (strcmp("CaptureStatus", cmd) == 0)
+		CaptureStatus_x4();
+	else if (strcmp("StopCapture", cmd) == 0)
+		StopCapture_x4();
+	else if (strcmp("ReadCapture", cmd) == 0)
+		ReadCapture_x4(atoi(arg1), atoi(arg2));
 	else
 		write_error("Invalid and/or Unimplemented Command");
 }
 
+
+bool handle_client_stream()
+{
+	static float partial[X4_INTEGRATE_MAX_VALUES];
+
+	// Frames of a capture go to SDRAM, not to the client
+	if (!x4_stream_is_running() || x4_capture_is_running())
+		return false;
+
+	X4StreamFrame_t frame;
+	if (x4_stream_get_frame(&frame, 0) != X4_STREAM_SUCCESS)
+		return false;
+
+	if (stream_mode == STREAM_MODE_DOPPLER)
+		return stream_doppler_frame(&frame);
+
+	// Only the frame completing an integrated frame needs a transmit slot,
+	// the others are added up out of partial
+	bool integrating = x4_integrate_get_frames() > 1;
+	bool send = true;
+
+	// No free slot leaves the frame in the stream ring until one frees up,
+	// unless the drop policy gives up an older queued frame
+	float *data = (!integrating || x4_integrate_completes()) ? usb_frame_acquire(0) : partial;
+	if (data == NULL)
+		return false;
+
+	// Unpack and encode straight into the transmit slot
+	int status = 0;
+	FrameDescriptor_t descriptor;
+	if (frame_format == FRAME_FORMAT_COUNTERS)
+	{
+		uint32_t count = frame.length / x4->bytes_per_counter;
+
+		// StartStreaming_x4() checked that the counters can be integrated
+		if (integrating)
+		{
+			send = x4_integrate_add_counters(frame.data, count, x4->bytes_per_counter, (uint8_t *)data);
+			frame_describe_counters(&descriptor, count, x4_integrate_sum_size(x4->bytes_per_counter));
+		}
+		else
+		{
+			frame_describe_counters(&descriptor, count, x4->bytes_per_counter);
+			memcpy(data, frame.data, descriptor.length);
+		}
+	}
+	else
+	{
+		if (stream_mode == STREAM_MODE_NORMALIZED)
+			status = x4driver_unpack_frame_normalized(x4, frame.data, frame.length, data, stream_bins);
+		else
+			status = x4driver_unpack_frame_raw(x4, frame.data, frame.length, data, stream_bins);
+
+		if (status == 0)
+			send = x4_integrate_add_f32(data, stream_bins);
+
+		if (status == 0 && send && stream_mode == STREAM_MODE_NORMALIZED)
+			x4_clutter_apply(data, stream_bins);
+
+		if (status == 0 && send)
+			status = frame_encode(frame_format, data, stream_bins, &descriptor);
+	}
+
+	X4StreamStats_t stats;
+	x4_stream_get_stats(&stats);
+
+	StreamHeader_t header;
+	header.sequence = stream_sequence;
+	header.frame_counter = frame.frame_counter;
+	header.timestamp = frame.timestamp * portTICK_PERIOD_MS;
+	header.dropped = stats.dropped;
+	header.bins = stream_bins;
+
+	// Hand the raw frame back before the USB transfer
+	x4_stream_release_frame();
+
+	if (status == 0 && send)
+	{
+		write_stream_frame(&header, &descriptor);
+		stream_sequence++;
+	}
+	else if (data != partial)
+	{
+		usb_tx_queue_release(usb_tx_slot);
+		usb_tx_slot = NULL;
+	}
+
+	return true;
+}
+
 // ~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~
 // Local Functions
 // ~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~-~
@@ -222,53 +651,119 @@ static void free_memory()
 }
 
 
-static void parse_user_command(char *buf, int n, char *cmd, char *arg1, char *arg2, char *arg3)
+/**
+Function takes the next complete command out of the USB receive queue. Line
+breaks and NULs between commands are skipped
+
+@param [out] *cmd  Buffer of MAT_CMD_MAX_LENGTH bytes
+
+@return Length of the command, 0 if no complete command is waiting, -1 if
+bytes were dropped
+*/
+static int next_command(uint8_t *cmd)
 {
-	int i;
-	int start_idx = 0;
+	uint32_t count = usb_rx_queue_count();
 
-	// Parse the cmd
-	for (i = 0; i < n; i++)
+	while (count > 0)
 	{
-		if (buf[i] == '(')
+		uint8_t c = usb_rx_queue_peek(0);
+		if (c != '\r' && c != '\n' && c != '\0')
 			break;
 
-		cmd[i] = buf[i];
+		usb_rx_queue_read(NULL, 1);
+		count--;
 	}
-	cmd[i] = '\0';
-	start_idx = i + 1;  // Move to the position after the '('
 
-	// parse the first arg
-	for (i = start_idx; i < n; i++)
+	if (count == 0)
+		return 0;
+
+	uint32_t length;
+
+	if (usb_rx_queue_peek(0) == MAT_BIN_MAGIC)
 	{
-		if ((buf[i] == ')') || (buf[i] == ','))
-			break;
+		// Binary requests are a fixed size
+		length = sizeof(MatBinRequest_t);
+		if (count < length)
+			return 0;
+	}
+	else
+	{
+		// Text commands end with the ')' closing their arguments
+		uint32_t limit = (count < MAT_CMD_MAX_LENGTH) ? count : MAT_CMD_MAX_LENGTH;
+		for (length = 0; length < limit; length++)
+		{
+			if (usb_rx_queue_peek(length) == ')')
+				break;
+		}
+
+		if (length == limit)
+		{
+			if (count < MAT_CMD_MAX_LENGTH)
+				return 0;
 
-		arg1[i - start_idx] = buf[i];
+			usb_rx_queue_read(NULL, MAT_CMD_MAX_LENGTH);
+			write_error("ERROR: Command too long");
+			return -1;
+		}
+
+		length++;
 	}
-	arg1[i - start_idx] = '\0';
-	start_idx = i + 1;  // Move to the position after the '('
 
-	// parse the second arg
-	for (i = start_idx; i < n; i++)
+	usb_rx_queue_read(cmd, length);
+
+	return length;
+}
+
+
+/**
+Function splits a text command into its name and up to three arguments. Fields
+longer than MAT_ARG_MAX_LENGTH are cut short
+
+@param [in]   *buf     Command, e.g. "VarSetValue_ByName(pps,2)"
+@param [in]    n       Length of the command
+@param [out]  *cmd     Name of the command
+@param [out]  *arg1    First argument
+@param [out]  *arg2    Second argument
+@param [out]  *arg3    Third argument
+@param [out]  *params  Text between the parentheses, MAT_CMD_MAX_LENGTH bytes
+*/
+static void parse_user_command(char *buf, int n, char *cmd, char *arg1, char *arg2, char *arg3, char *params)
+{
+	int i;
+	int start_idx = 0;
+
+	// Parse the cmd
+	for (i = 0; i < n; i++)
 	{
-		if ((buf[i] == ')') || (buf[i] == ','))
+		if (buf[i] == '(')
 			break;
 
-		arg2[i - start_idx] = buf[i];
+		if (i < MAT_ARG_MAX_LENGTH - 1)
+			cmd[i] = buf[i];
 	}
-	arg2[i - start_idx] = '\0';
+	cmd[(i < MAT_ARG_MAX_LENGTH - 1) ? i : MAT_ARG_MAX_LENGTH - 1] = '\0';
 	start_idx = i + 1;  // Move to the position after the '('
 
-	// parse the third arg
-	for (i = start_idx; i < n; i++)
+	// Keep the arguments in one piece for the commands taking a list
+	for (i = start_idx; i < n && buf[i] != ')' && i - start_idx < MAT_CMD_MAX_LENGTH - 1; i++)
+		params[i - start_idx] = buf[i];
+	params[(i > start_idx) ? i - start_idx : 0] = '\0';
+
+	// Parse the arguments
+	char *args[3] = {arg1, arg2, arg3};
+	for (int k = 0; k < 3; k++)
 	{
-		if ((buf[i] == ')') || (buf[i] == ','))
-			break;
+		for (i = start_idx; i < n; i++)
+		{
+			if ((buf[i] == ')') || (buf[i] == ','))
+				break;
 
-		arg3[i - start_idx] = buf[i];
+			if (i - start_idx < MAT_ARG_MAX_LENGTH - 1)
+				args[k][i - start_idx] = buf[i];
+		}
+		args[k][(i - start_idx < MAT_ARG_MAX_LENGTH - 1) ? i - start_idx : MAT_ARG_MAX_LENGTH - 1] = '\0';
+		start_idx = i + 1;  // Move to the position after the ','
 	}
-	arg3[i - start_idx] = '\0';
 
 //	PRINTF(">>>> parse_user_command():\r\n cmd: %s \r\n arg1: %s \r\n arg2: %s \r\n arg3: %s \r\n", cmd, arg1, arg2, arg3);
 }
@@ -301,6 +796,11 @@ static int OpenRadar_x4()
 		return 0;
 	}
 
+	// Block on the X4 data ready interrupt instead of polling TRX_CTRL_DONE
+	x4driver_set_frame_ready_strategy(x4, FRAME_IS_READY_INTERRUPT);
+	update_frame_state();
+	x4_clutter_reset();
+
 	isOpen = 1;
 
 	write_ack();
@@ -317,6 +817,11 @@ static int CloseRadar_x4()
 		return 1;
 	}
 
+	if (x4_capture_is_running())
+		x4_capture_stop();
+	else if (x4_stream_is_running())
+		x4_stream_stop(x4);
+
 	isOpen = 0;
 
 	write_ack();
@@ -333,156 +838,77 @@ static int VarGetValue_ByName_x4(char *var_name)
 		return 1;
 	}
 
-	int status;
-	char buf[80];
-
-	if (strcmp("DACMin", var_name) == 0 || strcmp("dac_min", var_name) == 0)
-	{
-		uint16_t tmp;
-		status = x4driver_get_dac_min(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("DACMax", var_name) == 0 || strcmp("dac_max", var_name) == 0)
-	{
-		uint16_t tmp;
-		status = x4driver_get_dac_max(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("DACStep", var_name) == 0 || strcmp("dac_step", var_name) == 0)
-	{
-		xtx4_dac_step_t tmp;
-		status = x4driver_get_dac_step(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("PPS", var_name) == 0 || strcmp("pps", var_name) == 0)
-	{
-		uint16_t tmp;
-		status = x4driver_get_pulses_per_step(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("Iterations", var_name) == 0 || strcmp("iterations", var_name) == 0)
-	{
-		uint8_t tmp;
-		status = x4driver_get_iterations(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("PRF", var_name) == 0 || strcmp("prf", var_name) == 0)
-	{
-		uint8_t prf_div;
-		status = x4driver_get_prf_div(x4, &prf_div);
-		sprintf(buf, "%e", X4_FIXED_PLL / (float)prf_div);
-	}
-	else if (strcmp("prf_div", var_name) == 0)
-	{
-		uint8_t tmp;
-		status = x4driver_get_prf_div(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("SamplingRate", var_name) == 0 || strcmp("fs", var_name) == 0)
-	{
-		float tmp;
-		status = x4driver_get_sampler_frequency(x4, &tmp);
-		sprintf(buf, "%e", tmp);
-	}
-	else if (strcmp("SamplersPerFrame", var_name) == 0 || strcmp("num_samples", var_name) == 0)
-	{
-		uint32_t tmp;
-		status = x4driver_get_frame_bin_count(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("frame_length", var_name) == 0)
-	{
-		uint32_t tmp;
-		status = x4driver_get_frame_length(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("RxWait", var_name) == 0 || strcmp("rx_wait", var_name) == 0)
-	{
-		uint8_t tmp;
-		status = x4driver_get_rx_wait(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("tx_region", var_name) == 0)
-	{
-		xtx4_tx_center_frequency_t tmp;
-		status = x4driver_get_tx_center_frequency(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("tx_power", var_name) == 0)
-	{
-		xtx4_tx_power_t tmp;
-		status = x4driver_get_tx_power(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("DownConvert", var_name) == 0 || strcmp("ddc_en", var_name) == 0)
+	const MatVar_t *var = find_variable(var_name);
+	if (var == NULL)
 	{
-		uint8_t tmp;
-		status = x4driver_get_downconversion(x4, &tmp);
-		sprintf(buf, "%d", (int)tmp);
-	}
-	else if (strcmp("frame_offset", var_name) == 0)
-	{
-		float tmp;
-		status = x4driver_get_frame_area_offset(x4, &tmp);
-		sprintf(buf, "%e", tmp);
-	}
-	else if (strcmp("frame_start", var_name) == 0)
-	{
-		float tmp1, tmp2;
-		status = x4driver_get_frame_area(x4, &tmp1, &tmp2);
-		sprintf(buf, "%e", tmp1);
-	}
-	else if (strcmp("frame_end", var_name) == 0)
-	{
-		float tmp1, tmp2;
-		status = x4driver_get_frame_area(x4, &tmp1, &tmp2);
-		sprintf(buf, "%e", tmp2);
+		write_error("Unknown Variable Name");
+		return 1;
 	}
-	else if (strcmp("sweep_time", var_name) == 0)
+
+	MatValue_t value;
+	int status = var->get(&value);
+	if (status)
 	{
-		float tmp;
-		status = x4driver_get_sweep_time(x4, &tmp);
-		sprintf(buf, "%e", tmp);
+		char error[256];
+		snprintf(error, 256, "ERROR: Get var error code = %d", status);
+		write_error(error);
+		return 1;
 	}
-	else if (strcmp("unambiguous_range", var_name) == 0 || strcmp("ur", var_name) == 0)
-	{
-		uint8_t prf_div;
-		status = x4driver_get_prf_div(x4, &prf_div);
 
-		float prf = X4_FIXED_PLL / (float)prf_div;
-		sprintf(buf, "%e", C / (2.0 * prf));
-	}
-	else if (strcmp("res", var_name) == 0)
+	char buf[80];
+	format_variable(var, &value, buf, sizeof(buf));
+
+	write_data(buf);
+
+	return 0;
+}
+
+
+int VarSetValue_ByName_x4(char* var_name, char* var_value)
+{
+	if (isOpen == 0)
 	{
-		float tmp;
-		status = x4driver_get_bin_length(x4, &tmp);
-		sprintf(buf, "%e", tmp);
+		write_error("ERROR: Radar is closed");
+		return 1;
 	}
-	else if (strcmp("fs_rf", var_name) == 0)
+
+	const MatVar_t *var = find_variable(var_name);
+	if (var == NULL || var->set == NULL)
 	{
-		float tmp;
-		status = x4driver_get_sampler_frequency_rf(x4, &tmp);
-		sprintf(buf, "%e", tmp);
+		write_error("Unknown/Invalid Variable Name");
+		return 1;
 	}
+
+	MatValue_t value;
+	if (var->type == MAT_VALUE_FLOAT)
+		value.f = atof(var_value);
 	else
-	{
-		sprintf(buf, "<ERR>Unknown Variable Name");
-	}
+		value.i = atoi(var_value);
+
+	var_warning[0] = '\0';
+	int status = var->set(value);
+	update_frame_state();
+
+	if (var_warning[0] != '\0')
+		write_warning(var_warning);
 
 	if (status)
 	{
-		char error[256];
-		snprintf(error, 256, "ERROR: Set var error code = %d", status);
-		write_error(error);
+		write_error("Error setting register\n");
+		return 1;
 	}
-	else
-		write_data(buf);
+
+	write_ack();
 
 	return 0;
 }
 
 
-int VarSetValue_ByName_x4(char* var_name, char* var_value)
+/**
+Function replies with the value of every variable in one packet, as
+"name=value,..." in registry order. Floats are sent as "%e"
+*/
+static int GetAllVariables_x4()
 {
 	if (isOpen == 0)
 	{
@@ -490,438 +916,1909 @@ int VarSetValue_ByName_x4(char* var_name, char* var_value)
 		return 1;
 	}
 
-	int status;
+	static char list[MAT_VARS_REPLY_LENGTH];
+	size_t length = 0;
 
-	if (strcmp("DACMin", var_name) == 0 || strcmp("dac_min", var_name) == 0)
+	for (int i = 0; i < MAT_VAR_COUNT && length < sizeof(list); i++)
 	{
-		int tmp = atoi(var_value);
+		const MatVar_t *var = &mat_vars[i];
 
-		status = x4driver_set_dac_min(x4, (uint16_t)tmp);
+		MatValue_t value;
+		int status = var->get(&value);
 		if (status)
 		{
-			write_error("Error setting register\n");
+			char error[128];
+			snprintf(error, sizeof(error), "ERROR: Get %s error code = %d", var->name, status);
+			write_error(error);
 			return 1;
 		}
+
+		length += snprintf(list + length, sizeof(list) - length, "%s%s=", (i == 0) ? "" : ",", var->name);
+		if (length < sizeof(list))
+			length += format_variable(var, &value, list + length, sizeof(list) - length);
 	}
-	else if (strcmp("DACMax", var_name) == 0 || strcmp("dac_max", var_name) == 0)
+
+	write_data(list);
+
+	return 0;
+}
+
+
+/**
+Function sets several variables at once, e.g. SetVariables(pps=2,ddc_en=1).
+Every name and value is checked before any variable changes. The variables are
+set in the order given; if one fails, all of them get their old values back.
+Warnings of the setters are sent together, before the ack
+
+@param [in] *params  Comma separated name=value pairs, changed by the parser
+*/
+static int SetVariables_x4(char* params)
+{
+	if (isOpen == 0)
 	{
-		int tmp = atoi(var_value);
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
 
-		status = x4driver_set_dac_max(x4, (uint16_t)tmp);
-		if (status)
+	const MatVar_t *vars[MAT_VAR_COUNT];
+	MatValue_t values[MAT_VAR_COUNT];
+	MatValue_t old_values[MAT_VAR_COUNT];
+	int count = 0;
+
+	char error[128];
+	char *item = params;
+
+	// Check all of the pairs and save the old values
+	while (*item != '\0')
+	{
+		char *next = strchr(item, ',');
+		if (next != NULL)
+			*next++ = '\0';
+		else
+			next = item + strlen(item);
+
+		char *equals = strchr(item, '=');
+		if (equals == NULL)
 		{
-			write_error("Error setting register\n");
+			snprintf(error, sizeof(error), "ERROR: Expected name=value, got '%s'", item);
+			write_error(error);
 			return 1;
 		}
-	}
-	else if (strcmp("DACStep", var_name) == 0 || strcmp("dac_step", var_name) == 0)
-	{
-		xtx4_dac_step_t dac_step;
+		*equals = '\0';
 
-		int tmp = atoi(var_value);
+		const MatVar_t *var = find_variable(item);
+		if (var == NULL || var->set == NULL)
+		{
+			snprintf(error, sizeof(error), "ERROR: Unknown/Invalid Variable Name '%s'", item);
+			write_error(error);
+			return 1;
+		}
 
-		switch(tmp)
+		if (count == MAT_VAR_COUNT)
 		{
-			case 0:
-				dac_step = DAC_STEP_1;
-				break;
-			case 1:
-				dac_step = DAC_STEP_2;
-				break;
-			case 2:
-				dac_step = DAC_STEP_4;
-				break;
-			case 3:
-				dac_step = DAC_STEP_8;
-				break;
-			default: // enforce legal setting?
-				dac_step = DAC_STEP_1;
-				break;
+			write_error("ERROR: Too many variables");
+			return 1;
 		}
-		status = x4driver_set_dac_step(x4, dac_step);
-		if (status)
+
+		if (parse_variable(var, equals + 1, &values[count]))
 		{
-			write_error("Error setting register\n");
+			snprintf(error, sizeof(error), "ERROR: Invalid value for %s", var->name);
+			write_error(error);
 			return 1;
 		}
-	}
-	else if (strcmp("PPS", var_name) == 0 || strcmp("pps", var_name) == 0)
-	{
-		int tmp = atoi(var_value);
 
-		status = x4driver_set_pulses_per_step(x4, (uint16_t)tmp);
+		int status = var->get(&old_values[count]);
 		if (status)
 		{
-			write_error("Error setting register\n");
+			snprintf(error, sizeof(error), "ERROR: Get %s error code = %d", var->name, status);
+			write_error(error);
 			return 1;
 		}
-	}
-	else if (strcmp("Iterations", var_name) == 0 || strcmp("iterations", var_name) == 0)
-	{
-		int tmp = atoi(var_value);
 
-		// Novelda **Highly Recommends** that Iterations be divisible by 2^noiseless_ghost_order*2^trx_auto_bidir_enable
-		uint8_t trx_auto_bidir_enable;
-		uint8_t noiseless_ghost_order;
+		vars[count++] = var;
+		item = next;
+	}
 
-		x4driver_get_pif_register(x4, 0x34, &trx_auto_bidir_enable);
-		x4driver_get_pif_register(x4, 0x3e, &noiseless_ghost_order);
+	if (count == 0)
+	{
+		write_error("ERROR: Expected name=value pairs");
+		return 1;
+	}
 
-		trx_auto_bidir_enable = (trx_auto_bidir_enable >> 5) & 0x01;
-		noiseless_ghost_order = (noiseless_ghost_order >> 4) & 0x07;
+	// Set them, undoing every change if one fails
+	char warnings[256] = "";
 
-		int recMult = (1 << noiseless_ghost_order) * (1 << trx_auto_bidir_enable);
-		if ((tmp % recMult) != 0)
-		{
-			char message[100];
-			sprintf(message, "It is recommended to set iterations to a multiple of %d with these radar settings", recMult);
-			write_warning(message);
-		}
+	for (int i = 0; i < count; i++)
+	{
+		var_warning[0] = '\0';
+		int status = vars[i]->set(values[i]);
 
-		status = x4driver_set_iterations(x4, (uint8_t)tmp);
 		if (status)
 		{
-			write_error("Error setting register\n");
+			for (int j = i; j >= 0; j--)
+				vars[j]->set(old_values[j]);
+
+			update_frame_state();
+
+			snprintf(error, sizeof(error), "ERROR: Set %s error code = %d, no variable changed", vars[i]->name, status);
+			write_error(error);
 			return 1;
 		}
-	}
-	else if (strcmp("prf_div", var_name) == 0)
-	{
-		int tmp = atoi(var_value);
 
-		status = x4driver_set_prf_div(x4, (uint8_t)tmp);
-		if (status)
+		if (var_warning[0] != '\0')
 		{
-			write_error("Error setting register\n");
-			return 1;
+			size_t length = strlen(warnings);
+			snprintf(warnings + length, sizeof(warnings) - length, "%s%s", (length == 0) ? "" : "; ", var_warning);
 		}
 	}
-	else if (strcmp("RxWait", var_name) == 0 || strcmp("rx_wait", var_name) == 0)
-	{
-		int tmp = atoi(var_value);
 
-		status = x4driver_set_rx_wait(x4, (uint8_t)tmp);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
-		}
+	// The frame settings follow the radar once, after the last change
+	update_frame_state();
+
+	if (warnings[0] != '\0')
+		write_warning(warnings);
+
+	write_ack();
+
+	return 0;
+}
+
+
+static int GetFrameRaw_x4()
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	// Get a new frame, encoded in place in a transmit slot
+	FrameDescriptor_t descriptor;
+	int status = get_frame_encoded(false, &descriptor);
+	if (status == MAT_STATUS_ERR_FORMAT)
+	{
+		write_error("ERROR: Frame can not be integrated");
+		return 1;
 	}
-	else if (strcmp("TxRegion", var_name) == 0 || strcmp("tx_region", var_name) == 0)
+	else if (status == MAT_STATUS_ERR_NO_SLOT)
 	{
-		xtx4_tx_center_frequency_t tx_center_frequency;
+		PRINTF("Failed to get a transmit slot for the frame\n");
+		return 1;
+	}
 
-		int tmp = atoi(var_value);
-		switch(tmp)
-		{
-			case 3:
-				tx_center_frequency = TX_CENTER_FREQUENCY_EU_7_290GHz;
-				break;
-			case 4:
-				tx_center_frequency = TX_CENTER_FREQUENCY_KCC_8_748GHz;
-				break;
-			default:
-				tx_center_frequency = TX_CENTER_FREQUENCY_EU_7_290GHz;
-				break;
-		}
-		status = x4driver_set_tx_center_frequency(x4, tx_center_frequency);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
-		}
+	// Send the radar frame to the client
+	write_binary_frame(&descriptor);
+
+	return 0;
+}
+
+
+static int GetFrameNormalized_x4()
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	// Get a new frame, encoded in place in a transmit slot
+	FrameDescriptor_t descriptor;
+	int status = get_frame_encoded(true, &descriptor);
+	if (status == MAT_STATUS_ERR_FORMAT)
+	{
+		if (frame_format == FRAME_FORMAT_COUNTERS)
+			write_error("ERROR: Raw counters are not normalized");
+		else
+			write_error("ERROR: Frame can not be integrated");
+		return 1;
 	}
-	else if (strcmp("DownConvert", var_name) == 0 || strcmp("ddc_en", var_name) == 0)
+	else if (status == MAT_STATUS_ERR_NO_SLOT)
 	{
-		int tmp = atoi(var_value);
+		PRINTF("Failed to get a transmit slot for the frame\n");
+		return 1;
+	}
 
-		ddc_en = (tmp == 1) ? true : false;
+	//Send the radar frame to the client
+	write_binary_frame(&descriptor);
 
-		status = x4driver_set_downconversion(x4, (uint8_t)tmp);
-		if (status)
+	return 0;
+}
+
+
+/**
+Function replies with the names and aliases of the variables, separated by
+commas. With details, each variable is listed as "name:alias:type:units:access"
+instead, e.g. "PRF:prf:float:Hz:ro"
+
+@param [in] details  0 for the names only, 1 for the details
+*/
+static int ListVariables_x4(int details)
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	static char list[MAT_VARS_REPLY_LENGTH];
+	size_t length = 0;
+
+	for (int i = 0; i < MAT_VAR_COUNT && length < sizeof(list); i++)
+	{
+		const MatVar_t *var = &mat_vars[i];
+		const char *sep = (i == 0) ? "" : ",";
+
+		if (details)
+			length += snprintf(list + length, sizeof(list) - length, "%s%s:%s:%s:%s:%s", sep, var->name,
+					(var->alias != NULL) ? var->alias : "", (var->type == MAT_VALUE_FLOAT) ? "float" : "int",
+					var->units, (var->set != NULL) ? "rw" : "ro");
+		else if (var->alias != NULL)
+			length += snprintf(list + length, sizeof(list) - length, "%s%s,%s", sep, var->name, var->alias);
+		else
+			length += snprintf(list + length, sizeof(list) - length, "%s%s", sep, var->name);
+	}
+
+	write_data(list);
+
+	return 0;
+}
+
+
+static int RegisterRead_x4(int address)
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	uint8_t registerValue = 0;
+
+	int status = x4driver_get_spi_register(x4, (uint8_t)address, &registerValue);
+	if (status)
+	{
+		char radarErrorMsg[] = "Cannot read register";
+		write_error(radarErrorMsg);
+		return 1;
+	}
+	else
+	{
+		char temp[10];
+		sprintf(temp, "%u", registerValue);
+		write_data(temp);
+	}
+
+	return 0;
+}
+
+
+static int ResetAllVars_x4()
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	x4driver_setup_default(x4);
+	update_frame_state();
+	x4_clutter_reset();
+
+	write_ack();
+
+	return 0;
+}
+
+
+static int GetRegisterProperties_x4(char *name)
+{
+	write_ack();
+	return 0;
+}
+
+
+/**
+Function times register-heavy driver calls with the polled SPI path enabled
+and disabled. Replies with the average CPU cycles per call
+
+@param [in] iterations  Number of calls to time per case
+*/
+static int SpiBenchmark_x4(int iterations)
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	if (iterations <= 0)
+		iterations = 100;
+
+	// Each call is timed on its own and summed in 64 bits, the 32 bit cycle
+	// counter wraps within seconds
+	uint64_t cycles[2][3] = {{0}};
+	uint32_t lengths[2] = {X4_SPI_POLLED_MAX_LENGTH, 0};
+	uint32_t saved_length = platform__get_spi_polled_max_length();
+	uint8_t value;
+
+	for (int mode = 0; mode < 2; mode++)
+	{
+		platform__set_spi_polled_max_length(lengths[mode]);
+
+		for (int i = 0; i < iterations; i++)
 		{
-			write_error("Error setting register\n");
-			return 1;
+			uint32_t start = platform__get_cycle_count();
+			x4driver_get_spi_register(x4, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &value);
+			cycles[mode][0] += platform__get_cycle_count() - start;
+
+			start = platform__get_cycle_count();
+			x4driver_get_pif_register(x4, ADDR_PIF_TRX_CTRL_DONE_R, &value);
+			cycles[mode][1] += platform__get_cycle_count() - start;
+
+			start = platform__get_cycle_count();
+			x4driver_is_frame_ready(x4, &value);
+			cycles[mode][2] += platform__get_cycle_count() - start;
 		}
+
+		for (int c = 0; c < 3; c++)
+			cycles[mode][c] /= iterations;
 	}
-	else if (strcmp("frame_length", var_name) == 0)
+
+	platform__set_spi_polled_max_length(saved_length);
+
+	char buf[256];
+	snprintf(buf, sizeof(buf),
+		"spi_register_polled=%lu,spi_register_rtos=%lu,"
+		"pif_register_polled=%lu,pif_register_rtos=%lu,"
+		"is_frame_ready_polled=%lu,is_frame_ready_rtos=%lu",
+		(unsigned long)cycles[0][0], (unsigned long)cycles[1][0],
+		(unsigned long)cycles[0][1], (unsigned long)cycles[1][1],
+		(unsigned long)cycles[0][2], (unsigned long)cycles[1][2]);
+	write_data(buf);
+
+	return 0;
+}
+
+
+/**
+Function to count driver lock operations per frame with and without a session
+
+@param [in]   iterations  Number of frames fetched per mode
+*/
+static int LockBenchmark_x4(int iterations)
+{
+	if (isOpen == 0)
 	{
-		int tmp = atoi(var_value);
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
 
-		status = x4driver_set_frame_length(x4, (uint8_t)tmp);
-		if (status)
+	if (iterations <= 0)
+		iterations = 10;
+
+	uint8_t *raw = platform__get_x4_frame_buffer(0);
+	X4DriverLockStats_t stats[2];
+	int status = 0;
+
+	for (int mode = 0; mode < 2; mode++)
+	{
+		x4driver_reset_lock_stats(x4);
+		for (int i = 0; i < iterations && status == 0; i++)
 		{
-			write_error("Error setting register\n");
-			return 1;
+			status = sweep_frame(x4);
+			if (mode == 1)
+				status |= x4driver_session_begin(x4);
+			status |= read_frame_bytes(x4, raw);
+			if (mode == 1)
+				status |= x4driver_session_end(x4);
 		}
+		x4driver_get_lock_stats(x4, &stats[mode]);
+	}
+
+	if (status)
+	{
+		write_error("ERROR: Frame fetch failed");
+		return 1;
 	}
-	else if (strcmp("tx_power", var_name) == 0)
+
+	char buf[256];
+	snprintf(buf, sizeof(buf),
+		"lock_ops_per_frame=%lu,lock_ops_per_frame_session=%lu,elided_per_frame_session=%lu",
+		(stats[0].takes + stats[0].gives) / iterations,
+		(stats[1].takes + stats[1].gives) / iterations,
+		stats[1].elided / iterations);
+	write_data(buf);
+
+	return 0;
+}
+
+/**
+Function reports the CPU time used since the previous CpuStats() (or since the
+scheduler started) from the FreeRTOS run time stats, as
+"window_us=...,idle_us=...,<task>=<us>,..." with the time of every task. The
+idle task gets the time no other task needs
+*/
+static int CpuStats_x4()
+{
+	static TaskStatus_t tasks[CPU_STATS_MAX_TASKS];
+	uint32_t deltas[CPU_STATS_MAX_TASKS];
+	uint32_t total;
+
+	UBaseType_t count = uxTaskGetSystemState(tasks, CPU_STATS_MAX_TASKS, &total);
+	if (count == 0)
 	{
-		xtx4_tx_power_t tx_power;
+		write_error("ERROR: Too many tasks");
+		return 1;
+	}
+
+	TaskHandle_t idle = xTaskGetIdleTaskHandle();
+	uint32_t idle_us = 0;
 
-		int tmp = atoi(var_value);
-		switch(tmp)
+	// Counters wrap, differences stay valid for windows up to 71 minutes
+	for (UBaseType_t i = 0; i < count; i++)
+	{
+		uint32_t previous = 0;
+		for (int k = 0; k < CPU_STATS_MAX_TASKS; k++)
 		{
-			case 0:
-				tx_power = TX_POWER_OFF;
-				break;
-			case 1:
-				tx_power = TX_POWER_LOW;
-				break;
-			case 2:
-				tx_power = TX_POWER_MEDIUM;
-				break;
-			case 3:
-				tx_power= TX_POWER_HIGH;
+			if (cpu_stats_tasks[k] == tasks[i].xHandle)
+			{
+				previous = cpu_stats_counters[k];
 				break;
-			default:
-				tx_power = TX_POWER_MEDIUM;
-				break;
-		}
-		status = x4driver_set_tx_power(x4, tx_power);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
+			}
 		}
 
+		deltas[i] = tasks[i].ulRunTimeCounter - previous;
+		if (tasks[i].xHandle == idle)
+			idle_us = deltas[i];
 	}
-	else if (strcmp("ddc_en", var_name) == 0)
+
+	char buf[512];
+	int len = snprintf(buf, sizeof(buf), "window_us=%u,idle_us=%u", (unsigned)(total - cpu_stats_total), (unsigned)idle_us);
+
+	for (UBaseType_t i = 0; i < count && len < (int)sizeof(buf); i++)
+		len += snprintf(buf + len, sizeof(buf) - len, ",%s=%u", tasks[i].pcTaskName, (unsigned)deltas[i]);
+
+	write_data(buf);
+
+	// Start the next window
+	memset(cpu_stats_tasks, 0, sizeof(cpu_stats_tasks));
+	for (UBaseType_t i = 0; i < count; i++)
 	{
-		int tmp = atoi(var_value);
+		cpu_stats_tasks[i] = tasks[i].xHandle;
+		cpu_stats_counters[i] = tasks[i].ulRunTimeCounter;
+	}
+	cpu_stats_total = total;
 
-		status = x4driver_set_downconversion(x4, (uint8_t)tmp);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
-		}
+	return 0;
+}
+
+
+
+/**
+Function starts pushing frames to the client at a fixed rate until
+StopStreaming() is received. Each frame is sent as "<STR>", a StreamHeader_t,
+the frame (with its FrameDescriptor_t unless sent as floats) and "<ACK>",
+preceded by the packet length if enabled
+
+@param [in] fps   Frame rate, rounded to a whole number by the X4 timer
+@param [in] mode  STREAM_MODE_RAW or STREAM_MODE_NORMALIZED
+*/
+static int StartStreaming_x4(float fps, int mode)
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	if (mode != STREAM_MODE_RAW && mode != STREAM_MODE_NORMALIZED)
+	{
+		write_error("ERROR: Invalid stream mode");
+		return 1;
+	}
+
+	if (mode == STREAM_MODE_NORMALIZED && frame_format == FRAME_FORMAT_COUNTERS)
+	{
+		write_error("ERROR: Raw counters are not normalized");
+		return 1;
 	}
-	else if (strcmp("frame_offset", var_name) == 0)
+
+	uint32_t bins;
+	x4driver_get_frame_bin_count(x4, &bins);
+
+	if (ddc_en)
+		bins *= 2;
+
+	bool integrable = (frame_format == FRAME_FORMAT_COUNTERS)
+		? counters_integrable(x4->frame_read_size / x4->bytes_per_counter)
+		: (x4_integrate_get_frames() == 1 || bins <= X4_INTEGRATE_MAX_VALUES);
+	if (!integrable)
+	{
+		write_error("ERROR: Frame can not be integrated");
+		return 1;
+	}
+
+	stream_mode = mode;
+	stream_bins = bins;
+	stream_sequence = 0;
+	x4_integrate_reset();
+
+	int status = x4_stream_start(x4, fps);
+	if (status)
+	{
+		char buf[80];
+		snprintf(buf, sizeof(buf), "ERROR: x4_stream_start() error %d", status);
+		write_error(buf);
+		return 1;
+	}
+
+	write_ack();
+
+	return 0;
+}
+
+
+/**
+Function stops streaming. Frames already queued arrive ahead of the ACK
+*/
+static int StopStreaming_x4()
+{
+	int status = x4_stream_stop(x4);
+
+	if (status == X4_STREAM_ERR_STOPPED)
+	{
+		write_error("ERROR: Not streaming");
+		return 1;
+	}
+	else if (status)
 	{
-		float tmp = atof(var_value);
+		char buf[80];
+		snprintf(buf, sizeof(buf), "ERROR: x4_stream_stop() error %d", status);
+		write_error(buf);
+		return 1;
+	}
+
+	write_ack();
+
+	return 0;
+}
+
+
+/**
+Function starts a stream of range-Doppler maps of down converted frames. Each
+map covers the last frames frames, and a new map follows every frames / 2
+frames. The maps are sent whole, or as their strongest cells only.
+StopStreaming() ends the stream
+
+@param [in] fps     Frame rate
+@param [in] frames  Frames in each map, a power of two from X4_DOPPLER_MIN_FRAMES to X4_DOPPLER_MAX_FRAMES
+@param [in] cells   Cells to send of each map, up to X4_DOPPLER_MAX_CELLS, 0 for the whole map
+*/
+static int StartDoppler_x4(float fps, int frames, int cells)
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	if (!ddc_en)
+	{
+		write_error("ERROR: Doppler processing needs DownConvert");
+		return 1;
+	}
+
+	if (frame_format == FRAME_FORMAT_COUNTERS)
+	{
+		write_error("ERROR: Raw counters are not normalized");
+		return 1;
+	}
+
+	if (cells < 0 || cells > X4_DOPPLER_MAX_CELLS)
+	{
+		write_error("ERROR: Invalid cell count");
+		return 1;
+	}
+
+	uint32_t bins;
+	x4driver_get_frame_bin_count(x4, &bins);
+
+	int status = (frames > 0) ? x4_doppler_start(bins, frames, frames / 2, x4->iq_separate) : X4_DOPPLER_ERR_ARG;
+	if (status)
+	{
+		char buf[80];
+		snprintf(buf, sizeof(buf), "ERROR: x4_doppler_start() error %d", status);
+		write_error(buf);
+		return 1;
+	}
+
+	stream_mode = STREAM_MODE_DOPPLER;
+	stream_bins = bins;
+	stream_sequence = 0;
+	x4_integrate_reset();
+	doppler_frames = frames;
+	doppler_cells = cells;
+
+	status = x4_stream_start(x4, fps);
+	if (status)
+	{
+		char buf[80];
+		snprintf(buf, sizeof(buf), "ERROR: x4_stream_start() error %d", status);
+		write_error(buf);
+		return 1;
+	}
+
+	write_ack();
+
+	return 0;
+}
+
+
+/**
+Function adds a stream frame to the range-Doppler engine, and sends a map once
+one is due
+
+@return true, the frame was taken out of the stream ring
+*/
+static bool stream_doppler_frame(const X4StreamFrame_t *frame)
+{
+	static float iq[2 * X4_DOPPLER_MAX_BINS];
+
+	int status = x4driver_unpack_frame_normalized(x4, frame->data, frame->length, iq, 2 * stream_bins);
+
+	DopplerHeader_t header;
+	header.frame_counter = frame->frame_counter;
+	header.timestamp = frame->timestamp * portTICK_PERIOD_MS;
+
+	x4_stream_release_frame();
+
+	if (status || !x4_integrate_add_f32(iq, 2 * stream_bins))
+		return true;
+
+	x4_clutter_apply(iq, 2 * stream_bins);
+	if (!x4_doppler_add_frame(iq))
+		return true;
+
+	x4_doppler_process();
+
+	X4StreamStats_t stats;
+	x4_stream_get_stats(&stats);
+
+	header.sequence = stream_sequence++;
+	header.dropped = stats.dropped;
+	header.bins = stream_bins;
+	header.frames = doppler_frames;
+	header.cells = doppler_cells;
+	header.format = frame_format;
+
+	status = (doppler_cells > 0) ? write_doppler_cells(&header) : write_doppler_map(&header);
+	if (status)
+		PRINTF("Failed to write Doppler map to client\n");
+
+	return true;
+}
+
+
+/**
+Function sends a whole map. It takes several transmit slots, so it is never
+dropped; a slow client holds up the stream instead
+*/
+static int write_doppler_map(const DopplerHeader_t *header)
+{
+	static float row[X4_DOPPLER_MAX_FRAMES];
+
+	uint32_t row_length = frame_encoded_length(frame_format, header->frames, 0);
+	if (frame_format != FRAME_FORMAT_FLOAT32)
+		row_length += sizeof(FrameDescriptor_t);
+
+	uint32_t offset = 0;
+
+	if (include_packet_length_flag)
+	{
+		uint32_t len = 5 + sizeof(DopplerHeader_t) + header->bins * row_length + 5;
+		usb_write_buf(&len, 4, &offset);
+	}
+
+	usb_write_buf("<DOP>", 5, &offset);
+	usb_write_buf(header, sizeof(DopplerHeader_t), &offset);
+
+	if (usb_tx_slot == NULL)
+		return 1;
+
+	const float *map = x4_doppler_get_map();
+
+	for (uint32_t b = 0; b <= header->bins; b++)
+	{
+		// Rows and the closing ack never straddle two slots
+		uint32_t length = (b < header->bins) ? row_length : 5;
+		if (offset + length > USB_TX_QUEUE_SLOT_SIZE)
+		{
+			if ((uint32_t)usb_write(offset, false) != offset)
+				return 1;
+
+			usb_tx_slot = usb_tx_queue_acquire(DOPPLER_SLOT_TIMEOUT_MS);
+			if (usb_tx_slot == NULL)
+				return 1;
+
+			offset = 0;
+		}
+
+		if (b == header->bins)
+			break;
+
+		memcpy(row, map + b * header->frames, header->frames * sizeof(float));
+
+		FrameDescriptor_t descriptor;
+		frame_encode(frame_format, row, header->frames, &descriptor);
+
+		if (frame_format != FRAME_FORMAT_FLOAT32)
+			usb_write_buf(&descriptor, sizeof(FrameDescriptor_t), &offset);
+
+		usb_write_buf(row, descriptor.length, &offset);
+	}
+
+	usb_write_buf("<ACK>", 5, &offset);
+	if ((uint32_t)usb_write(offset, false) != offset)
+		return 1;
+
+	return 0;
+}
+
+
+/**
+Function sends the strongest cells of a map, dropped like a stream frame when
+the client falls behind
+*/
+static int write_doppler_cells(const DopplerHeader_t *header)
+{
+	X4DopplerCell_t cells[X4_DOPPLER_MAX_CELLS];
+
+	DopplerHeader_t found = *header;
+	found.cells = x4_doppler_find_cells(cells, header->cells);
+
+	uint32_t offset = 0;
+
+	if (include_packet_length_flag)
+	{
+		uint32_t len = 5 + sizeof(DopplerHeader_t) + found.cells * sizeof(X4DopplerCell_t) + 5;
+		usb_write_buf(&len, 4, &offset);
+	}
+
+	usb_write_buf("<DOP>", 5, &offset);
+	usb_write_buf(&found, sizeof(DopplerHeader_t), &offset);
+	usb_write_buf(cells, found.cells * sizeof(X4DopplerCell_t), &offset);
+	usb_write_buf("<ACK>", 5, &offset);
+
+	if ((uint32_t)usb_write(offset, true) != offset)
+		return 1;
+
+	return 0;
+}
+
+
+/**
+Function starts a capture of frames into SDRAM at a fixed rate, see
+x4_capture.h. The frames are read with ReadCapture() once CaptureStatus()
+shows the capture has finished. Only CaptureStatus(), StopCapture() and Close()
+are accepted meanwhile
+
+@param [in] frames  Frames to capture, 0 to capture until StopCapture()
+@param [in] fps     Frame rate, rounded to a whole number by the X4 timer
+@param [in] mode    STREAM_MODE_RAW or STREAM_MODE_NORMALIZED
+*/
+static int CaptureFrames_x4(int frames, float fps, int mode)
+{
+	if (isOpen == 0)
+	{
+		write_error("ERROR: Radar is closed");
+		return 1;
+	}
+
+	if (mode != STREAM_MODE_RAW && mode != STREAM_MODE_NORMALIZED)
+	{
+		write_error("ERROR: Invalid capture mode");
+		return 1;
+	}
+
+	if (frames < 0)
+	{
+		write_error("ERROR: Invalid frame count");
+		return 1;
+	}
+
+	uint32_t bins;
+	x4driver_get_frame_bin_count(x4, &bins);
+
+	if (ddc_en)
+		bins *= 2;
+
+	capture_mode = mode;
+	capture_bins = bins;
+	capture_read_size = x4->frame_read_size;
+	capture_ddc_en = ddc_en;
+
+	int status = x4_capture_start(x4, frames, fps);
+	if (status)
+	{
+		char buf[80];
+		snprintf(buf, sizeof(buf), "ERROR: x4_capture_start() error %d", status);
+		write_error(buf);
+		return 1;
+	}
+
+	write_ack();
+
+	return 0;
+}
+
+
+/**
+Function reports the capture progress as
+"running,captured,first,capacity,dropped,errors"
+*/
+static int CaptureStatus_x4()
+{
+	X4CaptureStatus_t status;
+	x4_capture_get_status(&status);
+
+	char buf[80];
+	snprintf(buf, sizeof(buf), "%d,%u,%u,%u,%u,%u", status.running ? 1 : 0,
+			(unsigned)status.captured, (unsigned)status.first, (unsigned)status.capacity,
+			(unsigned)status.dropped, (unsigned)status.errors);
+	write_data(buf);
+
+	return 0;
+}
+
+
+/**
+Function ends a capture early, keeping the frames captured so far
+*/
+static int StopCapture_x4()
+{
+	int status = x4_capture_stop();
+
+	if (status == X4_CAPTURE_ERR_STOPPED)
+	{
+		write_error("ERROR: Not capturing");
+		return 1;
+	}
+	else if (status)
+	{
+		char buf[80];
+		snprintf(buf, sizeof(buf), "ERROR: x4_capture_stop() error %d", status);
+		write_error(buf);
+		return 1;
+	}
+
+	write_ack();
+
+	return 0;
+}
+
+
+/**
+Function sends captured frames as one message: "<CAP>", a CaptureHeader_t and
+for each frame a CaptureRecord_t and the frame in frame_format (with its
+FrameDescriptor_t unless sent as floats), then "<ACK>", preceded by the packet
+length if enabled. The frames go straight from SDRAM into transmit slots, one
+frame per slot
+
+@param [in] first  Capture index of the first frame, older frames than the
+                   ring holds start at the oldest
+@param [in] count  Number of frames, 0 for all frames from first
+*/
+static int ReadCapture_x4(int first, int count)
+{
+	X4CaptureStatus_t status;
+	x4_capture_get_status(&status);
+
+	if (status.captured == 0)
+	{
+		write_error("ERROR: No frames captured");
+		return 1;
+	}
+
+	// The frames are unpacked with the current settings
+	if (x4->frame_read_size != capture_read_size || ddc_en != capture_ddc_en)
+	{
+		write_error("ERROR: Settings changed since capture");
+		return 1;
+	}
+
+	if (capture_mode == STREAM_MODE_NORMALIZED && frame_format == FRAME_FORMAT_COUNTERS)
+	{
+		write_error("ERROR: Raw counters are not normalized");
+		return 1;
+	}
+
+	uint32_t start = (first < 0 || (uint32_t)first < status.first) ? status.first : (uint32_t)first;
+	if (start >= status.captured)
+	{
+		write_error("ERROR: Frame not captured");
+		return 1;
+	}
+
+	uint32_t frames = status.captured - start;
+	if (count > 0 && (uint32_t)count < frames)
+		frames = count;
+
+	// Every frame of the capture encodes to the same length
+	uint32_t length;
+	if (frame_format == FRAME_FORMAT_COUNTERS)
+		length = frame_encoded_length(frame_format, capture_read_size / x4->bytes_per_counter, x4->bytes_per_counter);
+	else
+		length = frame_encoded_length(frame_format, capture_bins, 0);
+
+	if (frame_format != FRAME_FORMAT_FLOAT32)
+		length += sizeof(FrameDescriptor_t);
+
+	CaptureHeader_t header;
+	header.first = start;
+	header.count = frames;
+	header.bins = capture_bins;
+	header.format = frame_format;
+	header.dropped = status.dropped;
+
+	uint32_t offset = 0;
+
+	if (include_packet_length_flag)
+	{
+		uint32_t len = 5 + sizeof(CaptureHeader_t) + frames * (sizeof(CaptureRecord_t) + length) + 5;
+		usb_write_buf(&len, 4, &offset);
+	}
+
+	usb_write_buf("<CAP>", 5, &offset);
+	usb_write_buf(&header, sizeof(CaptureHeader_t), &offset);
+
+	if ((uint32_t)usb_write(offset, false) != offset)
+	{
+		PRINTF("Failed to write capture header to client\n");
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		// The client sees a truncated message and times out
+		if (write_capture_frame(start + i, length))
+		{
+			PRINTF("Failed to write captured frame %u to client\n", (unsigned)(start + i));
+			return 1;
+		}
+	}
+
+	offset = 0;
+	usb_write_buf("<ACK>", 5, &offset);
+	usb_write(offset, false);
+
+	return 0;
+}
+
+
+/**
+Function sends a captured frame of ReadCapture(), unpacked and encoded in
+place in a transmit slot
+
+@param [in] index   Capture index
+@param [in] length  Bytes of frame, descriptor included, as announced in the
+                    packet length
+
+@return 0 on success, 1 on failure
+*/
+static int write_capture_frame(uint32_t index, uint32_t length)
+{
+	X4StreamFrame_t frame;
+	if (x4_capture_get_frame(index, &frame) != X4_CAPTURE_SUCCESS)
+		return 1;
+
+	float *data = usb_frame_acquire(CAPTURE_SLOT_TIMEOUT_MS);
+	if (data == NULL)
+		return 1;
+
+	FrameDescriptor_t descriptor;
+	if (frame_format == FRAME_FORMAT_COUNTERS)
+	{
+		frame_describe_counters(&descriptor, frame.length / x4->bytes_per_counter, x4->bytes_per_counter);
+		memcpy(data, frame.data, descriptor.length);
+	}
+	else
+	{
+		// Errors leave whatever was unpacked, the length is already announced
+		if (capture_mode == STREAM_MODE_NORMALIZED)
+			x4driver_unpack_frame_normalized(x4, frame.data, frame.length, data, capture_bins);
+		else
+			x4driver_unpack_frame_raw(x4, frame.data, frame.length, data, capture_bins);
+
+		frame_encode(frame_format, data, capture_bins, &descriptor);
+	}
+
+	CaptureRecord_t record;
+	record.index = index;
+	record.frame_counter = frame.frame_counter;
+	record.timestamp = frame.timestamp * portTICK_PERIOD_MS;
+	record.length = length;
+
+	uint8_t prefix[sizeof(CaptureRecord_t) + sizeof(FrameDescriptor_t)];
+	uint32_t prefix_len = sizeof(CaptureRecord_t);
+
+	memcpy(prefix, &record, sizeof(CaptureRecord_t));
+
+	if (frame_format != FRAME_FORMAT_FLOAT32)
+	{
+		memcpy(prefix + prefix_len, &descriptor, sizeof(FrameDescriptor_t));
+		prefix_len += sizeof(FrameDescriptor_t);
+	}
+
+	if (usb_frame_submit(prefix, prefix_len, descriptor.length, false, false) == 0)
+		return 1;
+
+	return 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Radar Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function to sweep a single radar frame and wait for it. Called outside a
+driver session, so other tasks can use the driver during the sweep
+
+@param [in]  *x4driver  Pointer to X4 driver instance
+*/
+static int sweep_frame(X4Driver_t* x4driver)
+{
+	int status;
+
+	// Register as the data ready waiter and drop any stale signal
+	if (x4driver->frame_is_ready_strategy == FRAME_IS_READY_INTERRUPT)
+		x4driver->callbacks.wait_data_ready(x4driver->user_reference, 0);
+
+	// Start radar sweep
+	status = x4driver_start_sweep(x4driver);
+
+	// Wait for sweep to complete
+	status |= x4driver_wait_frame_ready(x4driver, X4DRIVER_FRAME_READY_TIMEOUT_MS);
+	return status;
+}
+
+/**
+Function to read the raw bytes of the frame swept by sweep_frame()
+
+@param [in]  *x4driver  Pointer to X4 driver instance
+@param [out] *raw       Frame buffer of X4_FRAME_BUFFER_SIZE bytes
+*/
+static int read_frame_bytes(X4Driver_t* x4driver, uint8_t *raw)
+{
+	// Read the radar data (eDMA). The client has no use for the frame counter
+	// so skip reading it
+	int status = x4driver_read_frame_bytes_start(x4driver, NULL, raw, X4_FRAME_BUFFER_SIZE);
+	if (status)
+		return status;
+	return x4driver_read_frame_bytes_finish(x4driver, X4DRIVER_FRAME_FETCH_TIMEOUT_MS);
+}
+
+/**
+Function to get single normalized radar frame
+
+@param [in]  *x4driver  Pointer to X4 driver instance
+@param [out] *frame     Radar frame which will be written to
+@param [in]   n         Number of bins in single radar frame
+*/
+static int get_frame_normalized(X4Driver_t* x4driver, float *frame, int n)
+{
+	int status = sweep_frame(x4driver);
+	if (status)
+		return status;
+
+	// One session for the read and unpack, driver calls below skip the lock
+	status = x4driver_session_begin(x4driver);
+	if (status)
+		return status;
+
+	uint8_t *raw = platform__get_x4_frame_buffer(0);
+	status = read_frame_bytes(x4driver, raw);
+	if (status == 0)
+		status = x4driver_unpack_frame_normalized(x4driver, raw, x4driver->frame_read_size, frame, n);
+
+	x4driver_session_end(x4driver);
+
+	return status;
+}
+
+/**
+Function to get single normalized radar frame
+
+@param [in]  *x4driver  Pointer to X4 driver instance
+@param [out] *frame     Radar frame which will be written to
+@param [in]   n         Number of bins in single radar frame
+*/
+static int get_frame_raw(X4Driver_t* x4driver, float *frame, int n)
+{
+	int status = sweep_frame(x4driver);
+	if (status)
+		return status;
+
+	// One session for the read and unpack, driver calls below skip the lock
+	status = x4driver_session_begin(x4driver);
+	if (status)
+		return status;
+
+	uint8_t *raw = platform__get_x4_frame_buffer(0);
+	status = read_frame_bytes(x4driver, raw);
+	if (status == 0)
+		status = x4driver_unpack_frame_raw(x4driver, raw, x4driver->frame_read_size, frame, n);
+
+	x4driver_session_end(x4driver);
+	return status;
+}
+
+/**
+Function to get single radar frame as the raw counters read from the X4
+
+@param [in]  *x4driver   Pointer to X4 driver instance
+@param [out] *counters   Buffer the counters are copied to
+@param [out] *descriptor Descriptor of the counters
+*/
+static int get_frame_counters(X4Driver_t* x4driver, uint8_t *counters, FrameDescriptor_t *descriptor)
+{
+	frame_describe_counters(descriptor, x4driver->frame_read_size / x4driver->bytes_per_counter, x4driver->bytes_per_counter);
+
+	int status = sweep_frame(x4driver);
+	if (status)
+		return status;
+
+	// One session for the read, driver calls below skip the lock
+	status = x4driver_session_begin(x4driver);
+	if (status)
+		return status;
+
+	uint8_t *raw = platform__get_x4_frame_buffer(0);
+	status = read_frame_bytes(x4driver, raw);
+	if (status == 0)
+		memcpy(counters, raw, descriptor->length);
+
+	x4driver_session_end(x4driver);
+	return status;
+}
+
+/**
+Function to get a radar frame in frame_format, encoded in place in a transmit
+slot that is left in usb_tx_slot. Errors reading the frame leave the slot
+acquired, the text interface answers those with whatever was read. With
+integrate_frames above 1, that many frames are read and integrated into one
+
+@param [in]  normalized   Normalized frame rather than raw
+@param [out] *descriptor  Descriptor of the encoded frame
+
+@return 0 on success, X4 driver error code, MAT_STATUS_ERR_FORMAT (normalized
+counters, or a frame that can not be integrated) or MAT_STATUS_ERR_NO_SLOT. No
+slot is left acquired for the last two
+*/
+static int get_frame_encoded(bool normalized, FrameDescriptor_t *descriptor)
+{
+	if (normalized && frame_format == FRAME_FORMAT_COUNTERS)
+		return MAT_STATUS_ERR_FORMAT;
+
+	// Get the number of bins in the sample
+	uint32_t bins;
+	x4driver_get_frame_bin_count(x4, &bins);
+
+	if (ddc_en)
+		bins *= 2;
+
+	if (frame_format == FRAME_FORMAT_COUNTERS && !counters_integrable(x4->frame_read_size / x4->bytes_per_counter))
+		return MAT_STATUS_ERR_FORMAT;
+
+	float *frame = usb_frame_acquire(USB_TX_QUEUE_TIMEOUT_MS);
+	if (frame == NULL)
+		return MAT_STATUS_ERR_NO_SLOT;
+
+	// Frames to integrate are read back to back
+	uint32_t frames = x4_integrate_get_frames();
+	x4_integrate_reset();
+
+	int status = 0;
+	bool integrated = (frames == 1);
+	for (uint32_t i = 0; i < frames && status == 0; i++)
+	{
+		if (frame_format == FRAME_FORMAT_COUNTERS)
+			status = get_frame_counters(x4, (uint8_t *)frame, descriptor);
+		else if (normalized)
+			status = get_frame_normalized(x4, frame, bins);
+		else
+			status = get_frame_raw(x4, frame, bins);
+
+		if (status || frames == 1)
+			continue;
+
+		if (frame_format == FRAME_FORMAT_COUNTERS)
+			integrated = x4_integrate_add_counters((uint8_t *)frame, descriptor->count, descriptor->value_size, (uint8_t *)frame);
+		else
+			integrated = x4_integrate_add_f32(frame, bins);
+	}
+
+	if (status == 0 && !integrated)
+	{
+		usb_tx_queue_release(usb_tx_slot);
+		usb_tx_slot = NULL;
+		return MAT_STATUS_ERR_FORMAT;
+	}
+
+	if (frame_format == FRAME_FORMAT_COUNTERS)
+	{
+		if (frames > 1)
+			frame_describe_counters(descriptor, descriptor->count, x4_integrate_sum_size(descriptor->value_size));
+		return status;
+	}
+
+	if (status == 0 && normalized)
+		x4_clutter_apply(frame, bins);
+
+	frame_encode(frame_format, frame, bins, descriptor);
+
+	return status;
+}
+
+
+/**
+Function checks that the counters of a frame can be integrated into one
+transmit slot
+
+@param [in] count  Counters in the frame
+
+@return true if they can, or if integrate_frames is 1
+*/
+static bool counters_integrable(uint32_t count)
+{
+	if (x4_integrate_get_frames() == 1)
+		return true;
+
+	uint8_t size = x4_integrate_sum_size(x4->bytes_per_counter);
+	return size != 0 && count <= X4_INTEGRATE_MAX_VALUES && count * size <= USB_FRAME_MAX_LENGTH;
+}
+
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Variable Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function looks up a variable by its name or alias
+
+@param [in] *name  Variable name
+
+@return Variable, NULL if unknown
+*/
+static const MatVar_t *find_variable(const char *name)
+{
+	for (int i = 0; i < MAT_VAR_COUNT; i++)
+	{
+		const MatVar_t *var = &mat_vars[i];
+
+		if (strcmp(var->name, name) == 0 || (var->alias != NULL && strcmp(var->alias, name) == 0))
+			return var;
+	}
+
+	return NULL;
+}
+
+
+/**
+Function writes a value the way the text interface sends it, "%e" for floats
+and "%d" for integers
+
+@return Number of characters the value needs, as snprintf()
+*/
+static int format_variable(const MatVar_t *var, const MatValue_t *value, char *buf, size_t size)
+{
+	if (var->type == MAT_VALUE_FLOAT)
+		return snprintf(buf, size, "%e", value->f);
+	else
+		return snprintf(buf, size, "%d", (int)value->i);
+}
+
+
+/**
+Function reads a value of the type of the variable from text. Unlike atoi()
+and atof(), text that is not entirely a number is refused
+
+@return 0 on success, 1 if the text is not a number
+*/
+static int parse_variable(const MatVar_t *var, const char *text, MatValue_t *value)
+{
+	char *end;
+
+	if (var->type == MAT_VALUE_FLOAT)
+		value->f = strtof(text, &end);
+	else
+		value->i = (int32_t)strtol(text, &end, 10);
+
+	return (end == text || *end != '\0') ? 1 : 0;
+}
+
+
+/**
+Function reads back the radar settings the frame functions depend on. It runs
+after variables change instead of in the setters, so a failed or undone change
+cannot leave the flags behind the radar, and a bulk set refreshes them once
+*/
+static void update_frame_state()
+{
+	uint8_t enable;
+
+	if (x4driver_get_downconversion(x4, &enable) == XEP_ERROR_X4DRIVER_OK)
+		ddc_en = (enable == 1) ? true : false;
+}
+
+
+static int var_get_dac_min(MatValue_t *value)
+{
+	uint16_t tmp;
+	int status = x4driver_get_dac_min(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_dac_min(MatValue_t value)
+{
+	return x4driver_set_dac_min(x4, (uint16_t)value.i);
+}
+
+
+static int var_get_dac_max(MatValue_t *value)
+{
+	uint16_t tmp;
+	int status = x4driver_get_dac_max(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_dac_max(MatValue_t value)
+{
+	return x4driver_set_dac_max(x4, (uint16_t)value.i);
+}
+
+
+static int var_get_dac_step(MatValue_t *value)
+{
+	xtx4_dac_step_t tmp;
+	int status = x4driver_get_dac_step(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_dac_step(MatValue_t value)
+{
+	xtx4_dac_step_t dac_step;
+
+	switch (value.i)
+	{
+		case 0:
+			dac_step = DAC_STEP_1;
+			break;
+		case 1:
+			dac_step = DAC_STEP_2;
+			break;
+		case 2:
+			dac_step = DAC_STEP_4;
+			break;
+		case 3:
+			dac_step = DAC_STEP_8;
+			break;
+		default: // enforce legal setting?
+			dac_step = DAC_STEP_1;
+			break;
+	}
+
+	return x4driver_set_dac_step(x4, dac_step);
+}
+
+
+static int var_get_pps(MatValue_t *value)
+{
+	uint16_t tmp;
+	int status = x4driver_get_pulses_per_step(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_pps(MatValue_t value)
+{
+	return x4driver_set_pulses_per_step(x4, (uint16_t)value.i);
+}
+
+
+static int var_get_iterations(MatValue_t *value)
+{
+	uint8_t tmp;
+	int status = x4driver_get_iterations(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_iterations(MatValue_t value)
+{
+	// Novelda **Highly Recommends** that Iterations be divisible by 2^noiseless_ghost_order*2^trx_auto_bidir_enable
+	uint8_t trx_auto_bidir_enable;
+	uint8_t noiseless_ghost_order;
+
+	x4driver_get_pif_register(x4, 0x34, &trx_auto_bidir_enable);
+	x4driver_get_pif_register(x4, 0x3e, &noiseless_ghost_order);
+
+	trx_auto_bidir_enable = (trx_auto_bidir_enable >> 5) & 0x01;
+	noiseless_ghost_order = (noiseless_ghost_order >> 4) & 0x07;
+
+	int recMult = (1 << noiseless_ghost_order) * (1 << trx_auto_bidir_enable);
+	if ((value.i % recMult) != 0)
+	{
+		snprintf(var_warning, sizeof(var_warning), "It is recommended to set iterations to a multiple of %d with these radar settings", recMult);
+	}
+
+	return x4driver_set_iterations(x4, (uint8_t)value.i);
+}
+
+
+static int var_get_prf(MatValue_t *value)
+{
+	uint8_t prf_div;
+	int status = x4driver_get_prf_div(x4, &prf_div);
+	value->f = X4_FIXED_PLL / (float)prf_div;
+	return status;
+}
+
+
+static int var_get_prf_div(MatValue_t *value)
+{
+	uint8_t tmp;
+	int status = x4driver_get_prf_div(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_prf_div(MatValue_t value)
+{
+	return x4driver_set_prf_div(x4, (uint8_t)value.i);
+}
+
+
+static int var_get_fs(MatValue_t *value)
+{
+	return x4driver_get_sampler_frequency(x4, &value->f);
+}
+
+
+static int var_get_samplers_per_frame(MatValue_t *value)
+{
+	uint32_t tmp;
+	int status = x4driver_get_frame_bin_count(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_get_frame_length(MatValue_t *value)
+{
+	uint32_t tmp;
+	int status = x4driver_get_frame_length(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_frame_length(MatValue_t value)
+{
+	return x4driver_set_frame_length(x4, (uint8_t)value.i);
+}
+
+
+static int var_get_rx_wait(MatValue_t *value)
+{
+	uint8_t tmp;
+	int status = x4driver_get_rx_wait(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_rx_wait(MatValue_t value)
+{
+	return x4driver_set_rx_wait(x4, (uint8_t)value.i);
+}
+
+
+static int var_get_tx_region(MatValue_t *value)
+{
+	xtx4_tx_center_frequency_t tmp;
+	int status = x4driver_get_tx_center_frequency(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_tx_region(MatValue_t value)
+{
+	xtx4_tx_center_frequency_t tx_center_frequency;
+
+	switch (value.i)
+	{
+		case 3:
+			tx_center_frequency = TX_CENTER_FREQUENCY_EU_7_290GHz;
+			break;
+		case 4:
+			tx_center_frequency = TX_CENTER_FREQUENCY_KCC_8_748GHz;
+			break;
+		default:
+			tx_center_frequency = TX_CENTER_FREQUENCY_EU_7_290GHz;
+			break;
+	}
+
+	return x4driver_set_tx_center_frequency(x4, tx_center_frequency);
+}
+
+
+static int var_get_tx_power(MatValue_t *value)
+{
+	xtx4_tx_power_t tmp;
+	int status = x4driver_get_tx_power(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_tx_power(MatValue_t value)
+{
+	xtx4_tx_power_t tx_power;
+
+	switch (value.i)
+	{
+		case 0:
+			tx_power = TX_POWER_OFF;
+			break;
+		case 1:
+			tx_power = TX_POWER_LOW;
+			break;
+		case 2:
+			tx_power = TX_POWER_MEDIUM;
+			break;
+		case 3:
+			tx_power = TX_POWER_HIGH;
+			break;
+		default:
+			tx_power = TX_POWER_MEDIUM;
+			break;
+	}
+
+	return x4driver_set_tx_power(x4, tx_power);
+}
+
+
+static int var_get_ddc_en(MatValue_t *value)
+{
+	uint8_t tmp;
+	int status = x4driver_get_downconversion(x4, &tmp);
+	value->i = tmp;
+	return status;
+}
+
+
+static int var_set_ddc_en(MatValue_t value)
+{
+	return x4driver_set_downconversion(x4, (uint8_t)value.i);
+}
+
+
+static int var_get_frame_offset(MatValue_t *value)
+{
+	return x4driver_get_frame_area_offset(x4, &value->f);
+}
+
+
+static int var_set_frame_offset(MatValue_t value)
+{
+	return x4driver_set_frame_area_offset(x4, value.f);
+}
+
+
+static int var_get_frame_start(MatValue_t *value)
+{
+	float end;
+	return x4driver_get_frame_area(x4, &value->f, &end);
+}
+
+
+static int var_set_frame_start(MatValue_t value)
+{
+	float start, end;
+
+	x4driver_get_frame_area(x4, &start, &end);
+
+	return x4driver_set_frame_area(x4, value.f, end);
+}
+
+
+static int var_get_frame_end(MatValue_t *value)
+{
+	float start;
+	return x4driver_get_frame_area(x4, &start, &value->f);
+}
+
+
+static int var_set_frame_end(MatValue_t value)
+{
+	float start, end;
+
+	x4driver_get_frame_area(x4, &start, &end);
+
+	return x4driver_set_frame_area(x4, start, value.f);
+}
+
+
+static int var_get_sweep_time(MatValue_t *value)
+{
+	return x4driver_get_sweep_time(x4, &value->f);
+}
+
+
+static int var_get_unambiguous_range(MatValue_t *value)
+{
+	uint8_t prf_div;
+	int status = x4driver_get_prf_div(x4, &prf_div);
+
+	float prf = X4_FIXED_PLL / (float)prf_div;
+	value->f = C / (2.0 * prf);
+	return status;
+}
 
-		status = x4driver_set_frame_area_offset(x4, tmp);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
-		}
-	}
-	else if (strcmp("frame_start", var_name) == 0)
-	{
-		float start, end;
 
-		x4driver_get_frame_area(x4, &start, &end);
+static int var_get_res(MatValue_t *value)
+{
+	return x4driver_get_bin_length(x4, &value->f);
+}
 
-		start = atof(var_value);
 
-		status = x4driver_set_frame_area(x4, start, end);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
-		}
-	}
-	else if (strcmp("frame_end", var_name) == 0)
-	{
-		float start, end;
+static int var_get_fs_rf(MatValue_t *value)
+{
+	return x4driver_get_sampler_frequency_rf(x4, &value->f);
+}
 
-		x4driver_get_frame_area(x4, &start, &end);
 
-		end = atof(var_value);
+static int var_get_tx_drop_policy(MatValue_t *value)
+{
+	value->i = tx_drop_policy;
+	return 0;
+}
 
-		status = x4driver_set_frame_area(x4, start, end);
-		if (status)
-		{
-			write_error("Error setting register\n");
-			return 1;
-		}
-	}
-	else
-	{
-		write_error("Unknown/Invalid Variable Name");
-		return 1;
-	}
 
-	write_ack();
+static int var_set_tx_drop_policy(MatValue_t value)
+{
+	if (value.i != USB_TX_DROP_NEWEST && value.i != USB_TX_DROP_OLDEST)
+		return MAT_STATUS_ERR_VALUE;
 
+	tx_drop_policy = (UsbTxDropPolicy_t)value.i;
+	usb_tx_queue_set_drop_policy(tx_drop_policy);
 	return 0;
 }
 
 
-static int GetFrameRaw_x4()
+static int var_get_frame_format(MatValue_t *value)
 {
-	if (isOpen == 0)
-	{
-		write_error("ERROR: Radar is closed");
-		return 1;
-	}
+	value->i = frame_format;
+	return 0;
+}
 
-	// Get the number of bins in the sample
-	int bins;
-	x4driver_get_frame_bin_count(x4, &bins);
 
-	if (ddc_en)
-		bins *= 2;
+static int var_set_frame_format(MatValue_t value)
+{
+	if (value.i < FRAME_FORMAT_FLOAT32 || value.i >= FRAME_FORMAT_COUNT)
+		return MAT_STATUS_ERR_VALUE;
 
-	// Get a new frame
-	get_frame_raw(x4, x, bins);
+	frame_format = (uint8_t)value.i;
+	return 0;
+}
 
-	// Send the radar frame to the client
-	write_binary(x, bins * sizeof(float));
 
+static int var_get_clutter_mode(MatValue_t *value)
+{
+	value->i = x4_clutter_get_mode();
 	return 0;
 }
 
 
-static int GetFrameNormalized_x4()
+static int var_set_clutter_mode(MatValue_t value)
 {
-	if (isOpen == 0)
-	{
-		write_error("ERROR: Radar is closed");
-		return 1;
-	}
+	return x4_clutter_set_mode(value.i) ? MAT_STATUS_ERR_VALUE : 0;
+}
 
-	// Get the number of bins in the sample
-	int bins;
-	x4driver_get_frame_bin_count(x4, &bins);
 
-	if (ddc_en)
-		bins *= 2;
+static int var_get_clutter_alpha(MatValue_t *value)
+{
+	value->f = x4_clutter_get_alpha();
+	return 0;
+}
 
-	// Get a new frame
-	get_frame_normalized(x4, x, bins);
 
-	//Send the radar frame to the client
-	write_binary(x, bins * sizeof(float));
+static int var_set_clutter_alpha(MatValue_t value)
+{
+	return x4_clutter_set_alpha(value.f) ? MAT_STATUS_ERR_VALUE : 0;
+}
 
+
+static int var_get_clutter_capture(MatValue_t *value)
+{
+	value->i = x4_clutter_capture_remaining();
 	return 0;
 }
 
 
-static int ListVariables_x4()
+static int var_set_clutter_capture(MatValue_t value)
 {
-	if (isOpen == 0)
-	{
-		write_error("ERROR: Radar is closed");
-		return 1;
-	}
+	if (value.i < 0)
+		return MAT_STATUS_ERR_VALUE;
+
+	return x4_clutter_capture(value.i) ? MAT_STATUS_ERR_VALUE : 0;
+}
 
-	char *regList = "DACMin,dac_min,DACMax,dac_max,DACStep,dac_step,PPS,pps,Iterations,iterations,PRF,prf,prf_div,SamplingRate,fs,SamplersPerFrame,num_samples,frame_length,RxWait,rx_wait,tx_region,tx_power,DownConvert,ddc_en,frame_offset,frame_start,frame_end,sweep_time,unambiguous_range,ur,fs_rf,frame_offset,res";
-	write_data(regList);
 
+static int var_get_integrate_frames(MatValue_t *value)
+{
+	value->i = x4_integrate_get_frames();
 	return 0;
 }
 
 
-static int RegisterRead_x4(int address)
+static int var_set_integrate_frames(MatValue_t value)
 {
-	if (isOpen == 0)
+	if (value.i < 1)
+		return MAT_STATUS_ERR_VALUE;
+
+	return x4_integrate_set_frames(value.i) ? MAT_STATUS_ERR_VALUE : 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Binary Protocol Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function answers the binary requests in a packet, see mat_protocol.h
+
+@param [in] *buf  Packet starting with MAT_BIN_MAGIC
+@param [in]  n    Packet length
+*/
+static void handle_binary_request(const uint8_t *buf, int n)
+{
+	for (int offset = 0; offset + (int)sizeof(MatBinRequest_t) <= n; offset += sizeof(MatBinRequest_t))
 	{
-		write_error("ERROR: Radar is closed");
-		return 1;
+		// The packet buffer carries no alignment guarantee for the fields
+		MatBinRequest_t request;
+		memcpy(&request, buf + offset, sizeof(request));
+
+		if (request.magic != MAT_BIN_MAGIC)
+			break;
+
+		MatBinResponse_t response;
+		memset(&response, 0, sizeof(response));
+		response.magic = MAT_BIN_MAGIC;
+		response.opcode = request.opcode;
+		response.var_id = request.var_id;
+		response.request_id = request.request_id;
+
+		if (request.opcode >= MAT_OP_COUNT)
+			response.status = MAT_STATUS_ERR_OPCODE;
+		else if (x4_stream_is_running())
+			response.status = MAT_STATUS_ERR_STREAMING;
+		else if (isOpen == 0 && request.opcode != MAT_OP_PING)
+			response.status = MAT_STATUS_ERR_CLOSED;
+		else
+		{
+			bin_handlers[request.opcode](&request, &response);
+			continue;
+		}
+
+		write_bin_response(&response);
 	}
+}
 
-	uint8_t registerValue = 0;
 
-	int status = x4driver_get_spi_register(x4, (uint8_t)address, &registerValue);
-	if (status)
+static void bin_ping(const MatBinRequest_t *request, MatBinResponse_t *response)
+{
+	response->type = request->type;
+	response->value = request->value;
+
+	write_bin_response(response);
+}
+
+
+static void bin_var_get(const MatBinRequest_t *request, MatBinResponse_t *response)
+{
+	if (request->var_id >= MAT_VAR_COUNT)
 	{
-		char radarErrorMsg[] = "Cannot read register";
-		write_error(radarErrorMsg);
-		return 1;
+		response->status = MAT_STATUS_ERR_VARIABLE;
 	}
 	else
 	{
-		char temp[10];
-		sprintf(temp, "%u", registerValue);
-		write_data(temp);
+		const MatVar_t *var = &mat_vars[request->var_id];
+
+		response->type = var->type;
+		response->status = var->get(&response->value);
 	}
 
-	return 0;
+	write_bin_response(response);
 }
 
 
-static int ResetAllVars_x4()
+static void bin_var_set(const MatBinRequest_t *request, MatBinResponse_t *response)
 {
-	if (isOpen == 0)
+	const MatVar_t *var = (request->var_id < MAT_VAR_COUNT) ? &mat_vars[request->var_id] : NULL;
+
+	if (var == NULL)
+		response->status = MAT_STATUS_ERR_VARIABLE;
+	else if (var->set == NULL)
+		response->status = MAT_STATUS_ERR_READ_ONLY;
+	else if (request->type != MAT_VALUE_INT && request->type != MAT_VALUE_FLOAT)
+		response->status = MAT_STATUS_ERR_TYPE;
+	else
 	{
-		write_error("ERROR: Radar is closed");
-		return 1;
-	}
+		// Convert the value to the type of the variable
+		MatValue_t value = request->value;
+		if (request->type == MAT_VALUE_INT && var->type == MAT_VALUE_FLOAT)
+			value.f = (float)request->value.i;
+		else if (request->type == MAT_VALUE_FLOAT && var->type == MAT_VALUE_INT)
+			value.i = (int32_t)lroundf(request->value.f);
 
-	x4driver_setup_default(x4);
+		var_warning[0] = '\0';
+		response->status = var->set(value);
+		update_frame_state();
+		response->type = var->type;
+		response->value = value;
 
-	write_ack();
+		if (var_warning[0] != '\0')
+			response->flags |= MAT_BIN_FLAG_WARNING;
+	}
 
-	return 0;
+	write_bin_response(response);
 }
 
 
-static int GetRegisterProperties_x4(char *name)
+static void bin_get_frame_raw(const MatBinRequest_t *request, MatBinResponse_t *response)
 {
-	write_ack();
-	return 0;
+	bin_get_frame(false, response);
 }
 
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Radar Functions
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-/**
-Function to get single normalized radar frame
-
-@param [in]  *x4driver  Pointer to X4 driver instance
-@param [out] *frame     Radar frame which will be written to
-@param [in]   n         Number of bins in single radar frame
-*/
-static int get_frame_normalized(X4Driver_t* x4driver, float *frame, int n)
+static void bin_get_frame_normalized(const MatBinRequest_t *request, MatBinResponse_t *response)
 {
-	int status;
-
-	// Start radar sweep
-	status = x4driver_start_sweep(x4driver);
-
-	// Wait for sweep to complete
-	uint8_t trx_ctrl_done = 0;
-	do {
-		status |= x4driver_get_pif_register(x4driver, ADDR_PIF_TRX_CTRL_DONE_R, &trx_ctrl_done);
-	} while (trx_ctrl_done == 0);
-
-	// Read the radar data
-	uint32_t fc = 0;
-	status |= x4driver_read_frame_normalized(x4driver, &fc, frame, n);
-
-	return status;
+	bin_get_frame(true, response);
 }
 
-/**
-Function to get single normalized radar frame
 
-@param [in]  *x4driver  Pointer to X4 driver instance
-@param [out] *frame     Radar frame which will be written to
-@param [in]   n         Number of bins in single radar frame
+/**
+Function answers a frame request with the frame as payload
 */
-static int get_frame_raw(X4Driver_t* x4driver, float *frame, int n)
+static void bin_get_frame(bool normalized, MatBinResponse_t *response)
 {
-	int status;
+	FrameDescriptor_t descriptor;
 
-	// Start radar sweep
-	status = x4driver_start_sweep(x4driver);
-
-	// Wait for sweep to complete
-	uint8_t trx_ctrl_done = 0;
-	do {
-		status |= x4driver_get_pif_register(x4driver, ADDR_PIF_TRX_CTRL_DONE_R, &trx_ctrl_done);
-	} while (trx_ctrl_done == 0);
+	int status = get_frame_encoded(normalized, &descriptor);
+	if (status)
+	{
+		if (usb_tx_slot != NULL)
+		{
+			usb_tx_queue_release(usb_tx_slot);
+			usb_tx_slot = NULL;
+		}
 
-	// Read the radar data
-	uint32_t fc = 0;
-	status |= x4driver_read_frame_raw(x4driver, &fc, frame, n);
+		response->status = status;
+		write_bin_response(response);
+		return;
+	}
 
-	return status;
+	write_bin_frame(response, &descriptor);
 }
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -955,7 +2852,7 @@ static int write_warning(const char* warning)
 	usb_write_buf(warning, dlen, &offset);
 	usb_write_buf("<ACK>", 5, &offset);
 
-	n = usb_write(offset);
+	n = usb_write(offset, false);
 	if (n != offset)
 		PRINTF("Failed to write warning message to client\n");
 
@@ -982,7 +2879,7 @@ static int write_data_nack(const char* data)
 
 	usb_write_buf(data, dlen, &offset);
 
-	n = usb_write(offset);
+	n = usb_write(offset, false);
 	if (n != offset)
 		PRINTF("Failed to write data nack message to client\n");
 
@@ -998,7 +2895,7 @@ static int write_binary_nack(const void* data, int data_len)
 
 	usb_write_buf(data, data_len, &offset);
 
-	n = usb_write(offset);
+	n = usb_write(offset, false);
 	if (n != offset)
 		PRINTF("Failed to write binary nack message to client\n");
 
@@ -1031,7 +2928,7 @@ static int write_error(const char* error)
 	usb_write_buf(error, dlen, &offset);
 	usb_write_buf("<ACK>", 5, &offset);
 
-	n = usb_write(offset);
+	n = usb_write(offset, false);
 	if (n != offset)
 		PRINTF("Failed to write error message to client\n");
 
@@ -1054,7 +2951,7 @@ static int write_binary(const void* data, int data_len)
 	usb_write_buf(data, data_len, &offset);
 	usb_write_buf("<ACK>", 5, &offset);
 
-	n = usb_write(offset);
+	n = usb_write(offset, false);
 	if (n != offset)
 		PRINTF("Failed to write binary message to client\n");
 
@@ -1082,13 +2979,98 @@ static int write_data(const char* data)
 
 	usb_write_buf("<ACK>", 5, &offset);
 
-	n = usb_write(offset);
+	n = usb_write(offset, false);
 	if (n != offset)
 		PRINTF("Failed to write data message to client\n");
 
 	return 0;
 }
 
+/**
+Function sends the frame unpacked in place by usb_frame_acquire() the same way
+as write_binary(), led by its descriptor unless it is sent as floats
+*/
+static int write_binary_frame(const FrameDescriptor_t *descriptor)
+{
+	int n;
+	if (descriptor->format == FRAME_FORMAT_FLOAT32)
+		n = usb_frame_submit(NULL, 0, descriptor->length, false, true);
+	else
+		n = usb_frame_submit(descriptor, sizeof(FrameDescriptor_t), descriptor->length, false, true);
+	if (n == 0)
+		PRINTF("Failed to write binary message to client\n");
+
+	return 0;
+}
+
+
+/**
+Function sends the frame unpacked in place by usb_frame_acquire() as a stream
+packet
+*/
+static int write_stream_frame(const StreamHeader_t *header, const FrameDescriptor_t *descriptor)
+{
+	uint8_t prefix[5 + sizeof(StreamHeader_t) + sizeof(FrameDescriptor_t)];
+	uint32_t prefix_len = 5 + sizeof(StreamHeader_t);
+
+	memcpy(prefix, "<STR>", 5);
+	memcpy(prefix + 5, header, sizeof(StreamHeader_t));
+
+	if (descriptor->format != FRAME_FORMAT_FLOAT32)
+	{
+		memcpy(prefix + prefix_len, descriptor, sizeof(FrameDescriptor_t));
+		prefix_len += sizeof(FrameDescriptor_t);
+	}
+
+	int n = usb_frame_submit(prefix, prefix_len, descriptor->length, true, true);
+	if (n == 0)
+		PRINTF("Failed to write stream frame to client\n");
+
+	return 0;
+}
+
+/**
+Function sends a binary response without payload
+*/
+static int write_bin_response(const MatBinResponse_t *response)
+{
+	return write_binary(response, sizeof(MatBinResponse_t));
+}
+
+
+/**
+Function sends a binary response with the frame unpacked in place by
+usb_frame_acquire() as payload, led by its descriptor unless it is sent as
+floats. The value of the response is the frame format
+*/
+static int write_bin_frame(MatBinResponse_t *response, const FrameDescriptor_t *descriptor)
+{
+	uint8_t prefix[sizeof(MatBinResponse_t) + sizeof(FrameDescriptor_t)];
+	uint32_t prefix_len = sizeof(MatBinResponse_t);
+
+	response->type = MAT_VALUE_INT;
+	response->value.i = descriptor->format;
+	response->length = descriptor->length;
+
+	if (descriptor->format != FRAME_FORMAT_FLOAT32)
+	{
+		response->flags |= MAT_BIN_FLAG_DESCRIPTOR;
+		response->length += sizeof(FrameDescriptor_t);
+
+		memcpy(prefix + prefix_len, descriptor, sizeof(FrameDescriptor_t));
+		prefix_len += sizeof(FrameDescriptor_t);
+	}
+
+	memcpy(prefix, response, sizeof(MatBinResponse_t));
+
+	int n = usb_frame_submit(prefix, prefix_len, descriptor->length, false, true);
+	if (n == 0)
+		PRINTF("Failed to write binary frame to client\n");
+
+	return 0;
+}
+
+
 //
 // These GPIO functions are relic of BBB version. Not used on SLMX4
 //
@@ -1116,19 +3098,120 @@ static int read_io_pin(int bank, int pin, int* val)
 
 static void usb_write_buf(uint8_t *buf, uint32_t buf_len, uint32_t *offset)
 {
-	memcpy(usb_tx_buf + *offset, buf, buf_len);
+	// The first write of a message waits for a free slot
+	if (usb_tx_slot == NULL)
+		usb_tx_slot = usb_tx_queue_acquire(USB_TX_QUEUE_TIMEOUT_MS);
+
+	if (usb_tx_slot != NULL && *offset + buf_len <= USB_TX_QUEUE_SLOT_SIZE)
+		memcpy(usb_tx_slot + *offset, buf, buf_len);
+
 	*offset += buf_len;
 }
 
 
-static int usb_write(size_t n)
+static int usb_write(size_t n, bool droppable)
 {
-	// Transmit the message via USB
-	int error = USB_DeviceCdcAcmSend(s_cdcVcom.cdcAcmHandle, USB_CDC_VCOM_BULK_IN_ENDPOINT, usb_tx_buf, n);
-	if (error != kStatus_USB_Success)
+	uint8_t *slot = usb_tx_slot;
+	usb_tx_slot = NULL;
+
+	if (slot == NULL)
+	{
+		PRINTF("send_response() no free slot\n");
+		return 0;
+	}
+
+	if (n > USB_TX_QUEUE_SLOT_SIZE)
+	{
+		PRINTF("send_response() message too long %u\n", (unsigned)n);
+		usb_tx_queue_release(slot);
+		return 0;
+	}
+
+	// Queue the message, the slot is freed once the transfer completes
+	int error = usb_tx_queue_submit(slot, 0, n, droppable);
+	if (error)
 	{
 		// error
 		PRINTF("send_response() err = %d\n", error);
+		usb_tx_queue_release(slot);
+		return 0;
+	}
+
+	return n;
+}
+
+
+/**
+Function gets a transmit slot for a frame to be unpacked in place. The frame
+starts at USB_TX_QUEUE_HEADROOM, word aligned for the unpack kernels, with
+room for the framing in front of it
+
+@param [in] timeout_ms  Time to wait for a free slot
+
+@return Frame in the slot, NULL if no slot is free
+*/
+static float *usb_frame_acquire(uint32_t timeout_ms)
+{
+	usb_tx_slot = usb_tx_queue_acquire(timeout_ms);
+	if (usb_tx_slot == NULL)
+		return NULL;
+
+	return (float *)(usb_tx_slot + USB_TX_QUEUE_HEADROOM);
+}
+
+
+/**
+Function frames the frame from usb_frame_acquire() and queues it. The packet
+length (if enabled) and the prefix go right in front of the frame and "<ACK>"
+right after it
+
+@param [in] *prefix      Bytes between the packet length and the frame
+@param [in]  prefix_len  Number of prefix bytes
+@param [in]  data_len    Number of frame bytes
+@param [in]  droppable   Slot may be reclaimed under USB_TX_DROP_OLDEST
+@param [in]  packet      The frame is a whole message. Otherwise it is part of
+                         a longer one and only the prefix is added
+
+@return Number of bytes queued, 0 on failure
+*/
+static int usb_frame_submit(const void *prefix, uint32_t prefix_len, uint32_t data_len, bool droppable, bool packet)
+{
+	uint8_t *slot = usb_tx_slot;
+	usb_tx_slot = NULL;
+
+	if (slot == NULL)
+		return 0;
+
+	uint32_t length_len = packet ? 4 : 0;
+	uint32_t ack_len = packet ? 5 : 0;
+
+	if (prefix_len + length_len > USB_TX_QUEUE_HEADROOM || USB_TX_QUEUE_HEADROOM + data_len + ack_len > USB_TX_QUEUE_SLOT_SIZE)
+	{
+		usb_tx_queue_release(slot);
+		return 0;
+	}
+
+	uint32_t start = USB_TX_QUEUE_HEADROOM - prefix_len;
+	if (prefix_len > 0)
+		memcpy(slot + start, prefix, prefix_len);
+
+	if (packet && include_packet_length_flag)
+	{
+		uint32_t len = prefix_len + data_len + 5;
+		start -= 4;
+		memcpy(slot + start, &len, 4);
+	}
+
+	if (packet)
+		memcpy(slot + USB_TX_QUEUE_HEADROOM + data_len, "<ACK>", 5);
+
+	uint32_t n = USB_TX_QUEUE_HEADROOM - start + data_len + ack_len;
+
+	int error = usb_tx_queue_submit(slot, start, n, droppable);
+	if (error)
+	{
+		PRINTF("send_response() err = %d\n", error);
+		usb_tx_queue_release(slot);
 		return 0;
 	}
 
@@ -29,6 +29,9 @@ extern "C" {
 
 #define MAT_HANDLER_VERSION "1.0.0"
 
+// Longest text command, long enough for a SetVariables() of every variable
+#define MAT_CMD_MAX_LENGTH 384
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Public Functions
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -39,15 +42,39 @@ when connected
 */
 void handle_client_init();
 
+/**
+Function to handle the commands waiting in the USB receive queue
+
+Commands are framed from the byte stream regardless of how the host split it
+into packets, so the host can send many commands without waiting for each
+reply. Text commands end with the ')' closing their arguments, binary requests
+start with MAT_BIN_MAGIC and are a fixed size (see mat_protocol.h). Replies are
+sent in the order of the commands. A partial command waits for the rest.
+*/
+void handle_client_rx();
+
 /**
 Function to handle client requests
 
 In this version, the client task is a basic TCP server. The server acts like an
 infinite loop where it will check to see if there are any commands from the user
 to handle. It also will do things like stream the radar data.
+
+A buffer starting with MAT_BIN_MAGIC holds binary requests instead of a text
+command, see mat_protocol.h
 */
 void handle_client_request(uint8_t *buf, int n);
 
+/**
+Function to push the next streamed frame to the client
+
+Called from the client task loop. Does nothing unless StartStreaming() is
+active, a frame is waiting and a transmit slot is free.
+
+@return true if a frame was taken from the stream, more may be waiting
+*/
+bool handle_client_stream();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,164 @@
+/**
+@file mat_protocol.h
+
+Binary command protocol of the MATLAB server
+
+Alongside the text commands (e.g. "VarSetValue_ByName(pps,32)") the server
+accepts fixed size binary requests. A MatBinRequest_t starts with
+MAT_BIN_MAGIC and may be sent back to back with other requests and text
+commands, split across USB packets in any way. Each is answered in order by a
+MatBinResponse_t, followed by its payload (if any) and "<ACK>". The response is
+preceded by its length like any other reply when packet lengths are enabled
+with SendPacketLengths(1).
+
+Variables are addressed by MatVarId_t and carry typed values, so neither the
+request nor the reply is parsed or formatted as text. The request ID is
+returned unchanged and lets a client match replies to requests it pipelined.
+
+All values are little endian.
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef MAT_PROTOCOL_h
+#define MAT_PROTOCOL_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+// First byte of every binary request and response, never the start of a text
+// command
+#define MAT_BIN_MAGIC 0xA5
+
+/**
+Binary opcodes
+*/
+typedef enum {
+	MAT_OP_PING                 = 0, // Response only, echoes the value
+	MAT_OP_VAR_GET              = 1, // Value of var_id
+	MAT_OP_VAR_SET              = 2, // Sets var_id to value
+	MAT_OP_GET_FRAME_RAW        = 3, // Payload is a frame as GetFrameRaw()
+	MAT_OP_GET_FRAME_NORMALIZED = 4, // Payload is a frame as GetFrameNormalized()
+
+	MAT_OP_COUNT
+
+} MatOpcode_t;
+
+/**
+Variable IDs. The IDs are part of the protocol, new variables are appended
+*/
+typedef enum {
+	MAT_VAR_DAC_MIN            = 0,
+	MAT_VAR_DAC_MAX            = 1,
+	MAT_VAR_DAC_STEP           = 2,
+	MAT_VAR_PPS                = 3,
+	MAT_VAR_ITERATIONS         = 4,
+	MAT_VAR_PRF                = 5,
+	MAT_VAR_PRF_DIV            = 6,
+	MAT_VAR_FS                 = 7,
+	MAT_VAR_SAMPLERS_PER_FRAME = 8,
+	MAT_VAR_FRAME_LENGTH       = 9,
+	MAT_VAR_RX_WAIT            = 10,
+	MAT_VAR_TX_REGION          = 11,
+	MAT_VAR_TX_POWER           = 12,
+	MAT_VAR_DDC_EN             = 13,
+	MAT_VAR_FRAME_OFFSET       = 14,
+	MAT_VAR_FRAME_START        = 15,
+	MAT_VAR_FRAME_END          = 16,
+	MAT_VAR_SWEEP_TIME         = 17,
+	MAT_VAR_UNAMBIGUOUS_RANGE  = 18,
+	MAT_VAR_RES                = 19,
+	MAT_VAR_FS_RF              = 20,
+	MAT_VAR_TX_DROP_POLICY     = 21,
+	MAT_VAR_FRAME_FORMAT       = 22,
+	MAT_VAR_CLUTTER_MODE       = 23,
+	MAT_VAR_CLUTTER_ALPHA      = 24,
+	MAT_VAR_CLUTTER_CAPTURE    = 25,
+	MAT_VAR_INTEGRATE_FRAMES   = 26,
+
+	MAT_VAR_COUNT
+
+} MatVarId_t;
+
+// Value types
+#define MAT_VALUE_INT   0 // int32_t
+#define MAT_VALUE_FLOAT 1 // float
+
+// Response flags
+#define MAT_BIN_FLAG_WARNING    0x01 // Value set, but see the text interface warning
+#define MAT_BIN_FLAG_DESCRIPTOR 0x02 // Payload starts with a FrameDescriptor_t
+
+// Response status, positive values are X4 driver error codes
+#define MAT_STATUS_OK            0
+#define MAT_STATUS_ERR_OPCODE    (-1) // Unknown opcode
+#define MAT_STATUS_ERR_VARIABLE  (-2) // Unknown variable ID
+#define MAT_STATUS_ERR_READ_ONLY (-3) // Variable can not be set
+#define MAT_STATUS_ERR_TYPE      (-4) // Unknown value type
+#define MAT_STATUS_ERR_VALUE     (-5) // Value out of range
+#define MAT_STATUS_ERR_CLOSED    (-6) // Radar is closed
+#define MAT_STATUS_ERR_STREAMING (-7) // Rejected while streaming
+#define MAT_STATUS_ERR_FORMAT    (-8) // Frame not available in frame_format
+#define MAT_STATUS_ERR_NO_SLOT   (-9) // No transmit buffer for the frame
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@union MatValue_t
+Typed variable value
+*/
+typedef union {
+	int32_t i;
+	float f;
+
+} MatValue_t;
+
+/**
+@struct MatBinRequest_t
+Binary request, 16 bytes
+*/
+typedef struct {
+	uint8_t magic;       // MAT_BIN_MAGIC
+	uint8_t opcode;      // MatOpcode_t
+	uint16_t var_id;     // MatVarId_t for MAT_OP_VAR_GET and MAT_OP_VAR_SET
+	uint32_t request_id; // Returned in the response
+	uint8_t type;        // Type of value, MAT_VALUE_*
+	uint8_t reserved[3];
+	MatValue_t value;    // Value for MAT_OP_VAR_SET and MAT_OP_PING
+
+} MatBinRequest_t;
+
+/**
+@struct MatBinResponse_t
+Binary response, 20 bytes, followed by length bytes of payload and "<ACK>"
+*/
+typedef struct {
+	uint8_t magic;       // MAT_BIN_MAGIC
+	uint8_t opcode;      // Opcode of the request
+	uint16_t var_id;     // Variable of the request
+	uint32_t request_id; // ID of the request
+	int16_t status;      // MAT_STATUS_*, or an X4 driver error code
+	uint8_t type;        // Type of value, MAT_VALUE_*
+	uint8_t flags;       // MAT_BIN_FLAG_*
+	MatValue_t value;    // Value of the variable
+	uint32_t length;     // Bytes of payload
+
+} MatBinResponse_t;
+
+#ifdef __cplusplus
+}
+#endif
+#endif // MAT_PROTOCOL_h
@@ -0,0 +1,238 @@
+/**
+@file usb_rx_queue.c
+
+See header
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "usb_rx_queue.h"
+
+// USB includes
+#include "usb_device_cdc_acm.h"
+
+// FreeRTOS includes
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define RING_MASK (USB_RX_QUEUE_SIZE - 1)
+
+#if (USB_RX_QUEUE_SIZE & RING_MASK) != 0
+#error "USB_RX_QUEUE_SIZE must be a power of two"
+#endif
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static uint32_t ring_room();
+static void arm();
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Packet buffer of the endpoint. DTCM is not cached, so the USB DMA needs no
+// cache maintenance
+USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE)
+__BSS(SRAM_DTC) static uint8_t packet_data[USB_DATA_ALIGN_SIZE_MULTIPLE(USB_RX_QUEUE_PACKET_SIZE)];
+
+static uint8_t ring[USB_RX_QUEUE_SIZE];
+
+// Free running byte counters, head is written by the interrupt and tail by
+// the reader
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+
+// usb_rx_queue_start() leaves the discarding of unread bytes to the reader,
+// which owns ring_tail
+static volatile uint32_t flush_head = 0;
+static volatile bool flush_pending = false;
+
+static class_handle_t cdc_handle = (class_handle_t)NULL;
+static uint8_t cdc_endpoint = 0;
+static volatile uint32_t packet_size = 0; // 0 while stopped
+static volatile bool armed = false;
+static UsbRxQueueStats_t rx_stats = {0};
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int usb_rx_queue_init(class_handle_t handle, uint8_t endpoint)
+{
+	if ((class_handle_t)NULL == handle) return USB_RX_QUEUE_ERR_ARG;
+
+	cdc_handle = handle;
+	cdc_endpoint = endpoint;
+
+	return USB_RX_QUEUE_SUCCESS;
+}
+
+
+void usb_rx_queue_start(uint32_t max_packet_size)
+{
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+
+	flush_head = ring_head;
+	flush_pending = true;
+
+	packet_size = (max_packet_size < USB_RX_QUEUE_PACKET_SIZE) ? max_packet_size : USB_RX_QUEUE_PACKET_SIZE;
+	armed = false;
+	arm();
+
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+
+void usb_rx_queue_receive_complete(uint32_t length)
+{
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+
+	armed = false;
+
+	// Cancelled transfers are not re-armed, usb_rx_queue_start() does that
+	if (length == USB_UNINITIALIZED_VAL_32 || packet_size == 0) {
+		taskEXIT_CRITICAL_FROM_ISR(saved);
+		return;
+	}
+
+	uint32_t room = ring_room();
+	if (length > room)
+		length = room;
+
+	uint32_t head = ring_head & RING_MASK;
+	uint32_t first = USB_RX_QUEUE_SIZE - head;
+	if (first > length)
+		first = length;
+
+	memcpy(ring + head, packet_data, first);
+	memcpy(ring, packet_data + first, length - first);
+	ring_head += length;
+
+	rx_stats.packets++;
+	rx_stats.bytes += length;
+	if (USB_RX_QUEUE_SIZE - ring_room() > rx_stats.max_fill)
+		rx_stats.max_fill = USB_RX_QUEUE_SIZE - ring_room();
+
+	// Without room for a whole packet the host is NAKed until the reader
+	// catches up
+	if (ring_room() >= packet_size)
+		arm();
+	else
+		rx_stats.stalls++;
+
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+
+void usb_rx_queue_stop()
+{
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+
+	packet_size = 0;
+	armed = false;
+
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+
+uint32_t usb_rx_queue_count()
+{
+	if (flush_pending) {
+		taskENTER_CRITICAL();
+		ring_tail = flush_head;
+		flush_pending = false;
+		taskEXIT_CRITICAL();
+	}
+
+	return ring_head - ring_tail;
+}
+
+
+uint8_t usb_rx_queue_peek(uint32_t offset)
+{
+	return ring[(ring_tail + offset) & RING_MASK];
+}
+
+
+uint32_t usb_rx_queue_read(uint8_t *buf, uint32_t n)
+{
+	uint32_t count = usb_rx_queue_count();
+	if (n > count)
+		n = count;
+
+	if (buf != NULL) {
+		uint32_t tail = ring_tail & RING_MASK;
+		uint32_t first = USB_RX_QUEUE_SIZE - tail;
+		if (first > n)
+			first = n;
+
+		memcpy(buf, ring + tail, first);
+		memcpy(buf + first, ring, n - first);
+	}
+
+	taskENTER_CRITICAL();
+
+	// A restart while copying has discarded these bytes already
+	if (!flush_pending)
+		ring_tail += n;
+
+	// Resume an endpoint left unarmed for lack of room
+	if (!armed && packet_size != 0 && ring_room() >= packet_size)
+		arm();
+
+	taskEXIT_CRITICAL();
+
+	return n;
+}
+
+
+void usb_rx_queue_get_stats(UsbRxQueueStats_t *stats)
+{
+	*stats = rx_stats;
+}
+
+
+void usb_rx_queue_reset_stats()
+{
+	memset(&rx_stats, 0, sizeof(rx_stats));
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function gets the free bytes in the ring, counting bytes of a pending flush as
+free. Called in a critical section
+*/
+static uint32_t ring_room()
+{
+	uint32_t tail = flush_pending ? flush_head : ring_tail;
+
+	return USB_RX_QUEUE_SIZE - (ring_head - tail);
+}
+
+
+/**
+Function schedules the next packet. Called in a critical section
+*/
+static void arm()
+{
+	if (USB_DeviceCdcAcmRecv(cdc_handle, cdc_endpoint, packet_data, packet_size) == kStatus_USB_Success)
+		armed = true;
+}
@@ -0,0 +1,165 @@
+/**
+@file usb_rx_queue.h
+
+Receive queue for the CDC bulk OUT endpoint. Every packet is copied from the
+interrupt into a byte ring and the endpoint is re-armed right away, so the
+host can send more while earlier data is processed. Where packets start and
+end carries no meaning; the reader frames the bytes itself.
+
+When the ring has no room for another packet the endpoint is left unarmed and
+the host is NAKed until the reader frees enough room.
+
+Example:
+@code
+// USB interrupt, receive complete
+usb_rx_queue_receive_complete(length);
+
+// Task
+while (usb_rx_queue_count() >= 4) {
+  uint8_t word[4];
+  usb_rx_queue_read(word, 4);
+}
+@endcode
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef USB_RX_QUEUE_h
+#define USB_RX_QUEUE_h
+
+#include "usb_device_config.h"
+#include "usb.h"
+#include "usb_device.h"
+#include "usb_device_class.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Bytes in the ring, a power of two
+*/
+#ifndef USB_RX_QUEUE_SIZE
+#define USB_RX_QUEUE_SIZE 4096
+#endif
+
+/**
+Largest packet the endpoint receives
+*/
+#define USB_RX_QUEUE_PACKET_SIZE 512
+
+#define USB_RX_QUEUE_SUCCESS 0
+#define USB_RX_QUEUE_ERR_ARG 1
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct UsbRxQueueStats_t
+Receive counters, cleared by usb_rx_queue_reset_stats()
+*/
+typedef struct {
+	uint32_t packets;  // Packets received
+	uint32_t bytes;    // Bytes received
+	uint32_t stalls;   // Times the endpoint was left unarmed for lack of room
+	uint32_t max_fill; // Most bytes waiting in the ring at once
+
+} UsbRxQueueStats_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function sets up the queue for a bulk OUT endpoint
+
+@param [in] handle    CDC ACM class handle
+@param [in] endpoint  Bulk OUT endpoint number
+
+@return USB_RX_QUEUE_SUCCESS on success, error code on failure
+*/
+int usb_rx_queue_init(class_handle_t handle, uint8_t endpoint);
+
+/**
+Function discards anything not yet read and arms the endpoint, once the
+device is configured
+
+@note
+Called from the USB interrupt
+
+@param [in] max_packet_size  Max packet size of the endpoint at the bus speed
+*/
+void usb_rx_queue_start(uint32_t max_packet_size);
+
+/**
+Function to call from the receive complete event of the bulk OUT endpoint.
+Copies the packet into the ring and re-arms the endpoint if there is room
+
+@note
+Called from the USB interrupt
+
+@param [in] length  Bytes received, 0xFFFFFFFF for a cancelled transfer
+*/
+void usb_rx_queue_receive_complete(uint32_t length);
+
+/**
+Function stops receiving, for a bus reset or detach. The endpoint is armed
+again by usb_rx_queue_start()
+*/
+void usb_rx_queue_stop();
+
+/**
+Function gets the number of bytes waiting to be read
+
+@return Bytes in the ring
+*/
+uint32_t usb_rx_queue_count();
+
+/**
+Function gets a byte without removing it
+
+@param [in] offset  Position from the oldest byte, below usb_rx_queue_count()
+
+@return Byte at offset
+*/
+uint8_t usb_rx_queue_peek(uint32_t offset);
+
+/**
+Function removes the oldest bytes from the ring
+
+@param [out] *buf  Buffer the bytes are copied to, NULL to discard them
+@param [in]   n    Number of bytes
+
+@return Number of bytes removed, fewer than n if the ring held fewer
+*/
+uint32_t usb_rx_queue_read(uint8_t *buf, uint32_t n);
+
+/**
+Function gets the receive counters
+
+@param [out] *stats  Copy of the counters
+*/
+void usb_rx_queue_get_stats(UsbRxQueueStats_t *stats);
+
+/**
+Function clears the receive counters
+*/
+void usb_rx_queue_reset_stats();
+
+#ifdef __cplusplus
+}
+#endif
+#endif // USB_RX_QUEUE_h
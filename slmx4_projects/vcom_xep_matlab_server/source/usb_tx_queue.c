@@ -0,0 +1,333 @@
+/**
+@file usb_tx_queue.c
+
+See header
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "usb_tx_queue.h"
+
+// USB includes
+#include "usb_device_cdc_acm.h"
+
+// FreeRTOS includes
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#define SLOT_FREE     0 // On the free list
+#define SLOT_ACQUIRED 1 // Owned by a producer
+#define SLOT_QUEUED   2 // Waiting for the endpoint
+#define SLOT_SENDING  3 // On the bus
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static int slot_index(uint8_t *slot);
+static int claim_free_slot();
+static int reclaim_oldest();
+static void free_slot(int index);
+static void start_next();
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Transmit buffers. DTCM is not cached, so the USB DMA needs no cache
+// maintenance (USB_DEVICE_CONFIG_BUFFER_PROPERTY_CACHEABLE is 0)
+USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE)
+__BSS(SRAM_DTC) static uint8_t slot_data[USB_TX_QUEUE_SLOTS][USB_DATA_ALIGN_SIZE_MULTIPLE(USB_TX_QUEUE_SLOT_SIZE)];
+
+static volatile uint8_t slot_state[USB_TX_QUEUE_SLOTS];
+static uint32_t slot_start[USB_TX_QUEUE_SLOTS];
+static uint32_t slot_length[USB_TX_QUEUE_SLOTS];
+static bool slot_droppable[USB_TX_QUEUE_SLOTS];
+
+// Submitted slots in send order, the head is on the bus while sending is set
+static uint8_t order[USB_TX_QUEUE_SLOTS];
+static uint32_t order_head = 0;
+static volatile uint32_t order_count = 0;
+static volatile bool sending = false;
+
+static SemaphoreHandle_t free_slots = NULL; // Counts slots on the free list
+
+static class_handle_t cdc_handle = (class_handle_t)NULL;
+static uint8_t cdc_endpoint = 0;
+static UsbTxDropPolicy_t drop_policy = USB_TX_DROP_NEWEST;
+static UsbTxQueueStats_t tx_stats = {0};
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int usb_tx_queue_init(class_handle_t handle, uint8_t endpoint)
+{
+	if ((class_handle_t)NULL == handle) return USB_TX_QUEUE_ERR_ARG;
+
+	if (free_slots == NULL) {
+		free_slots = xSemaphoreCreateCounting(USB_TX_QUEUE_SLOTS, USB_TX_QUEUE_SLOTS);
+		if (free_slots == NULL)
+			return USB_TX_QUEUE_ERR_RTOS;
+	}
+
+	cdc_handle = handle;
+	cdc_endpoint = endpoint;
+
+	return USB_TX_QUEUE_SUCCESS;
+}
+
+
+uint8_t *usb_tx_queue_acquire(uint32_t timeout_ms)
+{
+	if (free_slots == NULL)
+		return NULL;
+
+	int index = -1;
+
+	if (xSemaphoreTake(free_slots, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+		taskENTER_CRITICAL();
+		index = claim_free_slot();
+		taskEXIT_CRITICAL();
+	} else if (drop_policy == USB_TX_DROP_OLDEST) {
+		taskENTER_CRITICAL();
+		index = reclaim_oldest();
+		taskEXIT_CRITICAL();
+	}
+
+	if (index < 0) {
+		tx_stats.timeouts++;
+		return NULL;
+	}
+
+	return slot_data[index];
+}
+
+
+int usb_tx_queue_submit(uint8_t *slot, uint32_t start, uint32_t length, bool droppable)
+{
+	int index = slot_index(slot);
+	if (index < 0 || slot_state[index] != SLOT_ACQUIRED || start + length > USB_TX_QUEUE_SLOT_SIZE)
+		return USB_TX_QUEUE_ERR_ARG;
+
+	taskENTER_CRITICAL();
+
+	slot_start[index] = start;
+	slot_length[index] = length;
+	slot_droppable[index] = droppable;
+	slot_state[index] = SLOT_QUEUED;
+	order[(order_head + order_count) % USB_TX_QUEUE_SLOTS] = index;
+	order_count++;
+
+	if (order_count > tx_stats.max_queued)
+		tx_stats.max_queued = order_count;
+
+	if (!sending)
+		start_next();
+
+	taskEXIT_CRITICAL();
+
+	return USB_TX_QUEUE_SUCCESS;
+}
+
+
+void usb_tx_queue_release(uint8_t *slot)
+{
+	int index = slot_index(slot);
+	if (index < 0 || slot_state[index] != SLOT_ACQUIRED)
+		return;
+
+	taskENTER_CRITICAL();
+	free_slot(index);
+	taskEXIT_CRITICAL();
+}
+
+
+int usb_tx_queue_flush(uint32_t timeout_ms)
+{
+	TickType_t start = xTaskGetTickCount();
+
+	while (order_count != 0) {
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(timeout_ms))
+			return USB_TX_QUEUE_ERR_TIMEOUT;
+
+		vTaskDelay(1);
+	}
+
+	return USB_TX_QUEUE_SUCCESS;
+}
+
+
+void usb_tx_queue_send_complete()
+{
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+
+	if (sending) {
+		int index = order[order_head];
+
+		tx_stats.sent++;
+		tx_stats.bytes += slot_length[index];
+
+		order_head = (order_head + 1) % USB_TX_QUEUE_SLOTS;
+		order_count--;
+		sending = false;
+		free_slot(index);
+	}
+
+	start_next();
+
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+
+void usb_tx_queue_abort()
+{
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+
+	while (order_count > 0) {
+		free_slot(order[order_head]);
+		order_head = (order_head + 1) % USB_TX_QUEUE_SLOTS;
+		order_count--;
+	}
+	sending = false;
+
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+
+void usb_tx_queue_set_drop_policy(UsbTxDropPolicy_t policy)
+{
+	drop_policy = policy;
+}
+
+
+void usb_tx_queue_get_stats(UsbTxQueueStats_t *stats)
+{
+	*stats = tx_stats;
+}
+
+
+void usb_tx_queue_reset_stats()
+{
+	memset(&tx_stats, 0, sizeof(tx_stats));
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function maps a slot pointer to its index
+
+@return Index, -1 if the pointer is not the start of a slot
+*/
+static int slot_index(uint8_t *slot)
+{
+	for (int i = 0; i < USB_TX_QUEUE_SLOTS; i++) {
+		if (slot == slot_data[i])
+			return i;
+	}
+
+	return -1;
+}
+
+
+/**
+Function takes a slot off the free list. Called in a critical section after
+the free count has been taken
+*/
+static int claim_free_slot()
+{
+	for (int i = 0; i < USB_TX_QUEUE_SLOTS; i++) {
+		if (slot_state[i] == SLOT_FREE) {
+			slot_state[i] = SLOT_ACQUIRED;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+Function takes back the oldest droppable slot that is not on the bus. Called
+in a critical section
+*/
+static int reclaim_oldest()
+{
+	uint32_t first = sending ? 1 : 0;
+
+	for (uint32_t i = first; i < order_count; i++) {
+		int index = order[(order_head + i) % USB_TX_QUEUE_SLOTS];
+		if (!slot_droppable[index])
+			continue;
+
+		// Close the gap, keeping the send order of the rest
+		for (uint32_t j = i; j + 1 < order_count; j++)
+			order[(order_head + j) % USB_TX_QUEUE_SLOTS] = order[(order_head + j + 1) % USB_TX_QUEUE_SLOTS];
+		order_count--;
+
+		slot_state[index] = SLOT_ACQUIRED;
+		tx_stats.dropped++;
+		return index;
+	}
+
+	return -1;
+}
+
+
+/**
+Function puts a slot back on the free list. Called in a critical section
+*/
+static void free_slot(int index)
+{
+	slot_state[index] = SLOT_FREE;
+
+	if (xPortIsInsideInterrupt()) {
+		BaseType_t woken = pdFALSE;
+		xSemaphoreGiveFromISR(free_slots, &woken);
+		portYIELD_FROM_ISR(woken);
+	} else {
+		xSemaphoreGive(free_slots);
+	}
+}
+
+
+/**
+Function starts the transfer of the oldest queued slot if the endpoint is
+idle. Called in a critical section. A busy endpoint is retried from the next
+send complete event, other errors drop the slot
+*/
+static void start_next()
+{
+	while (!sending && order_count > 0) {
+		int index = order[order_head];
+
+		usb_status_t error = USB_DeviceCdcAcmSend(cdc_handle, cdc_endpoint, slot_data[index] + slot_start[index], slot_length[index]);
+		if (error == kStatus_USB_Success) {
+			slot_state[index] = SLOT_SENDING;
+			sending = true;
+		} else if (error == kStatus_USB_Busy) {
+			break;
+		} else {
+			tx_stats.send_errors++;
+			order_head = (order_head + 1) % USB_TX_QUEUE_SLOTS;
+			order_count--;
+			free_slot(index);
+		}
+	}
+}
@@ -0,0 +1,198 @@
+/**
+@file usb_tx_queue.h
+
+Transmit queue for the CDC bulk IN endpoint. Producers acquire a DMA aligned
+slot, fill it and submit it. Submitted slots are sent in order, the next one
+starting from the send complete callback so the endpoint stays busy, and a
+slot only returns to the free list once its transfer (including a trailing
+zero length packet) has completed.
+
+Frames can be written in place at USB_TX_QUEUE_HEADROOM, where they are word
+aligned, with the framing bytes put in front of them and the sent range
+starting at the first framing byte.
+
+Example:
+@code
+uint8_t *slot = usb_tx_queue_acquire(USB_TX_QUEUE_TIMEOUT_MS);
+if (slot != NULL) {
+  memcpy(slot, data, n);
+  usb_tx_queue_submit(slot, 0, n, false);
+}
+@endcode
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef USB_TX_QUEUE_h
+#define USB_TX_QUEUE_h
+
+#include "usb_device_config.h"
+#include "usb.h"
+#include "usb_device.h"
+#include "usb_device_class.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Number of transmit slots
+*/
+#ifndef USB_TX_QUEUE_SLOTS
+#define USB_TX_QUEUE_SLOTS 4
+#endif
+
+/**
+Size of each slot, enough for a full frame of floats at USB_TX_QUEUE_HEADROOM
+followed by a trailer
+*/
+#ifndef USB_TX_QUEUE_SLOT_SIZE
+#define USB_TX_QUEUE_SLOT_SIZE 6208
+#endif
+
+/**
+Bytes reserved in front of an in place frame for its framing (length, tag,
+stream header and frame descriptor)
+*/
+#define USB_TX_QUEUE_HEADROOM 48
+
+/**
+Default time a producer waits for a free slot
+*/
+#define USB_TX_QUEUE_TIMEOUT_MS 100
+
+/**
+What usb_tx_queue_acquire() does when no slot frees up in time
+*/
+typedef enum {
+	USB_TX_DROP_NEWEST = 0, // Fail the acquire, the caller drops its data
+	USB_TX_DROP_OLDEST = 1, // Reclaim the oldest droppable slot not yet on the bus
+
+} UsbTxDropPolicy_t;
+
+#define USB_TX_QUEUE_SUCCESS     0
+#define USB_TX_QUEUE_ERR_ARG     1
+#define USB_TX_QUEUE_ERR_RTOS    2
+#define USB_TX_QUEUE_ERR_TIMEOUT 3
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct UsbTxQueueStats_t
+Transmit counters, cleared by usb_tx_queue_reset_stats()
+*/
+typedef struct {
+	uint32_t sent;        // Completed transfers
+	uint32_t bytes;       // Bytes in completed transfers
+	uint32_t dropped;     // Slots reclaimed under USB_TX_DROP_OLDEST
+	uint32_t timeouts;    // Acquires that found no slot
+	uint32_t send_errors; // USB_DeviceCdcAcmSend() failures other than busy
+	uint32_t max_queued;  // Most slots waiting or on the bus at once
+
+} UsbTxQueueStats_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function creates the queue for a bulk IN endpoint
+
+@param [in] handle    CDC ACM class handle
+@param [in] endpoint  Bulk IN endpoint number
+
+@return USB_TX_QUEUE_SUCCESS on success, error code on failure
+*/
+int usb_tx_queue_init(class_handle_t handle, uint8_t endpoint);
+
+/**
+Function gets a free slot of USB_TX_QUEUE_SLOT_SIZE bytes. The caller owns it
+until it is passed to usb_tx_queue_submit() or usb_tx_queue_release()
+
+@param [in] timeout_ms  Time to wait for a slot, 0 to not wait
+
+@return Slot, NULL if none became free and the drop policy reclaimed none
+*/
+uint8_t *usb_tx_queue_acquire(uint32_t timeout_ms);
+
+/**
+Function queues a slot for transmission and hands it to the queue
+
+@param [in] *slot       Slot from usb_tx_queue_acquire()
+@param [in]  start      Offset of the first byte to send
+@param [in]  length     Number of bytes to send
+@param [in]  droppable  Slot may be reclaimed under USB_TX_DROP_OLDEST
+
+@return USB_TX_QUEUE_SUCCESS on success, error code on failure
+*/
+int usb_tx_queue_submit(uint8_t *slot, uint32_t start, uint32_t length, bool droppable);
+
+/**
+Function returns an acquired slot without sending it
+
+@param [in] *slot  Slot from usb_tx_queue_acquire()
+*/
+void usb_tx_queue_release(uint8_t *slot);
+
+/**
+Function waits until every submitted slot has been sent
+
+@param [in] timeout_ms  Time to wait
+
+@return USB_TX_QUEUE_SUCCESS on success, USB_TX_QUEUE_ERR_TIMEOUT otherwise
+*/
+int usb_tx_queue_flush(uint32_t timeout_ms);
+
+/**
+Function to call from the send complete event of the bulk IN endpoint, after
+any zero length packet has completed. Frees the slot on the bus and starts
+the next one
+
+@note
+Called from the USB interrupt
+*/
+void usb_tx_queue_send_complete();
+
+/**
+Function frees every submitted slot, for a bus reset or detach where pending
+transfers never complete. Slots held by producers are not affected
+*/
+void usb_tx_queue_abort();
+
+/**
+Function sets the behavior when no slot is free
+
+@param [in] policy  USB_TX_DROP_NEWEST or USB_TX_DROP_OLDEST
+*/
+void usb_tx_queue_set_drop_policy(UsbTxDropPolicy_t policy);
+
+/**
+Function gets the transmit counters
+
+@param [out] *stats  Copy of the counters
+*/
+void usb_tx_queue_get_stats(UsbTxQueueStats_t *stats);
+
+/**
+Function clears the transmit counters
+*/
+void usb_tx_queue_reset_stats();
+
+#ifdef __cplusplus
+}
+#endif
+#endif // USB_TX_QUEUE_h
@@ -55,6 +55,9 @@ extern uint8_t USB_EnterLowpowerMode(void);
 
 #include "project.h"
 #include "mat_handler.h"
+#include "usb_tx_queue.h"
+#include "usb_rx_queue.h"
+#include "x4_stream.h"
 
 #include <cr_section_macros.h>
 
@@ -66,6 +69,12 @@ extern uint8_t USB_EnterLowpowerMode(void);
 #define EXAMPLE_SEMC_START_ADDRESS (0x80000000U)
 #define EXAMPLE_SEMC_CLK_FREQ CLOCK_GetFreq(kCLOCK_SemcClk)
 
+// Task notification bits waking USB_VCOM_Handler_Task
+#define VCOM_EVENT_RX         (1UL << 0) // Packet received
+#define VCOM_EVENT_CONNECTION (1UL << 1) // Attach or DTE state changed
+#define VCOM_EVENT_FRAME      (1UL << 2) // Stream frame in the ring
+#define VCOM_EVENT_TX_DONE    (1UL << 3) // Transmit slot freed
+
 // -----------------------------------------------------------------------------
 // Function Prototypes
 // -----------------------------------------------------------------------------
@@ -85,6 +94,9 @@ void BOARD_DbgConsole_Init(void);
 usb_status_t USB_DeviceCdcVcomCallback(class_handle_t handle, uint32_t event, void *param);
 usb_status_t USB_DeviceCallback(usb_device_handle handle, uint32_t event, void *param);
 
+static void notify_handler_from_isr(uint32_t events);
+static void notify_stream_frame();
+
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 // Global Variables
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
@@ -148,15 +160,10 @@ static uint8_t s_countryCode[COMM_FEATURE_DATA_SIZE] = {
 USB_DMA_NONINIT_DATA_ALIGN(USB_DATA_ALIGN_SIZE)
 static usb_cdc_acm_info_t s_usbCdcAcmInfo;
 
-/* Data buffer for receiving */
-USB_DMA_NONINIT_DATA_ALIGN(USB_DATA_ALIGN_SIZE)
-static uint8_t s_currRecvBuf[DATA_BUFF_SIZE];
-
 /* Data buffer for sending*/
 USB_DMA_NONINIT_DATA_ALIGN(USB_DATA_ALIGN_SIZE)
 static uint8_t s_currSendBuf[DATA_BUFF_SIZE];
 
-volatile static uint32_t s_recvSize = 0;
 volatile static uint32_t s_sendSize = 0;
 
 /* USB device class information */
@@ -259,6 +266,8 @@ usb_status_t USB_DeviceCdcVcomCallback(class_handle_t handle, uint32_t event, vo
 	{
 		case kUSB_DeviceCdcEventSendResponse:
 			{
+				bool zlp_sent = false;
+
 				if ((epCbParam->length != 0) && (!(epCbParam->length % g_UsbDeviceCdcVcomDicEndpoints[0].maxPacketSize)))
 				{
 					/* If the last packet is the size of endpoint, then send also zero-ended packet,
@@ -266,50 +275,43 @@ usb_status_t USB_DeviceCdcVcomCallback(class_handle_t handle, uint32_t event, vo
 					** data, so it can flush the output.
 					*/
 					error = USB_DeviceCdcAcmSend(handle, USB_CDC_VCOM_BULK_IN_ENDPOINT, NULL, 0);
+					zlp_sent = (error == kStatus_USB_Success);
 				}
-				else if ((1 == s_cdcVcom.attach) && (1 == s_cdcVcom.startTransactions))
-				{
-					if ((epCbParam->buffer != NULL) || ((epCbParam->buffer == NULL) && (epCbParam->length == 0)))
-					{
-						/* User: add your own code for send complete event */
-						/* Schedule buffer for next receive event */
-						error = USB_DeviceCdcAcmRecv(handle, USB_CDC_VCOM_BULK_OUT_ENDPOINT, s_currRecvBuf, g_UsbDeviceCdcVcomDicEndpoints[0].maxPacketSize);
 
-#if defined(FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED) && (FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED > 0U) && \
-	defined(USB_DEVICE_CONFIG_KEEP_ALIVE_MODE) && (USB_DEVICE_CONFIG_KEEP_ALIVE_MODE > 0U) &&             \
-	defined(FSL_FEATURE_USB_KHCI_USB_RAM) && (FSL_FEATURE_USB_KHCI_USB_RAM > 0U)
-						s_waitForDataReceive = 1;
-						USB0->INTEN &= ~USB_INTEN_SOFTOKEN_MASK;
-#endif
-					}
+				if (!zlp_sent)
+				{
+					// Transfer done, free its slot and start the next queued one
+					usb_tx_queue_send_complete();
+					notify_handler_from_isr(VCOM_EVENT_TX_DONE);
+					error = kStatus_USB_Success;
 				}
 			}
 			break;
 
 		case kUSB_DeviceCdcEventRecvResponse:
 			{
-				if ((1 == s_cdcVcom.attach) && (1 == s_cdcVcom.startTransactions))
-				{
-					s_recvSize = epCbParam->length;
+				uint32_t length = epCbParam->length;
+
+				// Packets sent before the host opened the port are dropped
+				if (((1 != s_cdcVcom.attach) || (1 != s_cdcVcom.startTransactions)) && (USB_UNINITIALIZED_VAL_32 != length))
+					length = 0;
+
+				// Queue the packet and schedule the next one while there is room
+				usb_rx_queue_receive_complete(length);
 
 #if defined(FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED) && (FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED > 0U) && \
 	defined(USB_DEVICE_CONFIG_KEEP_ALIVE_MODE) && (USB_DEVICE_CONFIG_KEEP_ALIVE_MODE > 0U) &&             \
 	defined(FSL_FEATURE_USB_KHCI_USB_RAM) && (FSL_FEATURE_USB_KHCI_USB_RAM > 0U)
-					s_waitForDataReceive = 0;
-					USB0->INTEN |= USB_INTEN_SOFTOKEN_MASK;
+				s_waitForDataReceive = 0;
+				USB0->INTEN |= USB_INTEN_SOFTOKEN_MASK;
 #endif
-					if (!s_recvSize)
-					{
-						/* Schedule buffer for next receive event */
-						error = USB_DeviceCdcAcmRecv(handle, USB_CDC_VCOM_BULK_OUT_ENDPOINT, s_currRecvBuf, g_UsbDeviceCdcVcomDicEndpoints[0].maxPacketSize);
-#if defined(FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED) && (FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED > 0U) && \
-	defined(USB_DEVICE_CONFIG_KEEP_ALIVE_MODE) && (USB_DEVICE_CONFIG_KEEP_ALIVE_MODE > 0U) &&             \
-	defined(FSL_FEATURE_USB_KHCI_USB_RAM) && (FSL_FEATURE_USB_KHCI_USB_RAM > 0U)
-						s_waitForDataReceive = 1;
-						USB0->INTEN &= ~USB_INTEN_SOFTOKEN_MASK;
-#endif
-					}
+				if ((0 != length) && (USB_UNINITIALIZED_VAL_32 != length))
+				{
+					// Wake the task to frame the commands
+					notify_handler_from_isr(VCOM_EVENT_RX);
 				}
+
+				error = kStatus_USB_Success;
 			}
 			break;
 
@@ -455,6 +457,7 @@ usb_status_t USB_DeviceCdcVcomCallback(class_handle_t handle, uint32_t event, vo
 					if (1 == s_cdcVcom.attach)
 					{
 						s_cdcVcom.startTransactions = 1;
+						notify_handler_from_isr(VCOM_EVENT_CONNECTION);
 #if defined(FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED) && (FSL_FEATURE_USB_KHCI_KEEP_ALIVE_ENABLED > 0U) && \
 	defined(USB_DEVICE_CONFIG_KEEP_ALIVE_MODE) && (USB_DEVICE_CONFIG_KEEP_ALIVE_MODE > 0U) &&             \
 	defined(FSL_FEATURE_USB_KHCI_USB_RAM) && (FSL_FEATURE_USB_KHCI_USB_RAM > 0U)
@@ -471,6 +474,7 @@ usb_status_t USB_DeviceCdcVcomCallback(class_handle_t handle, uint32_t event, vo
 					if (1 == s_cdcVcom.attach)
 					{
 						s_cdcVcom.startTransactions = 0;
+						notify_handler_from_isr(VCOM_EVENT_CONNECTION);
 					}
 				}
 			}
@@ -510,6 +514,11 @@ usb_status_t USB_DeviceCallback(usb_device_handle handle, uint32_t event, void *
 			{
 				s_cdcVcom.attach = 0;
 				s_cdcVcom.currentConfiguration = 0U;
+
+				// Transfers in flight are cancelled by the reset
+				usb_tx_queue_abort();
+				usb_rx_queue_stop();
+				notify_handler_from_isr(VCOM_EVENT_CONNECTION);
 #if (defined(USB_DEVICE_CONFIG_EHCI) && (USB_DEVICE_CONFIG_EHCI > 0U)) || \
 	(defined(USB_DEVICE_CONFIG_LPCIP3511HS) && (USB_DEVICE_CONFIG_LPCIP3511HS > 0U))
 				/* Get USB speed to configure the device, including max packet size and interval of the endpoints. */
@@ -526,13 +535,17 @@ usb_status_t USB_DeviceCallback(usb_device_handle handle, uint32_t event, void *
 			{
 				s_cdcVcom.attach = 0;
 				s_cdcVcom.currentConfiguration = 0U;
+				usb_tx_queue_abort();
+				usb_rx_queue_stop();
+				notify_handler_from_isr(VCOM_EVENT_CONNECTION);
 			}
 			else if (USB_CDC_VCOM_CONFIGURE_INDEX == (*temp8))
 			{
 				s_cdcVcom.attach = 1;
 				s_cdcVcom.currentConfiguration = *temp8;
 				/* Schedule buffer for receive */
-				USB_DeviceCdcAcmRecv(s_cdcVcom.cdcAcmHandle, USB_CDC_VCOM_BULK_OUT_ENDPOINT, s_currRecvBuf, g_UsbDeviceCdcVcomDicEndpoints[0].maxPacketSize);
+				usb_rx_queue_start(g_UsbDeviceCdcVcomDicEndpoints[0].maxPacketSize);
+				notify_handler_from_isr(VCOM_EVENT_CONNECTION);
 			}
 			else
 			{
@@ -639,30 +652,78 @@ void USB_VCOM_Handler_Task(void *handle)
 
 	USB_DeviceApplicationInit();
 
+	int status = usb_tx_queue_init(s_cdcVcom.cdcAcmHandle, USB_CDC_VCOM_BULK_IN_ENDPOINT);
+	if (status)
+	{
+		PRINTF("usb_tx_queue_init() err = %d\n", status);
+	}
+
+	status = usb_rx_queue_init(s_cdcVcom.cdcAcmHandle, USB_CDC_VCOM_BULK_OUT_ENDPOINT);
+	if (status)
+	{
+		PRINTF("usb_rx_queue_init() err = %d\n", status);
+	}
+
 	handle_client_init();
 
+	x4_stream_set_notify(notify_stream_frame);
+
+	// Set while streamed frames may be waiting in the ring
+	bool frames_pending = false;
+
 	while (1)
 	{
+		// Sleep until a packet, a connection change, a stream frame or a freed
+		// transmit slot. Events arriving while busy stay latched in the
+		// notification value
+		xTaskNotifyWait(0, UINT32_MAX, NULL, frames_pending ? 0 : portMAX_DELAY);
+
 		if ((1 == s_cdcVcom.attach) && (1 == s_cdcVcom.startTransactions))
 		{
 			usb_connected = 1;
 
-			if ((0 != s_recvSize) && (0xFFFFFFFF != s_recvSize))
-			{
-				handle_client_request(s_currRecvBuf, s_recvSize);
+			// Handle the commands received so far, in order
+			handle_client_rx();
 
-				// Reset rx count
-				s_recvSize = 0;
-			}
+			// Push frames while StartStreaming() is active
+			frames_pending = handle_client_stream();
 		}
 		else
 		{
 			usb_connected = 0;
+			frames_pending = false;
 		}
 	}
 }
 
 
+/**
+Function wakes USB_VCOM_Handler_Task from the USB interrupt
+
+@param [in] events  VCOM_EVENT_* bits
+*/
+static void notify_handler_from_isr(uint32_t events)
+{
+	BaseType_t woken = pdFALSE;
+
+	if (s_cdcVcom.applicationTaskHandle == NULL)
+		return;
+
+	xTaskNotifyFromISR(s_cdcVcom.applicationTaskHandle, events, eSetBits, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+
+/**
+Function wakes USB_VCOM_Handler_Task for a new stream frame, called from the
+x4_stream task
+*/
+static void notify_stream_frame()
+{
+	xTaskNotify(s_cdcVcom.applicationTaskHandle, VCOM_EVENT_FRAME, eSetBits);
+}
+
+
 // =============================================================================
 // Main Program
 // =============================================================================
@@ -734,6 +795,9 @@ void GPIO2_Combined_0_15_IRQHandler(void)
 	GPIO_PortClearInterruptFlags(BOARD_INIT_X4_GPIO1_GPIO, 1U << BOARD_INIT_X4_GPIO1_PIN);
 
 	x4_data_ready = 1;
+
+	// Wake the task waiting for the frame
+	platform__x4_data_ready_isr();
 }
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
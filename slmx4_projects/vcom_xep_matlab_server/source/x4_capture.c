@@ -0,0 +1,241 @@
+/**
+@file x4_capture.c
+
+See header
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "x4_capture.h"
+
+// Platform include
+#include "slmx4_freertos.h"
+
+// FreeRTOS includes
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+// Below the stream task, which must never wait for the copy into SDRAM
+#ifndef X4_CAPTURE_TASK_PRIORITY
+#define X4_CAPTURE_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#endif
+
+#define X4_CAPTURE_TASK_STACK_SIZE (2048L / sizeof(portSTACK_TYPE))
+
+// Time the capture task waits for a frame before checking for a stop request
+#define X4_CAPTURE_POLL_MS 50
+
+// Time x4_capture_stop() waits for the capture task, covering a stream stop
+// at the slowest frame rate
+#define X4_CAPTURE_STOP_TIMEOUT_MS 5000
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static int init_capture();
+static void store_frame(const X4StreamFrame_t *frame);
+static void update_stream_stats();
+static void x4_capture_task(void *arg);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Raw frames and their metadata. Only the CPU touches the ring, so the SDRAM
+// cache needs no maintenance
+__NOINIT(BOARD_SDRAM) static uint8_t capture_data[X4_CAPTURE_BUFFER_SIZE];
+__NOINIT(BOARD_SDRAM) static X4StreamFrame_t capture_frames[X4_CAPTURE_MAX_FRAMES];
+
+static SemaphoreHandle_t capture_run = NULL;  // Wakes the capture task
+static SemaphoreHandle_t capture_idle = NULL; // Capture task has finished
+static TaskHandle_t capture_task = NULL;
+
+static X4Driver_t *capture_x4 = NULL;
+static volatile bool capture_running = false;
+static volatile bool stop_requested = false;
+static uint32_t capture_stride = 0; // Bytes between raw frames in the ring
+static X4CaptureStatus_t capture_status = {0};
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int x4_capture_start(X4Driver_t *x4, uint32_t frames, float fps)
+{
+	if (capture_running) return X4_CAPTURE_ERR_RUNNING;
+	if (NULL == x4 || fps < 1.0f) return X4_CAPTURE_ERR_ARG;
+	if (x4->frame_read_size == 0 || x4->frame_read_size > X4_FRAME_BUFFER_SIZE) return X4_CAPTURE_ERR_ARG;
+	if (init_capture()) return X4_CAPTURE_ERR_RTOS;
+
+	// Keep frames word aligned
+	capture_x4 = x4;
+	capture_stride = (x4->frame_read_size + 3) & ~3u;
+
+	memset(&capture_status, 0, sizeof(capture_status));
+	capture_status.requested = frames;
+	capture_status.capacity = X4_CAPTURE_BUFFER_SIZE / capture_stride;
+	if (capture_status.capacity > X4_CAPTURE_MAX_FRAMES)
+		capture_status.capacity = X4_CAPTURE_MAX_FRAMES;
+
+	// Drop the idle signal of the previous capture
+	xSemaphoreTake(capture_idle, 0);
+
+	if (x4_stream_start(x4, fps) != X4_STREAM_SUCCESS)
+		return X4_CAPTURE_ERR_STREAM;
+
+	stop_requested = false;
+	capture_running = true;
+	capture_status.running = true;
+	xSemaphoreGive(capture_run);
+
+	return X4_CAPTURE_SUCCESS;
+}
+
+
+int x4_capture_stop()
+{
+	if (!capture_running) return X4_CAPTURE_ERR_STOPPED;
+
+	stop_requested = true;
+
+	if (xSemaphoreTake(capture_idle, pdMS_TO_TICKS(X4_CAPTURE_STOP_TIMEOUT_MS)) != pdTRUE)
+		return X4_CAPTURE_ERR_TIMEOUT;
+
+	return X4_CAPTURE_SUCCESS;
+}
+
+
+bool x4_capture_is_running()
+{
+	return capture_running;
+}
+
+
+void x4_capture_get_status(X4CaptureStatus_t *status)
+{
+	taskENTER_CRITICAL();
+	*status = capture_status;
+	taskEXIT_CRITICAL();
+}
+
+
+int x4_capture_get_frame(uint32_t index, X4StreamFrame_t *frame)
+{
+	if (capture_running) return X4_CAPTURE_ERR_RUNNING;
+	if (index < capture_status.first || index >= capture_status.captured) return X4_CAPTURE_ERR_INDEX;
+
+	*frame = capture_frames[index % capture_status.capacity];
+
+	return X4_CAPTURE_SUCCESS;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function creates the capture task and its semaphores on first use
+*/
+static int init_capture()
+{
+	if (capture_task != NULL)
+		return 0;
+
+	capture_run = xSemaphoreCreateBinary();
+	capture_idle = xSemaphoreCreateBinary();
+	if (capture_run == NULL || capture_idle == NULL)
+		return 1;
+
+	if (xTaskCreate(x4_capture_task, "x4_capture", X4_CAPTURE_TASK_STACK_SIZE, NULL, X4_CAPTURE_TASK_PRIORITY, &capture_task) != pdPASS) {
+		capture_task = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+Function copies a stream frame into the next ring slot, overwriting the
+oldest frame once the ring is full
+*/
+static void store_frame(const X4StreamFrame_t *frame)
+{
+	uint32_t slot = capture_status.captured % capture_status.capacity;
+	X4StreamFrame_t *dst = &capture_frames[slot];
+
+	dst->frame_counter = frame->frame_counter;
+	dst->timestamp = frame->timestamp;
+	dst->length = frame->length;
+	dst->data = capture_data + slot * capture_stride;
+	memcpy(dst->data, frame->data, frame->length);
+
+	taskENTER_CRITICAL();
+	capture_status.captured++;
+	if (capture_status.captured > capture_status.capacity)
+		capture_status.first = capture_status.captured - capture_status.capacity;
+	taskEXIT_CRITICAL();
+}
+
+
+static void update_stream_stats()
+{
+	X4StreamStats_t stats;
+	x4_stream_get_stats(&stats);
+
+	capture_status.dropped = stats.dropped;
+	capture_status.errors = stats.errors;
+}
+
+
+/**
+Task moving frames from the stream ring into SDRAM until the capture is
+complete or stopped
+*/
+static void x4_capture_task(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		xSemaphoreTake(capture_run, portMAX_DELAY);
+
+		while (!stop_requested) {
+			X4StreamFrame_t frame;
+
+			int status = x4_stream_get_frame(&frame, X4_CAPTURE_POLL_MS);
+			if (status == X4_STREAM_ERR_TIMEOUT)
+				continue;
+			if (status)
+				break;
+
+			store_frame(&frame);
+			x4_stream_release_frame();
+			update_stream_stats();
+
+			if (capture_status.requested != 0 && capture_status.captured >= capture_status.requested)
+				break;
+		}
+
+		x4_stream_stop(capture_x4);
+		update_stream_stats();
+
+		capture_status.running = false;
+		capture_running = false;
+		xSemaphoreGive(capture_idle);
+	}
+}
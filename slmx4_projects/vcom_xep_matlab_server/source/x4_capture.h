@@ -0,0 +1,151 @@
+/**
+@file x4_capture.h
+
+Burst capture of X4 frames into SDRAM. Frames are acquired on the X4 sweep
+timer through x4_stream and copied with their metadata into a ring in SDRAM by
+a capture task, so the capture keeps its rate no matter how fast the host
+reads. The frames are read back once the capture has finished.
+
+A capture of 0 frames runs until x4_capture_stop(), keeping the newest frames
+that fit in the ring.
+
+Example:
+@code
+x4_capture_start(x4, 500, 100.0f);
+
+X4CaptureStatus_t status;
+do {
+  vTaskDelay(10);
+  x4_capture_get_status(&status);
+} while (status.running);
+
+X4StreamFrame_t frame;
+for (uint32_t i = status.first; i < status.captured; i++) {
+  x4_capture_get_frame(i, &frame);
+  // frame.data holds frame.length raw bytes
+}
+@endcode
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef X4_CAPTURE_h
+#define X4_CAPTURE_h
+
+#include "x4driver.h"
+#include "x4_stream.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Bytes of SDRAM for raw frames
+*/
+#ifndef X4_CAPTURE_BUFFER_SIZE
+#define X4_CAPTURE_BUFFER_SIZE (4 * 1024 * 1024)
+#endif
+
+/**
+Most frames the ring holds, however short the frames
+*/
+#ifndef X4_CAPTURE_MAX_FRAMES
+#define X4_CAPTURE_MAX_FRAMES 4096
+#endif
+
+#define X4_CAPTURE_SUCCESS     0
+#define X4_CAPTURE_ERR_RUNNING 1
+#define X4_CAPTURE_ERR_STOPPED 2
+#define X4_CAPTURE_ERR_ARG     3
+#define X4_CAPTURE_ERR_STREAM  4
+#define X4_CAPTURE_ERR_RTOS    5
+#define X4_CAPTURE_ERR_INDEX   6
+#define X4_CAPTURE_ERR_TIMEOUT 7
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct X4CaptureStatus_t
+Progress of the current or last capture
+*/
+typedef struct {
+	bool running;       // Capture in progress
+	uint32_t requested; // Frames requested, 0 until stopped
+	uint32_t captured;  // Frames captured, the next capture index
+	uint32_t first;     // Capture index of the oldest frame still in the ring
+	uint32_t capacity;  // Frames the ring holds at the captured frame size
+	uint32_t dropped;   // Frames the X4 produced that did not make it into the ring
+	uint32_t errors;    // Data ready timeouts and failed reads
+
+} X4CaptureStatus_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function starts a capture, discarding the previous one
+
+@note
+The X4 stream is owned by the capture until it finishes, see x4_stream_start()
+
+@param [in] *x4      Handle to X4 radar
+@param [in]  frames  Frames to capture, 0 to capture until stopped
+@param [in]  fps     Frame rate
+
+@return X4_CAPTURE_SUCCESS on success, error code on failure
+*/
+int x4_capture_start(X4Driver_t *x4, uint32_t frames, float fps);
+
+/**
+Function ends the capture early. The frames captured so far are kept
+
+@return X4_CAPTURE_SUCCESS on success, error code on failure
+*/
+int x4_capture_stop();
+
+/**
+Function checks if a capture is in progress
+
+@return true while capturing
+*/
+bool x4_capture_is_running();
+
+/**
+Function gets the progress of the capture
+
+@param [out] *status  Capture status
+*/
+void x4_capture_get_status(X4CaptureStatus_t *status);
+
+/**
+Function gets a captured frame
+
+@note
+Frames are only read back once the capture has finished
+
+@param [in]   index  Capture index, from status.first to status.captured - 1
+@param [out] *frame  Frame, data points into the SDRAM ring
+
+@return X4_CAPTURE_SUCCESS on success, error code on failure
+*/
+int x4_capture_get_frame(uint32_t index, X4StreamFrame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4_CAPTURE_h
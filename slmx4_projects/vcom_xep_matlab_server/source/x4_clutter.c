@@ -0,0 +1,141 @@
+/**
+@file x4_clutter.c
+
+See header
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "x4_clutter.h"
+
+#include "arm_math.h"
+
+#include <cr_section_macros.h>
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Touched by every frame, so kept in DTCM
+__BSS(SRAM_DTC) static float background[X4_CLUTTER_MAX_VALUES];
+__BSS(SRAM_DTC) static float update[X4_CLUTTER_MAX_VALUES];
+
+static int clutter_mode = X4_CLUTTER_OFF;
+static float clutter_alpha = X4_CLUTTER_DEFAULT_ALPHA;
+
+static uint32_t length = 0;    // Values of the background, 0 before the first frame
+static uint32_t count = 0;     // Frames in the background
+static uint32_t remaining = 0; // Frames still to come of a capture
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int x4_clutter_set_mode(int mode)
+{
+	if (mode != X4_CLUTTER_OFF && mode != X4_CLUTTER_MOVING && mode != X4_CLUTTER_FROZEN)
+		return X4_CLUTTER_ERR_ARG;
+
+	// The background went stale while the filter was off
+	if (clutter_mode == X4_CLUTTER_OFF)
+		x4_clutter_reset();
+
+	clutter_mode = mode;
+	remaining = 0;
+
+	return X4_CLUTTER_SUCCESS;
+}
+
+
+int x4_clutter_get_mode()
+{
+	return clutter_mode;
+}
+
+
+int x4_clutter_set_alpha(float alpha)
+{
+	if (!(alpha > 0.0f && alpha <= 1.0f))
+		return X4_CLUTTER_ERR_ARG;
+
+	clutter_alpha = alpha;
+
+	return X4_CLUTTER_SUCCESS;
+}
+
+
+float x4_clutter_get_alpha()
+{
+	return clutter_alpha;
+}
+
+
+int x4_clutter_capture(uint32_t frames)
+{
+	if (frames > X4_CLUTTER_MAX_CAPTURE)
+		return X4_CLUTTER_ERR_ARG;
+
+	if (frames > 0)
+		x4_clutter_reset();
+
+	clutter_mode = X4_CLUTTER_FROZEN;
+	remaining = frames;
+
+	return X4_CLUTTER_SUCCESS;
+}
+
+
+uint32_t x4_clutter_capture_remaining()
+{
+	return remaining;
+}
+
+
+void x4_clutter_reset()
+{
+	length = 0;
+	count = 0;
+}
+
+
+void x4_clutter_apply(float *frame, uint32_t n)
+{
+	if (clutter_mode == X4_CLUTTER_OFF || n == 0 || n > X4_CLUTTER_MAX_VALUES)
+		return;
+
+	if (n != length)
+	{
+		arm_fill_f32(0.0f, background, n);
+		length = n;
+		count = 0;
+	}
+
+	// Weight of this frame in the background. The mean of the frames so far
+	// until it is smaller than alpha
+	float weight = 1.0f / (count + 1);
+
+	if (remaining > 0)
+		remaining--;
+	else if (clutter_mode == X4_CLUTTER_MOVING)
+		weight = (weight > clutter_alpha) ? weight : clutter_alpha;
+	else if (count > 0)
+		weight = 0.0f; // Frozen
+
+	if (count < UINT32_MAX)
+		count++;
+
+	// frame = frame - background, background += weight * frame
+	arm_sub_f32(frame, background, frame, n);
+
+	if (weight > 0.0f)
+	{
+		arm_scale_f32(frame, weight, update, n);
+		arm_add_f32(background, update, background, n);
+	}
+}
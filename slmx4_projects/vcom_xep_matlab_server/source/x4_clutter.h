@@ -0,0 +1,146 @@
+/**
+@file x4_clutter.h
+
+Static clutter removal for normalized X4 frames. A background is kept per
+frame value, so each range bin of a raw frame, and I and Q of each range bin
+of a down converted frame, have their own. Every frame has the background
+subtracted in place.
+
+The background is either:
+- a moving average, updated with every frame by weight alpha
+- frozen, learnt once as the mean of a number of frames and then held
+
+Until 1 / alpha frames have been seen, the moving average is the plain mean of
+the frames, so the output settles quickly after a reset.
+
+Example:
+@code
+x4_clutter_set_alpha(0.05f);
+x4_clutter_set_mode(X4_CLUTTER_MOVING);
+
+for (;;) {
+  // frame holds n normalized values
+  x4_clutter_apply(frame, n);
+}
+@endcode
+
+@note
+The first frame after a reset has nothing to be subtracted and passes through.
+A change of frame length resets the background.
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef X4_CLUTTER_h
+#define X4_CLUTTER_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Most values of a frame
+*/
+#ifndef X4_CLUTTER_MAX_VALUES
+#define X4_CLUTTER_MAX_VALUES 1536
+#endif
+
+/**
+Most frames a frozen background is learnt from
+*/
+#define X4_CLUTTER_MAX_CAPTURE 65535
+
+// Modes
+#define X4_CLUTTER_OFF    0 // Frames pass through
+#define X4_CLUTTER_MOVING 1 // Moving average background
+#define X4_CLUTTER_FROZEN 2 // Background held, see x4_clutter_capture()
+
+#define X4_CLUTTER_DEFAULT_ALPHA 0.05f
+
+#define X4_CLUTTER_SUCCESS 0
+#define X4_CLUTTER_ERR_ARG 1
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function sets the mode. Turning the filter on from X4_CLUTTER_OFF resets the
+background, X4_CLUTTER_FROZEN holds the current one and ends a capture
+
+@param [in] mode  X4_CLUTTER_*
+
+@return X4_CLUTTER_SUCCESS on success, X4_CLUTTER_ERR_ARG for an unknown mode
+*/
+int x4_clutter_set_mode(int mode);
+
+/**
+Function gets the mode
+
+@return X4_CLUTTER_*
+*/
+int x4_clutter_get_mode();
+
+/**
+Function sets the weight of each frame in the moving average
+
+@param [in] alpha  Weight, greater than 0 and at most 1
+
+@return X4_CLUTTER_SUCCESS on success, X4_CLUTTER_ERR_ARG if out of range
+*/
+int x4_clutter_set_alpha(float alpha);
+
+/**
+Function gets the weight of each frame in the moving average
+
+@return Weight
+*/
+float x4_clutter_get_alpha();
+
+/**
+Function resets the background and learns a frozen one from the mean of the
+next frames. The filter is X4_CLUTTER_FROZEN from then on
+
+@param [in] frames  Frames to learn from, up to X4_CLUTTER_MAX_CAPTURE. 0 ends
+                    a capture, keeping what was learnt so far
+
+@return X4_CLUTTER_SUCCESS on success, X4_CLUTTER_ERR_ARG if out of range
+*/
+int x4_clutter_capture(uint32_t frames);
+
+/**
+Function gets the frames still to come of a capture
+
+@return Frames, 0 when no capture is running
+*/
+uint32_t x4_clutter_capture_remaining();
+
+/**
+Function forgets the background, the next frame starts a new one
+*/
+void x4_clutter_reset();
+
+/**
+Function removes the background from a frame, and updates the background
+
+@param [in,out] *frame  Normalized values, background removed on return
+@param [in]      n      Number of values, up to X4_CLUTTER_MAX_VALUES. Longer
+                        frames pass through
+*/
+void x4_clutter_apply(float *frame, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4_CLUTTER_h
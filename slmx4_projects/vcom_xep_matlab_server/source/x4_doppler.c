@@ -0,0 +1,250 @@
+/**
+@file x4_doppler.c
+
+See header
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "x4_doppler.h"
+
+#include "arm_const_structs.h"
+#include "arm_math.h"
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#if X4_DOPPLER_MAX_FRAMES > 128
+#error "select_fft() has no FFT above 128 frames"
+#endif
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static const arm_cfft_instance_f32 *select_fft(uint32_t frames);
+static void make_window(uint32_t frames);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Slow time series of each range bin, I/Q pairs, and the map. Only the CPU
+// touches them, so the SDRAM cache needs no maintenance
+__NOINIT(BOARD_SDRAM) static float doppler_ring[X4_DOPPLER_MAX_BINS * X4_DOPPLER_MAX_FRAMES * 2];
+__NOINIT(BOARD_SDRAM) static float doppler_map[X4_DOPPLER_MAX_BINS * X4_DOPPLER_MAX_FRAMES];
+
+// The FFT works in DTCM
+__BSS(SRAM_DTC) static float window[X4_DOPPLER_MAX_FRAMES];
+__BSS(SRAM_DTC) static float column[X4_DOPPLER_MAX_FRAMES * 2];
+__BSS(SRAM_DTC) static float spectrum[X4_DOPPLER_MAX_FRAMES];
+
+static const arm_cfft_instance_f32 *fft = NULL;
+static uint32_t doppler_bins = 0;
+static uint32_t doppler_frames = 0;
+static uint32_t doppler_hop = 0;
+static bool doppler_iq_separate = false;
+
+static uint32_t next_slot = 0; // Ring slot of the next frame
+static uint32_t filled = 0;    // Frames in the ring, up to doppler_frames
+static uint32_t pending = 0;   // Frames added since the last map was due
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int x4_doppler_start(uint32_t bins, uint32_t frames, uint32_t hop, bool iq_separate)
+{
+	const arm_cfft_instance_f32 *instance = select_fft(frames);
+
+	if (bins == 0 || bins > X4_DOPPLER_MAX_BINS) return X4_DOPPLER_ERR_ARG;
+	if (instance == NULL) return X4_DOPPLER_ERR_ARG;
+	if (hop == 0 || hop > frames) return X4_DOPPLER_ERR_ARG;
+
+	fft = instance;
+	doppler_bins = bins;
+	doppler_frames = frames;
+	doppler_hop = hop;
+	doppler_iq_separate = iq_separate;
+
+	next_slot = 0;
+	filled = 0;
+	pending = 0;
+
+	make_window(frames);
+
+	return X4_DOPPLER_SUCCESS;
+}
+
+
+bool x4_doppler_add_frame(const float *frame)
+{
+	if (fft == NULL)
+		return false;
+
+	// Series are stored by range bin, so each FFT reads one contiguous block
+	float *dst = doppler_ring + next_slot * 2;
+	uint32_t stride = doppler_frames * 2;
+
+	if (doppler_iq_separate)
+	{
+		const float *q = frame + doppler_bins;
+		for (uint32_t b = 0; b < doppler_bins; b++, dst += stride)
+		{
+			dst[0] = frame[b];
+			dst[1] = q[b];
+		}
+	}
+	else
+	{
+		for (uint32_t b = 0; b < doppler_bins; b++, dst += stride)
+		{
+			dst[0] = frame[2 * b];
+			dst[1] = frame[2 * b + 1];
+		}
+	}
+
+	next_slot = (next_slot + 1) & (doppler_frames - 1);
+	if (filled < doppler_frames)
+		filled++;
+
+	pending++;
+	if (filled < doppler_frames || pending < doppler_hop)
+		return false;
+
+	pending = 0;
+	return true;
+}
+
+
+int x4_doppler_process()
+{
+	if (fft == NULL || filled < doppler_frames) return X4_DOPPLER_ERR_STOPPED;
+
+	uint32_t frames = doppler_frames;
+	uint32_t half = frames / 2;
+	uint32_t mask = frames - 1;
+
+	for (uint32_t b = 0; b < doppler_bins; b++)
+	{
+		const float *series = doppler_ring + b * frames * 2;
+
+		// Static reflectors would swamp the zero Doppler cells
+		float mean_i = 0.0f;
+		float mean_q = 0.0f;
+		for (uint32_t m = 0; m < frames; m++)
+		{
+			mean_i += series[2 * m];
+			mean_q += series[2 * m + 1];
+		}
+		mean_i /= frames;
+		mean_q /= frames;
+
+		// Oldest frame first
+		for (uint32_t m = 0; m < frames; m++)
+		{
+			uint32_t s = (next_slot + m) & mask;
+			column[2 * m] = (series[2 * s] - mean_i) * window[m];
+			column[2 * m + 1] = (series[2 * s + 1] - mean_q) * window[m];
+		}
+
+		arm_cfft_f32(fft, column, 0, 1);
+		arm_cmplx_mag_f32(column, spectrum, frames);
+
+		// Negative Doppler first
+		float *row = doppler_map + b * frames;
+		memcpy(row, spectrum + half, half * sizeof(float));
+		memcpy(row + half, spectrum, half * sizeof(float));
+	}
+
+	return X4_DOPPLER_SUCCESS;
+}
+
+
+const float *x4_doppler_get_map()
+{
+	return doppler_map;
+}
+
+
+uint32_t x4_doppler_find_cells(X4DopplerCell_t *cells, uint32_t count)
+{
+	if (count > X4_DOPPLER_MAX_CELLS)
+		count = X4_DOPPLER_MAX_CELLS;
+
+	uint32_t found = 0;
+	uint32_t half = doppler_frames / 2;
+	const float *cell = doppler_map;
+
+	for (uint32_t b = 0; b < doppler_bins; b++)
+	{
+		for (uint32_t k = 0; k < doppler_frames; k++, cell++)
+		{
+			if (found == count && (count == 0 || *cell <= cells[count - 1].magnitude))
+				continue;
+
+			// Insert in order, dropping the weakest cell when full
+			uint32_t i = (found < count) ? found++ : count - 1;
+			for (; i > 0 && cells[i - 1].magnitude < *cell; i--)
+				cells[i] = cells[i - 1];
+
+			cells[i].bin = (uint16_t)b;
+			cells[i].doppler = (int16_t)((int32_t)k - (int32_t)half);
+			cells[i].magnitude = *cell;
+		}
+	}
+
+	return found;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function gets the CMSIS-DSP FFT of a length
+
+@return FFT instance, NULL if frames is not a supported length
+*/
+static const arm_cfft_instance_f32 *select_fft(uint32_t frames)
+{
+	if (frames < X4_DOPPLER_MIN_FRAMES || frames > X4_DOPPLER_MAX_FRAMES)
+		return NULL;
+
+	switch (frames)
+	{
+		case 16:   return &arm_cfft_sR_f32_len16;
+		case 32:   return &arm_cfft_sR_f32_len32;
+		case 64:   return &arm_cfft_sR_f32_len64;
+		case 128:  return &arm_cfft_sR_f32_len128;
+		default:   return NULL;
+	}
+}
+
+
+/**
+Function fills the periodic Hann window, scaled to a sum of 1 so the map is in
+the units of the frames
+*/
+static void make_window(uint32_t frames)
+{
+	float sum = 0.0f;
+
+	for (uint32_t m = 0; m < frames; m++)
+	{
+		window[m] = 0.5f - 0.5f * arm_cos_f32(2.0f * PI * m / frames);
+		sum += window[m];
+	}
+
+	arm_scale_f32(window, 1.0f / sum, window, frames);
+}
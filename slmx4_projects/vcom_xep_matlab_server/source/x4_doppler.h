@@ -0,0 +1,144 @@
+/**
+@file x4_doppler.h
+
+Range-Doppler processing of down converted X4 frames. The frames are kept in a
+ring in SDRAM as one slow time series per range bin. Every hop frames, each
+series is transformed: the slow time mean (static clutter) is removed, a Hann
+window applied and a complex FFT taken with arm_cfft_f32. The result is a
+magnitude map of bins x frames cells, or the strongest cells of the map.
+
+Example:
+@code
+x4_doppler_start(bins, 64, 32, x4->iq_separate);
+
+for (;;) {
+  // frame holds the 2 * bins normalized values of a down converted frame
+  if (x4_doppler_add_frame(frame)) {
+    x4_doppler_process();
+
+    const float *map = x4_doppler_get_map();
+    // map[bin * 64 + 32] is the zero Doppler cell of range bin bin
+  }
+}
+@endcode
+
+@note
+Map index k of a range bin is the Doppler frequency (k - frames / 2) * fps /
+frames. The window is scaled so that a slow time tone of amplitude A shows as
+a cell of magnitude A.
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef X4_DOPPLER_h
+#define X4_DOPPLER_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Most range bins of a frame
+*/
+#ifndef X4_DOPPLER_MAX_BINS
+#define X4_DOPPLER_MAX_BINS 256
+#endif
+
+/**
+Most frames in a map, a power of two from X4_DOPPLER_MIN_FRAMES to 128
+*/
+#ifndef X4_DOPPLER_MAX_FRAMES
+#define X4_DOPPLER_MAX_FRAMES 128
+#endif
+
+#define X4_DOPPLER_MIN_FRAMES 16
+
+/**
+Most cells x4_doppler_find_cells() reports
+*/
+#define X4_DOPPLER_MAX_CELLS 64
+
+#define X4_DOPPLER_SUCCESS     0
+#define X4_DOPPLER_ERR_ARG     1
+#define X4_DOPPLER_ERR_STOPPED 2
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct X4DopplerCell_t
+One cell of a range-Doppler map
+*/
+typedef struct {
+	uint16_t bin;    // Range bin
+	int16_t doppler; // Doppler index, -frames / 2 to frames / 2 - 1
+	float magnitude; // Magnitude of the cell
+
+} X4DopplerCell_t;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function sets up the engine and empties the ring
+
+@param [in] bins         Range bins (complex values) of each frame
+@param [in] frames       Frames in a map, a power of two from X4_DOPPLER_MIN_FRAMES to X4_DOPPLER_MAX_FRAMES
+@param [in] hop          Frames between maps, from 1 to frames
+@param [in] iq_separate  Frames hold all I values, then all Q values, instead of I/Q pairs
+
+@return X4_DOPPLER_SUCCESS on success, error code on failure
+*/
+int x4_doppler_start(uint32_t bins, uint32_t frames, uint32_t hop, bool iq_separate);
+
+/**
+Function adds a frame to the ring, replacing the oldest one once it is full
+
+@param [in] *frame  2 * bins normalized values, laid out as given to x4_doppler_start()
+
+@return true when a new map is due, see x4_doppler_process()
+*/
+bool x4_doppler_add_frame(const float *frame);
+
+/**
+Function computes the map of the frames in the ring
+
+@return X4_DOPPLER_SUCCESS on success, X4_DOPPLER_ERR_STOPPED if the ring is not full
+*/
+int x4_doppler_process();
+
+/**
+Function gets the last map computed by x4_doppler_process()
+
+@return bins rows of frames magnitudes, the zero Doppler cell at frames / 2
+*/
+const float *x4_doppler_get_map();
+
+/**
+Function finds the strongest cells of the last map
+
+@param [out] *cells  Cells, strongest first
+@param [in]   count  Most cells to find, up to X4_DOPPLER_MAX_CELLS
+
+@return Number of cells found
+*/
+uint32_t x4_doppler_find_cells(X4DopplerCell_t *cells, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4_DOPPLER_h
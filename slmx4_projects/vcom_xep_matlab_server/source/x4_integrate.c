@@ -0,0 +1,177 @@
+/**
+@file x4_integrate.c
+
+See header
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "x4_integrate.h"
+
+#include "arm_math.h"
+
+#include <cr_section_macros.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+// Type of the frames being integrated
+#define SUM_NONE     0
+#define SUM_F32      1
+#define SUM_COUNTERS 2
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static void restart(int type, uint32_t n);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Touched by every frame, so kept in DTCM
+__BSS(SRAM_DTC) static union {
+	float f32[X4_INTEGRATE_MAX_VALUES];
+	int64_t counters[X4_INTEGRATE_MAX_VALUES];
+} sum_buffer;
+
+static uint32_t integrate_frames = 1;
+
+static int sum_type = SUM_NONE;
+static uint32_t sum_length = 0;     // Values of the sum
+static uint8_t sum_counter_size = 0; // Bytes per counter added, SUM_COUNTERS only
+static uint32_t added = 0;      // Frames in the sum
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int x4_integrate_set_frames(uint32_t frames)
+{
+	if (frames == 0 || frames > X4_INTEGRATE_MAX_FRAMES)
+		return X4_INTEGRATE_ERR_ARG;
+
+	integrate_frames = frames;
+	x4_integrate_reset();
+
+	return X4_INTEGRATE_SUCCESS;
+}
+
+
+uint32_t x4_integrate_get_frames()
+{
+	return integrate_frames;
+}
+
+
+bool x4_integrate_completes()
+{
+	return added + 1 >= integrate_frames;
+}
+
+
+void x4_integrate_reset()
+{
+	sum_type = SUM_NONE;
+	added = 0;
+}
+
+
+bool x4_integrate_add_f32(float *frame, uint32_t n)
+{
+	if (integrate_frames == 1)
+		return true;
+	if (n == 0 || n > X4_INTEGRATE_MAX_VALUES)
+		return false;
+
+	if (sum_type != SUM_F32 || sum_length != n)
+		restart(SUM_F32, n);
+
+	if (added == 0)
+		arm_copy_f32(frame, sum_buffer.f32, n);
+	else
+		arm_add_f32(sum_buffer.f32, frame, sum_buffer.f32, n);
+
+	if (++added < integrate_frames)
+		return false;
+
+	arm_scale_f32(sum_buffer.f32, 1.0f / integrate_frames, frame, n);
+	added = 0;
+
+	return true;
+}
+
+
+uint8_t x4_integrate_sum_size(uint8_t bytes_per_counter)
+{
+	if (bytes_per_counter == 0 || bytes_per_counter > X4_INTEGRATE_MAX_COUNTER_SIZE)
+		return 0;
+
+	// X4_INTEGRATE_MAX_FRAMES adds a byte, unsigned counters need another for
+	// the sign
+	return bytes_per_counter + ((bytes_per_counter <= 4) ? 2 : 1);
+}
+
+
+bool x4_integrate_add_counters(const uint8_t *counters, uint32_t count, uint8_t bytes_per_counter, uint8_t *sum)
+{
+	uint8_t sum_size = x4_integrate_sum_size(bytes_per_counter);
+
+	if (count == 0 || count > X4_INTEGRATE_MAX_VALUES || sum_size == 0)
+		return false;
+
+	if (sum_type != SUM_COUNTERS || sum_length != count || sum_counter_size != bytes_per_counter)
+	{
+		restart(SUM_COUNTERS, count);
+		sum_counter_size = bytes_per_counter;
+	}
+
+	// Baseband counters are unsigned, down converted ones are sign extended.
+	// No CMSIS-DSP kernel adds int64, the counters are unaligned anyway
+	uint32_t shift = (bytes_per_counter <= 4) ? 0 : 64 - 8 * bytes_per_counter;
+	for (uint32_t i = 0; i < count; i++, counters += bytes_per_counter)
+	{
+		uint64_t counter = 0;
+		for (uint32_t b = 0; b < bytes_per_counter; b++)
+			counter |= (uint64_t)counters[b] << (8 * b);
+
+		int64_t value = (int64_t)(counter << shift) >> shift;
+		sum_buffer.counters[i] = (added == 0) ? value : sum_buffer.counters[i] + value;
+	}
+
+	if (++added < integrate_frames)
+		return false;
+
+	// Every counter has been read, so sum may overwrite them
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t value = (uint64_t)sum_buffer.counters[i];
+		for (uint32_t b = 0; b < sum_size; b++)
+			*sum++ = (uint8_t)(value >> (8 * b));
+	}
+	added = 0;
+
+	return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function drops the sum and starts one of another type or length
+*/
+static void restart(int type, uint32_t n)
+{
+	sum_type = type;
+	sum_length = n;
+	added = 0;
+}
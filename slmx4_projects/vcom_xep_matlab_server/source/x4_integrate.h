@@ -0,0 +1,146 @@
+/**
+@file x4_integrate.h
+
+Coherent integration of consecutive X4 frames. Frames are summed value by
+value, I and Q separately for down converted frames, and one integrated frame
+is given back for every N frames added. Noise adds up as sqrt(N) and the
+signal as N, so SNR improves by N without lengthening the sweep.
+
+Frames come either as floats, normalized or raw, or as the counters read from
+the radar:
+- floats are given back as the mean of the N frames, so they stay in the units
+  of a single frame
+- counters are summed exactly in int64 and given back as signed counters of
+  x4_integrate_sum_size() bytes. As in frame_encode.h, counters of up to 4
+  bytes are unsigned (baseband) and wider ones signed (down converted)
+
+Example:
+@code
+x4_integrate_set_frames(8);
+
+for (;;) {
+  // frame holds n values, the mean of the last 8 frames on return of true
+  if (x4_integrate_add_f32(frame, n)) {
+    // send frame
+  }
+}
+@endcode
+
+@note
+A change of frame length or type restarts the integration.
+
+@par Environment
+Environment Independent
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef X4_INTEGRATE_h
+#define X4_INTEGRATE_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Most values of a frame
+*/
+#ifndef X4_INTEGRATE_MAX_VALUES
+#define X4_INTEGRATE_MAX_VALUES 1536
+#endif
+
+/**
+Most frames integrated. The sums of counters need at most 8 bits more than
+the counters
+*/
+#define X4_INTEGRATE_MAX_FRAMES 256
+
+/**
+Widest counters x4_integrate_add_counters() takes, as read with DDC on
+*/
+#define X4_INTEGRATE_MAX_COUNTER_SIZE 6
+
+#define X4_INTEGRATE_SUCCESS 0
+#define X4_INTEGRATE_ERR_ARG 1
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function sets the frames integrated into one and restarts the integration
+
+@param [in] frames  Frames, from 1 (every frame passes through) to X4_INTEGRATE_MAX_FRAMES
+
+@return X4_INTEGRATE_SUCCESS on success, X4_INTEGRATE_ERR_ARG if out of range
+*/
+int x4_integrate_set_frames(uint32_t frames);
+
+/**
+Function gets the frames integrated into one
+
+@return Frames
+*/
+uint32_t x4_integrate_get_frames();
+
+/**
+Function checks whether the next frame added completes an integrated frame
+
+@return true if it does
+*/
+bool x4_integrate_completes();
+
+/**
+Function drops the frames added so far
+*/
+void x4_integrate_reset();
+
+/**
+Function adds a frame of floats
+
+@param [in,out] *frame  n values, the mean of the integrated frames on return of true
+@param [in]      n      Number of values, up to X4_INTEGRATE_MAX_VALUES
+
+@return true when the frame completes an integrated frame, always true when
+integrating 1 frame (the frame passes through)
+*/
+bool x4_integrate_add_f32(float *frame, uint32_t n);
+
+/**
+Function gets the size of the integrated counters
+
+@param [in] bytes_per_counter  Size of the counters added
+
+@return Bytes per integrated counter, 0 if counters of that size are not supported
+*/
+uint8_t x4_integrate_sum_size(uint8_t bytes_per_counter);
+
+/**
+Function adds a frame of little endian X4 counters
+
+@param [in]  *counters           count counters of bytes_per_counter bytes
+@param [in]   count              Number of counters, up to X4_INTEGRATE_MAX_VALUES
+@param [in]   bytes_per_counter  Size of one counter, 1 to X4_INTEGRATE_MAX_COUNTER_SIZE
+@param [out] *sum                Sum of the integrated frames on return of true,
+                                 count signed little endian counters of
+                                 x4_integrate_sum_size() bytes. May be the same
+                                 buffer as counters
+
+@return true when the frame completes an integrated frame, false otherwise or
+if the counters are not supported
+*/
+bool x4_integrate_add_counters(const uint8_t *counters, uint32_t count, uint8_t bytes_per_counter, uint8_t *sum);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4_INTEGRATE_h
@@ -0,0 +1,281 @@
+/**
+@file x4_stream.c
+
+See header
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+
+#include "x4_stream.h"
+
+// Platform include
+#include "slmx4_freertos.h"
+
+// FreeRTOS includes
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+#ifndef X4_STREAM_TASK_PRIORITY
+#define X4_STREAM_TASK_PRIORITY (configMAX_PRIORITIES - 1)
+#endif
+
+#define X4_STREAM_TASK_STACK_SIZE (2048L / sizeof(portSTACK_TYPE))
+
+// Extra time on top of two frame periods before a missing frame is an error
+#define X4_STREAM_TIMEOUT_MARGIN_MS 100
+
+// -----------------------------------------------------------------------------
+// Function Prototypes
+// -----------------------------------------------------------------------------
+
+static int init_stream();
+static void reset_ring();
+static void x4_stream_task(void *arg);
+
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// Globals
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// Raw frame ring, read by eDMA. DTCM is not cached so no cache maintenance
+// is needed around the transfers
+__BSS(SRAM_DTC) static uint8_t ring_data[X4_STREAM_RING_FRAMES][X4_FRAME_BUFFER_SIZE];
+static X4StreamFrame_t ring[X4_STREAM_RING_FRAMES];
+
+// Free running slot counters, head is written by the stream task and tail by
+// the consumer
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+
+// Set while the consumer holds the frame at ring_tail
+static bool frame_held = false;
+
+static SemaphoreHandle_t frames_ready = NULL; // Counts frames in the ring
+static SemaphoreHandle_t stream_run = NULL;   // Wakes the stream task
+static SemaphoreHandle_t stream_idle = NULL;  // Stream task has parked
+static TaskHandle_t stream_task = NULL;
+
+static X4Driver_t *stream_x4 = NULL;
+static volatile bool stream_running = false;
+static uint32_t frame_timeout_ms = 0;
+static X4StreamStats_t stream_stats = {0};
+static volatile X4StreamNotify_t frame_notify = NULL;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int x4_stream_start(X4Driver_t *x4, float fps)
+{
+	if (stream_running) return X4_STREAM_ERR_RUNNING;
+	if (NULL == x4 || fps < 1.0f) return X4_STREAM_ERR_ARG;
+	if (init_stream()) return X4_STREAM_ERR_RTOS;
+
+	stream_x4 = x4;
+	reset_ring();
+	memset(&stream_stats, 0, sizeof(stream_stats));
+	frame_timeout_ms = (uint32_t)(2000.0f / fps) + X4_STREAM_TIMEOUT_MARGIN_MS;
+
+	int status = x4driver_set_frame_ready_strategy(x4, FRAME_IS_READY_INTERRUPT);
+	status |= x4driver_set_sweep_trigger_control(x4, SWEEP_TRIGGER_X4);
+	if (status)
+		return X4_STREAM_ERR_DRIVER;
+
+	// Let the stream task wait for data ready before the X4 timer is armed
+	stream_running = true;
+	xSemaphoreGive(stream_run);
+
+	status = x4driver_set_fps(x4, fps);
+	if (status) {
+		x4_stream_stop(x4);
+		return X4_STREAM_ERR_DRIVER;
+	}
+
+	return X4_STREAM_SUCCESS;
+}
+
+
+int x4_stream_stop(X4Driver_t *x4)
+{
+	if (!stream_running) return X4_STREAM_ERR_STOPPED;
+
+	stream_running = false;
+
+	// Stop the X4 timer, then wake the stream task in case it is waiting
+	int status = x4driver_set_fps(x4, 0);
+	status |= x4driver_set_sweep_trigger_control(x4, SWEEP_TRIGGER_MANUAL);
+	platform__x4_data_ready_abort();
+
+	// The task must have parked before the next start, or its late give of
+	// stream_idle would end the next stop early. Its waits are bounded, so
+	// keep waiting after reporting the timeout
+	TickType_t ticks = pdMS_TO_TICKS(frame_timeout_ms + X4DRIVER_FRAME_FETCH_TIMEOUT_MS);
+	bool timeout = (xSemaphoreTake(stream_idle, ticks) != pdTRUE);
+	if (timeout)
+		xSemaphoreTake(stream_idle, portMAX_DELAY);
+
+	reset_ring();
+
+	if (timeout)
+		return X4_STREAM_ERR_TIMEOUT;
+	return status ? X4_STREAM_ERR_DRIVER : X4_STREAM_SUCCESS;
+}
+
+
+bool x4_stream_is_running()
+{
+	return stream_running;
+}
+
+
+int x4_stream_get_frame(X4StreamFrame_t *frame, uint32_t timeout_ms)
+{
+	if (!frame_held) {
+		if (!stream_running && ring_head == ring_tail)
+			return X4_STREAM_ERR_STOPPED;
+
+		if (xSemaphoreTake(frames_ready, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+			return X4_STREAM_ERR_TIMEOUT;
+
+		frame_held = true;
+	}
+
+	*frame = ring[ring_tail % X4_STREAM_RING_FRAMES];
+
+	return X4_STREAM_SUCCESS;
+}
+
+
+void x4_stream_release_frame()
+{
+	if (frame_held) {
+		ring_tail++;
+		frame_held = false;
+	}
+}
+
+
+void x4_stream_get_stats(X4StreamStats_t *stats)
+{
+	*stats = stream_stats;
+}
+
+
+void x4_stream_set_notify(X4StreamNotify_t notify)
+{
+	frame_notify = notify;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Local Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function creates the stream task and its semaphores on first use
+*/
+static int init_stream()
+{
+	if (stream_task != NULL)
+		return 0;
+
+	for (int i = 0; i < X4_STREAM_RING_FRAMES; i++)
+		ring[i].data = ring_data[i];
+
+	frames_ready = xSemaphoreCreateCounting(X4_STREAM_RING_FRAMES, 0);
+	stream_run = xSemaphoreCreateBinary();
+	stream_idle = xSemaphoreCreateBinary();
+	if (frames_ready == NULL || stream_run == NULL || stream_idle == NULL)
+		return 1;
+
+	if (xTaskCreate(x4_stream_task, "x4_stream", X4_STREAM_TASK_STACK_SIZE, NULL, X4_STREAM_TASK_PRIORITY, &stream_task) != pdPASS) {
+		stream_task = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+Function empties the ring. Only called while the stream task is parked
+*/
+static void reset_ring()
+{
+	while (xSemaphoreTake(frames_ready, 0) == pdTRUE)
+		;
+	ring_head = 0;
+	ring_tail = 0;
+	frame_held = false;
+}
+
+
+/**
+Task reading one frame per X4 data ready interrupt into the ring
+*/
+static void x4_stream_task(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		xSemaphoreTake(stream_run, portMAX_DELAY);
+
+		// Register as the data ready waiter and drop any stale signal
+		stream_x4->callbacks.wait_data_ready(stream_x4->user_reference, 0);
+
+		while (stream_running) {
+			int status = x4driver_wait_frame_ready(stream_x4, frame_timeout_ms);
+			if (!stream_running)
+				break;
+			if (status) {
+				stream_stats.errors++;
+				continue;
+			}
+
+			// Ring full, leave the frame in the X4 and let the consumer catch up
+			if (ring_head - ring_tail >= X4_STREAM_RING_FRAMES) {
+				stream_stats.dropped++;
+				continue;
+			}
+
+			X4StreamFrame_t *slot = &ring[ring_head % X4_STREAM_RING_FRAMES];
+
+			status = x4driver_session_begin(stream_x4);
+			if (status == 0) {
+				status = x4driver_read_frame_bytes_start(stream_x4, &slot->frame_counter, slot->data, X4_FRAME_BUFFER_SIZE);
+				if (status == 0)
+					status = x4driver_read_frame_bytes_finish(stream_x4, X4DRIVER_FRAME_FETCH_TIMEOUT_MS);
+				x4driver_session_end(stream_x4);
+			}
+			if (status) {
+				stream_stats.errors++;
+				continue;
+			}
+
+			slot->timestamp = xTaskGetTickCount();
+			slot->length = stream_x4->frame_read_size;
+
+			ring_head++;
+			stream_stats.frames++;
+			xSemaphoreGive(frames_ready);
+
+			X4StreamNotify_t notify = frame_notify;
+			if (notify != NULL)
+				notify();
+		}
+
+		xSemaphoreGive(stream_idle);
+	}
+}
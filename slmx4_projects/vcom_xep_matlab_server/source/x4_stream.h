@@ -0,0 +1,164 @@
+/**
+@file x4_stream.h
+
+Continuous X4 acquisition. The X4 sweep timer triggers frames at a fixed rate
+and a streaming task reads each frame on the data ready interrupt into a ring
+of frame buffers, independent of host round trips.
+
+Example:
+@code
+x4_stream_start(x4, 20.0f);
+
+X4StreamFrame_t frame;
+while (x4_stream_get_frame(&frame, 100) == X4_STREAM_SUCCESS) {
+  // frame.data holds frame.length raw bytes
+  x4_stream_release_frame();
+}
+
+x4_stream_stop(x4);
+@endcode
+
+@par Environment
+FreeRTOS
+
+@par Compiler
+Compiler Independent
+
+@copyright (c) 2021 Sensor Logic
+*/
+#ifndef X4_STREAM_h
+#define X4_STREAM_h
+
+#include "x4driver.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+/**
+Number of raw frames the stream ring holds before new frames are dropped
+*/
+#ifndef X4_STREAM_RING_FRAMES
+#define X4_STREAM_RING_FRAMES 4
+#endif
+
+#define X4_STREAM_SUCCESS      0
+#define X4_STREAM_ERR_RUNNING  1
+#define X4_STREAM_ERR_STOPPED  2
+#define X4_STREAM_ERR_TIMEOUT  3
+#define X4_STREAM_ERR_DRIVER   4
+#define X4_STREAM_ERR_RTOS     5
+#define X4_STREAM_ERR_ARG      6
+
+// -----------------------------------------------------------------------------
+// Data Structure
+// -----------------------------------------------------------------------------
+
+/**
+@struct X4StreamFrame_t
+One raw frame in the stream ring
+*/
+typedef struct {
+	uint32_t frame_counter; // X4 frame counter, gaps mean dropped frames
+	uint32_t timestamp;     // RTOS tick count when the frame was read
+	uint32_t length;        // Number of raw bytes in data
+	uint8_t *data;          // Raw frame bytes, unpack with x4driver_unpack_frame_*
+
+} X4StreamFrame_t;
+
+/**
+@struct X4StreamStats_t
+Stream counters, cleared by x4_stream_start()
+*/
+typedef struct {
+	uint32_t frames;  // Frames read into the ring
+	uint32_t dropped; // Frames skipped because the ring was full
+	uint32_t errors;  // Data ready timeouts and failed reads
+
+} X4StreamStats_t;
+
+/**
+Function called from the stream task after each frame added to the ring
+*/
+typedef void (*X4StreamNotify_t)();
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Public Functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/**
+Function starts continuous acquisition with the X4 sweep timer
+
+@note
+The X4 is switched to SWEEP_TRIGGER_X4 and interrupt frame ready detection.
+The X4 timer rounds fps to a whole number (see x4driver_set_fps)
+
+@param [in] *x4   Handle to X4 radar
+@param [in]  fps  Frame rate
+
+@return X4_STREAM_SUCCESS on success, error code on failure
+*/
+int x4_stream_start(X4Driver_t *x4, float fps);
+
+/**
+Function stops continuous acquisition and returns the X4 to manual sweeps
+
+@note
+Frames still in the ring are discarded. Returns only once the stream task has
+parked, also when X4_STREAM_ERR_TIMEOUT is returned
+
+@param [in] *x4  Handle to X4 radar
+
+@return X4_STREAM_SUCCESS on success, X4_STREAM_ERR_TIMEOUT if the stream task
+was late to park, error code on failure
+*/
+int x4_stream_stop(X4Driver_t *x4);
+
+/**
+Function checks if the stream is running
+
+@return true while streaming
+*/
+bool x4_stream_is_running();
+
+/**
+Function gets the oldest frame in the ring without removing it
+
+@param [out] *frame       Frame descriptor, data points into the ring
+@param [in]   timeout_ms  Time to wait for a frame
+
+@return X4_STREAM_SUCCESS on success, X4_STREAM_ERR_TIMEOUT if no frame arrived
+*/
+int x4_stream_get_frame(X4StreamFrame_t *frame, uint32_t timeout_ms);
+
+/**
+Function hands the frame from x4_stream_get_frame() back to the ring
+*/
+void x4_stream_release_frame();
+
+/**
+Function gets the stream counters
+
+@param [out] *stats  Copy of the counters
+*/
+void x4_stream_get_stats(X4StreamStats_t *stats);
+
+/**
+Function sets the function called for each new frame, so a consumer can sleep
+until there is a frame instead of polling x4_stream_get_frame()
+
+@param [in] notify  Called from the stream task, NULL for none
+*/
+void x4_stream_set_notify(X4StreamNotify_t notify);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4_STREAM_h
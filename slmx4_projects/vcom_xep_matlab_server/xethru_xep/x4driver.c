@@ -12,6 +12,7 @@ Modified by Justin Hadella @ Flat Earth Inc (based on 3.4.7)
 #include <stdbool.h>
 
 #include "x4driver.h"
+#include "x4driver_unpack.h"
 #include "8051_firmware.h"
 
 // -----------------------------------------------------------------------------
@@ -38,8 +39,8 @@ Modified by Justin Hadella @ Flat Earth Inc (based on 3.4.7)
 #define XEP_LOCK_OK                             1
 #define XEP_LOCK_NOK                            0
 
-#define FRAME_IS_READY_READ_REGISTERS 1
 #define FRAME_NOT_READY 0
+#define FRAME_READY_POLL_INTERVAL_US 10
 #define TRIGGER_SWEEP_READ_REGISTERS 1
 #define TRIGGER_SWEEP_TRIGGER_PIN 0
 #define RESET_COUNTERS_ACTION 0xff
@@ -60,6 +61,11 @@ Modified by Justin Hadella @ Flat Earth Inc (based on 3.4.7)
 #define MIN_FRAME_LENGTH 4
 #define FETCH_DATA_ACTION    0xff
 
+// Max bytes per SPI burst when uploading or reading back 8051 firmware, limited by spi_buffer_size
+#ifndef X4DRIVER_FIRMWARE_BURST_SIZE
+#define X4DRIVER_FIRMWARE_BURST_SIZE 512
+#endif
+
 // -----------------------------------------------------------------------------
 // MACROS
 // -----------------------------------------------------------------------------
@@ -79,16 +85,6 @@ typedef struct {
   uint8_t *data;
 } X4DriverBuffer_t;
 
-/**
- * @brief X4 protocol command ids
- */
-typedef enum {
-  PIF_COMMAND            = 0,
-  XIF_COMMAND            = 1,
-  X4_SW_REGISTER_COMMAND = 2,
-  X4_SW_ACTION_COMMAND   = 3,
-} xtx4_command_id_t;
-
 /**
  * @brief X4 software actions enum.
  */
@@ -218,6 +214,11 @@ int _x4driver_set_rx_ram_last_line(X4Driver_t *x4driver, uint32_t last_line);
 int _x4driver_get_framecounter(X4Driver_t *x4driver, uint32_t *read_value);
 void _invert(int8_t *source, int8_t *dst, uint8_t len);
 
+static int _x4driver_mailbox_read_status(X4Driver_t *x4driver, uint8_t *fifo_status);
+static int _x4driver_mailbox_wait_to_cpu_empty(X4Driver_t *x4driver);
+static int _x4driver_mailbox_drain_from_cpu(X4Driver_t *x4driver, uint8_t *last_value);
+static int _x4driver_spi_read_burst(X4Driver_t *x4driver, uint8_t address, uint8_t *data, uint32_t length);
+
 // ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
 // Flat Earth Modifications
 // ~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~-~~
@@ -243,13 +244,54 @@ int _x4driver_get_data_8051_size(uint32_t *size)
 }
 
 
+#if X4DRIVER_SINGLE_OWNER
+
+/**
+ * @brief Utility function to take mutex. Single owner build, nothing to lock.
+ */
+static inline uint32_t mutex_take(X4Driver_t *x4driver)
+{
+  (void)x4driver;
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Utility function to give mutex. Single owner build, nothing to unlock.
+ */
+static inline void mutex_give(X4Driver_t *x4driver)
+{
+  (void)x4driver;
+}
+
+#else
+
+/**
+ * @brief Checks if the calling task owns an open session.
+ * Sessions need the owner callback, see x4driver_session_begin.
+ */
+static inline uint8_t _x4driver_in_session(X4Driver_t *x4driver)
+{
+  if (x4driver->session_depth == 0 || x4driver->lock.owner == NULL)
+    return 0;
+  return x4driver->lock.owner() == x4driver->session_owner;
+}
+
+
 /**
  * @brief Utility function to take mutex.
+ * Lock free when the caller already owns a session.
  */
 static uint32_t mutex_take(X4Driver_t *x4driver)
 {
-  if (x4driver->lock.lock(x4driver->lock.object, x4driver->lock.timeout) == XEP_LOCK_OK)
+  if (_x4driver_in_session(x4driver)) {
+    x4driver->lock_stats.elided++;
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+  if (x4driver->lock.lock(x4driver->lock.object, x4driver->lock.timeout) == XEP_LOCK_OK) {
+    x4driver->lock_stats.takes++;
     return XEP_ERROR_X4DRIVER_OK;
+  }
   else
     return XEP_ERROR_X4DRIVER_BUSY;
 }
@@ -257,12 +299,120 @@ static uint32_t mutex_take(X4Driver_t *x4driver)
 
 /**
  * @brief Utility function to give mutex.
+ * Lock free when the caller already owns a session.
  */
 static void mutex_give(X4Driver_t *x4driver)
 {
+  if (_x4driver_in_session(x4driver))
+    return;
+  x4driver->lock_stats.gives++;
   x4driver->lock.unlock(x4driver->lock.object);
 }
 
+#endif
+
+
+/**
+ * Writable configuration registers held in the shadow cache. Status, strobe,
+ * FIFO and LDO/oscillator control registers (changed by hardware) are left out.
+ */
+static const uint8_t shadow_pif_registers[] = {
+  ADDR_PIF_RX_MFRAMES_RW, ADDR_PIF_SMPL_MODE_RW,
+  ADDR_PIF_RX_RAM_LINE_FIRST_MSB_RW, ADDR_PIF_RX_RAM_LINE_LAST_MSB_RW, ADDR_PIF_RX_RAM_LSBS_RW,
+  ADDR_PIF_RX_COUNTER_NUM_BYTES_RW, ADDR_PIF_RX_COUNTER_LSB_RW, ADDR_PIF_RAM_SELECT_RW,
+  ADDR_PIF_TRX_CLOCKS_PER_PULSE_RW, ADDR_PIF_RX_MFRAMES_COARSE_RW,
+  ADDR_PIF_TRX_PULSES_PER_STEP_MSB_RW, ADDR_PIF_TRX_PULSES_PER_STEP_LSB_RW,
+  ADDR_PIF_TRX_DAC_MAX_H_RW, ADDR_PIF_TRX_DAC_MAX_L_RW, ADDR_PIF_TRX_DAC_MIN_H_RW, ADDR_PIF_TRX_DAC_MIN_L_RW,
+  ADDR_PIF_TRX_DAC_STEP_RW, ADDR_PIF_TRX_ITERATIONS_RW,
+  ADDR_PIF_TRX_LFSR_TAPS_0_RW, ADDR_PIF_TRX_LFSR_TAPS_1_RW, ADDR_PIF_TRX_LFSR_TAPS_2_RW,
+  ADDR_PIF_RX_WAIT_RW, ADDR_PIF_TX_WAIT_RW, ADDR_PIF_TRX_DAC_OVERRIDE_H_RW, ADDR_PIF_TRX_DAC_OVERRIDE_L_RW,
+  ADDR_PIF_CPU_SPI_MASTER_CLK_CTRL_RW, ADDR_PIF_MCLK_TRX_BACKEND_CLK_CTRL_RW,
+  ADDR_PIF_IO_CTRL_1_RW, ADDR_PIF_IO_CTRL_2_RW, ADDR_PIF_IO_CTRL_3_RW,
+  ADDR_PIF_IO_CTRL_4_RW, ADDR_PIF_IO_CTRL_5_RW, ADDR_PIF_IO_CTRL_6_RW,
+  ADDR_PIF_SPI_MASTER_MODE_RW, ADDR_PIF_SPI_MASTER_RADAR_BURST_SIZE_LSB_RW,
+  ADDR_PIF_RX_PLL_CTRL_1_RW, ADDR_PIF_RX_PLL_CTRL_2_RW, ADDR_PIF_TX_PLL_CTRL_1_RW, ADDR_PIF_TX_PLL_CTRL_2_RW,
+  ADDR_PIF_COMMON_PLL_CTRL_1_RW, ADDR_PIF_COMMON_PLL_CTRL_2_RW, ADDR_PIF_COMMON_PLL_CTRL_3_RW,
+  ADDR_PIF_COMMON_PLL_CTRL_4_RW, ADDR_PIF_COMMON_PLL_FRAC_2_RW, ADDR_PIF_COMMON_PLL_FRAC_1_RW,
+  ADDR_PIF_COMMON_PLL_FRAC_0_RW, ADDR_PIF_CLKOUT_SEL_RW, ADDR_PIF_MISC_CTRL,
+};
+
+static const uint8_t shadow_xif_registers[] = {
+  ADDR_XIF_SAMPLER_PRESET_MSB_RW, ADDR_XIF_SAMPLER_PRESET_LSB_RW, ADDR_XIF_DAC_TRIM_RW,
+  ADDR_XIF_PREAMP_TRIM_RW, ADDR_XIF_RX_FE_ANATESTREQ_RW, ADDR_XIF_LNA_ANATESTREQ_RW,
+  ADDR_XIF_DAC_ANATESTREQ_RW, ADDR_XIF_VREF_TRIM_RW, ADDR_XIF_IREF_TRIM_RW, ADDR_XIF__APC_TEMP_TRIM_RW,
+};
+
+static const uint8_t shadow_spi_registers[] = {
+  ADDR_SPI_DEBUG_RW, ADDR_SPI_RADAR_BIST_CTRL_RW, ADDR_SPI_MEM_MODE_RW,
+  ADDR_SPI_MEM_FIRST_ADDR_MSB_RW, ADDR_SPI_MEM_FIRST_ADDR_LSB_RW, ADDR_SPI_MCU_BIST_CTRL_RW,
+};
+
+#define SHADOW_WORD(address) (((address) & 0x7f) >> 5)
+#define SHADOW_BIT(address) (1UL << ((address) & 0x1f))
+
+
+/**
+ * @brief Marks the listed registers of a shadow bank as cacheable.
+ */
+static void _x4driver_shadow_init_bank(X4DriverShadowBank_t *bank, const uint8_t *registers, uint32_t count)
+{
+  memset(bank, 0, sizeof(X4DriverShadowBank_t));
+  for (uint32_t i = 0; i < count; i++)
+    bank->cacheable[SHADOW_WORD(registers[i])] |= SHADOW_BIT(registers[i]);
+}
+
+
+/**
+ * @brief Gets the shadow bank used for a mailbox command, NULL if it is not cached.
+ */
+static X4DriverShadowBank_t *_x4driver_shadow_bank(X4Driver_t *x4driver, uint8_t command)
+{
+  if (command == PIF_COMMAND)
+    return &x4driver->shadow.pif;
+  if (command == XIF_COMMAND)
+    return &x4driver->shadow.xif;
+  return NULL;
+}
+
+
+/**
+ * @brief Looks up a register in the shadow cache.
+ * @return 1 if value was served from the cache, 0 if the chip must be read.
+ */
+static uint32_t _x4driver_shadow_lookup(X4Driver_t *x4driver, X4DriverShadowBank_t *bank, uint8_t address, uint8_t *value)
+{
+  if (bank == NULL || !(bank->cacheable[SHADOW_WORD(address)] & SHADOW_BIT(address)))
+    return 0;
+  if (!(bank->valid[SHADOW_WORD(address)] & SHADOW_BIT(address)) || x4driver->shadow.verify) {
+    x4driver->shadow.misses++;
+    return 0;
+  }
+  x4driver->shadow.hits++;
+  *value = bank->value[address & 0x7f];
+  return 1;
+}
+
+
+/**
+ * @brief Stores a register value in the shadow cache.
+ * dirty is set for values written by the driver and cleared for values read from the chip.
+ */
+static void _x4driver_shadow_store(X4Driver_t *x4driver, X4DriverShadowBank_t *bank, uint8_t address, uint8_t value, uint32_t dirty)
+{
+  if (bank == NULL || !(bank->cacheable[SHADOW_WORD(address)] & SHADOW_BIT(address)))
+    return;
+  uint32_t word = SHADOW_WORD(address);
+  uint32_t bit = SHADOW_BIT(address);
+  if (!dirty && (bank->valid[word] & bit) && bank->value[address & 0x7f] != value)
+    x4driver->shadow.mismatches++;
+  bank->value[address & 0x7f] = value;
+  bank->valid[word] |= bit;
+  if (dirty)
+    bank->dirty[word] |= bit;
+  else
+    bank->dirty[word] &= ~bit;
+}
+
 
 /**
  * @brief Gets the default firmware used to programming 8051 in X4.
@@ -279,6 +429,42 @@ int _x4driver_get_8051_default_firmware(X4DriverBuffer_t *buffer)
 }
 
 
+/**
+ * @brief Gets the number of firmware bytes sent per SPI burst.
+ *
+ * @return Burst size, 0 if spi_buffer is too small for burst transfers.
+ */
+static uint32_t _x4driver_firmware_burst_size(X4Driver_t *x4driver)
+{
+  if (x4driver->spi_buffer == NULL || x4driver->spi_buffer_size < 2 + X4DRIVER_SPI_RDATA_OFFSET)
+    return 0;
+  if (X4DRIVER_FIRMWARE_BURST_SIZE > x4driver->spi_buffer_size - 1 - X4DRIVER_SPI_RDATA_OFFSET)
+    return x4driver->spi_buffer_size - 1 - X4DRIVER_SPI_RDATA_OFFSET;
+  return X4DRIVER_FIRMWARE_BURST_SIZE;
+}
+
+
+/**
+ * @brief Updates CRC-32 (IEEE 802.3) with data. Start with crc = 0.
+ *
+ * @return Updated CRC
+ */
+static uint32_t _x4driver_crc32(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+  static const uint32_t crc32_nibble_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+  };
+
+  crc = ~crc;
+  for (uint32_t i = 0; i < length; i++) {
+    crc = crc32_nibble_table[(crc ^ data[i]) & 0x0f] ^ (crc >> 4);
+    crc = crc32_nibble_table[(crc ^ (data[i] >> 4)) & 0x0f] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+
 /**
  * @brief Gets the filter coefficients for X4.
  *
@@ -389,38 +575,22 @@ cleanup:
 
 int _upload_downconversion_coeffs(X4Driver_t *x4driver)
 {
-  uint8_t value;
   int status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK)
     return status;
 
-  for (int i = 31; i >= 0; i--) {
-    value =  0x3f & x4driver->downconversion_coeff_i1[i];
-    status = x4driver_set_pif_register(x4driver, ADDR_PIF_RX_DOWNCONVERSION_COEFF_I1_WE, value);
-    if (status != XEP_ERROR_X4DRIVER_OK)
-      goto cleanup;
-  }
-
-  for (int i = 31; i >= 0; i--) {
-    value =  0x3f & x4driver->downconversion_coeff_q1[i];
-    status = x4driver_set_pif_register(x4driver, ADDR_PIF_RX_DOWNCONVERSION_COEFF_Q1_WE, value);
-    if (status != XEP_ERROR_X4DRIVER_OK)
-      goto cleanup;
-  }
-
-  for (int i = 31; i >= 0; i--) {
-    value =  0x3f & x4driver->downconversion_coeff_i2[i];
-    status = x4driver_set_pif_register(x4driver, ADDR_PIF_RX_DOWNCONVERSION_COEFF_I2_WE, value);
-    if (status != XEP_ERROR_X4DRIVER_OK)
-      goto cleanup;
-  }
-
-  for (int i = 31; i >= 0; i--) {
-    value =  0x3f & x4driver->downconversion_coeff_q2[i];
-    status = x4driver_set_pif_register(x4driver, ADDR_PIF_RX_DOWNCONVERSION_COEFF_Q2_WE, value);
-    if (status != XEP_ERROR_X4DRIVER_OK)
-      goto cleanup;
-  }
+  x4driver_pif_batch_begin(x4driver);
+  for (int i = 31; i >= 0; i--)
+    x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_DOWNCONVERSION_COEFF_I1_WE, 0x3f & x4driver->downconversion_coeff_i1[i], NULL);
+  for (int i = 31; i >= 0; i--)
+    x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_DOWNCONVERSION_COEFF_Q1_WE, 0x3f & x4driver->downconversion_coeff_q1[i], NULL);
+  for (int i = 31; i >= 0; i--)
+    x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_DOWNCONVERSION_COEFF_I2_WE, 0x3f & x4driver->downconversion_coeff_i2[i], NULL);
+  for (int i = 31; i >= 0; i--)
+    x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_DOWNCONVERSION_COEFF_Q2_WE, 0x3f & x4driver->downconversion_coeff_q2[i], NULL);
+  status = x4driver_pif_batch_commit(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK)
+    goto cleanup;
 
   _update_normalization_constants(x4driver);
 
@@ -439,26 +609,35 @@ uint32_t _update_normalization_variables(X4Driver_t *x4driver)
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
   uint8_t iterations = 0x00;
-  x4driver_get_iterations(x4driver, &iterations);
-  x4driver->iterations = iterations;
-  uint16_t pulses_per_step = 0x0000;
-  x4driver_get_pulses_per_step(x4driver, &pulses_per_step);
-  x4driver->pulses_per_step = pulses_per_step;
-  uint16_t dac_min = 0x0000;
-  x4driver_get_dac_min(x4driver, &dac_min);
-  x4driver->dac_min = dac_min;
-  uint16_t dac_max = 0x0000;
-  x4driver_get_dac_max(x4driver, &dac_max);
-  x4driver->dac_max = dac_max;
-  xtx4_dac_step_t dac_step = 0x00;
-  x4driver_get_dac_step(x4driver, &dac_step);
-  x4driver->dac_step = dac_step;
+  uint8_t pps_lsb = 0x00, pps_msb = 0x00;
+  uint8_t dac_min_lsb = 0x00, dac_min_msb = 0x00;
+  uint8_t dac_max_lsb = 0x00, dac_max_msb = 0x00;
+  uint8_t dac_step = 0x00;
   uint8_t bytes_per_counter = 0x00;
-  x4driver_get_pif_register(x4driver, ADDR_PIF_RX_COUNTER_NUM_BYTES_RW, &bytes_per_counter);
-  x4driver->bytes_per_counter =bytes_per_counter;
-  xtx4_tx_center_frequency_t center = TX_CENTER_FREQUENCY_EU_7_290GHz;
-  x4driver_get_tx_center_frequency(x4driver, &center);
-  x4driver->center_frequency = center;
+  uint8_t tx_pll_ctrl_1 = 0x00;
+  x4driver_pif_batch_begin(x4driver);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_ITERATIONS_RW, 0, &iterations);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_PULSES_PER_STEP_LSB_RW, 0, &pps_lsb);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_PULSES_PER_STEP_MSB_RW, 0, &pps_msb);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MIN_L_RW, 0, &dac_min_lsb);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MIN_H_RW, 0, &dac_min_msb);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MAX_L_RW, 0, &dac_max_lsb);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MAX_H_RW, 0, &dac_max_msb);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_STEP_RW, 0, &dac_step);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_COUNTER_NUM_BYTES_RW, 0, &bytes_per_counter);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TX_PLL_CTRL_1_RW, 0, &tx_pll_ctrl_1);
+  status = x4driver_pif_batch_commit(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
+  }
+  x4driver->iterations = iterations;
+  x4driver->pulses_per_step = (pps_msb << 8) | pps_lsb;
+  x4driver->dac_min = (dac_min_msb << 3) | (dac_min_lsb & 0x07);
+  x4driver->dac_max = (dac_max_msb << 3) | (dac_max_lsb & 0x07);
+  x4driver->dac_step = dac_step & 0x03;
+  x4driver->bytes_per_counter = bytes_per_counter;
+  x4driver->center_frequency = (tx_pll_ctrl_1 >> 4) & 0x07;
   _update_downconversion_coeffs(x4driver);
   _update_normalization_constants(x4driver);
   mutex_give(x4driver);
@@ -500,6 +679,46 @@ uint32_t _get_mask(uint32_t number_of_bytes)
 }
 
 
+/**
+ * @brief Gets the specialized unpack kernel for the current frame configuration.
+ * Kernels are selected again only when bytes per counter, down conversion or
+ * I/Q layout changed since the last frame.
+ * @return Kernel, or NULL to use the generic unpack code.
+ */
+static X4DriverUnpackKernel _x4driver_unpack_kernel(X4Driver_t *x4driver, uint8_t output_mode)
+{
+#if X4DRIVER_UNPACK_KERNELS
+  uint32_t config = x4driver->bytes_per_counter | (x4driver->downconversion_enabled << 8) | (x4driver->iq_separate << 16);
+  if (config != x4driver->unpack_config) {
+    x4driver->unpack_normalized = x4driver_unpack_select(x4driver->bytes_per_counter, x4driver->downconversion_enabled,
+                                                         x4driver->iq_separate, X4DRIVER_UNPACK_NORMALIZED);
+    x4driver->unpack_raw = x4driver_unpack_select(x4driver->bytes_per_counter, x4driver->downconversion_enabled,
+                                                  x4driver->iq_separate, X4DRIVER_UNPACK_RAW);
+    x4driver->unpack_config = config;
+  }
+  return (output_mode == X4DRIVER_UNPACK_NORMALIZED) ? x4driver->unpack_normalized : x4driver->unpack_raw;
+#else
+  (void)x4driver;
+  (void)output_mode;
+  return NULL;
+#endif
+}
+
+
+/**
+ * @brief Counts consecutive all zero frames.
+ */
+static void _x4driver_update_zero_frame_counter(X4Driver_t *x4driver, bool zero_frame)
+{
+  if (zero_frame) {
+    if (x4driver->zero_frame_counter < X4DRIVER_MAX_ALLOWED_ZERO_FRAMES)
+      x4driver->zero_frame_counter++;
+  } else {
+    x4driver->zero_frame_counter = 0;
+  }
+}
+
+
 /**
  * @brief Unpacks frame.
  *
@@ -545,6 +764,14 @@ int _x4driver_unpack_and_normalize_downconverted_frame(X4Driver_t *x4driver, flo
 
   float32_t nfactor =
     x4driver->normalization_nfactor * x4driver->filter_normalization_factor;
+
+  X4DriverUnpackKernel kernel = _x4driver_unpack_kernel(x4driver, X4DRIVER_UNPACK_NORMALIZED);
+  if (kernel != NULL && bins_data != NULL && (bins_data_size & 1) == 0) {
+    uint32_t nonzero = kernel(raw_data, bins_data, bins_data_size / 2, nfactor, 0);
+    _x4driver_update_zero_frame_counter(x4driver, !nonzero);
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
   uint32_t q_data_start = bins_data_size / 2;
   uint32_t i_data_start = 0;
   uint32_t raw_data_index = 0;
@@ -597,12 +824,7 @@ int _x4driver_unpack_and_normalize_downconverted_frame(X4Driver_t *x4driver, flo
     raw_data_index = (i + 1) * x4driver->bytes_per_counter;
   }
 
-  if (zero_frame) {
-    if (x4driver->zero_frame_counter < X4DRIVER_MAX_ALLOWED_ZERO_FRAMES)
-      x4driver->zero_frame_counter++;
-  } else {
-    x4driver->zero_frame_counter = 0;
-  }
+  _x4driver_update_zero_frame_counter(x4driver, zero_frame);
 
   return XEP_ERROR_X4DRIVER_OK;
 }
@@ -626,6 +848,13 @@ int _x4driver_unpack_and_normalize_frame(X4Driver_t *x4driver, float *bins_data,
   uint32_t raw_data_index = x4driver->frame_area_start_bin_offset * x4driver->bytes_per_counter;
   bool zero_frame = true;
 
+  X4DriverUnpackKernel kernel = _x4driver_unpack_kernel(x4driver, X4DRIVER_UNPACK_NORMALIZED);
+  if (kernel != NULL && bins_data != NULL) {
+    uint32_t nonzero = kernel(&raw_data[raw_data_index], bins_data, bins_data_size, nfactor, offset);
+    _x4driver_update_zero_frame_counter(x4driver, !nonzero);
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
   for (uint32_t i = 0; i < bins_data_size; i++) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
@@ -639,12 +868,7 @@ int _x4driver_unpack_and_normalize_frame(X4Driver_t *x4driver, float *bins_data,
     raw_data_index += x4driver->bytes_per_counter;//set_frame_area skip unused bins in start of ram line.
   }
 
-  if (zero_frame) {
-    if (x4driver->zero_frame_counter < X4DRIVER_MAX_ALLOWED_ZERO_FRAMES)
-      x4driver->zero_frame_counter++;
-  } else {
-    x4driver->zero_frame_counter = 0;
-  }
+  _x4driver_update_zero_frame_counter(x4driver, zero_frame);
 
   return XEP_ERROR_X4DRIVER_OK;
 }
@@ -688,6 +912,7 @@ int x4driver_create(X4Driver_t **x4driver, void *instance_memory, X4DriverCallba
   d->lock.object = lock->object;
   d->lock.lock = lock->lock;
   d->lock.unlock = lock->unlock;
+  d->lock.owner = lock->owner;
   d->lock.timeout = 100; // default timeout.
   d->callbacks.pin_set_enable = x4driver_callbacks->pin_set_enable;
   d->callbacks.spi_read = x4driver_callbacks->spi_read;
@@ -697,6 +922,14 @@ int x4driver_create(X4Driver_t **x4driver, void *instance_memory, X4DriverCallba
   d->callbacks.notify_data_ready = x4driver_callbacks->notify_data_ready;
   d->callbacks.trigger_sweep = x4driver_callbacks->trigger_sweep;
   d->callbacks.enable_data_ready_isr = x4driver_callbacks->enable_data_ready_isr;
+  d->callbacks.wait_data_ready = x4driver_callbacks->wait_data_ready;
+  d->callbacks.spi_write_read_async = x4driver_callbacks->spi_write_read_async;
+  d->callbacks.spi_wait = x4driver_callbacks->spi_wait;
+  d->frame_fetch_pending = 0;
+  _x4driver_shadow_init_bank(&d->shadow.pif, shadow_pif_registers, sizeof(shadow_pif_registers));
+  _x4driver_shadow_init_bank(&d->shadow.xif, shadow_xif_registers, sizeof(shadow_xif_registers));
+  _x4driver_shadow_init_bank(&d->shadow.spi, shadow_spi_registers, sizeof(shadow_spi_registers));
+  d->shadow.verify = X4DRIVER_SHADOW_VERIFY;
   d->zero_frame_counter = 0;
   d->frame_counter = 0;
   d->frame_length = 1536;
@@ -737,8 +970,25 @@ int x4driver_upload_firmware_custom(X4Driver_t *x4driver, const uint8_t *buffer,
   x4driver_set_spi_register(x4driver, ADDR_SPI_MEM_FIRST_ADDR_MSB_RW, START_OF_SRAM_MSB);
   x4driver_set_spi_register(x4driver, ADDR_SPI_MEM_MODE_RW, SET_PROGRAMMING_MODE);
 
-  for (uint32_t i = 0; i < length; i++) {
-    x4driver_set_spi_register(x4driver, ADDR_SPI_TO_MEM_WRITE_DATA_WE, buffer[i]);
+  uint32_t burst_size = _x4driver_firmware_burst_size(x4driver);
+  if (burst_size == 0) {
+    for (uint32_t i = 0; i < length; i++) {
+      x4driver_set_spi_register(x4driver, ADDR_SPI_TO_MEM_WRITE_DATA_WE, buffer[i]);
+    }
+    mutex_give(x4driver);
+    return status;
+  }
+
+  // Stream the image to the SRAM write FIFO, one SPI transfer per burst
+  for (uint32_t offset = 0; offset < length; offset += burst_size) {
+    uint32_t chunk = length - offset;
+    if (chunk > burst_size)
+      chunk = burst_size;
+    x4driver->spi_buffer[0] = ADDR_SPI_TO_MEM_WRITE_DATA_WE | SPI_ADDRESS_WRITE;
+    memcpy(&x4driver->spi_buffer[1], &buffer[offset], chunk);
+    status = x4driver->callbacks.spi_write(x4driver->user_reference, x4driver->spi_buffer, 1 + chunk);
+    if (status != XEP_ERROR_X4DRIVER_OK)
+      break;
   }
 
   mutex_give(x4driver);
@@ -806,12 +1056,16 @@ int x4driver_is_frame_ready(X4Driver_t *x4driver, uint8_t *is_ready)
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
 
-  if (x4driver->frame_is_ready_strategy == FRAME_IS_READY_READ_REGISTERS) {
+  if (x4driver->frame_is_ready_strategy == FRAME_IS_READY_READ_REGISTERS ||
+      x4driver->frame_is_ready_strategy == FRAME_IS_READY_INTERRUPT) {
+    // A register read in both strategies. wait_data_ready would make the caller,
+    // e.g. the timer task, the one the data ready interrupt notifies
     uint8_t trx_ctrl_done = 0x00;
     status |= x4driver_get_pif_register(x4driver, ADDR_PIF_TRX_CTRL_DONE_R, &trx_ctrl_done);
     *is_ready  = trx_ctrl_done;
-    //notify out
-    if (x4driver->trigger_mode == SWEEP_TRIGGER_MCU) {
+    //notify out, the interrupt notifies the waiter itself
+    if (x4driver->trigger_mode == SWEEP_TRIGGER_MCU &&
+        x4driver->frame_is_ready_strategy == FRAME_IS_READY_READ_REGISTERS) {
       if (*is_ready == 1) {
         x4driver->callbacks.notify_data_ready(x4driver->user_reference);
       }
@@ -826,6 +1080,62 @@ int x4driver_is_frame_ready(X4Driver_t *x4driver, uint8_t *is_ready)
 }
 
 
+/**
+ * @brief Selects how frame ready is detected.
+ * @return Status of execution as defined in x4driver.h.
+ */
+int x4driver_set_frame_ready_strategy(X4Driver_t *x4driver, uint32_t strategy)
+{
+  if (strategy == FRAME_IS_READY_INTERRUPT && x4driver->callbacks.wait_data_ready == NULL)
+    return XEP_ERROR_X4DRIVER_NOT_SUPPORTED;
+  if (strategy != FRAME_IS_READY_READ_REGISTERS && strategy != FRAME_IS_READY_INTERRUPT)
+    return XEP_ERROR_X4DRIVER_NOT_SUPPORTED;
+
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver->frame_is_ready_strategy = strategy;
+  mutex_give(x4driver);
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Blocks until the sweep started with x4driver_start_sweep has completed.
+ * @return XEP_ERROR_X4DRIVER_FRAME_READY_TIMEOUT if no frame is ready within timeout_ms.
+ */
+int x4driver_wait_frame_ready(X4Driver_t *x4driver, uint32_t timeout_ms)
+{
+  if (x4driver->frame_is_ready_strategy == FRAME_IS_READY_INTERRUPT) {
+    // Block on the data ready pin without the lock so the bus is free during the sweep
+    if (x4driver->callbacks.wait_data_ready(x4driver->user_reference, timeout_ms))
+      return XEP_ERROR_X4DRIVER_OK;
+
+    // Missed edge? Check the sweep status once before giving up
+    uint8_t trx_ctrl_done = 0;
+    int status = x4driver_get_pif_register(x4driver, ADDR_PIF_TRX_CTRL_DONE_R, &trx_ctrl_done);
+    if (status != XEP_ERROR_X4DRIVER_OK)
+      return status;
+    if (trx_ctrl_done != FRAME_NOT_READY)
+      return XEP_ERROR_X4DRIVER_OK;
+    return XEP_ERROR_X4DRIVER_FRAME_READY_TIMEOUT;
+  }
+
+  uint32_t waited_us = 0;
+  uint8_t is_ready = 0;
+  do {
+    int status = x4driver_is_frame_ready(x4driver, &is_ready);
+    if (status != XEP_ERROR_X4DRIVER_OK)
+      return status;
+    if (is_ready)
+      return XEP_ERROR_X4DRIVER_OK;
+    x4driver->callbacks.wait_us(FRAME_READY_POLL_INTERVAL_US);
+    waited_us += FRAME_READY_POLL_INTERVAL_US;
+  } while (waited_us < timeout_ms * MS);
+
+  return XEP_ERROR_X4DRIVER_FRAME_READY_TIMEOUT;
+}
+
+
 /**
  * @brief Will trigger a radar sweep.
  * Assumes Enable has been set.
@@ -862,16 +1172,20 @@ int x4driver_setup_default(X4Driver_t *x4driver)
 {
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_shadow_invalidate(x4driver);
+  x4driver_pif_batch_begin(x4driver);
   //Set receiver trimming values
   //dac_trim_a / dac_trim_b
-  status = x4driver_set_xif_register(x4driver, ADDR_XIF_DAC_TRIM_RW, 63);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, XIF_COMMAND, ADDR_XIF_DAC_TRIM_RW, 63, NULL);
   //preamp_trim
-  status = x4driver_set_xif_register(x4driver, ADDR_XIF_PREAMP_TRIM_RW, 15);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, XIF_COMMAND, ADDR_XIF_PREAMP_TRIM_RW, 15, NULL);
   //Enable Common PLL 243MHz
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_COMMON_PLL_CTRL_1_RW, 96);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_COMMON_PLL_CTRL_1_RW, 96, NULL);
+  status = x4driver_pif_batch_commit(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
+  }
 
   uint32_t timeout = PLL_LOCK_ATTEMPS_MAX;
   uint8_t pll_status, has_lock = 0;
@@ -935,56 +1249,44 @@ int x4driver_setup_default(X4Driver_t *x4driver)
   if (!has_lock)
     return XEP_ERROR_X4DRIVER_RX_PLL_LOCK_FAIL;
 
+  x4driver_pif_batch_begin(x4driver);
   //Enable receiver back end clocks
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_CLKOUT_SEL_RW, 16);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_MCLK_TRX_BACKEND_CLK_CTRL_RW, 8);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_CLKOUT_SEL_RW, 16, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_MCLK_TRX_BACKEND_CLK_CTRL_RW, 8, NULL);
   //Enable sampler
-  status = x4driver_set_xif_register(x4driver, ADDR_XIF_SAMPLER_PRESET_MSB_RW, 0);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_SMPL_MODE_RW, 0);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, XIF_COMMAND, ADDR_XIF_SAMPLER_PRESET_MSB_RW, 0, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_SMPL_MODE_RW, 0, NULL);
   //Configuration of transmitter Transmitter
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_MISC_CTRL, 80);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_MISC_CTRL, 80, NULL);
   //Set TX center frequency to EU
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TX_PLL_CTRL_1_RW, 48);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TX_PLL_CTRL_1_RW, 48, NULL);
   //set_dacmax
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_DAC_MAX_L_RW, 7);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_DAC_MAX_H_RW, 255);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MAX_L_RW, 7, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MAX_H_RW, 255, NULL);
   //set_dacmin
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_DAC_MIN_L_RW, 0);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_DAC_MIN_H_RW, 0);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MIN_L_RW, 0, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_DAC_MIN_H_RW, 0, NULL);
   //set_pps
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_PULSES_PER_STEP_LSB_RW, 10);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_PULSES_PER_STEP_MSB_RW, 0);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_PULSES_PER_STEP_LSB_RW, 10, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_PULSES_PER_STEP_MSB_RW, 0, NULL);
   //setting Iterations
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_ITERATIONS_RW, 8);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_ITERATIONS_RW, 8, NULL);
   //Set up PRF
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TRX_CLOCKS_PER_PULSE_RW, 16);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TRX_CLOCKS_PER_PULSE_RW, 16, NULL);
   //rx_mframes_coarse
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_RX_MFRAMES_COARSE_RW, 16);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_MFRAMES_COARSE_RW, 16, NULL);
   //rx_wait
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_RX_WAIT_RW, 0);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_WAIT_RW, 0, NULL);
   //tx_wait
-  status = x4driver_set_pif_register(x4driver, ADDR_PIF_TX_WAIT_RW, 1);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TX_WAIT_RW, 1, NULL);
   //set_frame_length
   uint8_t rx_mframes_coarse = 0x00;
-  status = x4driver_get_pif_register(x4driver,ADDR_PIF_RX_MFRAMES_COARSE_RW,&rx_mframes_coarse);
-  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_MFRAMES_COARSE_RW, 0, &rx_mframes_coarse);
+  status = x4driver_pif_batch_commit(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
+  }
   status = x4driver_set_frame_length(x4driver,rx_mframes_coarse);
 
 
@@ -1049,18 +1351,30 @@ int x4driver_verify_firmware(X4Driver_t *x4driver, const uint8_t *buffer, uint32
     }
   }
   x4driver_set_spi_register(x4driver, ADDR_SPI_MEM_MODE_RW, SET_READBACK_MODE); //set into read back mode
-  for (uint32_t i = 0; i < size; i++) {
-    status =  x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_MEM_READ_DATA_RE, &read_back);
-    if (buffer[i] != read_back) {
-      // Store in dummy variables for debug purposes when optimization is enabled.
-      //
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#pragma GCC diagnostic push
-      volatile uint8_t buffer_value = buffer[i];
-      volatile uint8_t read_back_value = read_back;
-#pragma GCC diagnostic pop
-      errors++;
+
+  uint32_t burst_size = _x4driver_firmware_burst_size(x4driver);
+  if (burst_size == 0) {
+    for (uint32_t i = 0; i < size; i++) {
+      status =  x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_MEM_READ_DATA_RE, &read_back);
+      if (buffer[i] != read_back)
+        errors++;
+    }
+  } else {
+    // Burst read back and compare CRC of the whole image
+    uint8_t address = ADDR_SPI_FROM_MEM_READ_DATA_RE;
+    uint32_t crc_expected = _x4driver_crc32(0, buffer, size);
+    uint32_t crc_read_back = 0;
+    for (uint32_t offset = 0; offset < size; offset += burst_size) {
+      uint32_t chunk = size - offset;
+      if (chunk > burst_size)
+        chunk = burst_size;
+      status = x4driver->callbacks.spi_write_read(x4driver->user_reference, &address, 1, x4driver->spi_buffer, chunk);
+      if (status != XEP_ERROR_X4DRIVER_OK)
+        break;
+      crc_read_back = _x4driver_crc32(crc_read_back, &x4driver->spi_buffer[X4DRIVER_SPI_RDATA_OFFSET], chunk);
     }
+    if (crc_read_back != crc_expected)
+      errors++;
   }
   x4driver_set_spi_register(x4driver, ADDR_SPI_MEM_MODE_RW, SET_NORMAL_MODE); //set into read back mode
   mutex_give(x4driver);
@@ -1135,7 +1449,6 @@ int x4driver_set_frame_area(X4Driver_t *x4driver, float32_t start, float32_t end
 
   double dR_bin = X4DRIVER_METERS_PER_BIN * DecimationFactor;
   double R_frame_step = X4DRIVER_METERS_PER_BIN * 96;
-  double R_FrameStart_discarded = NumberOfBinsDiscarded * dR_bin;
 
   // Find the required RXWait-TXWait diff to capture the requested start
   double diff_RxTxWait = floor( (FrameAreaStart - FrameAreaOffset) / R_frame_step );
@@ -1144,10 +1457,17 @@ int x4driver_set_frame_area(X4Driver_t *x4driver, float32_t start, float32_t end
 
   // Set RXWait according to TXWait and required diff
   uint8_t TxWait = 0x00;
-  x4driver_get_pif_register(x4driver,ADDR_PIF_TX_WAIT_RW,&TxWait);
+  uint8_t RxRamLsbs = 0x00;
+  x4driver_pif_batch_begin(x4driver);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_TX_WAIT_RW, 0, &TxWait);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_RAM_LSBS_RW, 0, &RxRamLsbs);
+  status = x4driver_pif_batch_commit(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
+  }
   double RxWait = (double)TxWait + diff_RxTxWait;
   uint8_t RxWait_8 = (uint8_t)RxWait;
-  x4driver_set_rx_wait(x4driver, RxWait_8);
 
   // Calculate limits of captured frame
   double FrameStart_quantized = diff_RxTxWait * R_frame_step + FrameAreaOffset;
@@ -1200,8 +1520,22 @@ int x4driver_set_frame_area(X4Driver_t *x4driver, float32_t start, float32_t end
     x4driver->frame_area_end  = FrameAreaStop_quantized;
   }
 
-  _x4driver_set_rx_ram_first_line(x4driver, x4driver->frame_area_start_ram_line);
-  _x4driver_set_rx_ram_last_line(x4driver, x4driver->frame_area_end_ram_line);
+  // rx_wait, first and last ram line in one batch. RX_RAM_LSBS holds bit 0 of the
+  // first line in bit 1 and bit 0 of the last line in bit 0.
+  RxRamLsbs &= ~0x03;
+  RxRamLsbs |= (uint8_t)((x4driver->frame_area_start_ram_line & 0x01) << 1);
+  RxRamLsbs |= (uint8_t)(x4driver->frame_area_end_ram_line & 0x01);
+  x4driver_pif_batch_begin(x4driver);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_WAIT_RW, RxWait_8, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_RAM_LSBS_RW, RxRamLsbs, NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_RAM_LINE_FIRST_MSB_RW, (uint8_t)(x4driver->frame_area_start_ram_line >> 1), NULL);
+  x4driver_pif_batch_queue(x4driver, PIF_COMMAND, ADDR_PIF_RX_RAM_LINE_LAST_MSB_RW, (uint8_t)(x4driver->frame_area_end_ram_line >> 1), NULL);
+  status = x4driver_pif_batch_commit(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
+  }
+  x4driver->rx_wait = RxWait_8;
 
   if (x4driver->downconversion_enabled) {
     uint32_t bytes_to_read = (x4driver->frame_area_end_ram_line - x4driver->frame_area_start_ram_line + 1) * 2 * x4driver->bytes_per_counter;
@@ -1267,17 +1601,19 @@ int x4driver_read_frame_normalized(X4Driver_t *x4driver, uint32_t *frame_counter
  */
 int x4driver_read_frame_bytes(X4Driver_t *x4driver, uint32_t *frame_counter, uint8_t *data, uint32_t length)
 {
-  uint32_t frame_cnt = 0;
-  _x4driver_get_framecounter(x4driver, &frame_cnt);
-  x4driver->frame_counter = frame_cnt;
-  *frame_counter = x4driver->frame_counter;
-
   if (length < x4driver->frame_read_size)
     return XEP_ERROR_X4DRIVER_BUFFER_TO_SMALL;
 
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
 
+  if (frame_counter != NULL) {
+    uint32_t frame_cnt = 0;
+    _x4driver_get_framecounter(x4driver, &frame_cnt);
+    x4driver->frame_counter = frame_cnt;
+    *frame_counter = x4driver->frame_counter;
+  }
+
   status = x4driver_set_pif_register(x4driver, ADDR_PIF_FETCH_RADAR_DATA_SPI_W, FETCH_DATA_ACTION);
   if (status != XEP_ERROR_X4DRIVER_OK) {
     mutex_give(x4driver);
@@ -1304,9 +1640,10 @@ int x4driver_set_spi_register(X4Driver_t *x4driver, uint8_t address, uint8_t val
 {
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
-  address |= 0x80;
-  uint8_t register_write_buffer[2] = {address, value};
+  uint8_t register_write_buffer[2] = {address | 0x80, value};
   status = x4driver->callbacks.spi_write(x4driver->user_reference, register_write_buffer, 2);
+  if (status == XEP_ERROR_X4DRIVER_OK)
+    _x4driver_shadow_store(x4driver, &x4driver->shadow.spi, address, value, 1);
   mutex_give(x4driver);
   return status;
 }
@@ -1322,9 +1659,16 @@ int x4driver_get_spi_register(X4Driver_t *x4driver, uint8_t address, uint8_t *va
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
 
+  if (_x4driver_shadow_lookup(x4driver, &x4driver->shadow.spi, address, value)) {
+    mutex_give(x4driver);
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
   uint8_t register_write_buffer = address;
   uint8_t register_read_buffer = 0x00;
   status = x4driver->callbacks.spi_write_read(x4driver->user_reference, &register_write_buffer, 1, &register_read_buffer, 1);
+  if (status == XEP_ERROR_X4DRIVER_OK)
+    _x4driver_shadow_store(x4driver, &x4driver->shadow.spi, address, register_read_buffer, 0);
   mutex_give(x4driver);
   *value = register_read_buffer;
   return status;
@@ -1363,7 +1707,6 @@ int x4driver_read_from_spi_register(X4Driver_t *x4driver, uint8_t address, uint8
 
   if (length >= x4driver->spi_buffer_size) return XEP_ERROR_X4DRIVER_BUFFER_TO_SMALL;
   uint8_t register_write_buffer = address;
-  uint8_t register_read_buffer = 0x00;
   status = x4driver->callbacks.spi_write_read(x4driver->user_reference, &register_write_buffer, 1, x4driver->spi_buffer, length);
   memcpy(values, x4driver->spi_buffer, length);
   mutex_give(x4driver);
@@ -1381,6 +1724,8 @@ int x4driver_set_enable(X4Driver_t *x4driver, uint8_t value)
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
   status = x4driver->callbacks.pin_set_enable(x4driver->user_reference, value);
+  // Power cycling X4 resets its registers
+  x4driver_shadow_invalidate(x4driver);
   mutex_give(x4driver);
   return status;
 }
@@ -1418,6 +1763,7 @@ int _x4driver_set_internal_register(X4Driver_t *x4driver, uint8_t address, uint8
 {
   uint32_t status = mutex_take(x4driver);
   if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  uint8_t register_address = address;
   address |= PIF_ADDRESS_WRITE;
 
   if (x4driver->initialized == 0) {
@@ -1454,6 +1800,8 @@ int _x4driver_set_internal_register(X4Driver_t *x4driver, uint8_t address, uint8
     }
   }
 
+  _x4driver_shadow_store(x4driver, _x4driver_shadow_bank(x4driver, command), register_address, write_value, 1);
+
   mutex_give(x4driver);
   return status;
 }
@@ -1528,27 +1876,27 @@ int _x4driver_get_framecounter(X4Driver_t *x4driver, uint32_t *value)
     return XEP_ERROR_X4DRIVER_UNINITIALIZED;
   }
 
-  uint8_t tmp_rb[4];
+  // One status read covers both the stale FROM_CPU check and TO_CPU empty
   uint8_t fifo_status = 0x00;
-  uint8_t data_in_fifo = 0;
-  uint8_t index = 0 ;
-  x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
-  //clear FIFO
-  while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_SET) {
-    x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, tmp_rb);
-    x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
-    data_in_fifo++;
+  status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+  if (status == XEP_ERROR_X4DRIVER_OK && bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_SET)
+    status = _x4driver_mailbox_drain_from_cpu(x4driver, NULL);
+  if (status == XEP_ERROR_X4DRIVER_OK && bit_is_set(fifo_status, TO_CPU_EMPTY_BIT) == BIT_NOT_SET)
+    status = _x4driver_mailbox_wait_to_cpu_empty(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
   }
 
-  _x4driver_set_x4_sw_action(x4driver,9);
-  x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, &tmp_rb[index]);
-  index++;
-  x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, &tmp_rb[index]);
-  index++;
-  x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, &tmp_rb[index]);
-  index++;
-  x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, &tmp_rb[index]);
-  //
+  // Software action 9 pushes the 4 counter bytes to the FROM_CPU FIFO
+  uint8_t action[] = {ADDR_SPI_TO_CPU_WRITE_DATA_WE | SPI_ADDRESS_WRITE, 9 | PIF_ADDRESS_WRITE, X4_SW_ACTION_COMMAND, 0xff};
+  status = x4driver->callbacks.spi_write(x4driver->user_reference, action, sizeof(action));
+  if (status == XEP_ERROR_X4DRIVER_OK)
+    status = _x4driver_mailbox_wait_to_cpu_empty(x4driver);
+
+  uint8_t tmp_rb[4] = {0};
+  if (status == XEP_ERROR_X4DRIVER_OK)
+    status = _x4driver_spi_read_burst(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, tmp_rb, sizeof(tmp_rb));
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
   *value =  *((uint32_t*)tmp_rb);
@@ -1573,6 +1921,12 @@ int _x4driver_get_x4_internal_register(X4Driver_t *x4driver, uint8_t address, ui
     return XEP_ERROR_X4DRIVER_UNINITIALIZED;
   }
 
+  X4DriverShadowBank_t *bank = _x4driver_shadow_bank(x4driver, command);
+  if (_x4driver_shadow_lookup(x4driver, bank, address, value)) {
+    mutex_give(x4driver);
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
   uint8_t tmp_rb = 0x00;
   uint8_t fifo_status = 0x00;
   uint8_t retries = 0;
@@ -1592,53 +1946,296 @@ int _x4driver_get_x4_internal_register(X4Driver_t *x4driver, uint8_t address, ui
   x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
   retries = 0;
 
-  //wait for response
-  while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_NOT_SET || bit_is_set(fifo_status, TO_CPU_EMPTY_BIT) == BIT_NOT_SET) {
-    x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
-    retries++;
-    if (retries > retries_max) {
-      mutex_give(x4driver);
-      return XEP_ERROR_X4DRIVER_PIF_TIMEOUT;
+  //wait for response
+  while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_NOT_SET || bit_is_set(fifo_status, TO_CPU_EMPTY_BIT) == BIT_NOT_SET) {
+    x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
+    retries++;
+    if (retries > retries_max) {
+      mutex_give(x4driver);
+      return XEP_ERROR_X4DRIVER_PIF_TIMEOUT;
+    }
+  }
+
+  //read response
+  x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
+  while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_SET) {
+    x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, &tmp_rb);
+    x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
+    if (retries > retries_max) {
+      mutex_give(x4driver);
+      return XEP_ERROR_X4DRIVER_PIF_TIMEOUT;
+    }
+    data_in_fifo++;
+  }
+  *value = tmp_rb;
+  _x4driver_shadow_store(x4driver, bank, address, tmp_rb, 0);
+
+  mutex_give(x4driver);
+  return status;
+}
+
+
+/**
+ * @brief Gets PIF register value.
+ * requires enable to be set and 8051 SRAM to be program.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_get_pif_register(X4Driver_t *x4driver, uint8_t address,uint8_t *value)
+{
+  return _x4driver_get_x4_internal_register(x4driver, address, value, PIF_COMMAND);
+}
+
+
+/**
+ * @brief Gets XIF register value.
+ * requires enable to be set and 8051 SRAM to be program.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_get_xif_register(X4Driver_t *x4driver, uint8_t address, uint8_t *value)
+{
+  return _x4driver_get_x4_internal_register(x4driver, address, value, XIF_COMMAND);
+}
+
+
+/**
+ * @brief Reads mailbox FIFO status without taking the lock.
+ * Caller must hold the driver lock.
+ * @return Status of execution as defined in x4driver.h
+ */
+static int _x4driver_mailbox_read_status(X4Driver_t *x4driver, uint8_t *fifo_status)
+{
+  uint8_t address = ADDR_SPI_SPI_MB_FIFO_STATUS_R;
+  return x4driver->callbacks.spi_write_read(x4driver->user_reference, &address, 1, fifo_status, 1);
+}
+
+
+/**
+ * @brief Waits until the 8051 has consumed the TO_CPU mailbox FIFO.
+ * Caller must hold the driver lock.
+ * @return Status of execution as defined in x4driver.h
+ */
+static int _x4driver_mailbox_wait_to_cpu_empty(X4Driver_t *x4driver)
+{
+  uint8_t fifo_status = 0x00;
+  uint32_t retries = 0;
+  int status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+  while (bit_is_set(fifo_status, TO_CPU_EMPTY_BIT) == BIT_NOT_SET) {
+    if (status != XEP_ERROR_X4DRIVER_OK) return status;
+    if (++retries > PIF_COMMAND_MAX_RETRIES) return XEP_ERROR_X4DRIVER_PIF_TIMEOUT;
+    status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+  }
+  return status;
+}
+
+
+/**
+ * @brief Reads length bytes from one SPI register in a single transfer.
+ * Used on FIFO registers (_RE) where every byte read pops the next entry.
+ * Caller must hold the driver lock.
+ * @return Status of execution as defined in x4driver.h
+ */
+static int _x4driver_spi_read_burst(X4Driver_t *x4driver, uint8_t address, uint8_t *data, uint32_t length)
+{
+  uint8_t rx[8 + X4DRIVER_SPI_RDATA_OFFSET];
+  if (length > 8)
+    return XEP_ERROR_X4DRIVER_BUFFER_TO_SMALL;
+  if (length == 1)
+    return x4driver->callbacks.spi_write_read(x4driver->user_reference, &address, 1, data, 1);
+
+  int status = x4driver->callbacks.spi_write_read(x4driver->user_reference, &address, 1, rx, length);
+  memcpy(data, &rx[X4DRIVER_SPI_RDATA_OFFSET], length);
+  return status;
+}
+
+
+/**
+ * @brief Reads FROM_CPU mailbox FIFO until empty, keeping the last byte.
+ * Caller must hold the driver lock.
+ * @return Status of execution as defined in x4driver.h
+ */
+static int _x4driver_mailbox_drain_from_cpu(X4Driver_t *x4driver, uint8_t *last_value)
+{
+  uint8_t address = ADDR_SPI_FROM_CPU_READ_DATA_RE;
+  uint8_t fifo_status = 0x00;
+  uint8_t tmp_rb = 0x00;
+  uint32_t retries = 0;
+  int status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+  while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_SET) {
+    if (status != XEP_ERROR_X4DRIVER_OK) return status;
+    if (++retries > PIF_COMMAND_MAX_RETRIES) return XEP_ERROR_X4DRIVER_MAILBOX_ERROR;
+    status = x4driver->callbacks.spi_write_read(x4driver->user_reference, &address, 1, &tmp_rb, 1);
+    if (status != XEP_ERROR_X4DRIVER_OK) return status;
+    status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+  }
+  if (last_value != NULL)
+    *last_value = tmp_rb;
+  return status;
+}
+
+
+/**
+ * @brief Sends all queued batch commands to X4.
+ * Consecutive writes are packed into one SPI burst on TO_CPU_WRITE_DATA_WE, up to
+ * X4DRIVER_PIF_BATCH_BURST_COMMANDS per burst. A read ends its burst since the
+ * response has to be collected before the next command is sent.
+ * Caller must hold the driver lock.
+ * @return Status of execution as defined in x4driver.h
+ */
+static int _x4driver_pif_batch_flush(X4Driver_t *x4driver)
+{
+  X4DriverPifBatch_t *batch = &x4driver->pif_batch;
+  uint8_t burst[1 + 3 * X4DRIVER_PIF_BATCH_BURST_COMMANDS];
+  int status = XEP_ERROR_X4DRIVER_OK;
+  uint32_t i = 0;
+
+  if (x4driver->initialized == 0) {
+    batch->count = 0;
+    return XEP_ERROR_X4DRIVER_UNINITIALIZED;
+  }
+
+  if (batch->count == 0)
+    return XEP_ERROR_X4DRIVER_OK;
+
+  // Stale responses would be taken as results of the reads below
+  status = _x4driver_mailbox_drain_from_cpu(x4driver, NULL);
+  if (status != XEP_ERROR_X4DRIVER_OK) goto cleanup;
+
+  while (i < batch->count) {
+    uint32_t first = i;
+    X4DriverMailboxCommand_t *read_command = NULL;
+    uint32_t length = 0;
+    burst[length++] = ADDR_SPI_TO_CPU_WRITE_DATA_WE | SPI_ADDRESS_WRITE;
+
+    for (uint32_t n = 0; n < X4DRIVER_PIF_BATCH_BURST_COMMANDS && i < batch->count; n++) {
+      X4DriverMailboxCommand_t *command = &batch->commands[i++];
+      if (command->read_value != NULL) {
+        burst[length++] = command->address;
+        burst[length++] = command->command;
+        read_command = command;
+        break;
+      }
+      burst[length++] = command->address | PIF_ADDRESS_WRITE;
+      burst[length++] = command->command;
+      burst[length++] = command->value;
+    }
+
+    status = _x4driver_mailbox_wait_to_cpu_empty(x4driver);
+    if (status != XEP_ERROR_X4DRIVER_OK) goto cleanup;
+    status = x4driver->callbacks.spi_write(x4driver->user_reference, burst, length);
+    if (status != XEP_ERROR_X4DRIVER_OK) goto cleanup;
+
+    for (uint32_t n = first; n < i; n++) {
+      X4DriverMailboxCommand_t *command = &batch->commands[n];
+      if (command->read_value == NULL)
+        _x4driver_shadow_store(x4driver, _x4driver_shadow_bank(x4driver, command->command), command->address, command->value, 1);
     }
-  }
 
-  //read response
-  x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
-  while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_SET) {
-    x4driver_get_spi_register(x4driver, ADDR_SPI_FROM_CPU_READ_DATA_RE, &tmp_rb);
-    x4driver_get_spi_register(x4driver, ADDR_SPI_SPI_MB_FIFO_STATUS_R, &fifo_status);
-    if (retries > retries_max) {
-      mutex_give(x4driver);
-      return XEP_ERROR_X4DRIVER_PIF_TIMEOUT;
+    if (read_command != NULL) {
+      uint8_t fifo_status = 0x00;
+      uint32_t retries = 0;
+      status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+      //wait for response
+      while (bit_is_set(fifo_status, FROM_CPU_VALID_BIT) == BIT_NOT_SET || bit_is_set(fifo_status, TO_CPU_EMPTY_BIT) == BIT_NOT_SET) {
+        if (status != XEP_ERROR_X4DRIVER_OK) goto cleanup;
+        if (++retries > PIF_COMMAND_MAX_RETRIES) {
+          status = XEP_ERROR_X4DRIVER_PIF_TIMEOUT;
+          goto cleanup;
+        }
+        status = _x4driver_mailbox_read_status(x4driver, &fifo_status);
+      }
+      status = _x4driver_mailbox_drain_from_cpu(x4driver, read_command->read_value);
+      if (status != XEP_ERROR_X4DRIVER_OK) goto cleanup;
+      _x4driver_shadow_store(x4driver, _x4driver_shadow_bank(x4driver, read_command->command), read_command->address, *read_command->read_value, 0);
     }
-    data_in_fifo++;
   }
-  *value = tmp_rb;
 
-  mutex_give(x4driver);
+  status = _x4driver_mailbox_wait_to_cpu_empty(x4driver);
+
+cleanup:
+  // Unknown how much of the batch reached X4
+  if (status != XEP_ERROR_X4DRIVER_OK)
+    x4driver_shadow_invalidate(x4driver);
+  batch->count = 0;
   return status;
 }
 
 
 /**
- * @brief Gets PIF register value.
- * requires enable to be set and 8051 SRAM to be program.
+ * @brief Starts a batch of PIF/XIF/software mailbox commands.
+ * Takes the driver lock until x4driver_pif_batch_commit. Batches may be nested.
  * @return Status of execution as defined in x4driver.h
  */
-int x4driver_get_pif_register(X4Driver_t *x4driver, uint8_t address,uint8_t *value)
+int x4driver_pif_batch_begin(X4Driver_t *x4driver)
 {
-  return _x4driver_get_x4_internal_register(x4driver, address, value, PIF_COMMAND);
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  if (x4driver->pif_batch.depth++ == 0) {
+    x4driver->pif_batch.count = 0;
+    x4driver->pif_batch.status = XEP_ERROR_X4DRIVER_OK;
+  }
+  return XEP_ERROR_X4DRIVER_OK;
 }
 
 
 /**
- * @brief Gets XIF register value.
+ * @brief Queues a mailbox command in the current batch.
+ * If read_value is NULL the command is a register write of value, otherwise
+ * a register read whose result is stored in *read_value on commit.
+ * A full batch is flushed to X4 before the command is queued.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_pif_batch_queue(X4Driver_t *x4driver, xtx4_command_id_t command, uint8_t address, uint8_t value, uint8_t *read_value)
+{
+  X4DriverPifBatch_t *batch = &x4driver->pif_batch;
+  if (batch->depth == 0)
+    return XEP_ERROR_X4DRIVER_NOK;
+
+  // Cached reads need no mailbox round trip, unless a write to the same
+  // register is still queued (the cache is updated when the write is flushed)
+  if (read_value != NULL) {
+    uint32_t pending_write = 0;
+    for (uint32_t n = 0; n < batch->count; n++) {
+      if (batch->commands[n].read_value == NULL && batch->commands[n].command == command && batch->commands[n].address == address)
+        pending_write = 1;
+    }
+    if (!pending_write && _x4driver_shadow_lookup(x4driver, _x4driver_shadow_bank(x4driver, command), address, read_value))
+      return batch->status;
+  }
+
+  if (batch->count == X4DRIVER_PIF_BATCH_MAX_COMMANDS) {
+    int status = _x4driver_pif_batch_flush(x4driver);
+    if (status != XEP_ERROR_X4DRIVER_OK && batch->status == XEP_ERROR_X4DRIVER_OK)
+      batch->status = status;
+  }
+
+  X4DriverMailboxCommand_t *entry = &batch->commands[batch->count++];
+  entry->command = command;
+  entry->address = address;
+  entry->value = value;
+  entry->read_value = read_value;
+  return batch->status;
+}
+
+
+/**
+ * @brief Sends all queued mailbox commands to X4 and ends the batch.
+ * All read results are valid when this returns.
  * requires enable to be set and 8051 SRAM to be program.
  * @return Status of execution as defined in x4driver.h
  */
-int x4driver_get_xif_register(X4Driver_t *x4driver, uint8_t address, uint8_t *value)
+int x4driver_pif_batch_commit(X4Driver_t *x4driver)
 {
-  return _x4driver_get_x4_internal_register(x4driver, address, value, XIF_COMMAND);
+  X4DriverPifBatch_t *batch = &x4driver->pif_batch;
+  if (batch->depth == 0)
+    return XEP_ERROR_X4DRIVER_NOK;
+
+  int status = _x4driver_pif_batch_flush(x4driver);
+  if (batch->status != XEP_ERROR_X4DRIVER_OK)
+    status = batch->status;
+  if (--batch->depth == 0)
+    batch->status = XEP_ERROR_X4DRIVER_OK;
+  mutex_give(x4driver);
+  return status;
 }
 
 
@@ -1978,6 +2575,8 @@ int x4driver_init(X4Driver_t *x4driver)
 {
   uint32_t status = mutex_take(x4driver);
 
+  x4driver_shadow_invalidate(x4driver);
+
   // Reset x4driver struct to defaults
   x4driver->zero_frame_counter = 0;
   x4driver->frame_counter = 0;
@@ -2876,11 +3475,11 @@ int x4driver_set_dac_auto(X4Driver_t *x4driver, uint32_t daclength)
   float32_t tmp[bins];
 
   x4driver_start_sweep(x4driver);
-  uint8_t trx_ctrl_done = 0;
-  x4driver_get_pif_register(x4driver, ADDR_PIF_TRX_CTRL_DONE_R, &trx_ctrl_done);
-
-  while (trx_ctrl_done == 0) {
-    x4driver_get_pif_register(x4driver, ADDR_PIF_TRX_CTRL_DONE_R, &trx_ctrl_done);
+  int status = x4driver_wait_frame_ready(x4driver, X4DRIVER_FRAME_READY_TIMEOUT_MS);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    x4driver_set_sweep_trigger_control(x4driver, org_tm);
+    x4driver_set_fps(x4driver, org_fps);
+    return status;
   }
   x4driver_read_frame_normalized(x4driver, &fc, tmp,bins);
   float32_t avg = 0;
@@ -2976,6 +3575,13 @@ int _x4driver_unpack_raw_downconverted_frame(X4Driver_t *x4driver, float *bins_d
     return XEP_ERROR_X4DRIVER_BUFFER_TO_SMALL;
   }
 
+  X4DriverUnpackKernel kernel = _x4driver_unpack_kernel(x4driver, X4DRIVER_UNPACK_RAW);
+  if (kernel != NULL && bins_data != NULL && (bins_data_size & 1) == 0) {
+    kernel(raw_data, bins_data, bins_data_size / 2, 1.0f, 0);
+    x4driver->zero_frame_counter++;
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
   uint32_t q_data_start = bins_data_size / 2;
   uint32_t i_data_start = 0;
   uint32_t raw_data_index = 0;
@@ -3043,6 +3649,13 @@ int _x4driver_unpack_raw_frame(X4Driver_t *x4driver, float *bins_data, uint32_t
   uint32_t mask = _get_mask(x4driver->bytes_per_counter);
   uint32_t raw_data_index = x4driver->frame_area_start_bin_offset * x4driver->bytes_per_counter;
 
+  X4DriverUnpackKernel kernel = _x4driver_unpack_kernel(x4driver, X4DRIVER_UNPACK_RAW);
+  if (kernel != NULL && bins_data != NULL) {
+    kernel(&raw_data[raw_data_index], bins_data, bins_data_size, 1.0f, 0);
+    x4driver->zero_frame_counter++;
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
   for (uint32_t i = 0; i < bins_data_size; i++) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
@@ -3074,3 +3687,301 @@ int x4driver_read_frame_raw(X4Driver_t *x4driver, uint32_t *frame_counter, float
   mutex_give(x4driver);
   return status;
 }
+
+
+/**
+ * @brief Starts reading raw frame bytes, see x4driver.h.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_read_frame_bytes_start(X4Driver_t *x4driver, uint32_t *frame_counter, uint8_t *data, uint32_t length)
+{
+  if (length < x4driver->frame_read_size)
+    return XEP_ERROR_X4DRIVER_BUFFER_TO_SMALL;
+
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  if (x4driver->frame_fetch_pending) {
+    mutex_give(x4driver);
+    return XEP_ERROR_X4DRIVER_BUSY;
+  }
+
+  if (frame_counter != NULL) {
+    uint32_t frame_cnt = 0;
+    _x4driver_get_framecounter(x4driver, &frame_cnt);
+    x4driver->frame_counter = frame_cnt;
+    *frame_counter = x4driver->frame_counter;
+  }
+
+  status = x4driver_set_pif_register(x4driver, ADDR_PIF_FETCH_RADAR_DATA_SPI_W, FETCH_DATA_ACTION);
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    mutex_give(x4driver);
+    return status;
+  }
+
+  // Must outlive this call when the transfer runs in the background
+  static uint8_t radar_data_addr = ADDR_SPI_RADAR_DATA_SPI_RE;
+
+  if (x4driver->callbacks.spi_write_read_async == NULL || x4driver->callbacks.spi_wait == NULL)
+    status = x4driver->callbacks.spi_write_read(x4driver->user_reference, &radar_data_addr, 1, data, x4driver->frame_read_size);
+  else
+    status = x4driver->callbacks.spi_write_read_async(x4driver->user_reference, &radar_data_addr, 1, data, x4driver->frame_read_size);
+
+  if (status != XEP_ERROR_X4DRIVER_OK) {
+    _x4driver_set_x4_sw_action(x4driver, 11);
+    mutex_give(x4driver);
+    return status;
+  }
+
+  // Lock stays taken until x4driver_read_frame_bytes_finish
+  x4driver->frame_fetch_pending = 1;
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Waits for the readout started with x4driver_read_frame_bytes_start.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_read_frame_bytes_finish(X4Driver_t *x4driver, uint32_t timeout_ms)
+{
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  if (!x4driver->frame_fetch_pending) {
+    mutex_give(x4driver);
+    return XEP_ERROR_X4DRIVER_NOK;
+  }
+
+  if (x4driver->callbacks.spi_write_read_async != NULL && x4driver->callbacks.spi_wait != NULL)
+    status = x4driver->callbacks.spi_wait(x4driver->user_reference, timeout_ms);
+  if (status != XEP_ERROR_X4DRIVER_OK)
+    status = XEP_ERROR_X4DRIVER_FRAME_READY_TIMEOUT;
+
+  _x4driver_set_x4_sw_action(x4driver, 11);
+  x4driver->frame_fetch_pending = 0;
+
+  // Once for this call and once for x4driver_read_frame_bytes_start
+  mutex_give(x4driver);
+  mutex_give(x4driver);
+  return status;
+}
+
+
+/**
+ * @brief Unpacks and normalizes frame bytes.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_unpack_frame_normalized(X4Driver_t *x4driver, uint8_t *raw_data, uint32_t raw_length, float32_t *data, uint32_t length)
+{
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  if (x4driver->downconversion_enabled == 0) {
+    status = _x4driver_unpack_and_normalize_frame(x4driver, data, length, raw_data, raw_length);
+  } else {
+    status = _x4driver_unpack_and_normalize_downconverted_frame(x4driver, data, length, raw_data, raw_length);
+  }
+
+  mutex_give(x4driver);
+  return status;
+}
+
+
+/**
+ * @brief Unpacks frame bytes without normalization.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_unpack_frame_raw(X4Driver_t *x4driver, uint8_t *raw_data, uint32_t raw_length, float *data, uint32_t length)
+{
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  if (x4driver->downconversion_enabled == 0) {
+    status = _x4driver_unpack_raw_frame(x4driver, data, length, raw_data, raw_length);
+  } else {
+    status = _x4driver_unpack_raw_downconverted_frame(x4driver, data, length, raw_data, raw_length);
+  }
+
+  mutex_give(x4driver);
+  return status;
+}
+
+
+/**
+ * @brief Drops all cached register values.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_shadow_invalidate(X4Driver_t *x4driver)
+{
+  X4DriverShadowBank_t *banks[] = {&x4driver->shadow.pif, &x4driver->shadow.xif, &x4driver->shadow.spi};
+  for (uint32_t b = 0; b < sizeof(banks) / sizeof(banks[0]); b++) {
+    memset(banks[b]->valid, 0, sizeof(banks[b]->valid));
+    memset(banks[b]->dirty, 0, sizeof(banks[b]->dirty));
+  }
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Enables debug verify mode of the shadow cache.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_set_shadow_verify(X4Driver_t *x4driver, uint8_t enable)
+{
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+  x4driver->shadow.verify = enable ? 1 : 0;
+  mutex_give(x4driver);
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Reads back every cached register from the chip and compares it to the cache.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_shadow_verify(X4Driver_t *x4driver, uint32_t *mismatches)
+{
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  uint8_t verify = x4driver->shadow.verify;
+  uint32_t mismatches_before = x4driver->shadow.mismatches;
+  uint8_t value = 0;
+
+  // With verify set every read below goes to the chip and is compared
+  x4driver->shadow.verify = 1;
+  for (uint32_t address = 0; address < 128 && status == XEP_ERROR_X4DRIVER_OK; address++) {
+    uint32_t word = SHADOW_WORD(address);
+    uint32_t bit = SHADOW_BIT(address);
+    if (x4driver->shadow.pif.valid[word] & bit)
+      status = x4driver_get_pif_register(x4driver, address, &value);
+    if (status == XEP_ERROR_X4DRIVER_OK && (x4driver->shadow.xif.valid[word] & bit))
+      status = x4driver_get_xif_register(x4driver, address, &value);
+    if (status == XEP_ERROR_X4DRIVER_OK && (x4driver->shadow.spi.valid[word] & bit))
+      status = x4driver_get_spi_register(x4driver, address, &value);
+  }
+  x4driver->shadow.verify = verify;
+
+  if (mismatches != NULL)
+    *mismatches = x4driver->shadow.mismatches - mismatches_before;
+
+  mutex_give(x4driver);
+  return status;
+}
+
+
+/**
+ * @brief Gets shadow cache counters.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_get_shadow_stats(X4Driver_t *x4driver, uint32_t *hits, uint32_t *misses, uint32_t *mismatches)
+{
+  // Taken so the three counters are from the same moment
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  *hits = x4driver->shadow.hits;
+  *misses = x4driver->shadow.misses;
+  *mismatches = x4driver->shadow.mismatches;
+
+  mutex_give(x4driver);
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Takes the driver lock once for a sequence of driver calls.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_session_begin(X4Driver_t *x4driver)
+{
+#if X4DRIVER_SINGLE_OWNER
+  (void)x4driver;
+  return XEP_ERROR_X4DRIVER_OK;
+#else
+  // Without the owner callback any task would be taken for the session owner
+  if (x4driver->lock.owner == NULL)
+    return XEP_ERROR_X4DRIVER_NOK;
+
+  if (_x4driver_in_session(x4driver)) {
+    x4driver->session_depth++;
+    return XEP_ERROR_X4DRIVER_OK;
+  }
+
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  x4driver->session_owner = x4driver->lock.owner();
+  x4driver->session_depth = 1;
+  return XEP_ERROR_X4DRIVER_OK;
+#endif
+}
+
+
+/**
+ * @brief Ends a session started with x4driver_session_begin.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_session_end(X4Driver_t *x4driver)
+{
+#if X4DRIVER_SINGLE_OWNER
+  (void)x4driver;
+  return XEP_ERROR_X4DRIVER_OK;
+#else
+  if (!_x4driver_in_session(x4driver))
+    return XEP_ERROR_X4DRIVER_NOK;
+
+  if (--x4driver->session_depth == 0) {
+    x4driver->session_owner = NULL;
+    mutex_give(x4driver);
+  }
+  return XEP_ERROR_X4DRIVER_OK;
+#endif
+}
+
+
+/**
+ * @brief Gets lock operation counters.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_get_lock_stats(X4Driver_t *x4driver, X4DriverLockStats_t *stats)
+{
+  // Other tasks only count while holding the lock
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  *stats = x4driver->lock_stats;
+#if !X4DRIVER_SINGLE_OWNER
+  // Leave out the take of this call
+  if (_x4driver_in_session(x4driver))
+    stats->elided--;
+  else
+    stats->takes--;
+#endif
+
+  mutex_give(x4driver);
+  return XEP_ERROR_X4DRIVER_OK;
+}
+
+
+/**
+ * @brief Clears lock operation counters.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_reset_lock_stats(X4Driver_t *x4driver)
+{
+  uint32_t status = mutex_take(x4driver);
+  if (status != XEP_ERROR_X4DRIVER_OK) return status;
+
+  memset(&x4driver->lock_stats, 0, sizeof(x4driver->lock_stats));
+#if !X4DRIVER_SINGLE_OWNER
+  // The give of this call is counted below, start it at zero
+  if (!_x4driver_in_session(x4driver))
+    x4driver->lock_stats.gives = (uint32_t)-1;
+#endif
+
+  mutex_give(x4driver);
+  return XEP_ERROR_X4DRIVER_OK;
+}
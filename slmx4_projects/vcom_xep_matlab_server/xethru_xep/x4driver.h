@@ -30,6 +30,8 @@ typedef uint32_t (*SpiReadFunc)(void* user_reference, uint8_t* data, uint32_t le
 
 /**
  * Function pointer allowing read/write access to spi bus.
+ * For rlength > 1 the platform may return the bytes clocked in during the
+ * write phase at the start of rdata, see X4DRIVER_SPI_RDATA_OFFSET.
  */
 typedef uint32_t (*SpiWriteReadFunc)(void* user_reference, uint8_t* wdata, uint32_t wlength, uint8_t* rdata, uint32_t rlength);
 
@@ -43,6 +45,11 @@ typedef uint32_t (*LockFunc)(void* lock, uint32_t timeout);
  */
 typedef void (*UnLockFunc)(void* lock);
 
+/**
+ * Function pointer returning an identifier of the calling task, see x4driver_session_begin.
+ */
+typedef void* (*LockOwnerFunc)(void);
+
 /**
  * Function pointer allowing triggering of sweep pin.
  */
@@ -68,6 +75,33 @@ typedef uint32_t (*TimerConfigure)(void* timer , uint32_t val);
  */
 typedef void (*EnableDataReadyISRFunc)(void* user_reference,uint32_t enable);
 
+/**
+ * Function pointer allowing blocking until the data_ready ISR has fired.
+ * Returns 1 if data ready was signalled within timeout_ms, else 0.
+ * A timeout_ms of 0 clears any pending data ready signal and does not block.
+ * The calling task is the one signalled from then on.
+ */
+typedef uint32_t (*WaitDataReadyFunc)(void* user_reference, uint32_t timeout_ms);
+
+/**
+ * Function pointer allowing a read/write on the spi bus that returns once the transfer has started.
+ * Completion is collected with SpiWaitFunc. Buffers must stay valid until then.
+ */
+typedef uint32_t (*SpiWriteReadAsyncFunc)(void* user_reference, uint8_t* wdata, uint32_t wlength, uint8_t* rdata, uint32_t rlength);
+
+/**
+ * Function pointer allowing waiting for a transfer started with SpiWriteReadAsyncFunc.
+ * Returns 0 when the transfer completed within timeout_ms.
+ */
+typedef uint32_t (*SpiWaitFunc)(void* user_reference, uint32_t timeout_ms);
+
+/**
+ * Kernel converting count raw frame counters to float, see x4driver_unpack.h.
+ * For down converted frames count is the number of I/Q pairs.
+ * Returns 1 if any normalized output value is non zero.
+ */
+typedef uint32_t (*X4DriverUnpackKernel)(const uint8_t* raw, float32_t* out, uint32_t count, float32_t scale, float32_t offset);
+
 /**
  * Error return codes
  */
@@ -359,6 +393,108 @@ typedef enum {
     X4DRIVER_LDO_ALL                                = 0x0000000f,
 } xtx4_x4driver_ldo_t;
 
+/**
+ * X4 mailbox protocol command ids.
+ */
+typedef enum {
+    PIF_COMMAND                                     = 0,
+    XIF_COMMAND                                     = 1,
+    X4_SW_REGISTER_COMMAND                          = 2,
+    X4_SW_ACTION_COMMAND                            = 3,
+} xtx4_command_id_t;
+
+/**
+ * Maximum number of mailbox commands held by a batch before it is flushed to X4.
+ */
+#ifndef X4DRIVER_PIF_BATCH_MAX_COMMANDS
+#define X4DRIVER_PIF_BATCH_MAX_COMMANDS 32
+#endif
+
+/**
+ * Number of mailbox commands packed into one SPI burst (3 bytes each).
+ * A burst must fit in the 8051 TO_CPU mailbox FIFO.
+ */
+#ifndef X4DRIVER_PIF_BATCH_BURST_COMMANDS
+#define X4DRIVER_PIF_BATCH_BURST_COMMANDS 5
+#endif
+
+/**
+ * Mailbox command queued in a batch. read_value is NULL for writes.
+ */
+typedef struct
+{
+    uint8_t command;
+    uint8_t address;
+    uint8_t value;
+    uint8_t* read_value;
+} X4DriverMailboxCommand_t;
+
+/**
+ * Batch of mailbox commands, see x4driver_pif_batch_begin.
+ */
+typedef struct
+{
+    X4DriverMailboxCommand_t commands[X4DRIVER_PIF_BATCH_MAX_COMMANDS];
+    uint32_t count;
+    uint32_t depth;
+    uint32_t status;
+} X4DriverPifBatch_t;
+
+/**
+ * Shadow copy of one X4 register space (PIF, XIF or SPI).
+ * Bit n of valid/dirty/cacheable refers to register address n.
+ */
+typedef struct
+{
+    uint8_t value[128];
+    uint32_t cacheable[4];
+    uint32_t valid[4];
+    uint32_t dirty[4];
+} X4DriverShadowBank_t;
+
+/**
+ * Shadow register cache, see x4driver_shadow_invalidate.
+ * A valid register is served without SPI traffic. Dirty marks values written
+ * by the driver and not yet read back from the chip.
+ */
+typedef struct
+{
+    X4DriverShadowBank_t pif;
+    X4DriverShadowBank_t xif;
+    X4DriverShadowBank_t spi;
+    uint8_t verify;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t mismatches;
+} X4DriverShadow_t;
+
+/**
+ * Initial state of the shadow cache verify mode, see x4driver_set_shadow_verify.
+ */
+#ifndef X4DRIVER_SHADOW_VERIFY
+#define X4DRIVER_SHADOW_VERIFY 0
+#endif
+
+/**
+ * Set to 1 when the driver is only ever called from one task. The lock callbacks
+ * are then never called and sessions are no-ops.
+ */
+#ifndef X4DRIVER_SINGLE_OWNER
+#define X4DRIVER_SINGLE_OWNER 0
+#endif
+
+/**
+ * Lock operation counters, see x4driver_get_lock_stats.
+ * Takes and gives count calls made to the lock callbacks. Elided counts
+ * take/give pairs skipped because the caller already owns a session.
+ */
+typedef struct
+{
+    uint32_t takes;
+    uint32_t gives;
+    uint32_t elided;
+} X4DriverLockStats_t;
+
 /**
  * Collection of callbacks, used to configure interact with the X4 chip.
  */
@@ -372,6 +508,9 @@ typedef struct
     NotifyDataReadyFunc notify_data_ready;
     TriggerSweepFunc trigger_sweep;
     EnableDataReadyISRFunc enable_data_ready_isr;
+    WaitDataReadyFunc wait_data_ready;
+    SpiWriteReadAsyncFunc spi_write_read_async;
+    SpiWaitFunc spi_wait;
 } X4DriverCallbacks_t;
 
 
@@ -385,6 +524,7 @@ typedef struct
 {
     LockFunc lock;
     UnLockFunc unlock;
+    LockOwnerFunc owner;
     void * object;
     uint32_t timeout;
 } X4DriverLock_t;
@@ -472,10 +612,49 @@ typedef struct
     int8_t downconversion_coeff_custom_q2[32];
     int8_t downconversion_coeff_custom_i2[32];
 
+    X4DriverPifBatch_t pif_batch;
+    uint8_t frame_fetch_pending;
+    X4DriverShadow_t shadow;
+    void* session_owner;
+    uint32_t session_depth;
+    X4DriverLockStats_t lock_stats;
+    X4DriverUnpackKernel unpack_normalized;
+    X4DriverUnpackKernel unpack_raw;
+    uint32_t unpack_config;
+
 } X4Driver_t;
 
 #define X4DRIVER_MAX_ALLOWED_ZERO_FRAMES 100
 
+/**
+ * Frame ready strategies, see x4driver_set_frame_ready_strategy.
+ */
+#define FRAME_IS_READY_READ_REGISTERS 1
+#define FRAME_IS_READY_INTERRUPT 2
+
+/**
+ * Number of bytes at the start of rdata that were clocked in while the
+ * address byte was sent, for spi_write_read calls with rlength > 1.
+ * The SLMX4 platform returns the full duplex stream, so the data follows 1 byte in.
+ */
+#ifndef X4DRIVER_SPI_RDATA_OFFSET
+#define X4DRIVER_SPI_RDATA_OFFSET 1
+#endif
+
+/**
+ * Default timeout used when waiting for a sweep to complete.
+ */
+#ifndef X4DRIVER_FRAME_READY_TIMEOUT_MS
+#define X4DRIVER_FRAME_READY_TIMEOUT_MS 1000
+#endif
+
+/**
+ * Default timeout used when waiting for a frame readout started with x4driver_read_frame_bytes_start.
+ */
+#ifndef X4DRIVER_FRAME_FETCH_TIMEOUT_MS
+#define X4DRIVER_FRAME_FETCH_TIMEOUT_MS 100
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -531,6 +710,7 @@ int x4driver_set_fps(X4Driver_t* x4driver, float32_t fps);
 
 /**
  * @brief Reads frame and normalizes that frame.
+ * frame_counter may be NULL to skip reading the frame counter from X4.
  * @return Status of execution as defined in x4driver.h,
  */
 int x4driver_read_frame_normalized(X4Driver_t* x4driver, uint32_t* frame_counter, float32_t* data, uint32_t length);
@@ -627,6 +807,33 @@ int x4driver_set_pif_register(X4Driver_t* x4driver, uint8_t address, uint8_t val
 int x4driver_set_xif_register(X4Driver_t* x4driver, uint8_t address, uint8_t value);
 
 
+/**
+ * @brief Starts a batch of PIF/XIF/software mailbox commands.
+ * Takes the driver lock until x4driver_pif_batch_commit. Batches may be nested.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_pif_batch_begin(X4Driver_t* x4driver);
+
+
+/**
+ * @brief Queues a mailbox command in the current batch.
+ * If read_value is NULL the command is a register write of value, otherwise
+ * a register read whose result is stored in *read_value on commit.
+ * A full batch is flushed to X4 before the command is queued.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_pif_batch_queue(X4Driver_t* x4driver, xtx4_command_id_t command, uint8_t address, uint8_t value, uint8_t * read_value);
+
+
+/**
+ * @brief Sends all queued mailbox commands to X4 in as few SPI bursts as possible and ends the batch.
+ * All read results are valid when this returns.
+ * requires enable to be set and 8051 SRAM to be program.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_pif_batch_commit(X4Driver_t* x4driver);
+
+
 /**
  * @brief setup external osc on X4.
  * requires enable to be set and 8051 SRAM to be program.
@@ -653,6 +860,8 @@ int x4driver_ldo_enable(X4Driver_t* x4driver,uint32_t ldo);
 
 /**
  * @brief Will check if frame is ready.
+ * Reads TRX_CTRL_DONE with either frame ready strategy, so it neither waits
+ * for nor consumes the data ready signal.
  * Assumes Enable has been set.
  * Assumes X4 firmware has been programmed.
  * @return Status of execution as defined in x4driver.h.
@@ -660,6 +869,28 @@ int x4driver_ldo_enable(X4Driver_t* x4driver,uint32_t ldo);
 int x4driver_is_frame_ready(X4Driver_t* x4driver,uint8_t * is_ready);
 
 
+/**
+ * @brief Selects how frame ready is detected.
+ * FRAME_IS_READY_READ_REGISTERS polls TRX_CTRL_DONE over SPI.
+ * FRAME_IS_READY_INTERRUPT waits for the X4 data ready pin through the wait_data_ready callback.
+ * @return Status of execution as defined in x4driver.h.
+ */
+int x4driver_set_frame_ready_strategy(X4Driver_t* x4driver, uint32_t strategy);
+
+
+/**
+ * @brief Blocks until the sweep started with x4driver_start_sweep has completed.
+ * With FRAME_IS_READY_INTERRUPT the driver lock is not held while waiting, and
+ * the waiting task must call the wait_data_ready callback with a timeout of 0
+ * before the sweep is started. x4driver_start_sweep may then be called from
+ * any task, e.g. a sweep timer.
+ * Assumes Enable has been set.
+ * Assumes X4 firmware has been programmed.
+ * @return XEP_ERROR_X4DRIVER_FRAME_READY_TIMEOUT if no frame is ready within timeout_ms.
+ */
+int x4driver_wait_frame_ready(X4Driver_t* x4driver, uint32_t timeout_ms);
+
+
 /**
  * @brief Will trigger a radar sweep.
  * Assumes Enable has been set.
@@ -694,6 +925,7 @@ int x4driver_set_frame_length(X4Driver_t* x4driver,uint8_t cycles);
 
 /**
  * @brief Reads raw frame
+ * frame_counter may be NULL to skip reading the frame counter from X4.
  * @return Status of execution as defined in x4driver.h
  */
 int x4driver_read_frame_bytes(X4Driver_t* x4driver, uint32_t* frame_counter, uint8_t* data, uint32_t length);
@@ -993,10 +1225,97 @@ int x4driver_set_frame_trigger_period(X4Driver_t* x4driver, uint32_t period);
 
 /**
  * @brief Reads frame without normalization
+ * frame_counter may be NULL to skip reading the frame counter from X4.
  * @return Status of execution as defined in x4driver.h
  */
 int x4driver_read_frame_raw(X4Driver_t* x4driver, uint32_t* frame_counter, float* data, uint32_t length);
 
+/**
+ * @brief Starts reading raw frame bytes into data and returns while the SPI transfer runs.
+ * The driver lock is held until x4driver_read_frame_bytes_finish, so only the calling task may use the driver meanwhile.
+ * Falls back to a blocking read if the platform has no spi_write_read_async callback.
+ * frame_counter may be NULL to skip reading the frame counter from X4.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_read_frame_bytes_start(X4Driver_t* x4driver, uint32_t* frame_counter, uint8_t* data, uint32_t length);
+
+/**
+ * @brief Waits for the readout started with x4driver_read_frame_bytes_start and releases the X4 frame buffer.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_read_frame_bytes_finish(X4Driver_t* x4driver, uint32_t timeout_ms);
+
+/**
+ * @brief Unpacks and normalizes frame bytes read with x4driver_read_frame_bytes_start.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_unpack_frame_normalized(X4Driver_t* x4driver, uint8_t* raw_data, uint32_t raw_length, float32_t* data, uint32_t length);
+
+/**
+ * @brief Unpacks frame bytes read with x4driver_read_frame_bytes_start without normalization.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_unpack_frame_raw(X4Driver_t* x4driver, uint8_t* raw_data, uint32_t raw_length, float* data, uint32_t length);
+
+/**
+ * @brief Drops all cached register values so the next reads go to the chip.
+ * Called by x4driver_set_enable, x4driver_init and x4driver_setup_default.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_shadow_invalidate(X4Driver_t* x4driver);
+
+/**
+ * @brief Enables debug verify mode. Every read of a cached register also reads the chip
+ * and counts a mismatch if the two differ. The chip value is returned and cached.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_set_shadow_verify(X4Driver_t* x4driver, uint8_t enable);
+
+/**
+ * @brief Reads back every cached register from the chip and compares it to the cache.
+ * Clears the dirty state of all registers.
+ * requires enable to be set and 8051 SRAM to be program.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_shadow_verify(X4Driver_t* x4driver, uint32_t* mismatches);
+
+/**
+ * @brief Gets shadow cache hit, miss and verify mismatch counters.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_get_shadow_stats(X4Driver_t* x4driver, uint32_t* hits, uint32_t* misses, uint32_t* mismatches);
+
+/**
+ * @brief Takes the driver lock once for a sequence of driver calls.
+ * Until x4driver_session_end, driver calls from the owning task skip the lock
+ * callbacks. Other tasks block on the lock as before. Sessions nest.
+ * Needs the lock owner callback, XEP_ERROR_X4DRIVER_NOK without it. Do not
+ * hold a session while blocking on the radar, e.g. in x4driver_wait_frame_ready.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_session_begin(X4Driver_t* x4driver);
+
+/**
+ * @brief Ends a session started with x4driver_session_begin, releasing the lock
+ * when the outermost session ends.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_session_end(X4Driver_t* x4driver);
+
+/**
+ * @brief Gets lock operation counters, see X4DriverLockStats_t.
+ * Copied under the driver lock. The lock operations of this call and of
+ * x4driver_reset_lock_stats are not counted.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_get_lock_stats(X4Driver_t* x4driver, X4DriverLockStats_t* stats);
+
+/**
+ * @brief Clears lock operation counters.
+ * @return Status of execution as defined in x4driver.h
+ */
+int x4driver_reset_lock_stats(X4Driver_t* x4driver);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,295 @@
+/**
+@file
+@brief Specialized kernels converting raw X4 frame counters to float.
+
+@note
+Results match the generic unpack functions in x4driver.c bit for bit. Q values
+are negated by negating the scale, which is exact.
+*/
+
+#include <float.h>
+#include <string.h>
+
+#include "x4driver_unpack.h"
+
+// -----------------------------------------------------------------------------
+// Counter Loads
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Unaligned little endian 32 bit load (single LDR on Cortex-M7).
+ */
+static inline uint32_t _load_u32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+/**
+ * @brief Unaligned little endian 16 bit load.
+ */
+static inline uint16_t _load_u16(const uint8_t *p)
+{
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+/**
+ * @brief Combines the sign extended high part and low word of a 40 or 48 bit counter.
+ */
+static inline float32_t _wide_to_float(int32_t hi, uint32_t lo)
+{
+#if X4DRIVER_UNPACK_USE_F64
+  // hi * 2^32 + lo is exact in double, so the single rounding to float matches
+  // the int64 conversion
+  return (float32_t)((double)hi * 4294967296.0 + (double)lo);
+#else
+  return (float32_t)(int64_t)(((uint64_t)(int64_t)hi << 32) | lo);
+#endif
+}
+
+
+/**
+ * @brief Signed 32 bit counter (down converted, 4 bytes).
+ */
+static inline float32_t _counter_s4(const uint8_t *p)
+{
+  return (float32_t)(int32_t)_load_u32(p);
+}
+
+
+/**
+ * @brief Signed 40 bit counter (down converted, 5 bytes).
+ */
+static inline float32_t _counter_s5(const uint8_t *p)
+{
+  return _wide_to_float((int8_t)p[4], _load_u32(p));
+}
+
+
+/**
+ * @brief Signed 48 bit counter (down converted, 6 bytes).
+ */
+static inline float32_t _counter_s6(const uint8_t *p)
+{
+  return _wide_to_float((int16_t)_load_u16(p + 4), _load_u32(p));
+}
+
+
+/**
+ * @brief Tracks whether a normalized value is non zero, as the generic code does.
+ */
+#define NONZERO(f) (((f) >= FLT_EPSILON) | ((f) <= -FLT_EPSILON))
+
+// -----------------------------------------------------------------------------
+// Down Converted Kernels
+//
+// count is the number of I/Q pairs. Interleaved output is I0 Q0 I1 Q1 ...,
+// separate output is I0 I1 ... followed by Q0 Q1 ...
+// -----------------------------------------------------------------------------
+
+#define DDC_KERNEL(bpc, layout, q_index, q_step)                                              \
+__attribute__ ((optimize("-O3")))                                                             \
+static uint32_t _unpack_ddc##bpc##_##layout##_norm(const uint8_t *raw, float32_t *out,        \
+                                                   uint32_t count, float32_t scale,           \
+                                                   float32_t offset)                          \
+{                                                                                             \
+  (void)offset;                                                                               \
+  float32_t q_scale = -scale;                                                                 \
+  float32_t *q_out = out + (q_index);                                                         \
+  uint32_t nonzero = 0;                                                                       \
+  for (uint32_t k = 0; k < count; k++) {                                                      \
+    float32_t i_val = _counter_s##bpc(raw) * scale;                                           \
+    float32_t q_val = _counter_s##bpc(raw + bpc) * q_scale;                                   \
+    out[0] = i_val;                                                                           \
+    q_out[0] = q_val;                                                                         \
+    nonzero |= NONZERO(i_val) | NONZERO(q_val);                                               \
+    out += (q_step);                                                                          \
+    q_out += (q_step);                                                                        \
+    raw += 2 * bpc;                                                                           \
+  }                                                                                           \
+  return nonzero;                                                                             \
+}                                                                                             \
+                                                                                              \
+__attribute__ ((optimize("-O3")))                                                             \
+static uint32_t _unpack_ddc##bpc##_##layout##_raw(const uint8_t *raw, float32_t *out,         \
+                                                  uint32_t count, float32_t scale,            \
+                                                  float32_t offset)                           \
+{                                                                                             \
+  (void)scale;                                                                                \
+  (void)offset;                                                                               \
+  float32_t *q_out = out + (q_index);                                                         \
+  for (uint32_t k = 0; k < count; k++) {                                                      \
+    out[0] = _counter_s##bpc(raw);                                                            \
+    q_out[0] = -_counter_s##bpc(raw + bpc);                                                   \
+    out += (q_step);                                                                          \
+    q_out += (q_step);                                                                        \
+    raw += 2 * bpc;                                                                           \
+  }                                                                                           \
+  return 1;                                                                                   \
+}
+
+DDC_KERNEL(4, iq, 1, 2)
+DDC_KERNEL(5, iq, 1, 2)
+DDC_KERNEL(6, iq, 1, 2)
+DDC_KERNEL(4, sep, count, 1)
+DDC_KERNEL(5, sep, count, 1)
+DDC_KERNEL(6, sep, count, 1)
+
+// -----------------------------------------------------------------------------
+// Baseband Kernels
+//
+// count is the number of bins. Counters are unsigned.
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Unpacks 4 byte counters, normalized.
+ */
+__attribute__ ((optimize("-O3")))
+static uint32_t _unpack_bb4_norm(const uint8_t *raw, float32_t *out, uint32_t count, float32_t scale, float32_t offset)
+{
+  uint32_t nonzero = 0;
+  for (uint32_t k = 0; k < count; k++) {
+    float32_t fbin = _load_u32(raw) * scale - offset;
+    out[k] = fbin;
+    nonzero |= NONZERO(fbin);
+    raw += 4;
+  }
+  return nonzero;
+}
+
+
+/**
+ * @brief Unpacks 4 byte counters, raw.
+ */
+__attribute__ ((optimize("-O3")))
+static uint32_t _unpack_bb4_raw(const uint8_t *raw, float32_t *out, uint32_t count, float32_t scale, float32_t offset)
+{
+  (void)scale;
+  (void)offset;
+  for (uint32_t k = 0; k < count; k++) {
+    out[k] = (float32_t)_load_u32(raw);
+    raw += 4;
+  }
+  return 1;
+}
+
+
+/**
+ * @brief Splits three words into four 3 byte counters.
+ */
+#define BB3_SPLIT(raw, c0, c1, c2, c3)           \
+  uint32_t w0 = _load_u32(raw);                  \
+  uint32_t w1 = _load_u32(raw + 4);              \
+  uint32_t w2 = _load_u32(raw + 8);              \
+  uint32_t c0 = w0 & 0x00ffffffu;                \
+  uint32_t c1 = (w0 >> 24) | ((w1 & 0xffffu) << 8); \
+  uint32_t c2 = (w1 >> 16) | ((w2 & 0xffu) << 16);  \
+  uint32_t c3 = w2 >> 8;
+
+
+/**
+ * @brief Reads one 3 byte counter without reading past it.
+ */
+static inline uint32_t _load_u24(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+}
+
+
+/**
+ * @brief Unpacks 3 byte counters, normalized. Four counters per three word loads.
+ */
+__attribute__ ((optimize("-O3")))
+static uint32_t _unpack_bb3_norm(const uint8_t *raw, float32_t *out, uint32_t count, float32_t scale, float32_t offset)
+{
+  uint32_t nonzero = 0;
+  uint32_t k = 0;
+  for (; k + 4 <= count; k += 4) {
+    BB3_SPLIT(raw, c0, c1, c2, c3)
+    float32_t f0 = c0 * scale - offset;
+    float32_t f1 = c1 * scale - offset;
+    float32_t f2 = c2 * scale - offset;
+    float32_t f3 = c3 * scale - offset;
+    out[k] = f0;
+    out[k + 1] = f1;
+    out[k + 2] = f2;
+    out[k + 3] = f3;
+    nonzero |= NONZERO(f0) | NONZERO(f1) | NONZERO(f2) | NONZERO(f3);
+    raw += 12;
+  }
+  for (; k < count; k++) {
+    float32_t fbin = _load_u24(raw) * scale - offset;
+    out[k] = fbin;
+    nonzero |= NONZERO(fbin);
+    raw += 3;
+  }
+  return nonzero;
+}
+
+
+/**
+ * @brief Unpacks 3 byte counters, raw. Four counters per three word loads.
+ */
+__attribute__ ((optimize("-O3")))
+static uint32_t _unpack_bb3_raw(const uint8_t *raw, float32_t *out, uint32_t count, float32_t scale, float32_t offset)
+{
+  (void)scale;
+  (void)offset;
+  uint32_t k = 0;
+  for (; k + 4 <= count; k += 4) {
+    BB3_SPLIT(raw, c0, c1, c2, c3)
+    out[k] = (float32_t)c0;
+    out[k + 1] = (float32_t)c1;
+    out[k + 2] = (float32_t)c2;
+    out[k + 3] = (float32_t)c3;
+    raw += 12;
+  }
+  for (; k < count; k++) {
+    out[k] = (float32_t)_load_u24(raw);
+    raw += 3;
+  }
+  return 1;
+}
+
+// -----------------------------------------------------------------------------
+// Kernel Selection
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Selects the kernel for a frame configuration.
+ * @return Kernel, or NULL if the generic unpack code must be used.
+ */
+X4DriverUnpackKernel x4driver_unpack_select(uint8_t bytes_per_counter, uint8_t downconversion, uint8_t iq_separate, uint8_t output_mode)
+{
+  uint8_t norm = (output_mode == X4DRIVER_UNPACK_NORMALIZED);
+
+  if (downconversion) {
+    switch (bytes_per_counter) {
+    case 4:
+      if (iq_separate) return norm ? _unpack_ddc4_sep_norm : _unpack_ddc4_sep_raw;
+      return norm ? _unpack_ddc4_iq_norm : _unpack_ddc4_iq_raw;
+    case 5:
+      if (iq_separate) return norm ? _unpack_ddc5_sep_norm : _unpack_ddc5_sep_raw;
+      return norm ? _unpack_ddc5_iq_norm : _unpack_ddc5_iq_raw;
+    case 6:
+      if (iq_separate) return norm ? _unpack_ddc6_sep_norm : _unpack_ddc6_sep_raw;
+      return norm ? _unpack_ddc6_iq_norm : _unpack_ddc6_iq_raw;
+    default:
+      return NULL;
+    }
+  }
+
+  switch (bytes_per_counter) {
+  case 3:
+    return norm ? _unpack_bb3_norm : _unpack_bb3_raw;
+  case 4:
+    return norm ? _unpack_bb4_norm : _unpack_bb4_raw;
+  default:
+    return NULL;
+  }
+}
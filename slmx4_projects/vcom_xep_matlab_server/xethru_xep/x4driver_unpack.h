@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @brief Specialized kernels converting raw X4 frame counters to float.
+ *
+ * One kernel exists per bytes per counter, down conversion, I/Q layout and
+ * output mode, so the per bin loop has no configuration branches. The driver
+ * selects the kernel once per configuration, see x4driver_unpack_select.
+ * The kernels do not depend on X4Driver_t and can be built for a host.
+ */
+
+#ifndef X4DRIVER_UNPACK_H
+#define X4DRIVER_UNPACK_H
+
+#include <stdint.h>
+
+#include "x4driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Output mode of a kernel.
+ * Normalized multiplies by scale, subtracts offset and reports zero frames.
+ * Raw converts the counters only.
+ */
+#define X4DRIVER_UNPACK_RAW        0
+#define X4DRIVER_UNPACK_NORMALIZED 1
+
+/**
+ * Set to 0 to always use the generic unpack code in x4driver.c.
+ */
+#ifndef X4DRIVER_UNPACK_KERNELS
+#define X4DRIVER_UNPACK_KERNELS 1
+#endif
+
+/**
+ * Use double precision to convert 40 and 48 bit counters. Exact and avoids the
+ * software int64 to float conversion on FPUs with double precision (Cortex-M7
+ * FPv5-D16). Cores with a single precision FPU fall back to int64 conversion.
+ */
+#ifndef X4DRIVER_UNPACK_USE_F64
+#if defined(__ARM_FP) && !(__ARM_FP & 0x8)
+#define X4DRIVER_UNPACK_USE_F64 0
+#else
+#define X4DRIVER_UNPACK_USE_F64 1
+#endif
+#endif
+
+/**
+ * @brief Selects the kernel for a frame configuration.
+ * @return Kernel, or NULL if the configuration has no specialized kernel and
+ * the generic unpack code must be used.
+ */
+X4DriverUnpackKernel x4driver_unpack_select(uint8_t bytes_per_counter, uint8_t downconversion, uint8_t iq_separate, uint8_t output_mode);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // X4DRIVER_UNPACK_H